@@ -0,0 +1,67 @@
+#ifndef _H_BEELANG_ANALYSIS
+#define _H_BEELANG_ANALYSIS
+
+#include "bytecode.h"
+
+/*
+    -= analysis.h =-
+    @returns the offset of the instruction a jump, a loop or a case
+    branches to. The targets of the switch tables are read by their users.
+*/
+int branchTarget(Bytecode *bytecode, int offset);
+
+/*
+    -= analysis.h =-
+    Computes the stack depth before each instruction by following all
+    the paths through the code, the locals included.
+    The code generators rely on it to keep stack slots at fixed places:
+    the JIT to skip overflow checks and --emit-c to turn slots into C locals.
+
+    The body of each function is followed from its entry, with the depths
+    counted from its first argument, and its Function.stackMax recorded.
+
+    @param int* maxDepth receives the deepest the stack of the script gets.
+    @returns an array of bytecode->count + 1 depths, -1 for operands and
+             unreachable code, to be released with FREE_SCRATCH(). NULL if the
+             depth exceeds STACK_MAX or differs between two paths, if an
+             instruction reads below the bottom of the stack, or if the code
+             holds an unknown or truncated instruction or a jump into one,
+             or a path from a function into another.
+*/
+int* stackDepths(Bytecode *bytecode, int *maxDepth);
+
+/*
+    -= analysis.h =-
+    stackDepths() for the code from 'start' on, entered with an empty
+    stack, and for the functions declared there.
+    @param int* owners receives the function each reached instruction
+           belongs to, -1 for the script. It holds bytecode->count + 1 ints.
+*/
+int* regionDepths(Bytecode *bytecode, int start, int *owners);
+
+/*
+    -= analysis.h =-
+    @returns how deep into the stack the instruction reads: the number of
+             operands it pops, or the slot of the local it accesses.
+*/
+int stackReach(uint8_t *code);
+
+/*
+    -= analysis.h =-
+    Load-time verifier, run once per chunk of code before it is executed.
+    Following all the paths from 'start', entered with an empty stack, and
+    from the functions declared there, it checks what stackDepths() does,
+    and also that the constant, global, function and loop counter indices
+    are in range, that only a function returns a value, makes a tail call or
+    calls itself, with its own arity, that the natives called exist in the VM
+    of the calling thread with the arity of the call, that a function with
+    captures is only made into a closure, by a single OP_CLOSURE, and reads
+    them boxed as that one takes them, that the classes, their methods and
+    the property names exist, that each inline cache serves a single
+    instruction, and that no path runs past the end of code. The code it
+    accepts can run without stack bounds checks nor checks of the calls.
+    @returns NULL if the code is safe, or what is wrong with it.
+*/
+const char* verifyBytecode(Bytecode *bytecode, int start);
+
+#endif // _H_BEELANG_ANALYSIS
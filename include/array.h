@@ -0,0 +1,123 @@
+#ifndef _H_BEELANG_ARRAY
+#define _H_BEELANG_ARRAY
+
+#include "object.h"
+
+/*
+    -= array.h =-
+    Built-in functions operating on typed arrays.
+    The compiler resolves their names at compile time and emits
+    OP_INTRINSIC followed by one of these indices, so calling them
+    costs no lookup at runtime.
+*/
+typedef enum
+{
+    INTRINSIC_NUMBERS,  // numbers(n)   - new number array of length n
+    INTRINSIC_INTS,     // ints(n)      - new integer array of length n
+    INTRINSIC_BOOLS,    // bools(n)     - new boolean array of length n
+    INTRINSIC_LEN,      // len(a)       - the number of elements
+    INTRINSIC_SUM,      // sum(a)       - sum of elements (count of 'true' for bools)
+    INTRINSIC_MIN,      // min(a)       - the smallest element
+    INTRINSIC_MAX,      // max(a)       - the largest element
+    INTRINSIC_SCALE,    // scale(a, k)  - multiplies each element by k in place
+    INTRINSIC_DOT,      // dot(a, b)    - dot product of two arrays of the same type
+    INTRINSIC_FILL,     // fill(a, v)   - sets each element to v
+    INTRINSIC_COPY,     // copy(dst, src) - copies src to the beginning of dst
+    INTRINSIC_COUNT
+} ArrayIntrinsic;
+
+typedef struct
+{
+    const char *name;
+    int length;     // length of the name
+    int arity;      // number of arguments
+} IntrinsicInfo;
+
+extern const IntrinsicInfo arrayIntrinsics[INTRINSIC_COUNT];
+
+/*
+    -= array.h =-
+    Looks up an intrinsic by its name.
+    @returns ArrayIntrinsic index or -1 if there is no such intrinsic.
+*/
+int findArrayIntrinsic(const char *name, int length);
+
+/*
+    -= array.h =-
+    @returns the size of a single element of the given type in bytes.
+*/
+size_t arrayElementSize(ArrayType elementType);
+
+/*
+    -= array.h =-
+    Boxes the element at 'index' into a Value.
+    The caller is responsible for bounds checking.
+*/
+Value arrayGet(ObjArray *array, int index);
+
+/*
+    -= array.h =-
+    Unboxes the 'value' and stores it at 'index'.
+    The caller is responsible for bounds checking.
+    @returns false if the value doesn't fit the element type of array.
+*/
+bool arraySet(ObjArray *array, int index, Value value);
+
+/*
+    -= array.h =-
+    Bulk kernels.
+    Where the target supports it, these are vectorized with SSE2, otherwise
+    they fall back to plain loops. Being summed in several lanes, the result
+    of arraySum() and arrayDot() on number arrays may differ from a strict
+    left-to-right summation in the last bits. arrayMin() and arrayMax()
+    don't depend on the path taken: a NaN anywhere in a number array is
+    the result, the first one if there are several.
+*/
+double arraySum(ObjArray *array);
+
+/*
+    -= array.h =-
+    Both expect a non-empty array.
+    @returns the element of the same type as the array elements.
+*/
+Value arrayMin(ObjArray *array);
+Value arrayMax(ObjArray *array);
+
+/*
+    -= array.h =-
+    Expects a number array.
+*/
+void arrayScale(ObjArray *array, double factor);
+
+/*
+    -= array.h =-
+    Expects two number or two int arrays of the same length.
+*/
+double arrayDot(ObjArray *a, ObjArray *b);
+
+/*
+    -= array.h =-
+    @returns false if the value doesn't fit the element type of array.
+*/
+bool arrayFill(ObjArray *array, Value value);
+
+/*
+    -= array.h =-
+    Expects arrays of the same type and src->count <= dst->count.
+*/
+void arrayCopy(ObjArray *dst, ObjArray *src);
+
+/*
+    -= array.h =-
+    Checked operations behind OP_ARRAY, OP_INDEX_GET, OP_INDEX_SET and
+    OP_INTRINSIC, shared by the interpreter and the code generated by
+    --emit-c. Each of them validates its operands and stores the result.
+    @returns NULL on success or the error message otherwise. The message
+             is kept in a static buffer until the next failed call.
+*/
+const char* arrayFromValues(Value *elements, int count, Value *result);
+const char* arrayIndexGet(Value array, Value index, Value *result);
+const char* arrayIndexSet(Value array, Value index, Value value);
+const char* arrayCallIntrinsic(int intrinsic, Value *args, Value *result);
+
+#endif // _H_BEELANG_ARRAY
@@ -0,0 +1,104 @@
+#ifndef _H_BEELANG_BEE
+#define _H_BEELANG_BEE
+
+#include "vm.h"
+
+/*
+    -= bee.h =-
+    Embedding API: a script is compiled once and run any number of times,
+    from any number of threads at once.
+
+    The handle beeCompile() returns is immutable, so it can be shared
+    without locking. Each thread runs it on its own VM, the one
+    beeOpenVM() gives: the VM, the compiler and the scanner are singletons
+    of the thread. The globals belong to the VM, so the runs of a script
+    don't see each other's.
+
+    A script calls natives by their index in the VM that compiled it, so
+    the VMs running it must have the same natives registered in the same
+    order.
+
+    Each VM may be given a quota of memory and of fuel, so that a script
+    running out of either stops on its own VM without harming the others.
+
+    The embedded profile (BEE_STATIC_POOL) has one pool for the whole
+    process and is to be used from a single thread. Running out of memory
+    there drops everything the pool holds, the compiled scripts included:
+    the handles are to be forgotten, not freed.
+*/
+typedef struct BeeScript BeeScript;
+
+/*
+    -= bee.h =-
+    Initializes the VM of the calling thread.
+    @returns the VM, to be passed to beeRun() on this thread only.
+*/
+VM* beeOpenVM(void);
+
+/*
+    -= bee.h =-
+    Frees the objects of the VM. The scripts are left alone.
+*/
+void beeCloseVM(VM *instance);
+
+/*
+    -= bee.h =-
+    Registers a host function callable from the scripts compiled on this
+    thread afterwards. See native.h.
+    @returns false if the VM has no room for one more native.
+*/
+bool beeDefineNative(VM *instance, const char *name, int arity, NativeFn function);
+
+/*
+    -= bee.h =-
+    Sends what the scripts print on this VM to the sink rather than to
+    stdout, NULL restoring stdout. See output.h for the sinks provided.
+    The output is flushed at the end of each beeRun().
+*/
+void beeSetOutput(VM *instance, OutputSink sink, void *context);
+
+/*
+    -= bee.h =-
+    Sets the fuel of the VM, FUEL_UNLIMITED to stop metering. A run
+    spending more than that stops with INTERPRET_OUT_OF_FUEL, see vm.h.
+*/
+void beeSetFuel(VM *instance, int64_t fuel);
+
+/*
+    -= bee.h =-
+    Sets the quota of the VM: an allocation that would take its heap past
+    'bytes', even after a collection, makes the run return
+    INTERPRET_OUT_OF_MEMORY, see interpret(). MEMORY_UNLIMITED lifts it.
+*/
+void beeSetMemoryLimit(VM *instance, size_t bytes);
+
+/*
+    -= bee.h =-
+    Compiles and verifies the source.
+    @returns the handle of the script, NULL on a compile error or if the
+             memory runs out, which is reported to stderr.
+*/
+BeeScript* beeCompile(const char *source);
+
+/*
+    -= bee.h =-
+    Runs the script from its beginning on the VM of the calling thread.
+    The globals the script assigns stay in the VM after it returns.
+*/
+InterpretResult beeRun(VM *instance, const BeeScript *script);
+
+/*
+    -= bee.h =-
+    Continues the run that has stopped with INTERPRET_OUT_OF_FUEL, once
+    beeSetFuel() has given it more. The script is not to be freed before
+    the run ends: starting another run on the VM drops it.
+*/
+InterpretResult beeResume(VM *instance);
+
+/*
+    -= bee.h =-
+    Frees the script, on any thread, once no thread is running it.
+*/
+void beeFree(BeeScript *script);
+
+#endif // _H_BEELANG_BEE
@@ -14,8 +14,8 @@
 */
 typedef enum
 {
-    // OP_CONSTANT_LONG,   // the same as OP_CONSTANT but with the index exceeded to three bytes.
     OP_CONSTANT,        // load the value from ConstantPool and push it onto the stack
+    OP_CONSTANT_LONG,   // OP_CONSTANT past the 256th constant: [constant_long, index16]
     OP_NIL,
     OP_TRUE,
     OP_FALSE,
@@ -28,9 +28,162 @@ typedef enum
     OP_DIVIDE,
     OP_NOT,
     OP_NEGATE,          // unary negation. Inverts the sign of the value
-    OP_RETURN,          // return from function/method call
+    OP_ARRAY,           // builds a typed array of the N values on top of the stack: [array, N]
+    OP_INDEX_GET,       // bounds-checked array[index]
+    OP_INDEX_SET,       // bounds-checked array[index] = value
+    OP_INTRINSIC,       // calls a built-in array function: [intrinsic, ArrayIntrinsic]
+    OP_NATIVE,          // calls a host function: [native, index, argCount]
+    OP_POP,             // discards the value on top of the stack
+    OP_PRINT,           // pops and prints the value on top of the stack
+    OP_GET_LOCAL,       // pushes a local variable: [get_local, slot]
+    OP_SET_LOCAL,       // assigns the top of the stack to a local variable: [set_local, slot]
+    OP_GET_BOXED,       // OP_GET_LOCAL of a local shared with closures, through its box: [get_boxed, slot]
+    OP_SET_BOXED,       // OP_SET_LOCAL of a local shared with closures: [set_boxed, slot]
+    OP_GET_CAPTURE,     // pushes a capture copied into the closure: [get_capture, index]
+    OP_GET_CAPTURE_BOXED,   // pushes a capture shared through a box: [get_capture_boxed, index]
+    OP_SET_CAPTURE,     // assigns the top of the stack to a boxed capture: [set_capture, index]
+    OP_GET_GLOBAL,      // pushes a global variable: [get_global, index16]
+    OP_SET_GLOBAL,      // assigns the top of the stack to a global variable: [set_global, index16]
+    OP_DEFINE_GLOBAL,   // pops the initializer of a global variable: [define_global, index16]
+    // The property instructions name the property by its index in
+    // Bytecode.names and each has an inline cache in Bytecode.caches.
+    OP_GET_PROPERTY,    // replaces an instance with its field or bound method: [get_property, name, cache16]
+    OP_SET_PROPERTY,    // assigns the top of the stack to a field of the instance below: [set_property, name, cache16]
+    OP_INVOKE,          // calls a method of the instance below the arguments: [invoke, name, argCount, cache16]
+
+    // Jumps come in pairs: the long form carries a 16-bit offset, the
+    // _SHORT form an 8-bit one. The compiler always emits the long form
+    // and relaxJumps() narrows it once the distance is known to fit.
+    // Forward jumps are relative to the end of the instruction.
+    OP_JUMP,            // unconditional forward jump: [jump, offset16]
+    OP_JUMP_SHORT,
+    OP_JUMP_BACK,       // unconditional backward jump: [jump_back, offset16]
+    OP_JUMP_BACK_SHORT,
+    OP_JUMP_IF_FALSE,   // pops the condition, jumps if it is falsey
+    OP_JUMP_IF_FALSE_SHORT,
+    OP_JUMP_IF_FALSE_OR_POP,    // 'and': jumps keeping the falsey top, pops it otherwise
+    OP_JUMP_IF_FALSE_OR_POP_SHORT,
+    OP_JUMP_IF_TRUE_OR_POP,     // 'or': jumps keeping the truthy top, pops it otherwise
+    OP_JUMP_IF_TRUE_OR_POP_SHORT,
+    // Comparisons fused with a conditional jump. Pop both operands.
+    OP_JUMP_IF_LESS,
+    OP_JUMP_IF_LESS_SHORT,
+    OP_JUMP_IF_NOT_LESS,
+    OP_JUMP_IF_NOT_LESS_SHORT,
+    OP_JUMP_IF_GREATER,
+    OP_JUMP_IF_GREATER_SHORT,
+    OP_JUMP_IF_NOT_GREATER,
+    OP_JUMP_IF_NOT_GREATER_SHORT,
+    OP_JUMP_IF_EQUAL,
+    OP_JUMP_IF_EQUAL_SHORT,
+    OP_JUMP_IF_NOT_EQUAL,
+    OP_JUMP_IF_NOT_EQUAL_SHORT,
+    OP_LOOP,            // loop back-edge: [loop, offset16, counter16]
+    OP_LOOP_SHORT,      // [loop_short, offset8, counter16]
+    OP_CASE,            // pops and jumps back if the top equals a constant: [case, index16, offset16]
+    OP_TABLESWITCH,     // pops and jumps back through a dense jump table:
+                        // [tableswitch, low32, count16, default16, count x offset16]
+    OP_LOOKUPSWITCH,    // pops and jumps back through a sorted key table:
+                        // [lookupswitch, count16, default16, count x (key32, offset16)]
+    OP_CALL,            // calls the function below the arguments: [call, argCount]
+    OP_CALL_SELF,       // calls the running function again, arity checked: [call_self, argCount]
+    OP_TAIL_CALL,       // OP_CALL in place of the running function: [tail_call, argCount]
+    OP_TAIL_CALL_SELF,  // OP_CALL_SELF in place of the running function: [tail_call_self, argCount]
+    OP_CLOSURE,         // pushes a closure of the function:
+                        // [closure, function, count, count x (CAPTURE_* flags, slot or capture index)]
+    OP_SELF,            // pushes the running function, or its closure
+    OP_RETURN_VALUE,    // returns the top of the stack from a function
+    OP_RETURN,          // ends the script
 }OpCode;
 
+/*
+    -= bytecode.h =-
+    Version of the instruction set and of the compiler output. It has to be
+    bumped by any change to either, since it keys the cached bytecode.
+*/
+#define BYTECODE_VERSION 8
+
+/*
+    -= bytecode.h =-
+    Where OP_CLOSURE takes a capture from: a local slot of the running
+    code, or one of its own captures. A boxed capture is shared, and
+    boxing a local puts the box in its slot.
+*/
+#define CAPTURE_LOCAL   0x01
+#define CAPTURE_BOXED   0x02
+
+/*
+    -= bytecode.h =-
+    A function declared by the script. Its body is compiled into the
+    same code as the script, which jumps over it. Values refer to it by
+    its index in Bytecode.functions (see FUNCTION_VAL), so a function
+    needs no allocation.
+*/
+typedef struct
+{
+    int entry;          // offset of the first instruction of the body
+    int arity;          // the arguments are the first locals of the body
+    int stackMax;       // depth the body takes the stack to, set by verifyBytecode()
+    int end;            // offset right after the body
+    int captureCount;   // 0 for a function needing no closure
+    char *name;
+    int nameLength;
+} Function;
+
+/*
+    -= bytecode.h =-
+    The name of a property, copied from the source. The instructions refer
+    to it by its index in Bytecode.names, each name being there once.
+*/
+typedef struct
+{
+    char *chars;
+    int length;
+} Name;
+
+typedef struct
+{
+    int name;           // index in Bytecode.names
+    int function;       // index in Bytecode.functions
+} Method;
+
+/*
+    -= bytecode.h =-
+    A class declared by the script. Like functions, classes are resolved
+    at compile time: a class is a value by its index (see CLASS_VAL), and
+    its methods are functions whose first argument is the receiver, 'this'.
+    The methods of the superclass are copied into the class when it is
+    declared, so that a lookup never walks the hierarchy.
+*/
+typedef struct
+{
+    char *name;
+    int nameLength;
+    int superclass;     // -1 if none
+    int initializer;    // the method run by a call of the class, 'init'
+    int methodCount;
+    int methodCapacity;
+    Method *methods;    // the inherited ones included
+} Class;
+
+struct Shape;
+
+/*
+    -= bytecode.h =-
+    What a property instruction found for the shape of the last instance
+    it has seen, so that it skips the lookup while the shape stays the
+    same. The cache is monomorphic: a site seeing instances of several
+    shapes refills it at each change.
+*/
+typedef struct
+{
+    struct Shape *shape;    // NULL until the first lookup
+    struct Shape *next;     // the shape OP_SET_PROPERTY moves the instance to
+                            // when adding the field, NULL if it has it
+    int slot;               // of the field, -1 for a method
+    int function;           // the method, for OP_GET_PROPERTY and OP_INVOKE
+} InlineCache;
+
 /*
     -= bytecode.h =-
     Bytecode - is a series of instructions.
@@ -42,8 +195,37 @@ typedef struct
     uint8_t *code;  // array of bytecodes
     int *lines;     // traces lines of bytecodes. Used in case runtime error occured.
     ConstantPool constantPool;
+    int loopCount;              // number of loops, i.e. OP_LOOP back-edges
+    uint32_t *loopCounters;     // how many times each back-edge has been taken
+    int functionCount;
+    int functionCapacity;
+    Function *functions;
+    int classCount;
+    int classCapacity;
+    Class *classes;
+    int nameCount;
+    int nameCapacity;
+    Name *names;
+    int cacheCount;
+    int cacheCapacity;
+    InlineCache *caches;        // one per property instruction
 }Bytecode;
 
+/*
+    -= bytecode.h =-
+    The sizes of the parts of a Bytecode, to cut it back to.
+*/
+typedef struct
+{
+    int count;
+    int constantCount;
+    int loopCount;
+    int functionCount;
+    int classCount;
+    int nameCount;
+    int cacheCount;
+} BytecodeMark;
+
 /*
     -= bytecode.h =-
     Sets the fields of 'Bytecode' structure to zero and NULL.
@@ -69,6 +251,14 @@ void freeBytecode(Bytecode *bytecode);
 */
 void appendBytecode(Bytecode *bytecode, uint8_t byte, int line);
 
+/*
+    -= bytecode.h =-
+    Grows 'Bytecode.code' and 'Bytecode.lines' to 'capacity' together:
+    when either can't grow, the failure unwinds with both left as they
+    were.
+*/
+void reserveCode(Bytecode *bytecode, int capacity);
+
 /*
     -= bytecode.h =-
     Convenience function to add a new constant to ConstantPool inside this module
@@ -77,6 +267,77 @@ void appendBytecode(Bytecode *bytecode, uint8_t byte, int line);
 */
 int addConstant(Bytecode *bytecode, Value value);
 
+/*
+    -= bytecode.h =-
+    Allocates a new zeroed back-edge counter.
+    @returns index of the counter, which is the operand of OP_LOOP.
+*/
+int addLoopCounter(Bytecode *bytecode);
+
+/*
+    -= bytecode.h =-
+    Adds a function whose body starts at the end of code.
+    The name is copied.
+    @returns index of the function, which is the payload of FUNCTION_VAL.
+*/
+int addFunction(Bytecode *bytecode, const char *name, int length);
+
+/*
+    -= bytecode.h =-
+    Adds a class without methods nor superclass. The name is copied.
+    @returns index of the class, which is the payload of CLASS_VAL.
+*/
+int addClass(Bytecode *bytecode, const char *name, int length);
+
+/*
+    -= bytecode.h =-
+    Adds the method to the class, in place of the one of the same name
+    it may have inherited.
+*/
+void addMethod(Bytecode *bytecode, int klass, int name, int function);
+
+/*
+    -= bytecode.h =-
+    @returns the function of the method of the class, -1 if it has none
+             by that name.
+*/
+int findMethod(Class *klass, int name);
+
+/*
+    -= bytecode.h =-
+    @returns index of the property name, added if it is new. The name is
+             copied.
+*/
+int addName(Bytecode *bytecode, const char *chars, int length);
+
+/*
+    -= bytecode.h =-
+    Allocates a new empty inline cache.
+    @returns index of the cache, the operand of the property instructions.
+*/
+int addInlineCache(Bytecode *bytecode);
+
+/*
+    -= bytecode.h =-
+    @returns the current sizes of the parts of the bytecode.
+*/
+BytecodeMark markBytecode(Bytecode *bytecode);
+
+/*
+    -= bytecode.h =-
+    Cuts the code, the constants, the loop counters, the functions, the
+    classes, the names and the caches back to the sizes of the mark,
+    keeping the buffers for the code to be appended next.
+*/
+void truncateBytecode(Bytecode *bytecode, BytecodeMark mark);
+
+/*
+    -= bytecode.h =-
+    @returns the length in bytes of the instruction at 'offset',
+    including its operands.
+*/
+int instructionLength(Bytecode *bytecode, int offset);
+
 /*
     -= bytecode.h =-
     Adds constant to Bytecode.ConstantPool and then writes an appropriate instruction
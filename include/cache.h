@@ -0,0 +1,32 @@
+#ifndef _H_BEELANG_CACHE
+#define _H_BEELANG_CACHE
+
+#include <stdio.h>
+#include "vm.h"
+
+/*
+    -= cache.h =-
+    On-disk cache of compiled scripts (bee --cache <dir>).
+    Each entry is a file named after a 64-bit FNV-1a hash of the source,
+    seeded with BYTECODE_VERSION and the optimization level, and holds the
+    length of the source and a second, independent hash of it, then the
+    serialized Bytecode: the code, its line numbers, the functions, the
+    property names, the classes, the constants and the numbers of loops
+    and of inline caches, which start empty.
+    An entry is written to a temporary file first and then renamed, so
+    that a reader never sees it half-written. On load, the header, both
+    hashes, the length and a checksum of the whole entry must match, and
+    the code must pass verifyBytecode(), otherwise the script is compiled
+    anew and the entry replaced.
+*/
+
+/*
+    -= cache.h =-
+    Same as interpretStream(), but looks the script up in the cache first
+    and stores it there after compiling it. The file has to be seekable:
+    it is read once for the hash and once more on a miss. A run out of fuel
+    can't be resumed.
+*/
+InterpretResult interpretCached(FILE *file, const char *dir);
+
+#endif // _H_BEELANG_CACHE
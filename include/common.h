@@ -5,7 +5,28 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#define UINT8_COUNT (UINT8_MAX + 1)
+#define UINT16_COUNT (UINT16_MAX + 1)
+
+// The VM, the compiler and the scanner are singletons of the thread using
+// them, so that each thread embedding the interpreter has its own.
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
 //#define DEBUG_PRINT_BYTECODE
 #define DEBUG_TRACE_VM
+//#define DEBUG_PRINT_LOOP_COUNTERS
+//#define DEBUG_STRESS_GC
+
+// Embedded profile: the memory comes from a static pool (see pool.h)
+// instead of the C heap.
+//#define BEE_STATIC_POOL
+
+// Profiling build: the hardware counters (see counters.h) are broken down
+// by opcode family, read before each instruction.
+//#define BEE_OPCODE_COUNTERS
 
 #endif // _H_BEELANG_COMMON
\ No newline at end of file
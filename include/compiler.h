@@ -12,4 +12,70 @@
 */
 bool compile(const char *source, Bytecode *bytecode);
 
+/**
+  -= compiler.h =-
+  Compiles the source to the end of the bytecode, for a REPL session.
+  Unlike compile(), it keeps the global variables declared by the previous
+  calls, so that the code can refer to them.
+  On error, the bytecode and the globals are left as they were.
+*/
+bool compileAppend(const char *source, Bytecode *bytecode);
+
+/**
+  -= compiler.h =-
+  Same as compile(), but reads the source from a stream (a file, a pipe,
+  a socket) as the compilation goes on, in a constant amount of memory.
+  The stream is read up to its end or up to a read error.
+*/
+bool compileStream(FILE *file, Bytecode *bytecode);
+
+/**
+  -= compiler.h =-
+  Forgets the names of the globals and the Scanner's buffers without
+  freeing them, for when the memory holding them is dropped as a whole.
+*/
+void abandonCompiler(void);
+
+/**
+  -= compiler.h =-
+  Undoes the compile a failed allocation has unwound from, if any: the
+  bytecode and the names of the globals go back to what they were before
+  it, and the Scanner's buffers are freed. The temporaries of the
+  compiler and of the optimizer are lost to the heap.
+*/
+void rollBackCompiler(void);
+
+/**
+  -= compiler.h =-
+  The names of the globals a REPL session has declared so far, by their
+  index in VM.globals, for a snapshot of the session.
+  @param Name* receives the names, GLOBALS_MAX of them at most, unless
+         it is NULL. They belong to the compiler and change with the
+         next compile.
+  @returns the number of names.
+*/
+int globalNames(Name *names);
+
+/**
+  -= compiler.h =-
+  Makes the compiler know the globals by these names, in place of those
+  it knew, as a REPL session restored from a snapshot had declared them.
+  The names are copied.
+*/
+void setGlobalNames(const Name *names, int count);
+
+/**
+  -= compiler.h =-
+  Sets how much the compiler of the calling thread optimizes: 1, the
+  default, only fuses instructions as it goes; 2 also runs
+  optimizeBytecode() over the code of each compile.
+*/
+void setOptimizationLevel(int level);
+
+/**
+  -= compiler.h =-
+  @returns the level set by setOptimizationLevel().
+*/
+int optimizationLevel(void);
+
 #endif // _H_BEELANG_COMPILER
\ No newline at end of file
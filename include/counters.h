@@ -0,0 +1,120 @@
+#ifndef _H_BEELANG_COUNTERS
+#define _H_BEELANG_COUNTERS
+
+#include <stdint.h>
+#include "common.h"
+
+/*
+    -= counters.h =-
+    Hardware performance counters of the runs (bee --counters out.json),
+    read through Linux perf_event_open(). The counters of the calling
+    thread are opened as one group, counting in user mode only, and are
+    enabled only while the interpreter or the native code of the JIT runs,
+    the compile left out. They add up over all the runs of the VM.
+
+    A counter the processor or the system doesn't provide, e.g. inside
+    most virtual machines, is left out and written as null.
+*/
+typedef enum
+{
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_L1D_MISSES,     // reads missing the L1 data cache
+    COUNTER_COUNT,
+} Counter;
+
+/*
+    -= counters.h =-
+    The opcodes grouped by what they do, for the breakdown of the
+    profiling build (BEE_OPCODE_COUNTERS, see common.h). There the
+    counters are read before each instruction the interpreter dispatches,
+    and what they have counted since the previous one is put down to the
+    family of the latter, the dispatch included. The reads go through
+    rdpmc where the system allows it, read() otherwise, and cost a few
+    dozen cycles each: the breakdown is for comparing the families, the
+    totals being inflated. The native code of the JIT is only counted in
+    the totals.
+*/
+typedef enum
+{
+    FAMILY_CONSTANT,    // OP_CONSTANT, OP_NIL, OP_TRUE, OP_FALSE
+    FAMILY_ARITHMETIC,  // the operators, comparisons included
+    FAMILY_VARIABLE,    // locals, captures, globals and OP_POP
+    FAMILY_ARRAY,       // OP_ARRAY, OP_INDEX_GET, OP_INDEX_SET, OP_INTRINSIC
+    FAMILY_PROPERTY,    // OP_GET_PROPERTY, OP_SET_PROPERTY
+    FAMILY_JUMP,        // the jumps, fused comparisons included
+    FAMILY_LOOP,        // OP_LOOP, OP_LOOP_SHORT
+    FAMILY_SWITCH,      // OP_CASE, OP_TABLESWITCH, OP_LOOKUPSWITCH
+    FAMILY_CALL,        // the calls, OP_INVOKE and OP_NATIVE, closures and returns
+    FAMILY_PRINT,       // OP_PRINT
+    FAMILY_COUNT,
+} OpcodeFamily;
+
+typedef struct
+{
+    uint64_t dispatches;            // instructions of the family run
+    uint64_t counts[COUNTER_COUNT];
+} FamilyCounts;
+
+typedef struct
+{
+    bool open;              // see openCounters()
+    bool running;           // enabled, between startCounters() and stopCounters()
+    int fds[COUNTER_COUNT]; // -1 for a counter that isn't available
+    int leader;             // the first one open, which the group follows
+#ifdef BEE_OPCODE_COUNTERS
+    void *pages[COUNTER_COUNT];     // the mapped pages of the counters, for rdpmc
+    uint64_t last[COUNTER_COUNT];   // read before the instruction being counted
+    int family;                     // the family of that instruction, -1 if none
+    FamilyCounts families[FAMILY_COUNT];
+#endif
+} Counters;
+
+/*
+    -= counters.h =-
+    Opens the counters for the VM of the calling thread, from zero. The
+    counters that aren't available are reported to stderr.
+    @returns false if the platform has no perf_event_open(), which is
+             reported to stderr.
+*/
+bool openCounters(void);
+
+/*
+    -= counters.h =-
+    Closes the counters, from freeVM().
+*/
+void closeCounters(void);
+
+/*
+    -= counters.h =-
+    Enable and disable the counters around a run, for the VM. Nothing
+    happens unless they are open.
+*/
+void startCounters(void);
+void stopCounters(void);
+
+/*
+    -= counters.h =-
+    Writes what the counters have counted to the file as a JSON object:
+        {"cycles": 123, "instructions": 456, "branch-misses": 7,
+         "l1d-misses": null}
+    In the profiling build, a "families" object follows, holding the
+    same counts and the number of "dispatches" for each family.
+    The counts of a counter the kernel has multiplexed with others are
+    scaled up to the time it was enabled.
+    @returns false if it can't be written, which is reported to stderr.
+*/
+bool writeCounters(const char *path);
+
+/*
+    -= counters.h =-
+    Puts down what the counters have counted since the previous
+    instruction to its family, 'instruction' being the next one.
+    For the dispatch loop of the profiling build.
+*/
+#ifdef BEE_OPCODE_COUNTERS
+void countOpcode(uint8_t instruction);
+#endif
+
+#endif // _H_BEELANG_COUNTERS
@@ -24,4 +24,12 @@ void disassembleBytecode(Bytecode *bytecode, const char *name);
 */
 int disassembleInstruction(Bytecode *bytecode, int offset);
 
+/**
+  -= debug.h =-
+  Prints how many times each loop back-edge has been taken,
+  along with the offset and the source line of the loop.
+  @param Bytecode* executed bytecode.
+*/
+void printLoopCounters(Bytecode *bytecode);
+
 #endif // _H_BEELANG_DEBUG
\ No newline at end of file
@@ -0,0 +1,25 @@
+#ifndef _H_BEELANG_EMITC
+#define _H_BEELANG_EMITC
+
+#include <stdio.h>
+#include "bytecode.h"
+
+/*
+    -= emitc.h =-
+    Ahead-of-time translator of Bytecode to C (bee --emit-c).
+    Each instruction becomes a short sequence of C statements. Since the
+    stack depth at each instruction is known statically, every stack slot,
+    locals included, becomes a C local variable, and jumps become gotos.
+    Globals stay in vm.globals.
+
+    The output is a standalone program to be linked against the runtime:
+    value.c, object.c, array.c and memory.c. It behaves like run() does,
+    including the runtime error messages and the exit code 70.
+
+    @returns false if the bytecode can't be translated, e.g. because it
+             calls natives or declares functions, in which case nothing
+             is written.
+*/
+bool emitC(Bytecode *bytecode, FILE *out);
+
+#endif // _H_BEELANG_EMITC
@@ -0,0 +1,92 @@
+#ifndef _H_BEELANG_IMAGE
+#define _H_BEELANG_IMAGE
+
+#include <stdio.h>
+#include "bytecode.h"
+
+#define FNV_OFFSET      14695981039346656037u
+#define FNV_PRIME       1099511628211u
+
+/*
+    -= image.h =-
+    On-disk encoding of compiled code, shared by the cache of compiled
+    scripts (see cache.h) and the snapshots of a session (see snapshot.h).
+    The files are little-endian whatever the host, and summed with a
+    64-bit FNV-1a hash as they are written, so that a reader can tell a
+    damaged one.
+*/
+uint64_t fnv1a(uint64_t hash, const uint8_t *bytes, size_t length);
+
+typedef struct
+{
+    FILE *file;
+    uint64_t checksum;  // of what has been written so far
+} Writer;
+
+void writeBytes(Writer *writer, const void *bytes, size_t length);
+void writeU8(Writer *writer, uint8_t value);
+void writeU32(Writer *writer, uint32_t value);
+void writeU64(Writer *writer, uint64_t value);
+
+/*
+    -= image.h =-
+    Reads a file held in memory. A read past the end returns zeros and
+    clears 'ok' for good, so that a sequence of reads is checked once.
+*/
+typedef struct
+{
+    const uint8_t *at;
+    const uint8_t *end;
+    bool ok;            // false once a read went past the end
+} Reader;
+
+/*
+    -= image.h =-
+    @returns the next 'length' bytes, NULL if there are not as many left.
+*/
+const uint8_t* readBytes(Reader *reader, size_t length);
+uint8_t readU8(Reader *reader);
+uint32_t readU32(Reader *reader);
+uint64_t readU64(Reader *reader);
+
+/*
+    -= image.h =-
+    Writes a value other than an object: its type, then its payload.
+*/
+void writeValue(Writer *writer, Value value);
+
+/*
+    -= image.h =-
+    Reads the payload of a value of the given type, other than an object.
+    The indices of functions and classes are left for the caller to check.
+    @returns nil, 'ok' cleared, if the type is unknown.
+*/
+Value readValue(Reader *reader, uint8_t type);
+
+/*
+    -= image.h =-
+    @returns false if the bytecode holds a constant that can't be written:
+             an object.
+*/
+bool isWritable(Bytecode *bytecode);
+
+/*
+    -= image.h =-
+    Writes a bytecode isWritable() accepts: the sizes of its parts, then
+    the code, its line numbers, the functions, the property names, the
+    classes and the constants. The loop counters and the inline caches
+    are not written, only their numbers: they are read back empty.
+*/
+void writeBytecode(Writer *writer, Bytecode *bytecode);
+
+/*
+    -= image.h =-
+    Reads what writeBytecode() has written into an empty bytecode.
+    Only the structure is checked: the code still has to pass
+    verifyBytecode() before it runs.
+    @returns false if the data is malformed, in which case the bytecode
+             is left for the caller to free.
+*/
+bool readBytecode(Reader *reader, Bytecode *bytecode);
+
+#endif // _H_BEELANG_IMAGE
@@ -0,0 +1,44 @@
+#ifndef _H_BEELANG_JIT
+#define _H_BEELANG_JIT
+
+#include "bytecode.h"
+
+/*
+    -= jit.h =-
+    Baseline template JIT for x86-64.
+    Each instruction of a Bytecode is translated into a fixed machine code
+    template, with the operands and the constants of the ConstantPool
+    inlined as immediates. The native code works on the very same VM stack
+    and globals as the interpreter, so that it can hand the execution over
+    to the interpreter at any instruction boundary.
+
+    Fast paths (numbers, locals, globals, jumps) are inlined. Everything
+    else calls the same C routines as the interpreter does. When an inlined
+    type check fails, the native code leaves and the interpreter resumes
+    from the failing instruction, reporting the error the usual way.
+*/
+typedef struct JitCode JitCode;
+
+#define JIT_DONE    -1      // the code ran up to OP_RETURN
+#define JIT_ERROR   -2      // a runtime error has been reported
+
+/*
+    -= jit.h =-
+    Translates the bytecode into native code.
+    @returns NULL if the target isn't x86-64 or the bytecode can't be
+             compiled, in which case it has to be interpreted.
+*/
+JitCode* jitCompile(Bytecode *bytecode);
+
+/*
+    -= jit.h =-
+    Runs the native code from the first instruction.
+    vm.bytecode must point to the bytecode the code was compiled from.
+    @returns JIT_DONE, JIT_ERROR or the offset of the instruction
+             the interpreter has to resume from.
+*/
+int jitExecute(JitCode *jit);
+
+void jitFree(JitCode *jit);
+
+#endif // _H_BEELANG_JIT
@@ -2,6 +2,7 @@
 #define _H_BEELANG_MEMORY
 
 #include "common.h"
+#include "value.h"
 
 /*
     -= memory.h =-
@@ -31,6 +32,19 @@
 #define FREE_ARRAY(type, pointer, oldCount) \
         reallocate(pointer, sizeof(type) * (oldCount), 0)
 
+/*
+    -= memory.h =-
+    Allocates a new array of 'count' elements of the given type.
+*/
+#define ALLOCATE(type, count) \
+        (type*)reallocate(NULL, 0, sizeof(type) * (count))
+
+/*
+    -= memory.h =-
+    Frees a single heap-allocated entity of the given type.
+*/
+#define FREE(type, pointer) reallocate(pointer, sizeof(type), 0)
+
 /*
     -= memory.h =-
     Handles dynamic memory management:
@@ -45,8 +59,126 @@
                   If 'oldSize' == 0 then this function allocates new block.
                   If < 'oldSize' - shrink existing allocation.
                   If > 'oldSize' - increase existing allocation.
-    @returns void* casted pointer to array.
+    @returns void* casted pointer to array. It never returns NULL for a
+             growth: when the system or vm.memoryLimit refuses it even after
+             a full collection, it unwinds to vm.unwind, see interpret().
 */
 void* reallocate(void* pointer, size_t oldSize, size_t newSize);
 
+/*
+    -= memory.h =-
+    Same as ALLOCATE(), INCREASE_ARRAY() and FREE_ARRAY(), for the
+    temporaries of the compiler, the optimizer, the verifier and the JIT:
+    the arrays they hold only until they return. Those are chained, so that
+    freeScratch() can give back what one that has unwound left behind.
+*/
+#define ALLOCATE_SCRATCH(type, count) \
+        (type*)reallocateScratch(NULL, 0, sizeof(type) * (count))
+
+#define INCREASE_SCRATCH(type, pointer, oldCount, newCount) \
+        (type*)reallocateScratch(pointer, sizeof(type) * (oldCount), \
+        sizeof(type) * (newCount))
+
+#define FREE_SCRATCH(type, pointer, oldCount) \
+        reallocateScratch(pointer, sizeof(type) * (oldCount), 0)
+
+/*
+    -= memory.h =-
+    reallocate() for the scratch arrays, a header chaining them ahead of
+    each. Like reallocate(), a growth either succeeds or unwinds, the array
+    it was given still chained.
+*/
+void* reallocateScratch(void *pointer, size_t oldSize, size_t newSize);
+
+/*
+    -= memory.h =-
+    Frees the scratch arrays still held, from rollBackCompiler(), once
+    their owners have unwound.
+*/
+void freeScratch(void);
+
+/*
+    -= memory.h =-
+    Walks the VM's list of objects and frees each of them.
+*/
+void freeObjects(void);
+
+/*
+    -= memory.h =-
+    Incremental tri-color mark-sweep garbage collector.
+    White objects are unmarked, gray ones are marked and wait on the gray
+    stack to be scanned, black ones are marked and scanned.
+
+    reallocate() drives the collector: once the heap grows past 'nextGC',
+    a cycle starts, and while it runs, each GC_STEP_BYTES of allocation
+    pays for a step of GC_STEP_MULTIPLIER times as many bytes of marking
+    or sweeping. So a cycle always finishes before the heap doubles, and
+    a single pause is bounded by the step size rather than the heap size.
+
+    The roots are the VM stack, the globals, the constants of the
+    running bytecode and the pinned values. Roots aren't guarded by the write barrier: instead,
+    they are marked once more before the sweep starts.
+*/
+typedef enum
+{
+    GC_IDLE,
+    GC_MARK,
+    GC_SWEEP,
+} GcPhase;
+
+// bucket 0 counts pauses under 1us, bucket i those under 2^i us
+#define GC_PAUSE_BUCKETS 24
+
+typedef struct
+{
+    uint64_t cycles;
+    uint64_t pauses;        // number of steps
+    uint64_t totalPause;    // in nanoseconds
+    uint64_t maxPause;      // in nanoseconds
+    uint64_t histogram[GC_PAUSE_BUCKETS];
+} GcStats;
+
+typedef struct
+{
+    GcPhase phase;
+    size_t bytesAllocated;  // the heap size as seen by reallocate()
+    size_t nextGC;          // the heap size starting the next cycle
+    size_t debt;            // bytes allocated since the last step
+    Obj **grayStack;
+    int grayCount;
+    int grayCapacity;
+    Obj *sweepList;         // objects left to sweep, detached from vm.objects
+    Value *pinned;          // more roots, for objects being built that no
+    int pinnedCount;        // root reaches yet, e.g. by loadSnapshot()
+    union Scratch *scratch; // the scratch arrays held, see reallocateScratch()
+    GcStats stats;
+} Collector;
+
+/*
+    -= memory.h =-
+    Resets the collector of the VM.
+*/
+void initCollector(void);
+
+/*
+    -= memory.h =-
+    Completes the current cycle, or runs a whole new one, in a single pause.
+*/
+void collectGarbage(void);
+
+/*
+    -= memory.h =-
+    Write barrier. Must be called whenever a reference to 'value' is stored
+    into a heap object. While marking, it grays the white object being
+    stored into an already marked one, so that the collector never misses
+    it. Typed arrays keep their elements unboxed, so they don't need it.
+*/
+void writeBarrier(Obj *object, Value value);
+
+/*
+    -= memory.h =-
+    Prints the collector statistics and the histogram of pauses to stderr.
+*/
+void printGcStats(void);
+
 #endif // _H_BEELANG_MEMORY
\ No newline at end of file
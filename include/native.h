@@ -0,0 +1,57 @@
+#ifndef _H_BEELANG_NATIVE
+#define _H_BEELANG_NATIVE
+
+#include "value.h"
+
+/*
+    -= native.h =-
+    Host functions, registered into the VM by the program embedding it.
+    Like the array intrinsics, they are resolved by name at compile time,
+    so a call is OP_NATIVE with the index of the function in the VM and
+    the number of arguments.
+
+    A native gets its arguments as a window into the VM stack: args[0] is
+    the first argument, args[argCount - 1] the top of the stack. Nothing
+    is copied. The result is written over args[0], which is valid even
+    with no arguments, and the VM drops the rest of the window.
+    The arguments stay on the stack during the call, so they are safe
+    from the collector if the native allocates.
+
+    @returns NULL on success or the message of the runtime error to report.
+*/
+typedef const char* (*NativeFn)(Value *args, int argCount);
+
+// arity of a native taking any number of arguments
+#define NATIVE_VARIADIC -1
+
+typedef struct
+{
+    const char *name;
+    int length;         // length of the name
+    int arity;          // number of arguments or NATIVE_VARIADIC
+    NativeFn function;
+} Native;
+
+/*
+    -= native.h =-
+    Registers the function into the VM of the calling thread, replacing
+    the one of the same name, if any. Code compiled beforehand keeps
+    calling the natives it was compiled against.
+    @returns false if the VM has no room for one more native.
+*/
+bool defineNative(const char *name, int arity, NativeFn function);
+
+/*
+    -= native.h =-
+    @returns the index of the native or -1 if there is no such native.
+*/
+int findNative(const char *name, int length);
+
+/*
+    -= native.h =-
+    Registers the natives every VM starts with: clock(), sqrt(x),
+    floor(x) and pow(x, y).
+*/
+void defineStandardNatives(void);
+
+#endif // _H_BEELANG_NATIVE
@@ -0,0 +1,43 @@
+#ifndef _H_BEELANG_NUMBER
+#define _H_BEELANG_NUMBER
+
+#include "common.h"
+
+// room for the longest number formatNumber() writes, "-2.2250738585072014e-308"
+#define NUMBER_BUFFER_SIZE 32
+
+/*
+    -= number.h =-
+    Conversions between doubles and their decimal text, independent of the
+    locale and exact both ways.
+
+    A number is printed with the fewest digits that read back to the same
+    double, found with Grisu3. The rare doubles Grisu3 can't settle, about
+    one in two hundred, go through a slower search. The digits are laid
+    out like "%.17g" would: in plain notation unless the exponent is below
+    -4 or above 16, in which case as "1.5e+20".
+
+    A number is read with an exact fast path for the integers and for the
+    values that are a product or quotient of two exact doubles (Clinger),
+    then with the Eisel-Lemire algorithm, which is correctly rounded from
+    a 128-bit approximation of the power of ten. strtod() is left with
+    only the inputs of over 19 digits that Eisel-Lemire can't round.
+*/
+
+/*
+    -= number.h =-
+    Writes the number into the buffer, which must hold NUMBER_BUFFER_SIZE
+    bytes. No terminating '\0' is written.
+    @returns the number of bytes written.
+*/
+int formatNumber(double number, char *buffer);
+
+/*
+    -= number.h =-
+    Reads a decimal number: an optional sign, digits with an optional
+    fraction, and an optional exponent, e.g. "-12.5e-3".
+    @returns false if the text isn't entirely such a number.
+*/
+bool parseNumber(const char *chars, int length, double *number);
+
+#endif // _H_BEELANG_NUMBER
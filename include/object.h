@@ -0,0 +1,188 @@
+#ifndef _H_BEELANG_OBJECT
+#define _H_BEELANG_OBJECT
+
+#include "common.h"
+#include "shape.h"
+#include "value.h"
+
+/*
+    -= object.h =-
+    Kinds of heap-allocated entities.
+*/
+typedef enum
+{
+    OBJ_ARRAY,
+    OBJ_CLOSURE,
+    OBJ_BOX,
+    OBJ_INSTANCE,
+    OBJ_BOUND_METHOD,
+} ObjType;
+
+/*
+    -= object.h =-
+    The header shared by all heap-allocated entities.
+    Each concrete object type embeds Obj as its very first field, so
+    a pointer to the concrete struct can be safely cast to Obj* and back.
+
+    The 'next' field links all objects allocated by the VM into a single
+    intrusive list, which the collector sweeps and freeVM() releases.
+*/
+struct Obj
+{
+    ObjType type;
+    bool isMarked;      // reached by the collector in the current cycle
+    struct Obj *next;
+};
+
+/*
+    -= object.h =-
+    The element type of a typed array.
+    Elements are stored unboxed, in their native C representation:
+    double for numbers, int32_t for integers and uint8_t for booleans.
+*/
+typedef enum
+{
+    ARRAY_NUMBER,
+    ARRAY_INT,
+    ARRAY_BOOL,
+} ArrayType;
+
+/*
+    -= object.h =-
+    Typed array with contiguous backing storage.
+    Unlike ConstantPool, which is an array of tagged Values, the elements
+    are kept unboxed, which makes the array four (int) or sixteen (bool)
+    times denser and lets the bulk kernels in array.c process it with SIMD.
+*/
+typedef struct
+{
+    Obj obj;
+    ArrayType elementType;
+    int count;
+    union {
+        double *numbers;
+        int32_t *ints;
+        uint8_t *bools;
+        void *raw;
+    } as;
+} ObjArray;
+
+/*
+    -= object.h =-
+    A function together with the variables it captures from the enclosing
+    code. The environment is flat: the captures are stored in the closure
+    itself, copied when it is created. A variable that is assigned after
+    being captured is shared through an ObjBox instead, the capture
+    holding the box.
+    Functions without captures are plain VAL_FUNCTION values: they need
+    no closure.
+*/
+typedef struct
+{
+    Obj obj;
+    int function;       // index in Bytecode.functions
+    int captureCount;
+    Value captures[];
+} ObjClosure;
+
+/*
+    -= object.h =-
+    A variable shared between the code declaring it and the closures
+    capturing it. The local slot then holds the box, not the value.
+*/
+typedef struct
+{
+    Obj obj;
+    Value value;
+} ObjBox;
+
+/*
+    -= object.h =-
+    An instance of a class. Its fields are in a dense array of slots,
+    which the shape maps their names to (see shape.h). The shape also
+    tells the class.
+*/
+typedef struct
+{
+    Obj obj;
+    Shape *shape;
+    int capacity;       // of 'fields', shape->slotCount of which are set
+    Value *fields;
+} ObjInstance;
+
+/*
+    -= object.h =-
+    A method read as a property, e.g. to be stored: calling it passes
+    the receiver as 'this'.
+*/
+typedef struct
+{
+    Obj obj;
+    Value receiver;
+    int function;       // index in Bytecode.functions
+} ObjBoundMethod;
+
+#define OBJ_TYPE(value)     (AS_OBJ(value)->type)
+
+#define IS_ARRAY(value)     isObjType(value, OBJ_ARRAY)
+#define IS_CLOSURE(value)   isObjType(value, OBJ_CLOSURE)
+#define IS_BOX(value)       isObjType(value, OBJ_BOX)
+#define IS_INSTANCE(value)  isObjType(value, OBJ_INSTANCE)
+#define IS_BOUND_METHOD(value)  isObjType(value, OBJ_BOUND_METHOD)
+
+#define AS_ARRAY(value)     ((ObjArray*)AS_OBJ(value))
+#define AS_CLOSURE(value)   ((ObjClosure*)AS_OBJ(value))
+#define AS_BOX(value)       ((ObjBox*)AS_OBJ(value))
+#define AS_INSTANCE(value)  ((ObjInstance*)AS_OBJ(value))
+#define AS_BOUND_METHOD(value)  ((ObjBoundMethod*)AS_OBJ(value))
+
+/*
+    -= object.h =-
+    Allocates a new zero-filled typed array of the given length and
+    links it into the VM's object list.
+*/
+ObjArray* newArray(ArrayType elementType, int count);
+
+/*
+    -= object.h =-
+    Allocates a closure of the function with 'captureCount' nil captures,
+    to be filled by the caller.
+*/
+ObjClosure* newClosure(int function, int captureCount);
+
+/*
+    -= object.h =-
+    Allocates a box holding the value.
+*/
+ObjBox* newBox(Value value);
+
+/*
+    -= object.h =-
+    Allocates an instance of the class, without fields.
+*/
+ObjInstance* newInstance(int klass);
+
+/*
+    -= object.h =-
+    Makes room in the instance for one more field than its shape has.
+*/
+void reserveField(ObjInstance *instance);
+
+/*
+    -= object.h =-
+    Allocates the method bound to the receiver.
+*/
+ObjBoundMethod* newBoundMethod(Value receiver, int function);
+
+/*
+    -= object.h =-
+    Prints a given heap-allocated value. Called from printValue().
+*/
+void printObject(Value value);
+
+static inline bool isObjType(Value value, ObjType type)
+{
+    return IS_OBJ(value) && AS_OBJ(value)->type == type;
+}
+
+#endif // _H_BEELANG_OBJECT
@@ -0,0 +1,47 @@
+#ifndef _H_BEELANG_OPTIMIZE
+#define _H_BEELANG_OPTIMIZE
+
+#include "bytecode.h"
+
+/*
+    -= optimize.h =-
+    Optimizer of -O2, run over the code of a compile() before relaxJumps().
+
+    The single-pass compiler sees a few instructions at a time, so it can
+    only fuse them. This pass takes the script and each function as a
+    whole: it splits the code into basic blocks, finds their dominators
+    and the loops, and numbers the values the SSA way. A value gets a
+    number once, which the locals and globals it is assigned to carry
+    along, and two computations of the same operation on the same numbers
+    get the same one. Where paths with different numbers in a variable
+    join, the variable gets a new number, a phi. Then:
+
+      - constants are folded, through the variables holding them too,
+        and so are the conditional jumps on them, the code they no
+        longer reach being dropped;
+      - an assignment to a local that isn't read afterwards is dropped,
+        and so is an expression statement that can have no effect;
+      - an expression computed again on a path where its value is
+        already known is read from a temporary instead (CSE);
+      - an expression whose operands don't change in a loop is computed
+        once before it, into a temporary (loop-invariant code motion).
+
+    The temporaries are slots right after the arguments, set to nil on
+    entry, and the locals after them move up.
+
+    No observable behavior changes: an expression only moves if it can't
+    fail, its operands being known numbers, or if the first thing the
+    loop does is to check that they are, which fails with the same error
+    on the same line. Calls may assign any global, so the value of a
+    global is only known between two of them. A function calling itself
+    gets no temporaries, since they would eat into its depth of recursion.
+
+    The code is left as it was if the result doesn't pass the checks of
+    regionDepths().
+
+    @param int offset of the first instruction to optimize. The code before
+           it is left untouched.
+*/
+void optimizeBytecode(Bytecode *bytecode, int start);
+
+#endif // _H_BEELANG_OPTIMIZE
@@ -0,0 +1,85 @@
+#ifndef _H_BEELANG_OUTPUT
+#define _H_BEELANG_OUTPUT
+
+#include <stdio.h>
+#include "common.h"
+
+#ifndef OUTPUT_BUFFER_SIZE
+#define OUTPUT_BUFFER_SIZE 8192
+#endif
+
+/*
+    -= output.h =-
+    Where the bytes go once the buffer is flushed.
+    'context' is the one given to setOutputSink().
+*/
+typedef void (*OutputSink)(const char *bytes, size_t length, void *context);
+
+/*
+    -= output.h =-
+    What the scripts print. printValue() formats straight into a buffer of
+    the VM, which is handed to the sink only when it is full and at the
+    flush points: the end of each interpret() call, before a runtime error
+    is reported and in freeVM(). A script printing many values thus costs
+    one write per OUTPUT_BUFFER_SIZE bytes rather than a printf() per value.
+    A host writing to the same file itself, e.g. from a native, calls
+    flushOutput() first to keep the order.
+*/
+typedef struct
+{
+    size_t count;       // bytes waiting in 'buffer'
+    OutputSink sink;    // NULL for stdout
+    void *context;
+    char buffer[OUTPUT_BUFFER_SIZE];
+} Output;
+
+/*
+    -= output.h =-
+    A memory area a sink fills, the context of memorySink().
+    Like snprintf(), the bytes past the capacity are dropped but counted:
+    the output was cut short if 'count' ends up larger than 'capacity'.
+*/
+typedef struct
+{
+    char *bytes;
+    size_t capacity;
+    size_t count;
+} OutputBuffer;
+
+/*
+    -= output.h =-
+    Flushes what is buffered to the current sink, then makes the VM of the
+    calling thread print to the new one. NULL restores stdout.
+*/
+void setOutputSink(OutputSink sink, void *context);
+
+/*
+    -= output.h =-
+    Appends the bytes to the buffer, flushing it as it fills up.
+*/
+void writeOutput(const char *bytes, size_t length);
+
+/*
+    -= output.h =-
+    Appends the number as formatNumber() writes it.
+*/
+void writeNumber(double number);
+
+/*
+    -= output.h =-
+    Hands the buffered bytes to the sink and empties the buffer.
+*/
+void flushOutput(void);
+
+/*
+    -= output.h =-
+    Sinks for setOutputSink().
+    fileSink writes to the FILE* given as context, fdSink to the file
+    descriptor given as context, cast with (void*)(intptr_t)fd, and
+    memorySink to the OutputBuffer given as context.
+*/
+void fileSink(const char *bytes, size_t length, void *context);
+void fdSink(const char *bytes, size_t length, void *context);
+void memorySink(const char *bytes, size_t length, void *context);
+
+#endif // _H_BEELANG_OUTPUT
@@ -0,0 +1,40 @@
+#ifndef _H_BEELANG_POOL
+#define _H_BEELANG_POOL
+
+#include "common.h"
+
+/*
+    -= pool.h =-
+    Static memory pool of the embedded profile (BEE_STATIC_POOL).
+    Every allocation of the VM, the compiler and the objects comes from a
+    single array of BEE_POOL_SIZE bytes reserved at link time, so that the
+    memory the interpreter may ever use is known in advance and nothing
+    is taken from the C heap.
+
+    The blocks are kept in address order, each one preceded by a header
+    holding its size, and the free ones are merged with their neighbours.
+    A block growing in place absorbs the free block following it, which
+    is the common case for the arrays doubling their capacity.
+*/
+#ifndef BEE_POOL_SIZE
+#define BEE_POOL_SIZE (32 * 1024)
+#endif
+
+/*
+    -= pool.h =-
+    Same contract as realloc(): a NULL pointer allocates, a zero size frees.
+    @returns NULL if the pool has no free block large enough, in which case
+             the old block is left untouched.
+*/
+void* poolResize(void *pointer, size_t newSize);
+
+/*
+    -= pool.h =-
+    Frees all the blocks at once.
+*/
+void poolReset(void);
+
+size_t poolUsed(void);
+size_t poolPeak(void);
+
+#endif // _H_BEELANG_POOL
@@ -0,0 +1,97 @@
+#ifndef _H_BEELANG_PROFILE
+#define _H_BEELANG_PROFILE
+
+#include <signal.h>
+#include <stdint.h>
+#include "common.h"
+
+// the sampling period, in microseconds of CPU time, rounded up to the tick of the system clock
+#ifndef PROFILE_INTERVAL
+#define PROFILE_INTERVAL 1000
+#endif
+
+/*
+    -= profile.h =-
+    Sampling profiler (bee --profile out.txt).
+    A timer of the CPU time (setitimer() and SIGPROF) ticks every
+    PROFILE_INTERVAL microseconds. The signal handler only counts the
+    ticks: the interpreter, which keeps its instruction pointer in a
+    local, takes the sample itself before the next instruction, from a
+    copy of its dispatch loop that is only run while profiling. The
+    sample is the stack of calls, each frame mapped to its source line
+    through Bytecode.lines, and it weighs the ticks it stands for, so that
+    the time spent in a native or a collection goes to the instruction
+    that has called it.
+
+    The samples are kept as distinct stacks with their counts, and written
+    in the collapsed-stack format flamegraph.pl reads: one line per stack,
+    the frames from the script down to the innermost one, separated by
+    semicolons and each written as "name:line", then the count, e.g.
+        script:12;fib:3;fib:3 41
+    The innermost frames thus tell the hot lines.
+
+    The JIT is off while profiling, its native code keeping no instruction
+    pointer. Only one VM at a time is profiled.
+*/
+typedef struct
+{
+    char *text;     // where the stack is written
+    int length;
+    int samples;
+} ProfileStack;
+
+typedef struct
+{
+    bool active;            // the dispatch loop takes the samples
+    ProfileStack *stacks;   // in the order they were first sampled
+    int stackCount;
+    int stackCapacity;
+    int *index;             // hash table of 'stacks', -1 for an empty slot
+    int indexCapacity;
+    char *buffer;           // the stack being sampled
+    int bufferCapacity;
+} Profile;
+
+/*
+    -= profile.h =-
+    Ticks of the timer the running VM has not sampled yet.
+*/
+extern volatile sig_atomic_t profileTicks;
+
+/*
+    -= profile.h =-
+    Drops the samples taken so far and starts sampling the VM of the
+    calling thread.
+    @returns false if the platform has no profiling timer or another VM
+             is being profiled, which is reported to stderr.
+*/
+bool startProfile(void);
+
+/*
+    -= profile.h =-
+    Stops sampling, keeping the samples.
+*/
+void stopProfile(void);
+
+/*
+    -= profile.h =-
+    Writes the samples to the file in the collapsed-stack format.
+    @returns false if it can't be written, which is reported to stderr.
+*/
+bool writeProfile(const char *path);
+
+/*
+    -= profile.h =-
+    Stops sampling and frees the samples, from freeVM().
+*/
+void freeProfile(void);
+
+/*
+    -= profile.h =-
+    Takes a sample of the running code, 'ip' being the instruction of
+    the innermost frame about to run. For the dispatch loop, once
+    profileTicks is set.
+*/
+void sampleProfile(const uint8_t *ip);
+
+#endif // _H_BEELANG_PROFILE
@@ -0,0 +1,25 @@
+#ifndef _H_BEELANG_RELAX
+#define _H_BEELANG_RELAX
+
+#include "bytecode.h"
+
+/*
+    -= relax.h =-
+    Branch relaxation pass.
+    The single-pass compiler doesn't know the distance of a forward jump
+    when it emits one, so it always emits the long (16-bit) form.
+    Once the code is complete, this pass narrows every jump whose distance
+    fits into 8 bits to its _SHORT form and rewrites the offsets of all
+    the branches, jump tables and function bodies included, to the new
+    layout.
+
+    Narrowing a jump can only bring other targets closer, so the pass
+    repeats until no more jumps can be narrowed.
+
+    @param Bytecode* code to be relaxed.
+    @param int offset of the first instruction to be processed. The code
+           before it is left untouched, and no branch may cross this offset.
+*/
+void relaxJumps(Bytecode *bytecode, int start);
+
+#endif // _H_BEELANG_RELAX
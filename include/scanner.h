@@ -1,12 +1,15 @@
 #ifndef _H_BEELANG_SCANNER
 #define _H_BEELANG_SCANNER
 
+#include <stdio.h>
+
 typedef enum {
   // Single-character tokens.
   TOKEN_LEFT_PAREN, TOKEN_RIGHT_PAREN,
   TOKEN_LEFT_BRACE, TOKEN_RIGHT_BRACE,
+  TOKEN_LEFT_BRACKET, TOKEN_RIGHT_BRACKET,
   TOKEN_COMMA, TOKEN_DOT, TOKEN_MINUS, TOKEN_PLUS,
-  TOKEN_SEMICOLON, TOKEN_SLASH, TOKEN_STAR,
+  TOKEN_SEMICOLON, TOKEN_SLASH, TOKEN_STAR, TOKEN_COLON,
   // One or two character tokens.
   TOKEN_BANG, TOKEN_BANG_EQUAL,
   TOKEN_EQUAL, TOKEN_EQUAL_EQUAL,
@@ -15,9 +18,9 @@ typedef enum {
   // Literals.
   TOKEN_IDENTIFIER, TOKEN_STRING, TOKEN_NUMBER,
   // Keywords.
-  TOKEN_AND, TOKEN_CLASS, TOKEN_ELSE, TOKEN_FALSE,
-  TOKEN_FOR, TOKEN_FUN, TOKEN_IF, TOKEN_NIL, TOKEN_OR,
-  TOKEN_PRINT, TOKEN_RETURN, TOKEN_SUPER, TOKEN_THIS,
+  TOKEN_AND, TOKEN_CASE, TOKEN_CLASS, TOKEN_DEFAULT, TOKEN_ELSE,
+  TOKEN_FALSE, TOKEN_FOR, TOKEN_FUN, TOKEN_IF, TOKEN_NIL, TOKEN_OR,
+  TOKEN_PRINT, TOKEN_RETURN, TOKEN_SUPER, TOKEN_SWITCH, TOKEN_THIS,
   TOKEN_TRUE, TOKEN_VAR, TOKEN_WHILE,
 
   TOKEN_ERROR, TOKEN_EOF
@@ -27,8 +30,10 @@ typedef enum {
     -= scanner.h =-
     Note: the 'start' pointer points to the substring of the source code string.
     Thus, current implementation requires us to ensure that source string outlives all
-    of the tokens. That's why runFile() function doesn't free the string until
-    interpret() finishes executing the code and returns.
+    of the tokens. That's why the callers of interpret() don't free the string
+    until it finishes executing the code and returns.
+    When scanning a stream, the lexeme is a copy instead. The identifiers stay
+    valid until freeScanner(), the other lexemes for the next two tokens only.
 */
 typedef struct
 {
@@ -44,6 +49,19 @@ typedef struct
 */
 void initScanner(const char *source);
 
+/*
+    -= scanner.h =-
+    Sets the Scanner to read the source from a stream, through a window of
+    a fixed size. The source doesn't have to fit in memory, only a lexeme does.
+*/
+void initStreamScanner(FILE *file);
+
+/*
+    -= scanner.h =-
+    Releases the window and the lexemes of a stream Scanner.
+*/
+void freeScanner(void);
+
 /*
     -= scanner.h =-
     Scans a complete token.
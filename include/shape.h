@@ -0,0 +1,54 @@
+#ifndef _H_BEELANG_SHAPE
+#define _H_BEELANG_SHAPE
+
+#include "common.h"
+
+/*
+    -= shape.h =-
+    Hidden class: the layout of the fields of an instance, which are kept
+    in a dense array of Values rather than in a table by name.
+    The shapes of a class form a transition tree rooted at its empty shape.
+    Adding a field moves the instance to the child shape for that name,
+    created the first time, so that the instances which got the same fields
+    in the same order share a shape. An inline cache keyed by the shape
+    then knows the slot of a field without looking its name up.
+
+    The shapes belong to the VM of the thread and live until freeVM():
+    the instances and the caches refer to them without keeping them alive.
+*/
+typedef struct Shape
+{
+    struct Shape *parent;   // the shape without the last field, NULL for the root
+    struct Shape *children; // the shapes adding one more field
+    struct Shape *sibling;  // the next child of the parent
+    int klass;              // index in Bytecode.classes
+    int name;               // the last field, by its index in Bytecode.names
+    int slotCount;          // the number of fields, the last one in the last slot
+} Shape;
+
+/*
+    -= shape.h =-
+    @returns the shape of the new instances of the class.
+*/
+Shape* rootShape(int klass);
+
+/*
+    -= shape.h =-
+    @returns the shape following 'shape' once the field is added, which
+             goes to the slot 'shape->slotCount'.
+*/
+Shape* addField(Shape *shape, int name);
+
+/*
+    -= shape.h =-
+    @returns the slot of the field, -1 if the shape has no such field.
+*/
+int findField(Shape *shape, int name);
+
+/*
+    -= shape.h =-
+    Frees the shapes of all the classes.
+*/
+void freeShapes(void);
+
+#endif // _H_BEELANG_SHAPE
@@ -0,0 +1,48 @@
+#ifndef _H_BEELANG_SNAPSHOT
+#define _H_BEELANG_SNAPSHOT
+
+#include "vm.h"
+
+/*
+    -= snapshot.h =-
+    Snapshot of a REPL session (bee --save-snapshot / --snapshot), for a
+    VM to start from a prelude that has run already: loading it skips
+    scanning, compiling and running the prelude.
+
+    It holds what the inputs of the session have left behind: the code
+    area with the functions and classes declared there, the names of the
+    globals and their values, the objects these reach and the shapes of
+    the instances among them. The file uses the encoding of image.h,
+    the references between objects being indices into its table of
+    objects. Loading maps the file into memory and reads it in place: the
+    objects are allocated in the heap of the VM, the collector freeing
+    them one by one like any other, and the references are fixed up to
+    their new addresses. The loop counters and the inline caches start
+    empty, and the code has to pass verifyBytecode() again.
+
+    The code calls natives by their index, so the loading VM must have the
+    natives of the saving one registered in the same order, which is
+    checked by name.
+*/
+
+/*
+    -= snapshot.h =-
+    Writes the session and the globals of the VM to the file, which is
+    replaced only once it is complete. A session whose run is out of fuel
+    can't be saved.
+    @returns false on failure, which is reported to stderr.
+*/
+bool saveSnapshot(Session *session, const char *path);
+
+/*
+    -= snapshot.h =-
+    Restores the snapshot into a new session, and its globals into the
+    VM, in place of those of the same index.
+    @returns false if the file can't be read, is damaged, was saved with
+             other natives, or if the memory runs out, which is reported
+             to stderr. The session and the VM are then left as they were,
+             bar the shapes the snapshot has added.
+*/
+bool loadSnapshot(Session *session, const char *path);
+
+#endif // _H_BEELANG_SNAPSHOT
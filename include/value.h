@@ -3,6 +3,8 @@
 
 #include "common.h"
 
+typedef struct Obj Obj;
+
 /*
     -= value.h =-
     Enum for each kind of value the VM supports.
@@ -12,7 +14,10 @@ typedef enum
 {
     VAL_BOOL,
     VAL_NIL,
-    VAL_NUMBER
+    VAL_NUMBER,
+    VAL_OBJ,        // heap-allocated entity. Its own type is kept in Obj.type
+    VAL_FUNCTION,   // a function of the running Bytecode, by its index
+    VAL_CLASS       // a class of the running Bytecode, by its index
 } ValueType;
 
 /*
@@ -26,17 +31,29 @@ typedef struct
     union {
         bool boolean;
         double number;
+        Obj *obj;
+        int function;
+        int klass;
     } as;
 } Value;
 
 #define IS_BOOL(value)   ((value).type == VAL_BOOL)
 #define IS_NIL(value)    ((value).type == VAL_NIL)
 #define IS_NUMBER(value) ((value).type == VAL_NUMBER)
+#define IS_OBJ(value)    ((value).type == VAL_OBJ)
+#define IS_FUNCTION(value) ((value).type == VAL_FUNCTION)
+#define IS_CLASS(value)  ((value).type == VAL_CLASS)
 
 /* Unpacks ValueType.boolean to native C boolean*/
 #define AS_BOOL(value)   ((value).as.boolean)
 /* Unpacks ValueType.number to native C double*/
 #define AS_NUMBER(value) ((value).as.number)
+/* Unpacks ValueType.obj to the pointer to the heap-allocated Obj */
+#define AS_OBJ(value)    ((value).as.obj)
+/* Unpacks the index of the function in Bytecode.functions */
+#define AS_FUNCTION(value) ((value).as.function)
+/* Unpacks the index of the class in Bytecode.classes */
+#define AS_CLASS(value)  ((value).as.klass)
 
 /* Converts from native C bool to a ValueType.boolean */
 #define BOOL_VAL(value)     ((Value){VAL_BOOL, {.boolean = value}})
@@ -44,6 +61,12 @@ typedef struct
 #define NIL_VAL             ((Value){VAL_NIL, {.number = 0}})
 /* Converts from native C double to a ValueType.number */
 #define NUMBER_VAL(value)   ((Value){VAL_NUMBER, {.number = value}})
+/* Wraps the pointer to the heap-allocated Obj into a Value */
+#define OBJ_VAL(object)     ((Value){VAL_OBJ, {.obj = (Obj*)object}})
+/* Wraps the index of a function in Bytecode.functions into a Value */
+#define FUNCTION_VAL(index) ((Value){VAL_FUNCTION, {.function = index}})
+/* Wraps the index of a class in Bytecode.classes into a Value */
+#define CLASS_VAL(index)    ((Value){VAL_CLASS, {.klass = index}})
 
 /*
     -= value.h =-
@@ -77,10 +100,22 @@ void freeConstantPool(ConstantPool *constantPool);
 
 /*
     -= value.h =-
-    Prints a given value. Used for debugging purposes
+    Prints a given value to the output of the VM, see output.h.
 */
 void printValue(Value value);
 
+/*
+    -= value.h =-
+    Prints the function with the given index in the running bytecode.
+*/
+void printFunction(int function);
+
+/*
+    -= value.h =-
+    Prints the class with the given index in the running bytecode.
+*/
+void printClass(int klass);
+
 /*
     -= value.h =-
     Appends one constant to the end of the 'ConstantPool.constants' array 
@@ -1,17 +1,95 @@
 #ifndef _H_BEELANG_VM
 #define _H_BEELANG_VM
 
+#include <setjmp.h>
+#include <stdio.h>
 #include "bytecode.h"
+#include "counters.h"
+#include "memory.h"
+#include "native.h"
+#include "object.h"
+#include "output.h"
+#include "profile.h"
 #include "value.h"
 
+#ifndef STACK_MAX
 #define STACK_MAX 256
+#endif
+
+#ifndef FRAMES_MAX
+#define FRAMES_MAX 64
+#endif
+
+// the globals a session may declare, indexed by a 16-bit operand
+#ifndef GLOBALS_MAX
+#ifdef BEE_STATIC_POOL
+#define GLOBALS_MAX 256
+#else
+#define GLOBALS_MAX 4096
+#endif
+#endif
+
+// the fuel of a VM nobody meters, more than any script can burn
+#define FUEL_UNLIMITED INT64_MAX
+
+// the memory limit of a VM without a quota
+#define MEMORY_UNLIMITED SIZE_MAX
+
+/*
+  -= vm.h =-
+  An ongoing call. The arguments are passed in place: they are the first
+  locals of the callee, right where the caller has pushed them.
+*/
+typedef struct
+{
+    int function;       // index in Bytecode.functions, -1 for the script
+    ObjClosure *closure;    // holding the captures, NULL if there are none
+    uint8_t *ip;        // where the frame resumes once its callee returns
+    Value *slots;       // the first argument, local slot 0
+    Value *result;      // where the return value goes: the callee, or the
+                        // first argument if there is no callee on the stack
+}CallFrame;
+
+/*
+  -= vm.h =-
+  A run that has stopped with INTERPRET_OUT_OF_FUEL, along with what it
+  owns: the memory the call that started it would have freed on return.
+*/
+typedef struct
+{
+    bool active;            // a run is waiting for resumeInterpret()
+    bool verified;          // it dispatches without the checks
+    Bytecode *bytecode;     // the code of interpret() or interpretStream(), NULL if the caller's
+    uint32_t *loopCounters; // those of interpretShared(), NULL if the bytecode's
+    int loopCount;
+    InlineCache *caches;    // likewise
+    int cacheCount;
+}Suspension;
 
 typedef struct
 {
     Bytecode *bytecode; // instruction set
     uint8_t *ip;        // instruction pointer
+    CallFrame frames[FRAMES_MAX];
+    int frameCount;
+    uint32_t *loopCounters; // the back-edge counters of the running code
+    InlineCache *caches;    // the inline caches of the running code
     Value stack[STACK_MAX];
     Value *stackTop;   // stack pointer
+    Value globals[GLOBALS_MAX]; // global variables, indexed at compile time
+    Native natives[UINT8_COUNT]; // host functions, indexed at compile time
+    int nativeCount;
+    Obj *objects;       // head of the list of all heap-allocated objects
+    Shape *shapes[UINT8_COUNT]; // the root shape of each class, NULL until instantiated
+    Collector gc;
+    bool jitEnabled;    // compile to native code before running (--jit)
+    int64_t fuel;       // what the scripts may still run, see resumeInterpret()
+    Suspension suspension;
+    size_t memoryLimit; // the quota of vm.gc.bytesAllocated, see interpret()
+    jmp_buf *unwind;    // where a failed allocation or a broken stack unwinds to, if not NULL
+    Output output;      // what the scripts print, see output.h
+    Profile profile;    // the samples of the profiler, see profile.h
+    Counters counters;  // the hardware counters of the runs, see counters.h
 }VM;
 
 typedef enum
@@ -21,8 +99,12 @@ typedef enum
     INTERPRET_RUNTIME_ERROR,
     STACK_OVERFLOW,
     STACK_UNDERFLOW,
+    INTERPRET_OUT_OF_MEMORY,
+    INTERPRET_OUT_OF_FUEL,
 }InterpretResult;
 
+extern THREAD_LOCAL VM vm;
+
 
 void initVM(void);
 void freeVM(void);
@@ -31,9 +113,91 @@ void freeVM(void);
   -= vm.h =-
   VM's entry point.
   This function scans, parses and interprets source code.
+
+  The run, compile included, ends with INTERPRET_OUT_OF_MEMORY rather than
+  the process when an allocation fails or would take the heap past
+  vm.memoryLimit, MEMORY_UNLIMITED after initVM(), even after a full
+  collection. Likewise with STACK_OVERFLOW and STACK_UNDERFLOW for push()
+  and pop(). Either way, the run is dropped but the globals and the
+  objects stay, so that the VM can run the next script. Running out of
+  memory in the embedded profile drops everything the pool holds, though.
+  The same holds for the variants below.
 */
 InterpretResult interpret(const char *source);
 
+/*
+  -= vm.h =-
+  Same as interpret(), but the source is read from a stream while compiling.
+*/
+InterpretResult interpretStream(FILE *file);
+
+/*
+  -= vm.h =-
+  Runs a bytecode compiled beforehand, e.g. loaded from the cache.
+  Since it doesn't come straight from the compiler, it is refused with
+  INTERPRET_COMPILE_ERROR unless verifyBytecode() accepts it.
+  The bytecode is left to the caller to free.
+*/
+InterpretResult interpretBytecode(Bytecode *bytecode);
+
+/*
+  -= vm.h =-
+  Runs a bytecode other threads may be running at the same time, on the VM
+  of the calling thread. The bytecode isn't written to: its loop counters
+  and inline caches are replaced by those of the call, and the JIT isn't
+  used.
+  'verified' tells the bytecode has passed verifyBytecode() already, in
+  which case it is dispatched without the checks.
+*/
+InterpretResult interpretShared(const Bytecode *bytecode, bool verified);
+
+/*
+  -= vm.h =-
+  REPL session.
+  Each input is compiled to the end of a persistent code area and run from
+  there, while the globals and their names stay alive between the inputs.
+  Once the area holds more than a few hundred constants or loops, the code
+  of the inputs that have run is dropped, back to the end of the last one that
+  declared functions or classes, which the globals may still refer to.
+*/
+typedef struct
+{
+    Bytecode bytecode;      // the code area
+    BytecodeMark declared;  // the end of the last input declaring functions or classes
+} Session;
+
+void initSession(Session *session);
+void freeSession(Session *session);
+
+/*
+  -= vm.h =-
+  Compiles and runs one input of the session.
+*/
+InterpretResult interpretSession(Session *session, const char *source);
+
+/*
+  -= vm.h =-
+  Fuel metering, to keep a script from running forever.
+  vm.fuel is the budget of the VM, FUEL_UNLIMITED after initVM(), which
+  the host sets as it likes. The code is charged its length in bytes
+  where it may run again: each time a loop jumps back, the length of its
+  body, and each time a function is called, the length of the function.
+  Every cycle the compiler emits goes through one of these, so that the
+  straight-line code costs nothing and a run does a bounded amount of
+  work past the point the fuel runs out.
+
+  Once vm.fuel is below zero, the run stops right after the jump or the
+  call with INTERPRET_OUT_OF_FUEL, its state left in the VM. Having given
+  it more fuel, the host continues it with resumeInterpret(), which may
+  run out of fuel again. The run is dropped by abandonInterpret(), by the
+  start of another one, or by freeVM(). Until then, the bytecode given to
+  interpretBytecode(), interpretShared() or interpretSession() must stay.
+  The native code of the JIT checks the fuel at the loops and leaves the
+  rest of the run to the interpreter.
+*/
+InterpretResult resumeInterpret(void);
+void abandonInterpret(void);
+
 /*
   -= vm.h =-
   Pushes a value onto the stack.
@@ -46,4 +210,34 @@ void push(Value value);
 */
 Value pop(void);
 
+/*
+  -= vm.h =-
+  Slow paths of the array instructions, shared by the interpreter loop
+  and the JIT. They operate on the values on top of the stack.
+  Each of them reports a runtime error and returns false on failure.
+  vm.ip must point past the instruction, so that the error gets its line.
+*/
+bool buildArray(int count);
+bool indexGet(void);
+bool indexSet(void);
+bool callIntrinsic(int intrinsic);
+
+/*
+  -= vm.h =-
+  Calls a native with its arguments on top of the stack, checking what
+  verifyBytecode() does: the native exists and takes that many arguments.
+  The verified code calls the native directly instead.
+*/
+bool callNative(int native, int argCount);
+
+/*
+  -= vm.h =-
+  Dispatch of OP_TABLESWITCH and OP_LOOKUPSWITCH.
+  @param uint8_t* ip pointing right after the opcode.
+  @param Value subject the switch subject, already popped.
+  @returns the address of the case body to continue with.
+*/
+uint8_t* tableSwitch(uint8_t *ip, Value subject);
+uint8_t* lookupSwitch(uint8_t *ip, Value subject);
+
 #endif  //_H_BEELANG_VM
\ No newline at end of file
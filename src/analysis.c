@@ -0,0 +1,598 @@
+#include <stdio.h>
+#include <string.h>
+#include "../include/analysis.h"
+#include "../include/array.h"
+#include "../include/memory.h"
+#include "../include/vm.h"
+
+static uint16_t readShort(uint8_t *code)
+{
+    return (uint16_t)((code[0] << 8) | code[1]);
+}
+
+/*
+    @returns true for the _SHORT form of a forward jump.
+    Jumps come in pairs, the long form first.
+*/
+static bool isShortJump(uint8_t instruction)
+{
+    return instruction >= OP_JUMP && instruction <= OP_JUMP_IF_NOT_EQUAL_SHORT &&
+           (instruction - OP_JUMP) % 2 == 1;
+}
+
+int branchTarget(Bytecode *bytecode, int offset)
+{
+    uint8_t *code = bytecode->code + offset;
+    int end = offset + instructionLength(bytecode, offset);
+
+    switch (code[0])
+    {
+        case OP_JUMP_BACK:
+        case OP_LOOP:               return end - readShort(code + 1);
+        case OP_JUMP_BACK_SHORT:
+        case OP_LOOP_SHORT:         return end - code[1];
+        case OP_CASE:               return end - readShort(code + 3);
+        default:
+            return isShortJump(code[0]) ? end + code[1] : end + readShort(code + 1);
+    }
+}
+
+#define OPERAND -2
+
+/*
+    The script and each function are followed from their own entry, the
+    depths of a function being relative to its first argument. No path
+    may lead from one of them into another.
+*/
+typedef struct
+{
+    int *depths;        // stack depth before each instruction, -1 if not reached yet,
+                        // OPERAND inside an instruction
+    int *owners;        // the function each instruction has been reached from
+    int *worklist;
+    int pending;
+    int maxDepth;
+    int count;          // the length of code
+    int function;       // the function being followed, -1 for the script
+    int arity;          // and its arity
+    int *closures;      // the OP_CLOSURE making each function, -1 if none
+} Analysis;
+
+static bool flowTo(Analysis *analysis, int target, int depth)
+{
+    if (depth < 0 || depth > STACK_MAX || target < 0 || target > analysis->count ||
+        analysis->depths[target] == OPERAND)
+    {
+        return false;
+    }
+
+    if (analysis->depths[target] >= 0)
+        return analysis->depths[target] == depth && analysis->owners[target] == analysis->function;
+
+    analysis->depths[target] = depth;
+    analysis->owners[target] = analysis->function;
+    analysis->worklist[analysis->pending++] = target;
+    if (depth > analysis->maxDepth)
+        analysis->maxDepth = depth;
+    return true;
+}
+
+/*
+    Marks the operands of the instructions from 'start' on, so that no jump
+    can land on them.
+    @returns false if an instruction is unknown or cut short by the end of code.
+*/
+static bool markOperands(Bytecode *bytecode, int start, int *depths)
+{
+    for (int offset = start; offset < bytecode->count; )
+    {
+        uint8_t instruction = bytecode->code[offset];
+        // the switch instructions hold their own length
+        int header = instruction == OP_TABLESWITCH ? 9 : instruction == OP_LOOKUPSWITCH ? 5 :
+                     instruction == OP_CLOSURE ? 3 : 1;
+        if (instruction > OP_RETURN || offset + header > bytecode->count)
+            return false;
+
+        int next = offset + instructionLength(bytecode, offset);
+        if (next > bytecode->count)
+            return false;
+
+        for (int i = offset + 1; i < next; i++)
+            depths[i] = OPERAND;
+        offset = next;
+    }
+
+    return true;
+}
+
+/*
+    Finds the OP_CLOSURE of each function declared from 'start' on, and
+    checks that it takes as many captures as the function has.
+    @returns false if a function has more than one.
+*/
+static bool findClosures(Bytecode *bytecode, int start, int *closures)
+{
+    for (int i = 0; i < bytecode->functionCount; i++)
+        closures[i] = -1;
+
+    for (int offset = start; offset < bytecode->count; offset += instructionLength(bytecode, offset))
+    {
+        uint8_t *code = bytecode->code + offset;
+        if (code[0] != OP_CLOSURE)
+            continue;
+
+        if (code[1] >= bytecode->functionCount || closures[code[1]] >= 0 ||
+            bytecode->functions[code[1]].entry < start ||
+            bytecode->functions[code[1]].captureCount != code[2])
+        {
+            return false;
+        }
+
+        closures[code[1]] = offset;
+    }
+
+    return true;
+}
+
+/*
+    @returns whether the capture of the function being followed is boxed,
+             -1 if it has no such capture.
+*/
+static int captureBoxed(Analysis *analysis, Bytecode *bytecode, int index)
+{
+    if (analysis->function < 0 || analysis->closures[analysis->function] < 0 ||
+        index >= bytecode->functions[analysis->function].captureCount)
+    {
+        return -1;
+    }
+
+    uint8_t *closure = bytecode->code + analysis->closures[analysis->function];
+    return (closure[3 + 2 * index] & CAPTURE_BOXED) != 0;
+}
+
+/*
+    @returns false if a capture OP_CLOSURE takes from the enclosing
+             function isn't one, or differs in boxing, or if the flags of a
+             capture aren't CAPTURE_* ones, which the VM compares as a whole.
+*/
+static bool validCaptures(Analysis *analysis, Bytecode *bytecode, uint8_t *code)
+{
+    for (int i = 0; i < code[2]; i++)
+    {
+        uint8_t flags = code[3 + 2 * i];
+        if ((flags & ~(CAPTURE_LOCAL | CAPTURE_BOXED)) != 0)
+            return false;
+
+        if (!(flags & CAPTURE_LOCAL) &&
+            captureBoxed(analysis, bytecode, code[4 + 2 * i]) != ((flags & CAPTURE_BOXED) != 0))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int stackReach(uint8_t *code)
+{
+    switch (code[0])
+    {
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_BOXED:
+        case OP_SET_BOXED:      return code[1] + 1;
+        case OP_CLOSURE:
+        {
+            int reach = 0;
+            for (int i = 0; i < code[2]; i++)
+            {
+                if ((code[3 + 2 * i] & CAPTURE_LOCAL) && code[4 + 2 * i] + 1 > reach)
+                    reach = code[4 + 2 * i] + 1;
+            }
+            return reach;
+        }
+        case OP_ARRAY:          return code[1];
+        case OP_INTRINSIC:      return arrayIntrinsics[code[1]].arity;
+        case OP_NATIVE:         return code[2];
+        case OP_CALL:           return code[1] + 1;
+        case OP_CALL_SELF:      return code[1];
+        case OP_TAIL_CALL:      return code[1] + 1;
+        case OP_TAIL_CALL_SELF: return code[1];
+        case OP_INVOKE:         return code[2] + 1;
+        case OP_RETURN_VALUE:   return 1;
+        case OP_INDEX_SET:      return 3;
+        case OP_SET_PROPERTY:   return 2;
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_INDEX_GET:      return 2;
+        case OP_NOT:
+        case OP_NEGATE:
+        case OP_POP:
+        case OP_PRINT:
+        case OP_GET_PROPERTY:
+        case OP_SET_GLOBAL:
+        case OP_SET_CAPTURE:
+        case OP_DEFINE_GLOBAL:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_FALSE_SHORT:
+        case OP_JUMP_IF_FALSE_OR_POP:
+        case OP_JUMP_IF_FALSE_OR_POP_SHORT:
+        case OP_JUMP_IF_TRUE_OR_POP:
+        case OP_JUMP_IF_TRUE_OR_POP_SHORT:
+        case OP_CASE:
+        case OP_TABLESWITCH:
+        case OP_LOOKUPSWITCH:   return 1;
+        default:
+            // fused comparisons read both operands
+            return code[0] >= OP_JUMP_IF_LESS && code[0] <= OP_JUMP_IF_NOT_EQUAL_SHORT ? 2 : 0;
+    }
+}
+
+/*
+    Follows the paths from the instructions in the worklist.
+    @returns false if the code is malformed.
+*/
+static bool followPaths(Analysis *analysis, Bytecode *bytecode)
+{
+    bool ok = true;
+    while (ok && analysis->pending > 0)
+    {
+        int offset = analysis->worklist[--analysis->pending];
+        if (offset == bytecode->count)
+            continue;   // the end of code has no instruction to follow
+
+        int depth = analysis->depths[offset];
+        uint8_t *code = bytecode->code + offset;
+        int next = offset + instructionLength(bytecode, offset);
+
+        if (code[0] == OP_INTRINSIC && code[1] >= INTRINSIC_COUNT)
+        {
+            ok = false;
+            break;
+        }
+
+        if (depth < stackReach(code))
+        {
+            ok = false;
+            break;
+        }
+
+        switch (code[0])
+        {
+            case OP_CONSTANT:
+            case OP_CONSTANT_LONG:
+            case OP_NIL:
+            case OP_TRUE:
+            case OP_FALSE:
+            case OP_GET_LOCAL:
+            case OP_GET_BOXED:
+            case OP_GET_GLOBAL:
+                ok = flowTo(analysis, next, depth + 1);
+            break;
+            case OP_GET_CAPTURE:
+                ok = captureBoxed(analysis, bytecode, code[1]) == 0 && flowTo(analysis, next, depth + 1);
+            break;
+            case OP_GET_CAPTURE_BOXED:
+                ok = captureBoxed(analysis, bytecode, code[1]) == 1 && flowTo(analysis, next, depth + 1);
+            break;
+            case OP_SET_CAPTURE:
+                ok = captureBoxed(analysis, bytecode, code[1]) == 1 && flowTo(analysis, next, depth);
+            break;
+            case OP_CLOSURE:
+                ok = validCaptures(analysis, bytecode, code) && flowTo(analysis, next, depth + 1);
+            break;
+            case OP_SELF:
+                ok = analysis->function >= 0 && flowTo(analysis, next, depth + 1);
+            break;
+            case OP_EQUAL:
+            case OP_GREATER:
+            case OP_LESS:
+            case OP_ADD:
+            case OP_SUBTRACT:
+            case OP_MULTIPLY:
+            case OP_DIVIDE:
+            case OP_INDEX_GET:
+            case OP_POP:
+            case OP_PRINT:
+            case OP_DEFINE_GLOBAL:
+                ok = flowTo(analysis, next, depth - 1);
+            break;
+            case OP_NOT:
+            case OP_NEGATE:
+            case OP_SET_LOCAL:
+            case OP_SET_BOXED:
+            case OP_SET_GLOBAL:
+            case OP_GET_PROPERTY:
+                ok = flowTo(analysis, next, depth);
+            break;
+            case OP_SET_PROPERTY:   ok = flowTo(analysis, next, depth - 1); break;
+            case OP_INVOKE:         ok = flowTo(analysis, next, depth - code[2]); break;
+            case OP_ARRAY:          ok = flowTo(analysis, next, depth + 1 - code[1]); break;
+            case OP_INDEX_SET:      ok = flowTo(analysis, next, depth - 2); break;
+            case OP_INTRINSIC:
+                ok = flowTo(analysis, next, depth + 1 - arrayIntrinsics[code[1]].arity);
+            break;
+            case OP_NATIVE:         ok = flowTo(analysis, next, depth + 1 - code[2]); break;
+            case OP_CALL:           ok = flowTo(analysis, next, depth - code[1]); break;
+            case OP_CALL_SELF:
+                // only a function calls itself, and with its own arity
+                ok = analysis->function >= 0 && code[1] == analysis->arity &&
+                     flowTo(analysis, next, depth + 1 - code[1]);
+            break;
+            case OP_TAIL_CALL:
+            case OP_RETURN_VALUE:
+                ok = analysis->function >= 0;
+            break;
+            case OP_TAIL_CALL_SELF:
+                ok = analysis->function >= 0 && code[1] == analysis->arity;
+            break;
+            case OP_JUMP:
+            case OP_JUMP_SHORT:
+            case OP_JUMP_BACK:
+            case OP_JUMP_BACK_SHORT:
+            case OP_LOOP:
+            case OP_LOOP_SHORT:
+                ok = flowTo(analysis, branchTarget(bytecode, offset), depth);
+            break;
+            case OP_JUMP_IF_FALSE:
+            case OP_JUMP_IF_FALSE_SHORT:
+                ok = flowTo(analysis, next, depth - 1) &&
+                     flowTo(analysis, branchTarget(bytecode, offset), depth - 1);
+            break;
+            case OP_JUMP_IF_FALSE_OR_POP:
+            case OP_JUMP_IF_FALSE_OR_POP_SHORT:
+            case OP_JUMP_IF_TRUE_OR_POP:
+            case OP_JUMP_IF_TRUE_OR_POP_SHORT:
+                ok = flowTo(analysis, next, depth - 1) &&
+                     flowTo(analysis, branchTarget(bytecode, offset), depth);
+            break;
+            case OP_CASE:
+                ok = flowTo(analysis, next, depth) &&
+                     flowTo(analysis, branchTarget(bytecode, offset), depth - 1);
+            break;
+            case OP_TABLESWITCH:
+            case OP_LOOKUPSWITCH:
+            {
+                // [tableswitch, low32, count16, default16, count x offset16]
+                // [lookupswitch, count16, default16, count x (key32, offset16)]
+                bool isTable = code[0] == OP_TABLESWITCH;
+                int entries = readShort(code + (isTable ? 5 : 1));
+                int first = 9;
+                int stride = isTable ? 2 : 6;
+
+                ok = flowTo(analysis, next - readShort(code + (isTable ? 7 : 3)), depth - 1);
+                for (int i = 0; ok && i < entries; i++)
+                    ok = flowTo(analysis, next - readShort(code + first + i * stride), depth - 1);
+            }break;
+            case OP_RETURN:
+            break;
+            default:
+                // fused comparisons pop both operands on either path
+                ok = code[0] >= OP_JUMP_IF_LESS && code[0] <= OP_JUMP_IF_NOT_EQUAL_SHORT &&
+                     flowTo(analysis, next, depth - 2) &&
+                     flowTo(analysis, branchTarget(bytecode, offset), depth - 2);
+            break;
+        }
+    }
+
+    return ok;
+}
+
+/*
+    stackDepths() for the code from 'start' on, entered with an empty stack,
+    and for the functions declared there, entered with their arguments.
+    Records the depth each function takes the stack to, and the function
+    of each instruction into 'owners' unless it is NULL.
+*/
+static int* depthsFrom(Bytecode *bytecode, int start, int *maxDepth, int *owners)
+{
+    Analysis analysis;
+    analysis.depths = ALLOCATE_SCRATCH(int, bytecode->count + 1);
+    analysis.owners = ALLOCATE_SCRATCH(int, bytecode->count + 1);
+    analysis.worklist = ALLOCATE_SCRATCH(int, bytecode->count + 1);
+    analysis.closures = ALLOCATE_SCRATCH(int, bytecode->functionCount);
+    analysis.pending = 0;
+    analysis.count = bytecode->count;
+
+    for (int i = 0; i <= bytecode->count; i++)
+        analysis.depths[i] = -1;
+
+    bool ok = markOperands(bytecode, start, analysis.depths) &&
+              findClosures(bytecode, start, analysis.closures);
+    for (int function = -1; ok && function < bytecode->functionCount; function++)
+    {
+        Function *info = function >= 0 ? &bytecode->functions[function] : NULL;
+        if (info != NULL && info->entry < start)
+            continue;   // verified along with the code declaring it
+
+        analysis.function = function;
+        analysis.arity = info != NULL ? info->arity : 0;
+        analysis.maxDepth = 0;
+        ok = flowTo(&analysis, info != NULL ? info->entry : start, analysis.arity) &&
+             followPaths(&analysis, bytecode);
+
+        if (info != NULL)
+            info->stackMax = analysis.maxDepth;
+        else
+            *maxDepth = analysis.maxDepth;
+    }
+
+    FREE_SCRATCH(int, analysis.closures, bytecode->functionCount);
+    FREE_SCRATCH(int, analysis.worklist, bytecode->count + 1);
+    if (ok && owners != NULL)
+        memcpy(owners, analysis.owners, (bytecode->count + 1) * sizeof(int));
+    FREE_SCRATCH(int, analysis.owners, bytecode->count + 1);
+    if (!ok)
+    {
+        FREE_SCRATCH(int, analysis.depths, bytecode->count + 1);
+        return NULL;
+    }
+
+    for (int i = 0; i <= bytecode->count; i++)
+    {
+        if (analysis.depths[i] == OPERAND)
+            analysis.depths[i] = -1;
+    }
+
+    return analysis.depths;
+}
+
+int* stackDepths(Bytecode *bytecode, int *maxDepth)
+{
+    return depthsFrom(bytecode, 0, maxDepth, NULL);
+}
+
+int* regionDepths(Bytecode *bytecode, int start, int *owners)
+{
+    int maxDepth;
+    return depthsFrom(bytecode, start, &maxDepth, owners);
+}
+
+/*
+    @returns false if the function can't be a method: it has to take the
+             receiver and needs no closure.
+*/
+static bool isMethod(Bytecode *bytecode, int function)
+{
+    return function >= 0 && function < bytecode->functionCount &&
+           bytecode->functions[function].arity >= 1 &&
+           bytecode->functions[function].captureCount == 0;
+}
+
+/*
+    @returns false if a class refers to a superclass declared after it,
+             or to a method or a name that doesn't exist.
+*/
+static bool validClasses(Bytecode *bytecode)
+{
+    if (bytecode->classCount > UINT8_COUNT)
+        return false;
+
+    for (int i = 0; i < bytecode->classCount; i++)
+    {
+        Class *klass = &bytecode->classes[i];
+        if (klass->superclass >= i || !isMethod(bytecode, klass->initializer))
+            return false;
+
+        for (int j = 0; j < klass->methodCount; j++)
+        {
+            if (klass->methods[j].name < 0 || klass->methods[j].name >= bytecode->nameCount ||
+                !isMethod(bytecode, klass->methods[j].function))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+const char* verifyBytecode(Bytecode *bytecode, int start)
+{
+    static THREAD_LOCAL char message[64];
+
+    int maxDepth;
+    int *depths = depthsFrom(bytecode, start, &maxDepth, NULL);
+    if (depths == NULL)
+        return "Malformed code or stack misuse.";
+
+    const char *error = NULL;
+    if (depths[bytecode->count] >= 0)
+        error = "Code runs past its end.";
+    else if (!validClasses(bytecode))
+        error = "Malformed class.";
+
+    // each cache belongs to a single instruction, so that the entry it
+    // finds there is one of its own kind
+    bool *cached = ALLOCATE_SCRATCH(bool, bytecode->cacheCount);
+    if (cached != NULL)
+        memset(cached, 0, bytecode->cacheCount);
+
+    // the reachable instructions are the ones with a depth
+    for (int offset = start; offset < bytecode->count && error == NULL; offset++)
+    {
+        if (depths[offset] < 0)
+            continue;
+
+        uint8_t *code = bytecode->code + offset;
+        int index = -1;
+        int limit = 0;
+
+        switch (code[0])
+        {
+            case OP_CONSTANT:
+                index = code[1];
+                limit = bytecode->constantPool.count;
+            break;
+            case OP_CONSTANT_LONG:
+            case OP_CASE:
+                index = (code[1] << 8) | code[2];
+                limit = bytecode->constantPool.count;
+            break;
+            case OP_GET_GLOBAL:
+            case OP_SET_GLOBAL:
+            case OP_DEFINE_GLOBAL:
+                index = (code[1] << 8) | code[2];
+                limit = GLOBALS_MAX;
+            break;
+            case OP_LOOP:
+                index = (code[3] << 8) | code[4];
+                limit = bytecode->loopCount;
+            break;
+            case OP_LOOP_SHORT:
+                index = (code[2] << 8) | code[3];
+                limit = bytecode->loopCount;
+            break;
+            case OP_NATIVE:
+                index = code[1];
+                limit = vm.nativeCount;
+            break;
+            case OP_GET_PROPERTY:
+            case OP_SET_PROPERTY:
+            case OP_INVOKE:
+            {
+                int cache = (code[code[0] == OP_INVOKE ? 3 : 2] << 8) | code[code[0] == OP_INVOKE ? 4 : 3];
+                index = code[1];
+                limit = bytecode->nameCount;
+                if (cache >= bytecode->cacheCount || cached[cache])
+                    index = limit;
+                else
+                    cached[cache] = true;
+            }break;
+        }
+
+        // the constant is pushed, not only compared as by OP_CASE
+        bool loaded = code[0] == OP_CONSTANT || code[0] == OP_CONSTANT_LONG;
+        if (index >= limit)
+        {
+            snprintf(message, sizeof(message), "Operand %d out of range at offset %d.", index, offset);
+            error = message;
+        }else if (loaded && IS_CLASS(bytecode->constantPool.constants[index]) &&
+                  (unsigned)AS_CLASS(bytecode->constantPool.constants[index]) >= (unsigned)bytecode->classCount)
+        {
+            snprintf(message, sizeof(message), "Class out of range at offset %d.", offset);
+            error = message;
+        }else if (loaded && IS_FUNCTION(bytecode->constantPool.constants[index]) &&
+                  ((unsigned)AS_FUNCTION(bytecode->constantPool.constants[index]) >= (unsigned)bytecode->functionCount ||
+                   bytecode->functions[AS_FUNCTION(bytecode->constantPool.constants[index])].captureCount > 0))
+        {
+            // a function with captures only runs as a closure
+            snprintf(message, sizeof(message), "Function out of range at offset %d.", offset);
+            error = message;
+        }else if (code[0] == OP_NATIVE && vm.natives[index].arity != NATIVE_VARIADIC &&
+                  vm.natives[index].arity != code[2])
+        {
+            snprintf(message, sizeof(message), "Wrong number of arguments at offset %d.", offset);
+            error = message;
+        }
+    }
+
+    FREE_SCRATCH(bool, cached, bytecode->cacheCount);
+    FREE_SCRATCH(int, depths, bytecode->count + 1);
+    return error;
+}
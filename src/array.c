@@ -0,0 +1,588 @@
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "../include/array.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define ARRAY_SSE2
+#include <emmintrin.h>
+#endif
+
+const IntrinsicInfo arrayIntrinsics[INTRINSIC_COUNT] = {
+    [INTRINSIC_NUMBERS] = {"numbers", 7, 1},
+    [INTRINSIC_INTS]    = {"ints",    4, 1},
+    [INTRINSIC_BOOLS]   = {"bools",   5, 1},
+    [INTRINSIC_LEN]     = {"len",     3, 1},
+    [INTRINSIC_SUM]     = {"sum",     3, 1},
+    [INTRINSIC_MIN]     = {"min",     3, 1},
+    [INTRINSIC_MAX]     = {"max",     3, 1},
+    [INTRINSIC_SCALE]   = {"scale",   5, 2},
+    [INTRINSIC_DOT]     = {"dot",     3, 2},
+    [INTRINSIC_FILL]    = {"fill",    4, 2},
+    [INTRINSIC_COPY]    = {"copy",    4, 2},
+};
+
+int findArrayIntrinsic(const char *name, int length)
+{
+    for (int i = 0; i < INTRINSIC_COUNT; i++)
+    {
+        if (arrayIntrinsics[i].length == length &&
+            memcmp(arrayIntrinsics[i].name, name, length) == 0)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+size_t arrayElementSize(ArrayType elementType)
+{
+    switch (elementType)
+    {
+        case ARRAY_NUMBER: return sizeof(double);
+        case ARRAY_INT:    return sizeof(int32_t);
+        case ARRAY_BOOL:   return sizeof(uint8_t);
+    }
+
+    return 0; // unreachable
+}
+
+/*
+    Checks whether a number can be stored in an int array without loss.
+*/
+static bool isInt32(double number)
+{
+    return number >= INT32_MIN && number <= INT32_MAX &&
+           (double)(int32_t)number == number;
+}
+
+Value arrayGet(ObjArray *array, int index)
+{
+    switch (array->elementType)
+    {
+        case ARRAY_NUMBER: return NUMBER_VAL(array->as.numbers[index]);
+        case ARRAY_INT:    return NUMBER_VAL((double)array->as.ints[index]);
+        case ARRAY_BOOL:   return BOOL_VAL(array->as.bools[index] != 0);
+    }
+
+    return NIL_VAL; // unreachable
+}
+
+bool arraySet(ObjArray *array, int index, Value value)
+{
+    switch (array->elementType)
+    {
+        case ARRAY_NUMBER:
+            if (!IS_NUMBER(value))
+                return false;
+            array->as.numbers[index] = AS_NUMBER(value);
+            return true;
+        case ARRAY_INT:
+            if (!IS_NUMBER(value) || !isInt32(AS_NUMBER(value)))
+                return false;
+            array->as.ints[index] = (int32_t)AS_NUMBER(value);
+            return true;
+        case ARRAY_BOOL:
+            if (!IS_BOOL(value))
+                return false;
+            array->as.bools[index] = AS_BOOL(value) ? 1 : 0;
+            return true;
+    }
+
+    return false; // unreachable
+}
+
+/*
+    Each kernel below processes the bulk of the array with SSE2 (when
+    available) and leaves the remaining elements to the scalar loop.
+    Without SSE2 the scalar loop processes the whole array.
+*/
+
+static double sumNumbers(const double *data, int count)
+{
+    int i = 0;
+    double sum = 0;
+#ifdef ARRAY_SSE2
+    // two independent accumulators hide the latency of addpd
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    for (; i + 4 <= count; i += 4)
+    {
+        acc0 = _mm_add_pd(acc0, _mm_loadu_pd(data + i));
+        acc1 = _mm_add_pd(acc1, _mm_loadu_pd(data + i + 2));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    sum = lanes[0] + lanes[1];
+#endif
+    for (; i < count; i++)
+        sum += data[i];
+
+    return sum;
+}
+
+static double sumInts(const int32_t *data, int count)
+{
+    int i = 0;
+    int64_t sum = 0;
+#ifdef ARRAY_SSE2
+    // sign-extend int32 lanes to int64 so that the sum can't overflow
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i sign = _mm_srai_epi32(v, 31);
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, sign));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(v, sign));
+    }
+    int64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    sum = lanes[0] + lanes[1];
+#endif
+    for (; i < count; i++)
+        sum += data[i];
+
+    return (double)sum;
+}
+
+static double sumBools(const uint8_t *data, int count)
+{
+    int i = 0;
+    int64_t sum = 0;
+#ifdef ARRAY_SSE2
+    // psadbw against zero sums each group of eight bytes into a 64-bit lane
+    __m128i acc = _mm_setzero_si128();
+    __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(v, zero));
+    }
+    int64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    sum = lanes[0] + lanes[1];
+#endif
+    for (; i < count; i++)
+        sum += data[i];
+
+    return (double)sum;
+}
+
+double arraySum(ObjArray *array)
+{
+    switch (array->elementType)
+    {
+        case ARRAY_NUMBER: return sumNumbers(array->as.numbers, array->count);
+        case ARRAY_INT:    return sumInts(array->as.ints, array->count);
+        case ARRAY_BOOL:   return sumBools(array->as.bools, array->count);
+    }
+
+    return 0; // unreachable
+}
+
+/*
+    'isMax' selects the direction of comparison. Being a constant at each
+    call site, it is folded away by the compiler.
+    @returns the first NaN of the array if there is one.
+*/
+static double extremumNumbers(const double *data, int count, bool isMax)
+{
+    int i = 1;
+    double result = data[0];
+#ifdef ARRAY_SSE2
+    if (count >= 3)
+    {
+        __m128d acc = _mm_set1_pd(data[0]);
+        // the lanes that have met a NaN, which minpd and maxpd keep or
+        // drop depending on the operand it is
+        __m128d unordered = _mm_cmpunord_pd(acc, acc);
+        for (; i + 2 <= count; i += 2)
+        {
+            __m128d v = _mm_loadu_pd(data + i);
+            unordered = _mm_or_pd(unordered, _mm_cmpunord_pd(v, v));
+            acc = isMax ? _mm_max_pd(acc, v) : _mm_min_pd(acc, v);
+        }
+
+        if (_mm_movemask_pd(unordered) != 0)
+        {
+            // the plain loop finds which one comes first
+            i = 1;
+        }else
+        {
+            double lanes[2];
+            _mm_storeu_pd(lanes, acc);
+            result = isMax ? (lanes[0] > lanes[1] ? lanes[0] : lanes[1])
+                           : (lanes[0] < lanes[1] ? lanes[0] : lanes[1]);
+        }
+    }
+#endif
+    if (isnan(result))
+        return result;
+
+    for (; i < count; i++)
+    {
+        if (isnan(data[i]))
+            return data[i];
+        if (isMax ? data[i] > result : data[i] < result)
+            result = data[i];
+    }
+
+    return result;
+}
+
+static int32_t extremumInts(const int32_t *data, int count, bool isMax)
+{
+    int i = 1;
+    int32_t result = data[0];
+#ifdef ARRAY_SSE2
+    if (count >= 5)
+    {
+        // SSE2 has no pminsd/pmaxsd, so select lanes by the comparison mask
+        __m128i acc = _mm_set1_epi32(data[0]);
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+            __m128i take = isMax ? _mm_cmpgt_epi32(v, acc) : _mm_cmpgt_epi32(acc, v);
+            acc = _mm_or_si128(_mm_and_si128(take, v), _mm_andnot_si128(take, acc));
+        }
+        int32_t lanes[4];
+        _mm_storeu_si128((__m128i*)lanes, acc);
+        for (int lane = 0; lane < 4; lane++)
+        {
+            if (isMax ? lanes[lane] > result : lanes[lane] < result)
+                result = lanes[lane];
+        }
+    }
+#endif
+    for (; i < count; i++)
+    {
+        if (isMax ? data[i] > result : data[i] < result)
+            result = data[i];
+    }
+
+    return result;
+}
+
+Value arrayMin(ObjArray *array)
+{
+    switch (array->elementType)
+    {
+        case ARRAY_NUMBER:
+            return NUMBER_VAL(extremumNumbers(array->as.numbers, array->count, false));
+        case ARRAY_INT:
+            return NUMBER_VAL((double)extremumInts(array->as.ints, array->count, false));
+        case ARRAY_BOOL:
+            // the minimum is 'true' only if there is no 'false' at all
+            return BOOL_VAL(memchr(array->as.bools, 0, array->count) == NULL);
+    }
+
+    return NIL_VAL; // unreachable
+}
+
+Value arrayMax(ObjArray *array)
+{
+    switch (array->elementType)
+    {
+        case ARRAY_NUMBER:
+            return NUMBER_VAL(extremumNumbers(array->as.numbers, array->count, true));
+        case ARRAY_INT:
+            return NUMBER_VAL((double)extremumInts(array->as.ints, array->count, true));
+        case ARRAY_BOOL:
+            // the maximum is 'true' if there is at least one 'true'
+            return BOOL_VAL(memchr(array->as.bools, 1, array->count) != NULL);
+    }
+
+    return NIL_VAL; // unreachable
+}
+
+void arrayScale(ObjArray *array, double factor)
+{
+    double *data = array->as.numbers;
+    int count = array->count;
+    int i = 0;
+#ifdef ARRAY_SSE2
+    __m128d k = _mm_set1_pd(factor);
+    for (; i + 2 <= count; i += 2)
+        _mm_storeu_pd(data + i, _mm_mul_pd(_mm_loadu_pd(data + i), k));
+#endif
+    for (; i < count; i++)
+        data[i] *= factor;
+}
+
+static double dotNumbers(const double *a, const double *b, int count)
+{
+    int i = 0;
+    double sum = 0;
+#ifdef ARRAY_SSE2
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    for (; i + 4 <= count; i += 4)
+    {
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    sum = lanes[0] + lanes[1];
+#endif
+    for (; i < count; i++)
+        sum += a[i] * b[i];
+
+    return sum;
+}
+
+static double dotInts(const int32_t *a, const int32_t *b, int count)
+{
+    int i = 0;
+    double sum = 0;
+#ifdef ARRAY_SSE2
+    // products of two int32 are exact in double, so multiply after conversion
+    __m128d acc = _mm_setzero_pd();
+    for (; i + 2 <= count; i += 2)
+    {
+        __m128d va = _mm_cvtepi32_pd(_mm_loadl_epi64((const __m128i*)(a + i)));
+        __m128d vb = _mm_cvtepi32_pd(_mm_loadl_epi64((const __m128i*)(b + i)));
+        acc = _mm_add_pd(acc, _mm_mul_pd(va, vb));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    sum = lanes[0] + lanes[1];
+#endif
+    for (; i < count; i++)
+        sum += (double)a[i] * (double)b[i];
+
+    return sum;
+}
+
+double arrayDot(ObjArray *a, ObjArray *b)
+{
+    if (a->elementType == ARRAY_INT)
+        return dotInts(a->as.ints, b->as.ints, a->count);
+
+    return dotNumbers(a->as.numbers, b->as.numbers, a->count);
+}
+
+bool arrayFill(ObjArray *array, Value value)
+{
+    int count = array->count;
+    int i = 0;
+
+    switch (array->elementType)
+    {
+        case ARRAY_NUMBER:
+        {
+            if (!IS_NUMBER(value))
+                return false;
+
+            double number = AS_NUMBER(value);
+            double *data = array->as.numbers;
+#ifdef ARRAY_SSE2
+            __m128d v = _mm_set1_pd(number);
+            for (; i + 2 <= count; i += 2)
+                _mm_storeu_pd(data + i, v);
+#endif
+            for (; i < count; i++)
+                data[i] = number;
+        }break;
+        case ARRAY_INT:
+        {
+            if (!IS_NUMBER(value) || !isInt32(AS_NUMBER(value)))
+                return false;
+
+            int32_t number = (int32_t)AS_NUMBER(value);
+            int32_t *data = array->as.ints;
+#ifdef ARRAY_SSE2
+            __m128i v = _mm_set1_epi32(number);
+            for (; i + 4 <= count; i += 4)
+                _mm_storeu_si128((__m128i*)(data + i), v);
+#endif
+            for (; i < count; i++)
+                data[i] = number;
+        }break;
+        case ARRAY_BOOL:
+            if (!IS_BOOL(value))
+                return false;
+
+            memset(array->as.bools, AS_BOOL(value) ? 1 : 0, count);
+        break;
+    }
+
+    return true;
+}
+
+void arrayCopy(ObjArray *dst, ObjArray *src)
+{
+    // memmove() allows to copy an array onto itself
+    memmove(dst->as.raw, src->as.raw, arrayElementSize(src->elementType) * src->count);
+}
+
+/*
+    The message of the last failed checked operation.
+*/
+static THREAD_LOCAL char errorMessage[128];
+
+static const char* arrayError(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vsnprintf(errorMessage, sizeof(errorMessage), format, args);
+    va_end(args);
+    return errorMessage;
+}
+
+/*
+    Validates the array and index operands of an element access.
+*/
+static const char* checkIndex(Value arrayValue, Value indexValue, int *index)
+{
+    if (!IS_ARRAY(arrayValue))
+        return arrayError("Only arrays can be indexed.");
+
+    if (!IS_NUMBER(indexValue))
+        return arrayError("Array index must be a number.");
+
+    double number = AS_NUMBER(indexValue);
+    ObjArray *array = AS_ARRAY(arrayValue);
+    // the negated comparison also rejects NaN
+    if (!(number >= 0 && number < array->count) || (double)(int)number != number)
+        return arrayError("Array index %g out of bounds [0, %d).", number, array->count);
+
+    *index = (int)number;
+    return NULL;
+}
+
+/*
+    Checks that the value is an array, optionally of the given element type.
+    Pass -1 to accept any element type.
+*/
+static bool expectArray(Value value, int elementType)
+{
+    return IS_ARRAY(value) &&
+           (elementType < 0 || AS_ARRAY(value)->elementType == (ArrayType)elementType);
+}
+
+const char* arrayFromValues(Value *elements, int count, Value *result)
+{
+    ArrayType elementType = ARRAY_NUMBER;
+    if (count > 0 && IS_BOOL(elements[0]))
+        elementType = ARRAY_BOOL;
+
+    ObjArray *array = newArray(elementType, count);
+    for (int i = 0; i < count; i++)
+    {
+        if (!arraySet(array, i, elements[i]))
+            return arrayError("Array elements must be either all numbers or all booleans.");
+    }
+
+    *result = OBJ_VAL(array);
+    return NULL;
+}
+
+const char* arrayIndexGet(Value array, Value index, Value *result)
+{
+    int at = 0;
+    const char *error = checkIndex(array, index, &at);
+    if (error != NULL)
+        return error;
+
+    *result = arrayGet(AS_ARRAY(array), at);
+    return NULL;
+}
+
+const char* arrayIndexSet(Value array, Value index, Value value)
+{
+    int at = 0;
+    const char *error = checkIndex(array, index, &at);
+    if (error != NULL)
+        return error;
+
+    if (!arraySet(AS_ARRAY(array), at, value))
+        return arrayError("Value doesn't match the array element type.");
+
+    return NULL;
+}
+
+const char* arrayCallIntrinsic(int intrinsic, Value *args, Value *result)
+{
+    switch ((ArrayIntrinsic)intrinsic)
+    {
+        case INTRINSIC_NUMBERS:
+        case INTRINSIC_INTS:
+        case INTRINSIC_BOOLS:
+        {
+            double length = IS_NUMBER(args[0]) ? AS_NUMBER(args[0]) : -1;
+            if (!(length >= 0 && length <= INT32_MAX) || (double)(int)length != length)
+                return arrayError("Array length must be a non-negative integer.");
+
+            ArrayType elementType = intrinsic == INTRINSIC_NUMBERS ? ARRAY_NUMBER :
+                                    intrinsic == INTRINSIC_INTS    ? ARRAY_INT : ARRAY_BOOL;
+            *result = OBJ_VAL(newArray(elementType, (int)length));
+        }break;
+        case INTRINSIC_LEN:
+            if (!expectArray(args[0], -1))
+                return arrayError("Operand must be an array.");
+            *result = NUMBER_VAL(AS_ARRAY(args[0])->count);
+        break;
+        case INTRINSIC_SUM:
+            if (!expectArray(args[0], -1))
+                return arrayError("Operand must be an array.");
+            *result = NUMBER_VAL(arraySum(AS_ARRAY(args[0])));
+        break;
+        case INTRINSIC_MIN:
+        case INTRINSIC_MAX:
+            if (!expectArray(args[0], -1))
+                return arrayError("Operand must be an array.");
+            if (AS_ARRAY(args[0])->count == 0)
+                return arrayError("Array is empty.");
+            *result = intrinsic == INTRINSIC_MIN ? arrayMin(AS_ARRAY(args[0]))
+                                                 : arrayMax(AS_ARRAY(args[0]));
+        break;
+        case INTRINSIC_SCALE:
+            if (!expectArray(args[0], ARRAY_NUMBER))
+                return arrayError("Operand must be a number array.");
+            if (!IS_NUMBER(args[1]))
+                return arrayError("Scale factor must be a number.");
+            arrayScale(AS_ARRAY(args[0]), AS_NUMBER(args[1]));
+            *result = args[0];
+        break;
+        case INTRINSIC_DOT:
+        {
+            if (!expectArray(args[0], -1) || !expectArray(args[1], -1))
+                return arrayError("Operand must be an array.");
+
+            ObjArray *a = AS_ARRAY(args[0]);
+            ObjArray *b = AS_ARRAY(args[1]);
+            if (a->elementType != b->elementType || a->elementType == ARRAY_BOOL ||
+                a->count != b->count)
+            {
+                return arrayError("Operands must be numeric arrays of the same type and length.");
+            }
+            *result = NUMBER_VAL(arrayDot(a, b));
+        }break;
+        case INTRINSIC_FILL:
+            if (!expectArray(args[0], -1))
+                return arrayError("Operand must be an array.");
+            if (!arrayFill(AS_ARRAY(args[0]), args[1]))
+                return arrayError("Value doesn't match the array element type.");
+            *result = args[0];
+        break;
+        case INTRINSIC_COPY:
+        {
+            if (!expectArray(args[0], -1) || !expectArray(args[1], -1))
+                return arrayError("Operand must be an array.");
+
+            ObjArray *dst = AS_ARRAY(args[0]);
+            ObjArray *src = AS_ARRAY(args[1]);
+            if (dst->elementType != src->elementType || src->count > dst->count)
+                return arrayError("Source array must be of the same type and fit the destination.");
+            arrayCopy(dst, src);
+            *result = args[0];
+        }break;
+        default:
+            return arrayError("Unknown intrinsic %d.", intrinsic);
+    }
+
+    return NULL;
+}
@@ -0,0 +1,157 @@
+#include "../include/analysis.h"
+#include "../include/bee.h"
+#include "../include/compiler.h"
+#include "../include/memory.h"
+
+struct BeeScript
+{
+    Bytecode bytecode;
+};
+
+/*
+    @returns the number of bytes the script accounts for in the heap.
+*/
+static size_t scriptSize(const BeeScript *script)
+{
+    const Bytecode *bytecode = &script->bytecode;
+    size_t size = sizeof(BeeScript) +
+                  (sizeof(uint8_t) + sizeof(int)) * bytecode->capacity +
+                  sizeof(Value) * bytecode->constantPool.capacity +
+                  sizeof(uint32_t) * bytecode->loopCount +
+                  sizeof(Function) * bytecode->functionCapacity +
+                  sizeof(Class) * bytecode->classCapacity +
+                  sizeof(Name) * bytecode->nameCapacity +
+                  sizeof(InlineCache) * bytecode->cacheCapacity;
+
+    for (int i = 0; i < bytecode->functionCount; i++)
+        size += bytecode->functions[i].nameLength;
+    for (int i = 0; i < bytecode->classCount; i++)
+        size += bytecode->classes[i].nameLength + sizeof(Method) * bytecode->classes[i].methodCapacity;
+    for (int i = 0; i < bytecode->nameCount; i++)
+        size += bytecode->names[i].length;
+    return size;
+}
+
+VM* beeOpenVM(void)
+{
+    initVM();
+    return &vm;
+}
+
+void beeCloseVM(VM *instance)
+{
+    (void)instance;
+    freeVM();
+}
+
+bool beeDefineNative(VM *instance, const char *name, int arity, NativeFn function)
+{
+    (void)instance;
+    return defineNative(name, arity, function);
+}
+
+void beeSetOutput(VM *instance, OutputSink sink, void *context)
+{
+    (void)instance;
+    setOutputSink(sink, context);
+}
+
+void beeSetFuel(VM *instance, int64_t fuel)
+{
+    (void)instance;
+    vm.fuel = fuel;
+}
+
+void beeSetMemoryLimit(VM *instance, size_t bytes)
+{
+    (void)instance;
+    vm.memoryLimit = bytes;
+}
+
+/*
+    Compiles and verifies the source into a new script, '*script' pointing
+    to it as soon as it is allocated. Running out of memory fails the
+    compile rather than the process, just like a run.
+    @returns false on error, which is reported to stderr.
+*/
+static bool compileScript(const char *source, BeeScript **script)
+{
+    jmp_buf handler;
+    if (setjmp(handler) != 0)
+    {
+        vm.unwind = NULL;
+        rollBackCompiler();
+        return false;
+    }
+
+    vm.unwind = &handler;
+    *script = ALLOCATE(BeeScript, 1);
+    initBytecode(&(*script)->bytecode);
+
+    bool compiled = compile(source, &(*script)->bytecode);
+    if (compiled)
+    {
+        // verified once here rather than on every run, so that the runs
+        // dispatch without the checks
+        const char *error = verifyBytecode(&(*script)->bytecode, 0);
+        if (error != NULL)
+        {
+            fprintf(stderr, "Invalid bytecode: %s\n", error);
+            compiled = false;
+        }
+    }
+
+    vm.unwind = NULL;
+    return compiled;
+}
+
+BeeScript* beeCompile(const char *source)
+{
+    BeeScript *script = NULL;
+    if (!compileScript(source, &script))
+    {
+        if (script != NULL)
+        {
+            freeBytecode(&script->bytecode);
+            FREE(BeeScript, script);
+        }
+        return NULL;
+    }
+
+    // The script belongs to no VM: it is taken off the account of this
+    // thread's collector, and beeFree() charges the thread freeing it.
+    vm.gc.bytesAllocated -= scriptSize(script);
+    return script;
+}
+
+InterpretResult beeRun(VM *instance, const BeeScript *script)
+{
+    if (instance != &vm)
+    {
+        fprintf(stderr, "The VM belongs to another thread.\n");
+        return INTERPRET_RUNTIME_ERROR;
+    }
+
+    return interpretShared(&script->bytecode, true);
+}
+
+InterpretResult beeResume(VM *instance)
+{
+    if (instance != &vm)
+    {
+        fprintf(stderr, "The VM belongs to another thread.\n");
+        return INTERPRET_RUNTIME_ERROR;
+    }
+
+    return resumeInterpret();
+}
+
+void beeFree(BeeScript *script)
+{
+    if (NULL == script)
+        return;
+
+    vm.gc.bytesAllocated += scriptSize(script);
+    freeBytecode(&script->bytecode);
+    FREE(BeeScript, script);
+}
@@ -1,6 +1,9 @@
+#include <setjmp.h>
 #include <stdlib.h>
+#include <string.h>
 #include "../include/bytecode.h"
 #include "../include/memory.h"
+#include "../include/vm.h"
 
 void initBytecode(Bytecode *bytecode)
 {
@@ -8,31 +11,78 @@ void initBytecode(Bytecode *bytecode)
     bytecode->capacity = 0;
     bytecode->code = NULL;
     bytecode->lines = NULL;
+    bytecode->loopCount = 0;
+    bytecode->loopCounters = NULL;
+    bytecode->functionCount = 0;
+    bytecode->functionCapacity = 0;
+    bytecode->functions = NULL;
+    bytecode->classCount = 0;
+    bytecode->classCapacity = 0;
+    bytecode->classes = NULL;
+    bytecode->nameCount = 0;
+    bytecode->nameCapacity = 0;
+    bytecode->names = NULL;
+    bytecode->cacheCount = 0;
+    bytecode->cacheCapacity = 0;
+    bytecode->caches = NULL;
     initConstantPool(&bytecode->constantPool);
 }
 
+static void freeClass(Class *klass)
+{
+    FREE_ARRAY(char, klass->name, klass->nameLength);
+    FREE_ARRAY(Method, klass->methods, klass->methodCapacity);
+}
+
 void freeBytecode(Bytecode *bytecode)
 {
     FREE_ARRAY(uint8_t, bytecode->code, bytecode->capacity);
     FREE_ARRAY(int, bytecode->lines, bytecode->capacity);
+    FREE_ARRAY(uint32_t, bytecode->loopCounters, bytecode->loopCount);
+    for (int i = 0; i < bytecode->functionCount; i++)
+        FREE_ARRAY(char, bytecode->functions[i].name, bytecode->functions[i].nameLength);
+    FREE_ARRAY(Function, bytecode->functions, bytecode->functionCapacity);
+    for (int i = 0; i < bytecode->classCount; i++)
+        freeClass(&bytecode->classes[i]);
+    FREE_ARRAY(Class, bytecode->classes, bytecode->classCapacity);
+    for (int i = 0; i < bytecode->nameCount; i++)
+        FREE_ARRAY(char, bytecode->names[i].chars, bytecode->names[i].length);
+    FREE_ARRAY(Name, bytecode->names, bytecode->nameCapacity);
+    FREE_ARRAY(InlineCache, bytecode->caches, bytecode->cacheCapacity);
     freeConstantPool(&bytecode->constantPool);
     initBytecode(bytecode);
 }
 
+void reserveCode(Bytecode *bytecode, int capacity)
+{
+    int oldCapacity = bytecode->capacity;
+    bytecode->code = INCREASE_ARRAY(uint8_t, bytecode->code, oldCapacity, capacity);
+
+    // Should the lines fail to follow, the code shrinks back before the
+    // failure unwinds any further, 'capacity' being the size of both.
+    jmp_buf *outer = vm.unwind;
+    jmp_buf handler;
+    int unwound = setjmp(handler);
+    if (unwound != 0)
+    {
+        vm.unwind = outer;
+        bytecode->code = INCREASE_ARRAY(uint8_t, bytecode->code, capacity, oldCapacity);
+        if (outer == NULL)
+            exit(1);
+        longjmp(*outer, unwound);
+    }
+
+    vm.unwind = &handler;
+    bytecode->lines = INCREASE_ARRAY(int, bytecode->lines, oldCapacity, capacity);
+    vm.unwind = outer;
+    bytecode->capacity = capacity;
+}
+
 void appendBytecode(Bytecode *bytecode, uint8_t byte, int line)
 {
     // Increase array's capacity if there is no space for the next bytecode
     if (bytecode->capacity < bytecode->count + 1)
-    {
-        int oldCapacity = bytecode->capacity;
-        
-        bytecode->capacity = INCREASE_CAPACITY(oldCapacity);
-        bytecode->code = INCREASE_ARRAY(uint8_t, bytecode->code,
-                                        oldCapacity, bytecode->capacity);
-        bytecode->lines = INCREASE_ARRAY(int, bytecode->lines,
-                                        oldCapacity, bytecode->capacity);
-        
-    }
+        reserveCode(bytecode, INCREASE_CAPACITY(bytecode->capacity));
 
     bytecode->code[bytecode->count] = byte;
     bytecode->lines[bytecode->count] = line;
@@ -44,3 +94,242 @@ int addConstant(Bytecode *bytecode, Value value)
     appendConstant(&bytecode->constantPool, value);
     return bytecode->constantPool.count - 1;
 }
+
+int addLoopCounter(Bytecode *bytecode)
+{
+    // counters are added once per loop at compile time, so growing
+    // the array by one element at a time is good enough.
+    bytecode->loopCounters = INCREASE_ARRAY(uint32_t, bytecode->loopCounters,
+                                            bytecode->loopCount, bytecode->loopCount + 1);
+    bytecode->loopCounters[bytecode->loopCount] = 0;
+    return bytecode->loopCount++;
+}
+
+int addFunction(Bytecode *bytecode, const char *name, int length)
+{
+    if (bytecode->functionCapacity < bytecode->functionCount + 1)
+    {
+        int oldCapacity = bytecode->functionCapacity;
+        int capacity = INCREASE_CAPACITY(oldCapacity);
+        bytecode->functions = INCREASE_ARRAY(Function, bytecode->functions, oldCapacity, capacity);
+        bytecode->functionCapacity = capacity;
+    }
+
+    char *copy = ALLOCATE(char, length);
+    if (length > 0)
+        memcpy(copy, name, length);
+
+    Function *function = &bytecode->functions[bytecode->functionCount];
+    function->entry = bytecode->count;
+    function->arity = 0;
+    function->stackMax = 0;
+    function->end = bytecode->count;
+    function->captureCount = 0;
+    function->name = copy;
+    function->nameLength = length;
+    return bytecode->functionCount++;
+}
+
+int addClass(Bytecode *bytecode, const char *name, int length)
+{
+    if (bytecode->classCapacity < bytecode->classCount + 1)
+    {
+        int oldCapacity = bytecode->classCapacity;
+        int capacity = INCREASE_CAPACITY(oldCapacity);
+        bytecode->classes = INCREASE_ARRAY(Class, bytecode->classes, oldCapacity, capacity);
+        bytecode->classCapacity = capacity;
+    }
+
+    char *copy = ALLOCATE(char, length);
+    if (length > 0)
+        memcpy(copy, name, length);
+
+    Class *klass = &bytecode->classes[bytecode->classCount];
+    klass->name = copy;
+    klass->nameLength = length;
+    klass->superclass = -1;
+    klass->initializer = -1;
+    klass->methodCount = 0;
+    klass->methodCapacity = 0;
+    klass->methods = NULL;
+    return bytecode->classCount++;
+}
+
+void addMethod(Bytecode *bytecode, int klass, int name, int function)
+{
+    Class *owner = &bytecode->classes[klass];
+    for (int i = 0; i < owner->methodCount; i++)
+    {
+        if (owner->methods[i].name == name)
+        {
+            owner->methods[i].function = function;
+            return;
+        }
+    }
+
+    if (owner->methodCapacity < owner->methodCount + 1)
+    {
+        int oldCapacity = owner->methodCapacity;
+        int capacity = INCREASE_CAPACITY(oldCapacity);
+        owner->methods = INCREASE_ARRAY(Method, owner->methods, oldCapacity, capacity);
+        owner->methodCapacity = capacity;
+    }
+
+    owner->methods[owner->methodCount].name = name;
+    owner->methods[owner->methodCount].function = function;
+    owner->methodCount++;
+}
+
+int findMethod(Class *klass, int name)
+{
+    for (int i = 0; i < klass->methodCount; i++)
+    {
+        if (klass->methods[i].name == name)
+            return klass->methods[i].function;
+    }
+
+    return -1;
+}
+
+int addName(Bytecode *bytecode, const char *chars, int length)
+{
+    for (int i = 0; i < bytecode->nameCount; i++)
+    {
+        Name *name = &bytecode->names[i];
+        if (name->length == length && (length == 0 || memcmp(name->chars, chars, length) == 0))
+            return i;
+    }
+
+    if (bytecode->nameCapacity < bytecode->nameCount + 1)
+    {
+        int oldCapacity = bytecode->nameCapacity;
+        int capacity = INCREASE_CAPACITY(oldCapacity);
+        bytecode->names = INCREASE_ARRAY(Name, bytecode->names, oldCapacity, capacity);
+        bytecode->nameCapacity = capacity;
+    }
+
+    char *copy = ALLOCATE(char, length);
+    if (length > 0)
+        memcpy(copy, chars, length);
+
+    bytecode->names[bytecode->nameCount].chars = copy;
+    bytecode->names[bytecode->nameCount].length = length;
+    return bytecode->nameCount++;
+}
+
+int addInlineCache(Bytecode *bytecode)
+{
+    if (bytecode->cacheCapacity < bytecode->cacheCount + 1)
+    {
+        int oldCapacity = bytecode->cacheCapacity;
+        int capacity = INCREASE_CAPACITY(oldCapacity);
+        bytecode->caches = INCREASE_ARRAY(InlineCache, bytecode->caches, oldCapacity, capacity);
+        bytecode->cacheCapacity = capacity;
+    }
+
+    // a slot left by truncateBytecode() may hold the entry of another site
+    bytecode->caches[bytecode->cacheCount] = (InlineCache){NULL, NULL, -1, -1};
+    return bytecode->cacheCount++;
+}
+
+BytecodeMark markBytecode(Bytecode *bytecode)
+{
+    return (BytecodeMark){bytecode->count, bytecode->constantPool.count, bytecode->loopCount,
+                          bytecode->functionCount, bytecode->classCount, bytecode->nameCount,
+                          bytecode->cacheCount};
+}
+
+void truncateBytecode(Bytecode *bytecode, BytecodeMark mark)
+{
+    while (bytecode->functionCount > mark.functionCount)
+    {
+        Function *function = &bytecode->functions[--bytecode->functionCount];
+        FREE_ARRAY(char, function->name, function->nameLength);
+    }
+
+    while (bytecode->classCount > mark.classCount)
+        freeClass(&bytecode->classes[--bytecode->classCount]);
+
+    while (bytecode->nameCount > mark.nameCount)
+    {
+        Name *name = &bytecode->names[--bytecode->nameCount];
+        FREE_ARRAY(char, name->chars, name->length);
+    }
+
+    bytecode->count = mark.count;
+    bytecode->constantPool.count = mark.constantCount;
+    bytecode->cacheCount = mark.cacheCount;
+
+    // unlike the others, the counters are allocated one by one
+    bytecode->loopCounters = INCREASE_ARRAY(uint32_t, bytecode->loopCounters,
+                                            bytecode->loopCount, mark.loopCount);
+    bytecode->loopCount = mark.loopCount;
+}
+
+int instructionLength(Bytecode *bytecode, int offset)
+{
+    uint8_t *code = bytecode->code + offset;
+
+    switch (code[0])
+    {
+        case OP_CONSTANT:
+        case OP_ARRAY:
+        case OP_INTRINSIC:
+        case OP_CALL:
+        case OP_CALL_SELF:
+        case OP_TAIL_CALL:
+        case OP_TAIL_CALL_SELF:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_BOXED:
+        case OP_SET_BOXED:
+        case OP_GET_CAPTURE:
+        case OP_GET_CAPTURE_BOXED:
+        case OP_SET_CAPTURE:
+        case OP_JUMP_SHORT:
+        case OP_JUMP_BACK_SHORT:
+        case OP_JUMP_IF_FALSE_SHORT:
+        case OP_JUMP_IF_FALSE_OR_POP_SHORT:
+        case OP_JUMP_IF_TRUE_OR_POP_SHORT:
+        case OP_JUMP_IF_LESS_SHORT:
+        case OP_JUMP_IF_NOT_LESS_SHORT:
+        case OP_JUMP_IF_GREATER_SHORT:
+        case OP_JUMP_IF_NOT_GREATER_SHORT:
+        case OP_JUMP_IF_EQUAL_SHORT:
+        case OP_JUMP_IF_NOT_EQUAL_SHORT:
+            return 2;
+        case OP_CONSTANT_LONG:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_JUMP:
+        case OP_JUMP_BACK:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_FALSE_OR_POP:
+        case OP_JUMP_IF_TRUE_OR_POP:
+        case OP_JUMP_IF_LESS:
+        case OP_JUMP_IF_NOT_LESS:
+        case OP_JUMP_IF_GREATER:
+        case OP_JUMP_IF_NOT_GREATER:
+        case OP_JUMP_IF_EQUAL:
+        case OP_JUMP_IF_NOT_EQUAL:
+        case OP_NATIVE:
+            return 3;
+        case OP_LOOP_SHORT:
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+            return 4;
+        case OP_LOOP:
+        case OP_CASE:
+        case OP_INVOKE:
+            return 5;
+        case OP_TABLESWITCH:
+            return 9 + 2 * ((code[5] << 8) | code[6]);
+        case OP_LOOKUPSWITCH:
+            return 5 + 6 * ((code[1] << 8) | code[2]);
+        case OP_CLOSURE:
+            return 3 + 2 * code[2];
+        default:
+            return 1;
+    }
+}
@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <string.h>
+#include "../include/analysis.h"
+#include "../include/cache.h"
+#include "../include/compiler.h"
+#include "../include/image.h"
+#include "../include/memory.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#include <windows.h>
+#define getpid _getpid
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define CACHE_MAGIC     "BEEC"
+
+// header: magic, version, hash, source length, check, code length,
+// constants, loops, functions, names, classes, inline caches
+#define HEADER_SIZE     (4 + 4 + 8 + 8 + 8 + 4 + 4 + 4 + 4 + 4 + 4 + 4)
+
+/*
+    What tells the source of an entry. The hash names the file; the length
+    and a second hash, independent from it, rule out a collision of the
+    hash passing for the source.
+*/
+typedef struct
+{
+    uint64_t hash;
+    uint64_t length;
+    uint64_t check;
+} SourceKey;
+
+/*
+    @returns the check of the bytes: a multiplicative hash, each byte
+             mixed in with the golden ratio and a shift, which FNV-1a
+             doesn't share its collisions with.
+*/
+static uint64_t checkHash(uint64_t check, const uint8_t *bytes, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        check = (check + bytes[i] + 1) * 0x9e3779b97f4a7c15u;
+        check ^= check >> 32;
+    }
+    return check;
+}
+
+/*
+    @returns the key of the source, its hashes seeded with BYTECODE_VERSION.
+*/
+static SourceKey keySource(FILE *file)
+{
+    uint32_t version = BYTECODE_VERSION;
+    uint32_t level = (uint32_t)optimizationLevel();
+    SourceKey key = {FNV_OFFSET, 0, 0};
+    key.hash = fnv1a(key.hash, (const uint8_t*)&version, sizeof(version));
+    key.hash = fnv1a(key.hash, (const uint8_t*)&level, sizeof(level));
+    key.check = checkHash(key.check, (const uint8_t*)&version, sizeof(version));
+    key.check = checkHash(key.check, (const uint8_t*)&level, sizeof(level));
+
+    uint8_t buffer[4096];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        key.hash = fnv1a(key.hash, buffer, read);
+        key.check = checkHash(key.check, buffer, read);
+        key.length += read;
+    }
+
+    return key;
+}
+
+static void entryPath(char *path, size_t size, const char *dir, uint64_t hash, const char *suffix)
+{
+    snprintf(path, size, "%s/%016llx.beec%s", dir, (unsigned long long)hash, suffix);
+}
+
+static void storeEntry(const char *dir, SourceKey key, Bytecode *bytecode)
+{
+    if (!isWritable(bytecode))
+        return;
+
+#ifdef _WIN32
+    _mkdir(dir);
+#else
+    mkdir(dir, 0777);
+#endif
+
+    char path[1024];
+    char temporary[1024];
+    char suffix[32];
+    entryPath(path, sizeof(path), dir, key.hash, "");
+    snprintf(suffix, sizeof(suffix), ".%d.tmp", (int)getpid());
+    entryPath(temporary, sizeof(temporary), dir, key.hash, suffix);
+
+    Writer writer;
+    writer.file = fopen(temporary, "wb");
+    writer.checksum = FNV_OFFSET;
+    if (writer.file == NULL)
+        return;
+
+    writeBytes(&writer, CACHE_MAGIC, 4);
+    writeU32(&writer, BYTECODE_VERSION);
+    writeU64(&writer, key.hash);
+    writeU64(&writer, key.length);
+    writeU64(&writer, key.check);
+    writeBytecode(&writer, bytecode);
+
+    uint64_t checksum = writer.checksum;
+    writeU64(&writer, checksum);
+
+    bool written = !ferror(writer.file);
+    written = fclose(writer.file) == 0 && written;
+
+    // the entry appears whole or not at all
+#ifdef _WIN32
+    written = written && MoveFileExA(temporary, path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    written = written && rename(temporary, path) == 0;
+#endif
+    if (!written)
+        remove(temporary);
+}
+
+/*
+    @returns the content of the file, NULL if it can't be read or is too
+             short to be an entry.
+*/
+static uint8_t* readEntry(const char *path, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return NULL;
+
+    fseek(file, 0L, SEEK_END);
+    long length = ftell(file);
+    rewind(file);
+
+    // the header and the checksum at least
+    uint8_t *buffer = length >= HEADER_SIZE + 8 ? ALLOCATE(uint8_t, length) : NULL;
+    if (buffer != NULL && fread(buffer, 1, length, file) != (size_t)length)
+    {
+        FREE_ARRAY(uint8_t, buffer, length);
+        buffer = NULL;
+    }
+
+    fclose(file);
+    *size = (size_t)length;
+    return buffer;
+}
+
+/*
+    @returns false if there is no valid entry for the source: none, a
+             damaged one, one of another source or one verifyBytecode()
+             refuses, e.g. written by a faulty build.
+*/
+static bool loadEntry(const char *dir, SourceKey key, Bytecode *bytecode)
+{
+    char path[1024];
+    entryPath(path, sizeof(path), dir, key.hash, "");
+
+    size_t size;
+    uint8_t *buffer = readEntry(path, &size);
+    if (buffer == NULL)
+        return false;
+
+    // the checksum covers everything before it
+    Reader reader = {buffer, buffer + size - 8, true};
+    Reader trailer = {buffer + size - 8, buffer + size, true};
+    bool ok = readU64(&trailer) == fnv1a(FNV_OFFSET, buffer, size - 8);
+
+    ok = ok && memcmp(readBytes(&reader, 4), CACHE_MAGIC, 4) == 0;
+    ok = ok && readU32(&reader) == BYTECODE_VERSION;
+    ok = ok && readU64(&reader) == key.hash;
+    ok = ok && readU64(&reader) == key.length;
+    ok = ok && readU64(&reader) == key.check;
+
+    ok = ok && readBytecode(&reader, bytecode) && reader.at == reader.end;
+    ok = ok && verifyBytecode(bytecode, 0) == NULL;
+
+    FREE_ARRAY(uint8_t, buffer, size);
+    if (!ok)
+        freeBytecode(bytecode);
+    return ok;
+}
+
+InterpretResult interpretCached(FILE *file, const char *dir)
+{
+    SourceKey key = keySource(file);
+
+    Bytecode bytecode;
+    initBytecode(&bytecode);
+
+    // a miss is compiled anew, and its entry overwrites what was there
+    if (!loadEntry(dir, key, &bytecode))
+    {
+        rewind(file);
+        if (!compileStream(file, &bytecode))
+        {
+            freeBytecode(&bytecode);
+            return INTERPRET_COMPILE_ERROR;
+        }
+
+        storeEntry(dir, key, &bytecode);
+    }
+
+    InterpretResult result = interpretBytecode(&bytecode);
+    // the bytecode goes away, and with it a run out of fuel
+    if (result == INTERPRET_OUT_OF_FUEL)
+        abandonInterpret();
+    freeBytecode(&bytecode);
+    return result;
+}
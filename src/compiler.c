@@ -1,8 +1,14 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "../include/array.h"
 #include "../include/common.h"
 #include "../include/compiler.h"
+#include "../include/memory.h"
+#include "../include/number.h"
+#include "../include/optimize.h"
+#include "../include/relax.h"
 #include "../include/scanner.h"
 
 #ifdef DEBUG_PRINT_BYTECODE
@@ -36,7 +42,7 @@ typedef enum
     PREC_PRIMARY
 } Precedence;
 
-typedef void (*ParseFn)();
+typedef void (*ParseFn)(bool canAssign);
 
 typedef struct
 {
@@ -45,8 +51,104 @@ typedef struct
     Precedence precedence;
 } ParseRule;
 
-Parser parser;
-Bytecode *compilingBytecode;
+/*
+    A local variable. Locals live on the VM's stack in the order they are
+    declared, so the index of a Local in Compiler.locals is its stack slot.
+*/
+typedef struct
+{
+    Token name;
+    int depth;  // scope depth of the declaring block. -1 until initialized.
+    int start;  // offset of the code the local is declared at
+    bool isCaptured;    // by a closure
+    bool isMutated;     // assigned after its declaration, by any code
+} Local;
+
+/*
+    A variable of the enclosing code a function refers to: a local of the
+    code right around it or, through it, a capture of its own.
+*/
+typedef struct
+{
+    uint8_t index;  // the slot of the local or the index of the capture
+    bool isLocal;
+} Capture;
+
+typedef enum
+{
+    TYPE_SCRIPT,
+    TYPE_FUNCTION,
+    TYPE_METHOD,        // takes the receiver, 'this', as its first argument
+    TYPE_INITIALIZER    // a method returning the receiver
+} FunctionType;
+
+/*
+    Compiles the script or the body of a function. A function has its own
+    locals, the arguments first, and doesn't see those of the enclosing code.
+*/
+typedef struct Compiler
+{
+    struct Compiler *enclosing;
+    FunctionType type;
+    int function;       // index in Bytecode.functions, -1 for the script
+
+    Local locals[UINT8_COUNT];
+    int localCount;
+    int scopeDepth;     // 0 is the top level, where variables are global.
+    Capture captures[UINT8_COUNT];
+    int captureCount;
+
+    // A comparison a following conditional jump can be fused with.
+    int fusableStart;   // offset of the comparison instructions
+    int fusableEnd;     // offset right after them
+    uint8_t fusedJump;  // the fused jump, taken when the comparison is false
+    int lastTarget;     // the latest offset a forward jump lands on
+
+    int lastCall;       // offset of the latest OP_CALL or OP_CALL_SELF, -1 if none
+} Compiler;
+
+/*
+    The class whose methods are being compiled, the innermost one if
+    classes are nested.
+*/
+typedef struct ClassCompiler
+{
+    struct ClassCompiler *enclosing;
+    int klass;          // index in Bytecode.classes
+} ClassCompiler;
+
+THREAD_LOCAL Parser parser;
+THREAD_LOCAL Compiler *current = NULL;
+THREAD_LOCAL ClassCompiler *currentClass = NULL;
+THREAD_LOCAL Bytecode *compilingBytecode;
+
+/*
+    Names of the global variables. The index of a name is the index of
+    the variable in VM.globals, so globals are resolved at compile time.
+    The names are copied, since they outlive the source in a REPL session,
+    and the array grows as they are declared, up to GLOBALS_MAX.
+*/
+THREAD_LOCAL Token *globals;
+THREAD_LOCAL int globalCapacity;
+THREAD_LOCAL int globalCount;
+
+/*
+    The offset the code of the current compile() starts at.
+*/
+THREAD_LOCAL int codeStart;
+
+/*
+    What the current compile() started from, for rollBackCompiler().
+    'compiling' is false between two compiles.
+*/
+THREAD_LOCAL bool compiling = false;
+THREAD_LOCAL BytecodeMark compileMark;
+THREAD_LOCAL int compileGlobals;
+
+/*
+    See setOptimizationLevel().
+*/
+THREAD_LOCAL int optimization = 1;
 
 static Bytecode* currentBytecode(void)
 {
@@ -134,6 +236,28 @@ static void consume(TokenType type, const char *message)
     errorAtCurrent(message);
 }
 
+/*
+    Checks whether the current token is of the given type.
+    Doesn't consume the token.
+*/
+static bool check(TokenType type)
+{
+    return parser.current.type == type;
+}
+
+/*
+    Consumes the current token if it is of the given type.
+    @returns true if the token has been consumed.
+*/
+static bool match(TokenType type)
+{
+    if (!check(type))
+        return false;
+
+    advance();
+    return true;
+}
+
 /**
     Appends a single byte to the Bytecode.code.
     This function writes the given byte, which may be an opcode or
@@ -154,6 +278,103 @@ static void emitBytes(uint8_t byte1, uint8_t byte2)
     emitByte(byte2);
 }
 
+/*
+    Appends a 16-bit operand in big-endian order.
+*/
+static void emitShort(uint16_t value)
+{
+    emitByte((value >> 8) & 0xff);
+    emitByte(value & 0xff);
+}
+
+/*
+    Appends an instruction on a global variable, whose index is 16-bit.
+*/
+static void emitGlobal(uint8_t op, int global)
+{
+    emitByte(op);
+    emitShort((uint16_t)global);
+}
+
+/*
+    Appends a 32-bit operand in big-endian order.
+*/
+static void emitInt32(int32_t value)
+{
+    emitShort((uint16_t)(((uint32_t)value >> 16) & 0xffff));
+    emitShort((uint16_t)((uint32_t)value & 0xffff));
+}
+
+/*
+    Emits a forward jump instruction with a placeholder operand.
+    @returns the offset of the operand to be patched by patchJump().
+*/
+static int emitJump(uint8_t instruction)
+{
+    emitByte(instruction);
+    emitShort(0xffff);
+    return currentBytecode()->count - 2;
+}
+
+/*
+    Backpatches the operand of a forward jump emitted by emitJump(),
+    so that it lands on the next instruction to be emitted.
+*/
+static void patchJump(int offset)
+{
+    // -2 to adjust for the jump offset itself.
+    int jump = currentBytecode()->count - offset - 2;
+
+    if (jump > UINT16_MAX)
+        error("Too much code to jump over.");
+
+    currentBytecode()->code[offset] = (jump >> 8) & 0xff;
+    currentBytecode()->code[offset + 1] = jump & 0xff;
+    current->lastTarget = currentBytecode()->count;
+}
+
+/*
+    Emits a conditional jump taken if the condition on top of the stack
+    is falsey. If the condition has just been computed by a comparison,
+    the comparison is replaced with a fused compare-and-jump instruction.
+    That is only safe if no jump lands between the comparison and the jump.
+*/
+static int emitJumpIfFalse(void)
+{
+    Bytecode *bytecode = currentBytecode();
+
+    if (current->fusableEnd == bytecode->count &&
+        current->lastTarget <= current->fusableStart)
+    {
+        bytecode->count = current->fusableStart;
+        current->fusableEnd = -1;
+        return emitJump(current->fusedJump);
+    }
+
+    return emitJump(OP_JUMP_IF_FALSE);
+}
+
+/*
+    Emits a loop back-edge to 'loopStart'.
+    Each back-edge gets its own counter in Bytecode.loopCounters, so that
+    hot loops can be found by reading the counters.
+*/
+static void emitLoop(int loopStart)
+{
+    int counter = addLoopCounter(currentBytecode());
+    if (counter > UINT16_MAX)
+        error("Too many loops in one chunk.");
+
+    // +5 to adjust for the instruction itself: [op, offset16, counter16]
+    int offset = currentBytecode()->count + 5 - loopStart;
+    if (offset > UINT16_MAX)
+        error("Loop body too large.");
+
+    emitByte(OP_LOOP);
+    emitShort((uint16_t)offset);
+    emitShort((uint16_t)counter);
+}
+
 /*
     Appends OP_RETURN to the tail of compilingBytecode entry.
 */
@@ -162,30 +383,82 @@ static void emitReturn(void)
     emitByte(OP_RETURN);
 }
 
+/*
+    Returns from the function without a value: nil, or the receiver from
+    an initializer.
+*/
+static void emitEmptyReturn(void)
+{
+    if (current->type == TYPE_INITIALIZER)
+        emitBytes(OP_GET_LOCAL, 0);
+    else
+        emitByte(OP_NIL);
+
+    emitByte(OP_RETURN_VALUE);
+}
+
 
 /**
-    Appends constant to Constant pool.
-    @returns uint8_t index in Constant pool.
+    Appends constant to Constant pool, unless the very same value is
+    already there: numbers are compared bit for bit, so that 0 and -0
+    stay apart.
+    @returns index in Constant pool.
 */
-static uint8_t makeConstant(Value value)
+static int makeConstant(Value value)
 {
+    ConstantPool *pool = &currentBytecode()->constantPool;
+    for (int i = 0; i < pool->count; i++)
+    {
+        Value constant = pool->constants[i];
+        if (constant.type == value.type &&
+            (IS_NUMBER(value) ? memcmp(&constant.as.number, &value.as.number, sizeof(double)) == 0
+                              : valuesEqual(constant, value)))
+            return i;
+    }
+
     int index = addConstant(currentBytecode(), value);
-    if (index > UINT8_MAX)
+    if (index > UINT16_MAX)
     {
         error("Too many constants in one Constant pool.");
         return 0;
     }
 
-    return (uint8_t)index;
+    return index;
 }
 
 /*
    Load the given value to the Constant pool and adds OP_CONSTANT
-   instruction to Bytecode array.
+   instruction to Bytecode array, OP_CONSTANT_LONG past the 256th constant.
 */
 static void emitConstant(Value value)
 {
-    emitBytes(OP_CONSTANT, makeConstant(value));
+    int constant = makeConstant(value);
+    if (constant <= UINT8_MAX)
+    {
+        emitBytes(OP_CONSTANT, (uint8_t)constant);
+    }else
+    {
+        emitByte(OP_CONSTANT_LONG);
+        emitShort((uint16_t)constant);
+    }
+}
+
+/*
+    Initializes the compiler of the script or of a function body, starting
+    at the current end of code.
+*/
+static void initCompiler(Compiler *compiler, FunctionType type, int function)
+{
+    compiler->enclosing = current;
+    compiler->type = type;
+    compiler->function = function;
+    compiler->localCount = 0;
+    compiler->scopeDepth = type == TYPE_SCRIPT ? 0 : 1;
+    compiler->captureCount = 0;
+    compiler->fusableEnd = -1;
+    compiler->lastTarget = currentBytecode()->count;
+    compiler->lastCall = -1;
+    current = compiler;
 }
 
 /*
@@ -196,6 +469,12 @@ static void emitConstant(Value value)
 static void endCompiler(void)
 {
     emitReturn();
+
+    if (!parser.hadError && optimization >= 2)
+        optimizeBytecode(currentBytecode(), codeStart);
+    if (!parser.hadError)
+        relaxJumps(currentBytecode(), codeStart);
+
 #ifdef DEBUG_PRINT_BYTECODE
     if (!parser.hadError)
     {
@@ -206,10 +485,12 @@ static void endCompiler(void)
 }
 
 static void expression(void);
+static void statement(void);
+static void declaration(void);
 static ParseRule* getRule(TokenType type);
 static void parsePrecedence(Precedence precedence);
 
-static void binary(void)
+static void binary(bool canAssign)
 {
     TokenType operatorType = parser.previous.type;
 
@@ -227,26 +508,59 @@ static void binary(void)
     // call this function with the same precedence. 
     parsePrecedence((Precedence)(rule->precedence + 1));
 
+    int operatorStart = currentBytecode()->count;
+    // The jump taken when the comparison is false, if it gets fused.
+    // OP_RETURN stands for "not a comparison".
+    uint8_t fusedJump = OP_RETURN;
+
     switch(operatorType)
     {
         // a != b equals !(a == b)
-        case TOKEN_BANG_EQUAL:    emitBytes(OP_EQUAL, OP_NOT);  break;
-        case TOKEN_EQUAL_EQUAL:   emitByte(OP_EQUAL);           break;
-        case TOKEN_GREATER:       emitByte(OP_GREATER);         break;
+        case TOKEN_BANG_EQUAL:    emitBytes(OP_EQUAL, OP_NOT);  fusedJump = OP_JUMP_IF_EQUAL;       break;
+        case TOKEN_EQUAL_EQUAL:   emitByte(OP_EQUAL);           fusedJump = OP_JUMP_IF_NOT_EQUAL;   break;
+        case TOKEN_GREATER:       emitByte(OP_GREATER);         fusedJump = OP_JUMP_IF_NOT_GREATER; break;
         // a >= b equals !(a < b)
-        case TOKEN_GREATER_EQUAL: emitBytes(OP_LESS, OP_NOT);   break;
-        case TOKEN_LESS:          emitByte(OP_LESS);            break;
+        case TOKEN_GREATER_EQUAL: emitBytes(OP_LESS, OP_NOT);   fusedJump = OP_JUMP_IF_LESS;        break;
+        case TOKEN_LESS:          emitByte(OP_LESS);            fusedJump = OP_JUMP_IF_NOT_LESS;    break;
         // a <= b equals !(a > b)
-        case TOKEN_LESS_EQUAL:    emitBytes(OP_GREATER, OP_NOT);break;
+        case TOKEN_LESS_EQUAL:    emitBytes(OP_GREATER, OP_NOT);fusedJump = OP_JUMP_IF_GREATER;     break;
         case TOKEN_PLUS:          emitByte(OP_ADD);             break;
         case TOKEN_MINUS:         emitByte(OP_SUBTRACT);        break;
         case TOKEN_STAR:          emitByte(OP_MULTIPLY);        break;
         case TOKEN_SLASH:         emitByte(OP_DIVIDE);          break;
         default: return;    //unreachable
     }
+
+    if (fusedJump != OP_RETURN)
+    {
+        current->fusableStart = operatorStart;
+        current->fusableEnd = currentBytecode()->count;
+        current->fusedJump = fusedJump;
+    }
+}
+
+/*
+    'and' short-circuits: if the left operand is falsey, it is the result
+    and the right operand isn't evaluated at all.
+*/
+static void and_(bool canAssign)
+{
+    int endJump = emitJump(OP_JUMP_IF_FALSE_OR_POP);
+    parsePrecedence(PREC_AND);
+    patchJump(endJump);
+}
+
+/*
+    'or' short-circuits: if the left operand is truthy, it is the result.
+*/
+static void or_(bool canAssign)
+{
+    int endJump = emitJump(OP_JUMP_IF_TRUE_OR_POP);
+    parsePrecedence(PREC_OR);
+    patchJump(endJump);
 }
 
-static void literal(void)
+static void literal(bool canAssign)
 {
     switch (parser.previous.type)
     {
@@ -264,7 +578,7 @@ static void literal(void)
     The inner call to expression() takes care of generating bytecode for the expression
     inside the parentheses.
 */
-static void grouping(void)
+static void grouping(bool canAssign)
 {
     expression();
     consume(TOKEN_RIGHT_PAREN, "')' token expected after expression");
@@ -275,9 +589,11 @@ static void grouping(void)
  * This function assumes that token for the number literal
  * has already been consumed and is stored in Parser.previous Token.
 */
-static void number(void)
+static void number(bool canAssign)
 {
-    double value = strtod(parser.previous.start, NULL);
+    double value;
+    if (!parseNumber(parser.previous.start, parser.previous.length, &value))
+        error("Malformed number.");
     emitConstant(NUMBER_VAL(value));
 }
 
@@ -298,7 +614,7 @@ static void number(void)
     appears in the source code and rearranging it into the order that
     execution happens.
 */
-static void unary(void)
+static void unary(bool canAssign)
 {
     TokenType operatorType = parser.previous.type;
 
@@ -314,110 +630,1642 @@ static void unary(void)
     }
 }
 
-/**
- * Array of function pointers.
- * 
- * The indexes in the array correspond to the TokenType enum
- * values, and the function at each index is the code to compile
- * an expression of that token type.
+/*
+    Parses an array literal: [e1, e2, ...].
+    This function assumes that the opening bracket has already been consumed.
+    The element values are left on the stack and OP_ARRAY packs them into
+    a typed array, whose element type is chosen at runtime by the values.
 */
-ParseRule rules[] = {
-    [TOKEN_LEFT_PAREN]    = {grouping, NULL,   PREC_NONE},
-    [TOKEN_RIGHT_PAREN]   = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_LEFT_BRACE]    = {NULL,     NULL,   PREC_NONE}, 
-    [TOKEN_RIGHT_BRACE]   = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_COMMA]         = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_DOT]           = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_MINUS]         = {unary,    binary, PREC_TERM},
-    [TOKEN_PLUS]          = {NULL,     binary, PREC_TERM},
-    [TOKEN_SEMICOLON]     = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_SLASH]         = {NULL,     binary, PREC_FACTOR},
-    [TOKEN_STAR]          = {NULL,     binary, PREC_FACTOR},
-    [TOKEN_BANG]          = {unary,    NULL,   PREC_NONE},
-    [TOKEN_BANG_EQUAL]    = {NULL,     binary, PREC_EQUALITY},
-    [TOKEN_EQUAL]         = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_EQUAL_EQUAL]   = {NULL,     binary, PREC_EQUALITY},
-    [TOKEN_GREATER]       = {NULL,     binary, PREC_COMPARISON},
-    [TOKEN_GREATER_EQUAL] = {NULL,     binary, PREC_COMPARISON},
-    [TOKEN_LESS]          = {NULL,     binary, PREC_COMPARISON},
-    [TOKEN_LESS_EQUAL]    = {NULL,     binary, PREC_COMPARISON},
-    [TOKEN_IDENTIFIER]    = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_STRING]        = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_NUMBER]        = {number,   NULL,   PREC_NONE},
-    [TOKEN_AND]           = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_CLASS]         = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_ELSE]          = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_FALSE]         = {literal,  NULL,   PREC_NONE},
-    [TOKEN_FOR]           = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_FUN]           = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_IF]            = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_NIL]           = {literal,  NULL,   PREC_NONE},
-    [TOKEN_OR]            = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_PRINT]         = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_RETURN]        = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_SUPER]         = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_THIS]          = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_TRUE]          = {literal,  NULL,   PREC_NONE},
-    [TOKEN_VAR]           = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_WHILE]         = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_ERROR]         = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_EOF]           = {NULL,     NULL,   PREC_NONE},
-};
+static void arrayLiteral(bool canAssign)
+{
+    int count = 0;
+
+    if (!check(TOKEN_RIGHT_BRACKET))
+    {
+        do
+        {
+            expression();
+            if (count == UINT8_MAX)
+                error("Too many elements in an array literal.");
+            count++;
+        } while (match(TOKEN_COMMA));
+    }
+
+    consume(TOKEN_RIGHT_BRACKET, "']' token expected after array elements.");
+    emitBytes(OP_ARRAY, (uint8_t)count);
+}
 
 /*
-    Orchestrates all of the parsing functions.
-    This function starts at the current token and parses any expression
-    at the given precedence level or higher. It uses table of parsing
-    function pointers.
+    Parses subscript: array[index] or array[index] = value.
+    The array expression has already been compiled and '[' consumed.
 */
-static void parsePrecedence(Precedence precedence)
+static void subscript(bool canAssign)
 {
-    // read next token.
-    advance();
-    // look up corresponding ParseRule.
-    ParseFn prefixRule = getRule(parser.previous.type)->prefix;
-    if (prefixRule == NULL)
+    expression();
+    consume(TOKEN_RIGHT_BRACKET, "']' token expected after index.");
+
+    if (canAssign && match(TOKEN_EQUAL))
     {
-        error("An expression expected.");
-        return;
+        expression();
+        emitByte(OP_INDEX_SET);
+    }else
+    {
+        emitByte(OP_INDEX_GET);
     }
-    // does its stuff and compiles the rest of the prefix expression.
-    prefixRule();
+}
 
-    // compiling the infix expressions.
-    // If the next token is too low precedence, or isnt an infix
-    // operator at all, were done.
-    while (precedence <= getRule(parser.current.type)->precedence)
+static bool identifiersEqual(Token *a, Token *b)
+{
+    return a->length == b->length && memcmp(a->start, b->start, a->length) == 0;
+}
+
+/*
+    Looks the name up among the locals, innermost first.
+    @returns the stack slot of the variable or -1 if it isn't a local.
+*/
+static int resolveLocal(Compiler *compiler, Token *name)
+{
+    for (int i = compiler->localCount - 1; i >= 0; i--)
     {
-        advance(); // if so, consume current token.
-        ParseFn infixRule = getRule(parser.previous.type)->infix;
-        infixRule();
+        Local *local = &compiler->locals[i];
+        if (identifiersEqual(name, &local->name))
+        {
+            if (local->depth == -1)
+                error("Can't read local variable in its own initializer.");
+
+            return i;
+        }
     }
+
+    return -1;
 }
 
-static ParseRule* getRule(TokenType type)
+/*
+    @returns the index of the capture of the compiler, added if it is new.
+*/
+static int addCapture(Compiler *compiler, uint8_t index, bool isLocal)
 {
-    return &rules[type];
+    for (int i = 0; i < compiler->captureCount; i++)
+    {
+        Capture *capture = &compiler->captures[i];
+        if (capture->index == index && capture->isLocal == isLocal)
+            return i;
+    }
+
+    if (compiler->captureCount == UINT8_COUNT)
+    {
+        error("Too many captured variables in function.");
+        return 0;
+    }
+
+    compiler->captures[compiler->captureCount].index = index;
+    compiler->captures[compiler->captureCount].isLocal = isLocal;
+    return compiler->captureCount++;
 }
 
-static void expression(void)
+/*
+    Looks the name up among the locals of the enclosing functions,
+    innermost first, and captures it in each function on the way.
+    @param Local** origin receives the captured local.
+    @returns the index of the capture or -1 if the name isn't a local
+             of any enclosing function.
+*/
+static int resolveCapture(Compiler *compiler, Token *name, Local **origin)
 {
-    parsePrecedence(PREC_ASSIGNMENT);
+    if (compiler->enclosing == NULL)
+        return -1;
+
+    int local = resolveLocal(compiler->enclosing, name);
+    if (local >= 0)
+    {
+        *origin = &compiler->enclosing->locals[local];
+        (*origin)->isCaptured = true;
+        return addCapture(compiler, (uint8_t)local, true);
+    }
+
+    int capture = resolveCapture(compiler->enclosing, name, origin);
+    if (capture >= 0)
+        return addCapture(compiler, (uint8_t)capture, false);
+
+    return -1;
 }
 
-bool compile(const char *source, Bytecode *bytecode)
+/*
+    @returns the index of the global variable or -1 if it isn't declared.
+*/
+static int resolveGlobal(Token *name)
 {
-    initScanner(source);
-    compilingBytecode = bytecode;
-    parser.hadError = false;
-    parser.panicMode = false;
+    for (int i = 0; i < globalCount; i++)
+    {
+        if (identifiersEqual(name, &globals[i]))
+            return i;
+    }
 
-    advance();          // turn Scanner on.
-    expression();       // Parse expression.
+    return -1;
+}
 
-    // The last token must be of type EOF
-    consume(TOKEN_EOF, "End of expression expected.");
-    endCompiler();
+/*
+    Emits a read or, if followed by '=', an assignment of the variable.
+    @returns false if there is no variable with such a name.
+*/
+static bool namedVariable(Token name, bool canAssign)
+{
+    uint8_t getOp, setOp;
+    bool global = false;
+    Local *origin = NULL;
+    int arg = resolveLocal(current, &name);
 
-    return !parser.hadError;
+    // The accesses of a local or a capture are emitted as if it weren't
+    // shared: those of a local turning out to be both captured and
+    // mutated are rewritten once its scope ends (see boxLocal()).
+    if (arg >= 0)
+    {
+        getOp = OP_GET_LOCAL;
+        setOp = OP_SET_LOCAL;
+        origin = &current->locals[arg];
+    }else if ((arg = resolveCapture(current, &name, &origin)) >= 0)
+    {
+        getOp = OP_GET_CAPTURE;
+        setOp = OP_SET_CAPTURE;
+    }else if ((arg = resolveGlobal(&name)) >= 0)
+    {
+        getOp = OP_GET_GLOBAL;
+        setOp = OP_SET_GLOBAL;
+        global = true;
+    }else
+    {
+        return false;
+    }
+
+    if (canAssign && match(TOKEN_EQUAL))
+    {
+        expression();
+        if (global)
+            emitGlobal(setOp, arg);
+        else
+            emitBytes(setOp, (uint8_t)arg);
+        if (origin != NULL)
+            origin->isMutated = true;
+    }else if (global)
+    {
+        emitGlobal(getOp, arg);
+    }else
+    {
+        emitBytes(getOp, (uint8_t)arg);
+    }
+
+    return true;
+}
+
+/*
+    Parses the arguments of a call, the opening parenthesis being consumed.
+    @returns the number of arguments.
+*/
+static int argumentList(void)
+{
+    int argCount = 0;
+    if (!check(TOKEN_RIGHT_PAREN))
+    {
+        do
+        {
+            expression();
+            if (argCount == UINT8_MAX)
+                error("Can't have more than 255 arguments.");
+            argCount++;
+        } while (match(TOKEN_COMMA));
+    }
+    consume(TOKEN_RIGHT_PAREN, "')' token expected after arguments.");
+
+    return argCount;
+}
+
+/*
+    @returns the index of the property name, the operand of the property
+             instructions.
+*/
+static uint8_t propertyName(Token *name)
+{
+    int index = addName(currentBytecode(), name->start, name->length);
+    if (index > UINT8_MAX)
+    {
+        error("Too many property names.");
+        return 0;
+    }
+
+    return (uint8_t)index;
+}
+
+/*
+    Emits the inline cache operand of a property instruction: each
+    instruction gets a cache of its own.
+*/
+static void emitInlineCache(void)
+{
+    int index = addInlineCache(currentBytecode());
+    if (index > UINT16_MAX)
+        error("Too many property accesses in one chunk.");
+
+    emitShort((uint16_t)index);
+}
+
+/*
+    object.name, object.name = value or object.name(arg1, arg2, ...).
+    A call of a property is a single OP_INVOKE, which calls the method
+    without binding it to the object first.
+*/
+static void dot(bool canAssign)
+{
+    consume(TOKEN_IDENTIFIER, "Property name expected after '.'.");
+    uint8_t name = propertyName(&parser.previous);
+
+    if (canAssign && match(TOKEN_EQUAL))
+    {
+        expression();
+        emitBytes(OP_SET_PROPERTY, name);
+    }else if (match(TOKEN_LEFT_PAREN))
+    {
+        int argCount = argumentList();
+        emitBytes(OP_INVOKE, name);
+        emitByte((uint8_t)argCount);
+    }else
+    {
+        emitBytes(OP_GET_PROPERTY, name);
+    }
+
+    emitInlineCache();
+}
+
+static Token syntheticToken(const char *text)
+{
+    Token token;
+    token.type = TOKEN_IDENTIFIER;
+    token.start = text;
+    token.length = (int)strlen(text);
+    token.line = parser.previous.line;
+    return token;
+}
+
+/*
+    The receiver of the method being compiled: its first local, or a
+    capture of it in a function declared inside the method.
+*/
+static void this_(bool canAssign)
+{
+    if (currentClass == NULL)
+    {
+        error("Can't use 'this' outside of a class.");
+        return;
+    }
+
+    namedVariable(syntheticToken("this"), false);
+}
+
+/*
+    super.name(arg1, arg2, ...)
+    The method of the superclass is known at compile time: it is called
+    directly, with the receiver as its first argument.
+*/
+static void super_(bool canAssign)
+{
+    Bytecode *bytecode = currentBytecode();
+    int superclass = currentClass != NULL ? bytecode->classes[currentClass->klass].superclass : -1;
+    if (currentClass == NULL)
+        error("Can't use 'super' outside of a class.");
+    else if (superclass < 0)
+        error("Can't use 'super' in a class with no superclass.");
+
+    consume(TOKEN_DOT, "'.' token expected after 'super'.");
+    consume(TOKEN_IDENTIFIER, "Superclass method name expected.");
+    uint8_t name = propertyName(&parser.previous);
+
+    int method = superclass >= 0 ? findMethod(&bytecode->classes[superclass], name) : -1;
+    if (superclass >= 0 && method < 0)
+        error("Undefined superclass method.");
+
+    emitConstant(FUNCTION_VAL(method));
+    namedVariable(syntheticToken("this"), false);
+
+    consume(TOKEN_LEFT_PAREN, "'(' token expected after superclass method name.");
+    int argCount = argumentList();
+    if (argCount == UINT8_MAX)
+        error("Can't have more than 254 arguments.");
+
+    current->lastCall = currentBytecode()->count;
+    emitBytes(OP_CALL, (uint8_t)(argCount + 1));
+}
+
+/*
+    callee(arg1, arg2, ...), the callee being any expression. Whether it is
+    a function, and one of that arity, is only known at run time.
+*/
+static void call(bool canAssign)
+{
+    uint8_t argCount = (uint8_t)argumentList();
+    current->lastCall = currentBytecode()->count;
+    emitBytes(OP_CALL, argCount);
+}
+
+/*
+    Parses a call of a native or of a built-in array function:
+    name(arg1, arg2, ...). The names are resolved at compile time, so the
+    arguments are followed by OP_NATIVE or OP_INTRINSIC with the index of
+    the function.
+*/
+static void functionCall(void)
+{
+    int native = findNative(parser.previous.start, parser.previous.length);
+    int intrinsic = native < 0 ? findArrayIntrinsic(parser.previous.start, parser.previous.length) : -1;
+    bool isFunction = native >= 0 || intrinsic >= 0;
+    if (!isFunction || !check(TOKEN_LEFT_PAREN))
+    {
+        error(!isFunction && check(TOKEN_LEFT_PAREN) ? "Undefined function."
+                                                     : "Undefined variable.");
+        return;
+    }
+
+    consume(TOKEN_LEFT_PAREN, "'(' token expected after function name.");
+    int argCount = argumentList();
+
+    int arity = native >= 0 ? vm.natives[native].arity : arrayIntrinsics[intrinsic].arity;
+    if (arity != NATIVE_VARIADIC && argCount != arity)
+    {
+        error("Wrong number of arguments.");
+        return;
+    }
+
+    if (native >= 0)
+    {
+        emitBytes(OP_NATIVE, (uint8_t)native);
+        emitByte((uint8_t)argCount);
+    }else
+    {
+        emitBytes(OP_INTRINSIC, (uint8_t)intrinsic);
+    }
+}
+
+/*
+    @returns true if the name is the one of the function being compiled,
+             not shadowed by one of its locals.
+*/
+static bool isOwnName(Token *name)
+{
+    if (current->type != TYPE_FUNCTION || resolveLocal(current, name) >= 0)
+        return false;
+
+    Function *function = &currentBytecode()->functions[current->function];
+    return function->nameLength == name->length &&
+           memcmp(function->name, name->start, name->length) == 0;
+}
+
+/*
+    A function calling itself by its name. The callee is known, so it
+    isn't pushed and the arity is checked here: OP_CALL_SELF only pushes
+    a frame over the arguments.
+*/
+static void selfCall(void)
+{
+    consume(TOKEN_LEFT_PAREN, "'(' token expected after function name.");
+    int argCount = argumentList();
+
+    int arity = currentBytecode()->functions[current->function].arity;
+    if (argCount != arity)
+    {
+        error("Wrong number of arguments.");
+        return;
+    }
+
+    current->lastCall = currentBytecode()->count;
+    emitBytes(OP_CALL_SELF, (uint8_t)argCount);
+}
+
+/*
+    An identifier in an expression: a variable or a function.
+    Inside a function, its own name refers to it unless it is assigned.
+    Variables shadow the natives, which shadow the built-in functions.
+*/
+static void variable(bool canAssign)
+{
+    Token name = parser.previous;
+    if (isOwnName(&name) && !(canAssign && check(TOKEN_EQUAL)))
+    {
+        if (check(TOKEN_LEFT_PAREN))
+            selfCall();
+        else
+            emitByte(OP_SELF);  // the closure, if the function turns out to capture
+        return;
+    }
+
+    if (!namedVariable(name, canAssign))
+        functionCall();
+}
+
+/**
+ * Array of function pointers.
+ * 
+ * The indexes in the array correspond to the TokenType enum
+ * values, and the function at each index is the code to compile
+ * an expression of that token type.
+*/
+ParseRule rules[] = {
+    [TOKEN_LEFT_PAREN]    = {grouping, call,   PREC_CALL},
+    [TOKEN_RIGHT_PAREN]   = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_LEFT_BRACE]    = {NULL,     NULL,   PREC_NONE}, 
+    [TOKEN_RIGHT_BRACE]   = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_LEFT_BRACKET]  = {arrayLiteral, subscript, PREC_CALL},
+    [TOKEN_RIGHT_BRACKET] = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_COMMA]         = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_DOT]           = {NULL,     dot,    PREC_CALL},
+    [TOKEN_MINUS]         = {unary,    binary, PREC_TERM},
+    [TOKEN_PLUS]          = {NULL,     binary, PREC_TERM},
+    [TOKEN_SEMICOLON]     = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_SLASH]         = {NULL,     binary, PREC_FACTOR},
+    [TOKEN_STAR]          = {NULL,     binary, PREC_FACTOR},
+    [TOKEN_COLON]         = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_BANG]          = {unary,    NULL,   PREC_NONE},
+    [TOKEN_BANG_EQUAL]    = {NULL,     binary, PREC_EQUALITY},
+    [TOKEN_EQUAL]         = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_EQUAL_EQUAL]   = {NULL,     binary, PREC_EQUALITY},
+    [TOKEN_GREATER]       = {NULL,     binary, PREC_COMPARISON},
+    [TOKEN_GREATER_EQUAL] = {NULL,     binary, PREC_COMPARISON},
+    [TOKEN_LESS]          = {NULL,     binary, PREC_COMPARISON},
+    [TOKEN_LESS_EQUAL]    = {NULL,     binary, PREC_COMPARISON},
+    [TOKEN_IDENTIFIER]    = {variable, NULL,   PREC_NONE},
+    [TOKEN_STRING]        = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_NUMBER]        = {number,   NULL,   PREC_NONE},
+    [TOKEN_AND]           = {NULL,     and_,   PREC_AND},
+    [TOKEN_CASE]          = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_CLASS]         = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_DEFAULT]       = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_ELSE]          = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_FALSE]         = {literal,  NULL,   PREC_NONE},
+    [TOKEN_FOR]           = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_FUN]           = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_IF]            = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_NIL]           = {literal,  NULL,   PREC_NONE},
+    [TOKEN_OR]            = {NULL,     or_,    PREC_OR},
+    [TOKEN_PRINT]         = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_RETURN]        = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_SUPER]         = {super_,   NULL,   PREC_NONE},
+    [TOKEN_SWITCH]        = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_THIS]          = {this_,    NULL,   PREC_NONE},
+    [TOKEN_TRUE]          = {literal,  NULL,   PREC_NONE},
+    [TOKEN_VAR]           = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_WHILE]         = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_ERROR]         = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_EOF]           = {NULL,     NULL,   PREC_NONE},
+};
+
+/*
+    Orchestrates all of the parsing functions.
+    This function starts at the current token and parses any expression
+    at the given precedence level or higher. It uses table of parsing
+    function pointers.
+*/
+static void parsePrecedence(Precedence precedence)
+{
+    // read next token.
+    advance();
+    // look up corresponding ParseRule.
+    ParseFn prefixRule = getRule(parser.previous.type)->prefix;
+    if (prefixRule == NULL)
+    {
+        error("An expression expected.");
+        return;
+    }
+    // Assignment is allowed only if the target is parsed at the lowest
+    // precedence. Otherwise "a * b[0] = c" would be parsed as "a * (b[0] = c)".
+    bool canAssign = precedence <= PREC_ASSIGNMENT;
+    // does its stuff and compiles the rest of the prefix expression.
+    prefixRule(canAssign);
+
+    // compiling the infix expressions.
+    // If the next token is too low precedence, or isnt an infix
+    // operator at all, were done.
+    while (precedence <= getRule(parser.current.type)->precedence)
+    {
+        advance(); // if so, consume current token.
+        ParseFn infixRule = getRule(parser.previous.type)->infix;
+        infixRule(canAssign);
+    }
+
+    // Nothing has consumed the '=', so the left side isn't assignable.
+    if (canAssign && match(TOKEN_EQUAL))
+        error("Invalid assignment target.");
+}
+
+static ParseRule* getRule(TokenType type)
+{
+    return &rules[type];
+}
+
+static void expression(void)
+{
+    parsePrecedence(PREC_ASSIGNMENT);
+}
+
+static void beginScope(void)
+{
+    current->scopeDepth++;
+}
+
+/*
+    Rewrites the code from 'start' to 'end' to go through the box of a
+    shared variable: the local in slot 'index' or the capture 'index' of
+    the function the code belongs to. The bodies of the functions declared
+    there are skipped, their locals and captures being their own, except
+    for the closures capturing the variable, which get to share the box.
+*/
+static void shareVariable(int start, int end, int index, bool isLocal)
+{
+    Bytecode *bytecode = currentBytecode();
+
+    // the functions are in the order of their bodies
+    int function = 0;
+    while (function < bytecode->functionCount && bytecode->functions[function].entry <= start)
+        function++;
+
+    for (int offset = start; offset < end; )
+    {
+        while (function < bytecode->functionCount && bytecode->functions[function].entry < offset)
+            function++;
+        if (function < bytecode->functionCount && bytecode->functions[function].entry == offset)
+        {
+            offset = bytecode->functions[function].end;
+            continue;
+        }
+
+        uint8_t *code = bytecode->code + offset;
+        if (isLocal && code[0] == OP_GET_LOCAL && code[1] == index)
+        {
+            code[0] = OP_GET_BOXED;
+        }else if (isLocal && code[0] == OP_SET_LOCAL && code[1] == index)
+        {
+            code[0] = OP_SET_BOXED;
+        }else if (!isLocal && code[0] == OP_GET_CAPTURE && code[1] == index)
+        {
+            code[0] = OP_GET_CAPTURE_BOXED;
+        }else if (code[0] == OP_CLOSURE)
+        {
+            for (int i = 0; i < code[2]; i++)
+            {
+                uint8_t *capture = code + 3 + 2 * i;
+                if (((capture[0] & CAPTURE_LOCAL) != 0) == isLocal && capture[1] == index &&
+                    (capture[0] & CAPTURE_BOXED) == 0)
+                {
+                    capture[0] |= CAPTURE_BOXED;
+                    Function *closed = &bytecode->functions[code[1]];
+                    shareVariable(closed->entry, closed->end, i, false);
+                }
+            }
+        }
+
+        offset += instructionLength(bytecode, offset);
+    }
+}
+
+/*
+    Called as the local goes out of scope, when all its uses are known.
+    A captured local is copied into the closures, unless it is assigned
+    somewhere: then the local and the closures share it through a box.
+*/
+static void boxLocal(int slot)
+{
+    Local *local = &current->locals[slot];
+    if (local->isCaptured && local->isMutated)
+        shareVariable(local->start, currentBytecode()->count, slot, true);
+}
+
+/*
+    Discards the locals declared in the scope being closed.
+*/
+static void endScope(void)
+{
+    current->scopeDepth--;
+
+    while (current->localCount > 0 &&
+           current->locals[current->localCount - 1].depth > current->scopeDepth)
+    {
+        boxLocal(current->localCount - 1);
+        emitByte(OP_POP);
+        current->localCount--;
+    }
+}
+
+/*
+    Compiles declarations until the closing brace of the block.
+    This function assumes that the opening brace has already been consumed.
+*/
+static void block(void)
+{
+    while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF))
+        declaration();
+
+    consume(TOKEN_RIGHT_BRACE, "'}' token expected after block.");
+}
+
+static void printStatement(void)
+{
+    expression();
+    consume(TOKEN_SEMICOLON, "';' token expected after value.");
+    emitByte(OP_PRINT);
+}
+
+/*
+    An expression followed by semicolon. Evaluates the expression
+    for its side effect and discards the result.
+*/
+static void expressionStatement(void)
+{
+    expression();
+    consume(TOKEN_SEMICOLON, "';' token expected after expression.");
+    emitByte(OP_POP);
+}
+
+/*
+    Records a new local in the current scope. Its value is the result
+    of the initializer, which is left on the stack right in its slot.
+*/
+static void addLocal(Token name)
+{
+    if (current->localCount == UINT8_COUNT)
+    {
+        error("Too many local variables in scope.");
+        return;
+    }
+
+    for (int i = current->localCount - 1; i >= 0; i--)
+    {
+        Local *local = &current->locals[i];
+        if (local->depth != -1 && local->depth < current->scopeDepth)
+            break;
+
+        if (identifiersEqual(&name, &local->name))
+            error("Already a variable with this name in this scope.");
+    }
+
+    Local *local = &current->locals[current->localCount++];
+    local->name = name;
+    local->depth = -1;
+    local->start = currentBytecode()->count;
+    local->isCaptured = false;
+    local->isMutated = false;
+}
+
+/*
+    Registers the global variable unless it is already declared.
+    @returns the index of the global or -1 if there are too many of them.
+*/
+static int declareGlobal(Token name)
+{
+    int global = resolveGlobal(&name);
+    if (global >= 0)
+        return global;
+
+    if (globalCount == GLOBALS_MAX)
+    {
+        error("Too many global variables.");
+        return -1;
+    }
+
+    if (globalCount == globalCapacity)
+    {
+        int capacity = INCREASE_CAPACITY(globalCapacity);
+        globals = INCREASE_ARRAY(Token, globals, globalCapacity, capacity);
+        globalCapacity = capacity;
+    }
+
+    char *copy = ALLOCATE(char, name.length);
+    memcpy(copy, name.start, name.length);
+    name.start = copy;
+
+    globals[globalCount] = name;
+    return globalCount++;
+}
+
+/*
+    var name = initializer;
+    At the top level the variable is global, otherwise it is local to
+    the enclosing block. A variable without initializer is nil.
+*/
+static void varDeclaration(void)
+{
+    consume(TOKEN_IDENTIFIER, "Variable name expected.");
+    Token name = parser.previous;
+
+    if (current->scopeDepth > 0)
+        addLocal(name);
+
+    if (match(TOKEN_EQUAL))
+        expression();
+    else
+        emitByte(OP_NIL);
+
+    consume(TOKEN_SEMICOLON, "';' token expected after variable declaration.");
+
+    if (current->scopeDepth > 0)
+    {
+        current->locals[current->localCount - 1].depth = current->scopeDepth;
+        return;
+    }
+
+    // The global is registered after its initializer, so "var a = a;"
+    // refers to the previous declaration of 'a', if there is any.
+    int global = declareGlobal(name);
+    if (global >= 0)
+        emitGlobal(OP_DEFINE_GLOBAL, global);
+}
+
+/*
+    Compiles the parameters and the body of a function, the name being
+    consumed, and jumps over them: the body only runs when called.
+    Then pushes the function: a closure if it captures variables,
+    otherwise the bare function, which needs no allocation.
+    A method is pushed by no code: its class refers to it.
+    @returns the index of the function.
+*/
+static int function(Token name, FunctionType type)
+{
+    int skipJump = emitJump(OP_JUMP);
+    int index = addFunction(currentBytecode(), name.start, name.length);
+    if (index > UINT8_MAX)
+        error("Too many functions.");
+
+    Compiler compiler;
+    initCompiler(&compiler, type, index);
+
+    int arity = 0;
+    if (type != TYPE_FUNCTION)
+    {
+        addLocal(syntheticToken("this"));
+        current->locals[0].depth = current->scopeDepth;
+        arity++;
+    }
+
+    consume(TOKEN_LEFT_PAREN, "'(' token expected after function name.");
+    if (!check(TOKEN_RIGHT_PAREN))
+    {
+        do
+        {
+            if (arity == UINT8_MAX)
+                errorAtCurrent("Can't have more than 255 parameters.");
+            arity++;
+
+            consume(TOKEN_IDENTIFIER, "Parameter name expected.");
+            addLocal(parser.previous);
+            current->locals[current->localCount - 1].depth = current->scopeDepth;
+        } while (match(TOKEN_COMMA));
+    }
+    consume(TOKEN_RIGHT_PAREN, "')' token expected after parameters.");
+    currentBytecode()->functions[index].arity = arity;
+
+    consume(TOKEN_LEFT_BRACE, "'{' token expected before function body.");
+    block();
+
+    // falling off the end returns nil, or the receiver
+    emitEmptyReturn();
+
+    for (int slot = 0; slot < compiler.localCount; slot++)
+        boxLocal(slot);
+
+    Function *info = &currentBytecode()->functions[index];
+    info->end = currentBytecode()->count;
+    info->captureCount = compiler.captureCount;
+
+    current = compiler.enclosing;
+    patchJump(skipJump);
+
+    if (type != TYPE_FUNCTION)
+    {
+        // the methods are called without a closure
+        if (compiler.captureCount > 0)
+            error("A method can't capture local variables.");
+        return index;
+    }
+
+    if (compiler.captureCount == 0)
+    {
+        emitConstant(FUNCTION_VAL(index));
+        return index;
+    }
+
+    // the captures are copies until the scope of the variable proves
+    // it has to be shared
+    emitBytes(OP_CLOSURE, (uint8_t)index);
+    emitByte((uint8_t)compiler.captureCount);
+    for (int i = 0; i < compiler.captureCount; i++)
+    {
+        Capture *capture = &compiler.captures[i];
+        emitBytes(capture->isLocal ? CAPTURE_LOCAL : 0, capture->index);
+    }
+
+    return index;
+}
+
+/*
+    fun name(parameters) { body }
+    The function is a value like any other, stored in a variable named
+    after it: a global at the top level, otherwise a local of the block.
+*/
+static void funDeclaration(void)
+{
+    consume(TOKEN_IDENTIFIER, "Function name expected.");
+    Token name = parser.previous;
+
+    if (current->scopeDepth > 0)
+    {
+        // The body refers to the function by its own name. The local isn't
+        // initialized before the closure: it couldn't capture itself.
+        addLocal(name);
+        function(name, TYPE_FUNCTION);
+        current->locals[current->localCount - 1].depth = current->scopeDepth;
+        return;
+    }
+
+    // registered before the body, which may then call the function through it
+    int global = declareGlobal(name);
+    function(name, TYPE_FUNCTION);
+    if (global >= 0)
+        emitGlobal(OP_DEFINE_GLOBAL, global);
+}
+
+/*
+    The initializer of a class declaring none and inheriting none: it takes
+    no arguments and returns the receiver.
+*/
+static int defaultInitializer(void)
+{
+    int skipJump = emitJump(OP_JUMP);
+    int index = addFunction(currentBytecode(), "init", 4);
+    if (index > UINT8_MAX)
+        error("Too many functions.");
+
+    Function *info = &currentBytecode()->functions[index];
+    info->arity = 1;
+    emitBytes(OP_GET_LOCAL, 0);
+    emitByte(OP_RETURN_VALUE);
+
+    info = &currentBytecode()->functions[index];
+    info->end = currentBytecode()->count;
+    patchJump(skipJump);
+    return index;
+}
+
+/*
+    @returns the class declared with the name before 'klass', the latest
+             one if there are several, -1 if there is none.
+*/
+static int findClass(Token *name, int klass)
+{
+    Bytecode *bytecode = currentBytecode();
+    for (int i = klass - 1; i >= 0; i--)
+    {
+        Class *candidate = &bytecode->classes[i];
+        if (candidate->nameLength == name->length &&
+            memcmp(candidate->name, name->start, name->length) == 0)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/*
+    name(parameters) { body }
+    The method named 'init' is the initializer.
+*/
+static void method(void)
+{
+    consume(TOKEN_IDENTIFIER, "Method name expected.");
+    Token name = parser.previous;
+    uint8_t property = propertyName(&name);
+
+    Token init = syntheticToken("init");
+    FunctionType type = identifiersEqual(&name, &init) ? TYPE_INITIALIZER : TYPE_METHOD;
+    int index = function(name, type);
+
+    Bytecode *bytecode = currentBytecode();
+    addMethod(bytecode, currentClass->klass, property, index);
+    if (type == TYPE_INITIALIZER)
+        bytecode->classes[currentClass->klass].initializer = index;
+}
+
+/*
+    class Name < Superclass { methods }
+
+    The class is a value stored in a variable named after it, like a
+    function. The superclass is the latest class declared by that name:
+    classes are resolved at compile time, and the methods it has are
+    copied into the new class, which may then override them.
+*/
+static void classDeclaration(void)
+{
+    consume(TOKEN_IDENTIFIER, "Class name expected.");
+    Token name = parser.previous;
+
+    Bytecode *bytecode = currentBytecode();
+    int klass = addClass(bytecode, name.start, name.length);
+    if (klass > UINT8_MAX)
+        error("Too many classes.");
+
+    if (match(TOKEN_LESS))
+    {
+        consume(TOKEN_IDENTIFIER, "Superclass name expected.");
+        int superclass = findClass(&parser.previous, klass);
+
+        if (identifiersEqual(&name, &parser.previous))
+        {
+            error("A class can't inherit from itself.");
+        }else if (superclass < 0)
+        {
+            error("Superclass must be a class declared before.");
+        }else
+        {
+            bytecode->classes[klass].superclass = superclass;
+            bytecode->classes[klass].initializer = bytecode->classes[superclass].initializer;
+            for (int i = 0; i < bytecode->classes[superclass].methodCount; i++)
+            {
+                Method *method = &bytecode->classes[superclass].methods[i];
+                addMethod(bytecode, klass, method->name, method->function);
+            }
+        }
+    }
+
+    // the variable is defined before the methods, which may refer to it
+    if (current->scopeDepth > 0)
+    {
+        addLocal(name);
+        emitConstant(CLASS_VAL(klass));
+        current->locals[current->localCount - 1].depth = current->scopeDepth;
+    }else
+    {
+        int global = declareGlobal(name);
+        emitConstant(CLASS_VAL(klass));
+        if (global >= 0)
+            emitGlobal(OP_DEFINE_GLOBAL, global);
+    }
+
+    ClassCompiler classCompiler;
+    classCompiler.enclosing = currentClass;
+    classCompiler.klass = klass;
+    currentClass = &classCompiler;
+
+    consume(TOKEN_LEFT_BRACE, "'{' token expected before class body.");
+    while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF))
+        method();
+    consume(TOKEN_RIGHT_BRACE, "'}' token expected after class body.");
+
+    if (bytecode->classes[klass].initializer < 0)
+        bytecode->classes[klass].initializer = defaultInitializer();
+
+    currentClass = classCompiler.enclosing;
+}
+
+/*
+    return;
+    return value;
+
+    A value which is a call, the last instruction of the expression, is
+    a tail call: the callee takes over the frame of the returning function
+    and returns to its caller, so that recursion in tail position runs in
+    constant stack. OP_RETURN_VALUE is kept for the other paths of the
+    expression, e.g. the left operand of 'or'.
+*/
+static void returnStatement(void)
+{
+    if (current->type == TYPE_SCRIPT)
+        error("Can't return from top-level code.");
+
+    if (match(TOKEN_SEMICOLON))
+    {
+        emitEmptyReturn();
+        return;
+    }
+
+    if (current->type == TYPE_INITIALIZER)
+        error("Can't return a value from an initializer.");
+
+    expression();
+    consume(TOKEN_SEMICOLON, "';' token expected after return value.");
+
+    Bytecode *bytecode = currentBytecode();
+    if (current->lastCall >= 0 && current->lastCall + 2 == bytecode->count)
+    {
+        uint8_t *call = &bytecode->code[current->lastCall];
+        *call = *call == OP_CALL ? OP_TAIL_CALL : OP_TAIL_CALL_SELF;
+    }
+
+    emitByte(OP_RETURN_VALUE);
+}
+
+static void ifStatement(void)
+{
+    consume(TOKEN_LEFT_PAREN, "'(' token expected after 'if'.");
+    expression();
+    consume(TOKEN_RIGHT_PAREN, "')' token expected after condition.");
+
+    int thenJump = emitJumpIfFalse();
+    statement();
+
+    if (match(TOKEN_ELSE))
+    {
+        int elseJump = emitJump(OP_JUMP);
+        patchJump(thenJump);
+        statement();
+        patchJump(elseJump);
+    }else
+    {
+        patchJump(thenJump);
+    }
+}
+
+static void whileStatement(void)
+{
+    int loopStart = currentBytecode()->count;
+
+    consume(TOKEN_LEFT_PAREN, "'(' token expected after 'while'.");
+    expression();
+    consume(TOKEN_RIGHT_PAREN, "')' token expected after condition.");
+
+    int exitJump = emitJumpIfFalse();
+    statement();
+    emitLoop(loopStart);
+
+    patchJump(exitJump);
+}
+
+/*
+    for (initializer; condition; increment) body
+
+    The increment appears in the source before the body but runs after it.
+    Instead of jumping around the increment on every iteration, its code is
+    compiled in place, cut off and appended after the body:
+
+        <initializer>
+    loop:
+        <condition>
+        OP_JUMP_IF_FALSE exit
+        <body>
+        <increment>
+        OP_LOOP          loop
+    exit:
+
+    The increment is an expression, so all its jumps are relative and
+    internal: moving it as a whole keeps them valid.
+*/
+static void forStatement(void)
+{
+    beginScope();
+    consume(TOKEN_LEFT_PAREN, "'(' token expected after 'for'.");
+
+    if (match(TOKEN_SEMICOLON))
+    {
+        // No initializer.
+    }else if (match(TOKEN_VAR))
+    {
+        varDeclaration();
+    }else
+    {
+        expressionStatement();
+    }
+
+    Bytecode *bytecode = currentBytecode();
+    int loopStart = bytecode->count;
+    int exitJump = -1;
+
+    if (!match(TOKEN_SEMICOLON))
+    {
+        expression();
+        consume(TOKEN_SEMICOLON, "';' token expected after loop condition.");
+        exitJump = emitJumpIfFalse();
+    }
+
+    uint8_t *increment = NULL;
+    int *incrementLines = NULL;
+    int incrementLength = 0;
+
+    if (!match(TOKEN_RIGHT_PAREN))
+    {
+        int incrementStart = bytecode->count;
+        expression();
+        emitByte(OP_POP);
+        consume(TOKEN_RIGHT_PAREN, "')' token expected after for clauses.");
+
+        incrementLength = bytecode->count - incrementStart;
+        increment = ALLOCATE_SCRATCH(uint8_t, incrementLength);
+        incrementLines = ALLOCATE_SCRATCH(int, incrementLength);
+        memcpy(increment, bytecode->code + incrementStart, incrementLength);
+        memcpy(incrementLines, bytecode->lines + incrementStart, incrementLength * sizeof(int));
+
+        bytecode->count = incrementStart;
+        // the offsets recorded inside the increment are no longer valid
+        current->fusableEnd = -1;
+        current->lastTarget = incrementStart;
+        current->lastCall = -1;
+    }
+
+    statement();
+
+    for (int i = 0; i < incrementLength; i++)
+        appendBytecode(bytecode, increment[i], incrementLines[i]);
+
+    FREE_SCRATCH(uint8_t, increment, incrementLength);
+    FREE_SCRATCH(int, incrementLines, incrementLength);
+
+    emitLoop(loopStart);
+
+    if (exitJump != -1)
+        patchJump(exitJump);
+
+    endScope();
+}
+
+/*
+    A single 'case' label of a switch statement.
+*/
+typedef struct
+{
+    Value key;      // the value after 'case' keyword
+    int target;     // offset of the first instruction of the case body
+} SwitchCase;
+
+/*
+    Switches with fewer cases than this are dispatched by a chain of
+    OP_CASE comparisons: for them a table doesn't pay off.
+*/
+#define SWITCH_TINY 4
+
+/*
+    Parses the value of a 'case' label. It must be a literal: a number
+    (possibly negative), 'true', 'false' or 'nil'.
+    @returns false if the value is not a literal.
+*/
+static bool caseValue(Value *value)
+{
+    bool negate = match(TOKEN_MINUS);
+
+    if (match(TOKEN_NUMBER))
+    {
+        double number;
+        if (!parseNumber(parser.previous.start, parser.previous.length, &number))
+            error("Malformed number.");
+        *value = NUMBER_VAL(negate ? -number : number);
+        return true;
+    }
+
+    if (!negate)
+    {
+        if (match(TOKEN_TRUE))  { *value = BOOL_VAL(true);  return true; }
+        if (match(TOKEN_FALSE)) { *value = BOOL_VAL(false); return true; }
+        if (match(TOKEN_NIL))   { *value = NIL_VAL;         return true; }
+    }
+
+    errorAtCurrent("Case value must be a literal.");
+    return false;
+}
+
+static bool isInt32Key(Value key)
+{
+    if (!IS_NUMBER(key))
+        return false;
+
+    double number = AS_NUMBER(key);
+    return number >= INT32_MIN && number <= INT32_MAX &&
+           (double)(int32_t)number == number;
+}
+
+static int compareCases(const void *a, const void *b)
+{
+    double left = AS_NUMBER(((const SwitchCase*)a)->key);
+    double right = AS_NUMBER(((const SwitchCase*)b)->key);
+    return (left > right) - (left < right);
+}
+
+/*
+    Calculates the backward distance from the end of a dispatch
+    instruction to the case body. The target -1 stands for the end of
+    the switch, which immediately follows the dispatch instruction.
+*/
+static uint16_t caseDistance(int instructionEnd, int target)
+{
+    if (target < 0)
+        return 0;
+
+    int distance = instructionEnd - target;
+    if (distance > UINT16_MAX)
+    {
+        error("Too much code in switch statement.");
+        return 0;
+    }
+
+    return (uint16_t)distance;
+}
+
+/*
+    Emits the instruction which transfers control to one of the case bodies.
+    All the bodies have already been compiled, so each target lies behind
+    the dispatch instruction. The choice of the instruction depends on the
+    density of the case values:
+    - a few cases, or non-integer ones: a chain of OP_CASE comparisons;
+    - compact integers: OP_TABLESWITCH, indexing a jump table in O(1);
+    - sparse integers: OP_LOOKUPSWITCH, a binary search over sorted keys.
+*/
+static void emitSwitchDispatch(SwitchCase *cases, int count, int defaultTarget)
+{
+    bool intKeys = true;
+    for (int i = 0; i < count; i++)
+        intKeys = intKeys && isInt32Key(cases[i].key);
+
+    Bytecode *bytecode = currentBytecode();
+
+    if (!intKeys || count < SWITCH_TINY)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            emitByte(OP_CASE);
+            emitShort((uint16_t)makeConstant(cases[i].key));
+            emitShort(caseDistance(bytecode->count + 2, cases[i].target));
+        }
+
+        // none of the cases matched: drop the subject and go to 'default'
+        emitByte(OP_POP);
+        if (defaultTarget >= 0)
+        {
+            emitByte(OP_JUMP_BACK);
+            emitShort(caseDistance(bytecode->count + 2, defaultTarget));
+        }
+        return;
+    }
+
+    qsort(cases, count, sizeof(SwitchCase), compareCases);
+
+    int32_t low = (int32_t)AS_NUMBER(cases[0].key);
+    int64_t range = (int64_t)AS_NUMBER(cases[count - 1].key) - low + 1;
+
+    // at least every second slot of the table holds a case
+    if (range <= 2 * (int64_t)count && range <= UINT16_MAX)
+    {
+        int end = bytecode->count + 1 + 4 + 2 + 2 + 2 * (int)range;
+        emitByte(OP_TABLESWITCH);
+        emitInt32(low);
+        emitShort((uint16_t)range);
+        emitShort(caseDistance(end, defaultTarget));
+
+        int next = 0;
+        for (int32_t key = 0; key < range; key++)
+        {
+            if (next < count && (int32_t)AS_NUMBER(cases[next].key) - low == key)
+            {
+                emitShort(caseDistance(end, cases[next].target));
+                next++;
+            }else
+            {
+                // a hole in the table
+                emitShort(caseDistance(end, defaultTarget));
+            }
+        }
+        return;
+    }
+
+    if (count > UINT16_MAX)
+    {
+        error("Too many cases in switch statement.");
+        return;
+    }
+
+    int end = bytecode->count + 1 + 2 + 2 + 6 * count;
+    emitByte(OP_LOOKUPSWITCH);
+    emitShort((uint16_t)count);
+    emitShort(caseDistance(end, defaultTarget));
+    for (int i = 0; i < count; i++)
+    {
+        emitInt32((int32_t)AS_NUMBER(cases[i].key));
+        emitShort(caseDistance(end, cases[i].target));
+    }
+}
+
+/*
+    switch (subject) { case 1: ... case 2, 3: ... case 4: default: ... }
+
+    There is no fall through: each case body ends by a jump out of the switch.
+    A label followed right away by another one has no body of its own and
+    shares the next one, like the values of a list.
+    The dispatch instruction can only be emitted once all the case values
+    are known, so it is placed after the bodies:
+
+        <subject>
+        OP_JUMP      dispatch
+        <body 1>
+        OP_JUMP      end
+        ...
+        <body N>
+        OP_JUMP      end
+    dispatch:
+        OP_TABLESWITCH | OP_LOOKUPSWITCH | OP_CASE chain
+    end:
+*/
+static void switchStatement(void)
+{
+    consume(TOKEN_LEFT_PAREN, "'(' token expected after 'switch'.");
+    expression();
+    consume(TOKEN_RIGHT_PAREN, "')' token expected after switch subject.");
+    consume(TOKEN_LEFT_BRACE, "'{' token expected before switch body.");
+
+    int dispatchJump = emitJump(OP_JUMP);
+
+    SwitchCase *cases = NULL;
+    int caseCount = 0;
+    int caseCapacity = 0;
+    int *endJumps = NULL;
+    int endCount = 0;
+    int endCapacity = 0;
+    int defaultTarget = -1;
+
+    while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF))
+    {
+        int target = currentBytecode()->count;
+
+        if (match(TOKEN_CASE))
+        {
+            do
+            {
+                Value key;
+                if (!caseValue(&key))
+                    break;
+
+                for (int i = 0; i < caseCount; i++)
+                {
+                    if (valuesEqual(cases[i].key, key))
+                        error("Duplicate case value.");
+                }
+
+                if (caseCapacity < caseCount + 1)
+                {
+                    int oldCapacity = caseCapacity;
+                    caseCapacity = INCREASE_CAPACITY(oldCapacity);
+                    cases = INCREASE_SCRATCH(SwitchCase, cases, oldCapacity, caseCapacity);
+                }
+                cases[caseCount].key = key;
+                cases[caseCount].target = target;
+                caseCount++;
+            } while (match(TOKEN_COMMA));
+        }else if (match(TOKEN_DEFAULT))
+        {
+            if (defaultTarget >= 0)
+                error("Multiple 'default' labels in one switch.");
+            defaultTarget = target;
+        }else
+        {
+            errorAtCurrent("'case' or 'default' expected.");
+            break;
+        }
+        consume(TOKEN_COLON, "':' token expected after case label.");
+
+        // the next label targets the same body, nothing having been emitted
+        if (check(TOKEN_CASE) || check(TOKEN_DEFAULT))
+            continue;
+
+        while (!check(TOKEN_CASE) && !check(TOKEN_DEFAULT) &&
+               !check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF))
+        {
+            statement();
+        }
+
+        if (endCapacity < endCount + 1)
+        {
+            int oldCapacity = endCapacity;
+            endCapacity = INCREASE_CAPACITY(oldCapacity);
+            endJumps = INCREASE_SCRATCH(int, endJumps, oldCapacity, endCapacity);
+        }
+        endJumps[endCount++] = emitJump(OP_JUMP);
+    }
+
+    consume(TOKEN_RIGHT_BRACE, "'}' token expected after switch body.");
+
+    patchJump(dispatchJump);
+    emitSwitchDispatch(cases, caseCount, defaultTarget);
+
+    for (int i = 0; i < endCount; i++)
+        patchJump(endJumps[i]);
+
+    FREE_SCRATCH(SwitchCase, cases, caseCapacity);
+    FREE_SCRATCH(int, endJumps, endCapacity);
+}
+
+/*
+    Skips tokens until it reaches a statement boundary, so that a single
+    error doesn't produce a cascade of meaningless ones.
+*/
+static void synchronize(void)
+{
+    parser.panicMode = false;
+
+    while (parser.current.type != TOKEN_EOF)
+    {
+        if (parser.previous.type == TOKEN_SEMICOLON)
+            return;
+
+        switch (parser.current.type)
+        {
+            case TOKEN_CLASS:
+            case TOKEN_FUN:
+            case TOKEN_VAR:
+            case TOKEN_FOR:
+            case TOKEN_IF:
+            case TOKEN_WHILE:
+            case TOKEN_PRINT:
+            case TOKEN_SWITCH:
+            case TOKEN_RETURN:
+                return;
+            default:
+                ; // Do nothing.
+        }
+
+        advance();
+    }
+}
+
+static void declaration(void)
+{
+    if (match(TOKEN_CLASS))
+        classDeclaration();
+    else if (match(TOKEN_FUN))
+        funDeclaration();
+    else if (match(TOKEN_VAR))
+        varDeclaration();
+    else
+        statement();
+
+    if (parser.panicMode)
+        synchronize();
+}
+
+static void statement(void)
+{
+    if (match(TOKEN_PRINT))
+    {
+        printStatement();
+    }else if (match(TOKEN_IF))
+    {
+        ifStatement();
+    }else if (match(TOKEN_WHILE))
+    {
+        whileStatement();
+    }else if (match(TOKEN_FOR))
+    {
+        forStatement();
+    }else if (match(TOKEN_SWITCH))
+    {
+        switchStatement();
+    }else if (match(TOKEN_RETURN))
+    {
+        returnStatement();
+    }else if (match(TOKEN_LEFT_BRACE))
+    {
+        beginScope();
+        block();
+        endScope();
+    }else
+    {
+        expressionStatement();
+    }
+}
+
+/*
+    Forgets the names of the globals declared from the given index on,
+    and the array of the names once none is left.
+*/
+static void forgetGlobals(int count)
+{
+    while (globalCount > count)
+    {
+        Token *name = &globals[--globalCount];
+        FREE_ARRAY(char, (char*)name->start, name->length);
+    }
+
+    if (globalCount == 0)
+    {
+        FREE_ARRAY(Token, globals, globalCapacity);
+        globals = NULL;
+        globalCapacity = 0;
+    }
+}
+
+void abandonCompiler(void)
+{
+    compiling = false;
+    globals = NULL;
+    globalCapacity = 0;
+    globalCount = 0;
+    currentClass = NULL;
+    initScanner("");
+}
+
+void rollBackCompiler(void)
+{
+    if (compiling)
+    {
+        truncateBytecode(compilingBytecode, compileMark);
+        forgetGlobals(compileGlobals);
+        compiling = false;
+    }
+
+    // the temporaries of the compile, or of the verifier and the JIT after it
+    freeScratch();
+    currentClass = NULL;
+    freeScanner();
+    initScanner("");
+}
+
+int globalNames(Name *names)
+{
+    for (int i = 0; i < globalCount && names != NULL; i++)
+        names[i] = (Name){(char*)globals[i].start, globals[i].length};
+    return globalCount;
+}
+
+void setGlobalNames(const Name *names, int count)
+{
+    forgetGlobals(0);
+    globals = ALLOCATE(Token, count);
+    globalCapacity = count;
+    for (int i = 0; i < count; i++)
+    {
+        char *copy = ALLOCATE(char, names[i].length);
+        memcpy(copy, names[i].chars, names[i].length);
+        globals[i] = (Token){TOKEN_IDENTIFIER, copy, names[i].length, 0};
+        globalCount = i + 1;
+    }
+}
+
+void setOptimizationLevel(int level)
+{
+    optimization = level;
+}
+
+int optimizationLevel(void)
+{
+    return optimization;
+}
+
+bool compile(const char *source, Bytecode *bytecode)
+{
+    forgetGlobals(0);
+    bool compiled = compileAppend(source, bytecode);
+    forgetGlobals(0);
+    return compiled;
+}
+
+/*
+    Compiles the tokens of the Scanner to the end of the bytecode.
+    On error, the bytecode and the globals are left as they were.
+*/
+static bool compileTokens(Bytecode *bytecode)
+{
+    compilingBytecode = bytecode;
+    current = NULL;
+    currentClass = NULL;
+
+    Compiler compiler;
+    initCompiler(&compiler, TYPE_SCRIPT, -1);
+    codeStart = bytecode->count;
+
+    compileMark = markBytecode(bytecode);
+    compileGlobals = globalCount;
+    compiling = true;
+
+    parser.hadError = false;
+    parser.panicMode = false;
+
+    advance();          // turn Scanner on.
+
+    while (!match(TOKEN_EOF))
+        declaration();
+
+    endCompiler();
+    compiling = false;
+
+    if (parser.hadError)
+    {
+        truncateBytecode(bytecode, compileMark);
+        forgetGlobals(compileGlobals);
+    }
+
+    return !parser.hadError;
+}
+
+bool compileAppend(const char *source, Bytecode *bytecode)
+{
+    initScanner(source);
+    return compileTokens(bytecode);
+}
+
+bool compileStream(FILE *file, Bytecode *bytecode)
+{
+    forgetGlobals(0);
+    initStreamScanner(file);
+    bool compiled = compileTokens(bytecode);
+    freeScanner();
+    forgetGlobals(0);
+    return compiled;
 }
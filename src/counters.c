@@ -0,0 +1,403 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include "../include/bytecode.h"
+#include "../include/counters.h"
+#include "../include/vm.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// the names of the counters in the JSON output
+static const char *counterNames[COUNTER_COUNT] = {
+    "cycles", "instructions", "branch-misses", "l1d-misses",
+};
+
+#ifdef BEE_OPCODE_COUNTERS
+static const char *familyNames[FAMILY_COUNT] = {
+    "constant", "arithmetic", "variable", "array", "property",
+    "jump", "loop", "switch", "call", "print",
+};
+#endif
+
+#ifdef __linux__
+/*
+    Sets the perf_event_open() type and config of the counter.
+*/
+static void describeCounter(Counter counter, struct perf_event_attr *attr)
+{
+    attr->type = PERF_TYPE_HARDWARE;
+    switch (counter)
+    {
+        case COUNTER_CYCLES:        attr->config = PERF_COUNT_HW_CPU_CYCLES;     break;
+        case COUNTER_INSTRUCTIONS:  attr->config = PERF_COUNT_HW_INSTRUCTIONS;   break;
+        case COUNTER_BRANCH_MISSES: attr->config = PERF_COUNT_HW_BRANCH_MISSES;  break;
+        default:
+            attr->type = PERF_TYPE_HW_CACHE;
+            attr->config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                           (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+    }
+}
+
+/*
+    Reads the whole group at once, in the order the counters were opened.
+    @returns false if the read failed.
+*/
+static bool readGroup(uint64_t values[COUNTER_COUNT], bool scaled)
+{
+    Counters *counters = &vm.counters;
+    // the number of counters, the times enabled and running, then the counts
+    uint64_t data[3 + COUNTER_COUNT];
+    if (read(counters->leader, data, sizeof(data)) < (ssize_t)(3 * sizeof(uint64_t)))
+        return false;
+
+    double scale = 1.0;
+    if (scaled && data[2] > 0 && data[2] < data[1])
+        scale = (double)data[1] / (double)data[2];
+
+    int next = 0;
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        if (counters->fds[i] < 0)
+            continue;
+
+        values[i] = (uint64_t)(data[3 + next++] * scale);
+    }
+    return true;
+}
+#endif
+
+bool openCounters(void)
+{
+#ifdef __linux__
+    Counters *counters = &vm.counters;
+    closeCounters();
+
+    counters->leader = -1;
+    char missing[128] = "";
+    int error = 0;
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        describeCounter((Counter)i, &attr);
+        // the group starts disabled and is enabled through its leader
+        attr.disabled = counters->leader < 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        counters->fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, counters->leader, 0);
+        if (counters->fds[i] < 0)
+        {
+            error = errno;
+            if (missing[0] != '\0')
+                strcat(missing, ", ");
+            strcat(missing, counterNames[i]);
+            continue;
+        }
+
+        if (counters->leader < 0)
+            counters->leader = counters->fds[i];
+#ifdef BEE_OPCODE_COUNTERS
+        counters->pages[i] = mmap(NULL, (size_t)sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED,
+                                  counters->fds[i], 0);
+        if (counters->pages[i] == MAP_FAILED)
+            counters->pages[i] = NULL;
+#endif
+    }
+
+    if (missing[0] != '\0')
+        fprintf(stderr, "The hardware counters %s aren't available: %s.\n", missing, strerror(error));
+
+#ifdef BEE_OPCODE_COUNTERS
+    counters->family = -1;
+#endif
+    counters->open = true;
+    return true;
+#else
+    fprintf(stderr, "Hardware counters aren't supported on this platform.\n");
+    return false;
+#endif
+}
+
+void closeCounters(void)
+{
+#ifdef __linux__
+    Counters *counters = &vm.counters;
+    if (!counters->open)
+        return;
+
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+#ifdef BEE_OPCODE_COUNTERS
+        if (counters->pages[i] != NULL)
+            munmap(counters->pages[i], (size_t)sysconf(_SC_PAGESIZE));
+#endif
+        if (counters->fds[i] >= 0)
+            close(counters->fds[i]);
+    }
+#endif
+    vm.counters = (Counters){0};
+}
+
+#if defined(BEE_OPCODE_COUNTERS) && defined(__linux__)
+#if defined(__x86_64__) && defined(__GNUC__)
+static inline uint64_t rdpmc(uint32_t counter)
+{
+    uint32_t low, high;
+    __asm__ volatile("rdpmc" : "=a"(low), "=d"(high) : "c"(counter));
+    return (uint64_t)low | ((uint64_t)high << 32);
+}
+
+/*
+    Reads a counter from user mode, following the protocol of its page.
+    @returns false if the counter can't be read that way just now.
+*/
+static bool readMapped(volatile struct perf_event_mmap_page *page, uint64_t *value)
+{
+    uint32_t sequence;
+    uint64_t count;
+    do
+    {
+        sequence = page->lock;
+        __asm__ volatile("" ::: "memory");
+
+        uint32_t index = page->index;
+        if (!page->cap_user_rdpmc || index == 0)
+            return false;
+
+        // the hardware counter holds the low 'pmc_width' bits, sign-extended
+        int shift = 64 - page->pmc_width;
+        int64_t pmc = (int64_t)(rdpmc(index - 1) << shift) >> shift;
+        count = (uint64_t)(page->offset + pmc);
+
+        __asm__ volatile("" ::: "memory");
+    } while (page->lock != sequence);
+
+    *value = count;
+    return true;
+}
+#else
+static bool readMapped(volatile struct perf_event_mmap_page *page, uint64_t *value)
+{
+    (void)page;
+    (void)value;
+    return false;
+}
+#endif
+
+/*
+    Reads the counters without scaling them, through rdpmc if they all
+    allow it.
+*/
+static bool readNow(uint64_t values[COUNTER_COUNT])
+{
+    Counters *counters = &vm.counters;
+    bool mapped = true;
+    for (int i = 0; i < COUNTER_COUNT && mapped; i++)
+    {
+        if (counters->fds[i] >= 0)
+            mapped = counters->pages[i] != NULL && readMapped(counters->pages[i], &values[i]);
+    }
+
+    return mapped || readGroup(values, false);
+}
+
+static OpcodeFamily familyOf(uint8_t instruction)
+{
+    switch (instruction)
+    {
+        case OP_CONSTANT:
+        case OP_CONSTANT_LONG:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+            return FAMILY_CONSTANT;
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_NOT:
+        case OP_NEGATE:
+            return FAMILY_ARITHMETIC;
+        case OP_ARRAY:
+        case OP_INDEX_GET:
+        case OP_INDEX_SET:
+        case OP_INTRINSIC:
+            return FAMILY_ARRAY;
+        case OP_POP:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_BOXED:
+        case OP_SET_BOXED:
+        case OP_GET_CAPTURE:
+        case OP_GET_CAPTURE_BOXED:
+        case OP_SET_CAPTURE:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+            return FAMILY_VARIABLE;
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+            return FAMILY_PROPERTY;
+        case OP_LOOP:
+        case OP_LOOP_SHORT:
+            return FAMILY_LOOP;
+        case OP_CASE:
+        case OP_TABLESWITCH:
+        case OP_LOOKUPSWITCH:
+            return FAMILY_SWITCH;
+        case OP_PRINT:
+            return FAMILY_PRINT;
+        case OP_NATIVE:
+        case OP_INVOKE:
+        case OP_CALL:
+        case OP_CALL_SELF:
+        case OP_TAIL_CALL:
+        case OP_TAIL_CALL_SELF:
+        case OP_CLOSURE:
+        case OP_SELF:
+        case OP_RETURN_VALUE:
+        case OP_RETURN:
+            return FAMILY_CALL;
+        default:
+            return FAMILY_JUMP;
+    }
+}
+
+/*
+    Puts down what has been counted since the last read to the family of
+    the instruction being counted, if any.
+*/
+static void countFamily(void)
+{
+    Counters *counters = &vm.counters;
+    uint64_t values[COUNTER_COUNT] = {0};
+    if (counters->leader < 0 || !readNow(values))
+        return;
+
+    if (counters->family >= 0)
+    {
+        FamilyCounts *family = &counters->families[counters->family];
+        for (int i = 0; i < COUNTER_COUNT; i++)
+            family->counts[i] += values[i] - counters->last[i];
+    }
+    memcpy(counters->last, values, sizeof(values));
+}
+
+void countOpcode(uint8_t instruction)
+{
+    Counters *counters = &vm.counters;
+    if (!counters->running)
+        return;
+
+    countFamily();
+    counters->family = familyOf(instruction);
+    counters->families[counters->family].dispatches++;
+}
+#endif
+
+void startCounters(void)
+{
+#ifdef __linux__
+    Counters *counters = &vm.counters;
+    if (!counters->open || counters->running)
+        return;
+
+    // without any counter, the profiling build still counts the dispatches
+    if (counters->leader >= 0)
+        ioctl(counters->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    counters->running = true;
+#ifdef BEE_OPCODE_COUNTERS
+    counters->family = -1;
+    countFamily();
+#endif
+#endif
+}
+
+void stopCounters(void)
+{
+#ifdef __linux__
+    Counters *counters = &vm.counters;
+    if (!counters->running)
+        return;
+
+#ifdef BEE_OPCODE_COUNTERS
+    // the rest goes to the last instruction
+    countFamily();
+    counters->family = -1;
+#endif
+    if (counters->leader >= 0)
+        ioctl(counters->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    counters->running = false;
+#endif
+}
+
+/*
+    Writes the counts as JSON members, null where the counter is missing.
+*/
+static void writeCounts(FILE *file, const uint64_t values[COUNTER_COUNT])
+{
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        fprintf(file, "%s\"%s\": ", i > 0 ? ", " : "", counterNames[i]);
+        if (vm.counters.open && vm.counters.fds[i] >= 0)
+            fprintf(file, "%llu", (unsigned long long)values[i]);
+        else
+            fputs("null", file);
+    }
+}
+
+bool writeCounters(const char *path)
+{
+    uint64_t values[COUNTER_COUNT] = {0};
+#ifdef __linux__
+    if (vm.counters.open && vm.counters.leader >= 0 && !readGroup(values, true))
+    {
+        fprintf(stderr, "Couldn't read the hardware counters: %s.\n", strerror(errno));
+        return false;
+    }
+#endif
+
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Couldn't write the counters \"%s\".\n", path);
+        return false;
+    }
+
+    fputs("{", file);
+    writeCounts(file, values);
+#ifdef BEE_OPCODE_COUNTERS
+    fputs(",\n \"families\": {", file);
+    for (int i = 0; i < FAMILY_COUNT; i++)
+    {
+        FamilyCounts *family = &vm.counters.families[i];
+        fprintf(file, "%s\n  \"%s\": {\"dispatches\": %llu, ", i > 0 ? "," : "", familyNames[i],
+                (unsigned long long)family->dispatches);
+        writeCounts(file, family->counts);
+        fputs("}", file);
+    }
+    fputs("\n }", file);
+#endif
+    fputs("}\n", file);
+
+    if (fclose(file) != 0)
+    {
+        fprintf(stderr, "Couldn't write the counters \"%s\".\n", path);
+        return false;
+    }
+    return true;
+}
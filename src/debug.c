@@ -1,6 +1,9 @@
 #include <stdio.h>
+#include "../include/array.h"
 #include "../include/debug.h"
+#include "../include/output.h"
 #include "../include/value.h"
+#include "../include/vm.h"
 
 void disassembleBytecode(Bytecode *bytecode, const char *name)
 {
@@ -12,31 +15,202 @@ void disassembleBytecode(Bytecode *bytecode, const char *name)
     }
 }
 
-// static int lconstantInstruction(const char *name, Bytecode *bytecode, int offset)
-// {
-//     // fetch OP_CONSTANT_LONG's operand which resides at three subsequent bytes.
-//     uint32_t constant = (uint16_t)((((uint16_t)bytecode->code[offset + 1]) << 16) |
-//                                    (((uint16_t)bytecode->code[offset + 2]) <<  8) |
-//                                      (uint16_t)bytecode->code[offset + 3]);
-
-//     // print "OP_CONSTANT" and operand's value
-//     printf("%-16s %4d '", name, constant);
-//     // print the constant at index 'constant' in ConstantPool
-//     printValue(bytecode->constantPool.constants[constant]);
-//     return offset + 4;
-// }
+static uint16_t readShort(Bytecode *bytecode, int offset)
+{
+    return (uint16_t)((bytecode->code[offset] << 8) | bytecode->code[offset + 1]);
+}
 
-static int constantInstruction(const char *name, Bytecode *bytecode, int offset)
+/*
+    Handler function of OP_CONSTANT and OP_CONSTANT_LONG, whose index
+    takes 'width' bytes.
+*/
+static int constantInstruction(const char *name, Bytecode *bytecode, int offset, int width)
 {
-    // fetch OP_CONSTANT's operand which resides right after it.
-    uint8_t constant = bytecode->code[offset + 1];
+    // fetch the operand which resides right after the opcode.
+    int constant = width == 1 ? bytecode->code[offset + 1] : readShort(bytecode, offset + 1);
     // print "OP_CONSTANT" and operand's value
     printf("%-16s %4d '", name, constant);
     // print the constant at index 'constant' in ConstantPool
+    Value value = bytecode->constantPool.constants[constant];
+    if (IS_FUNCTION(value) && AS_FUNCTION(value) < bytecode->functionCount)
+    {
+        // the code being disassembled may not be running yet
+        Function *function = &bytecode->functions[AS_FUNCTION(value)];
+        printf("<fn %.*s>", function->nameLength, function->name);
+    }else if (IS_CLASS(value) && AS_CLASS(value) < bytecode->classCount)
+    {
+        Class *klass = &bytecode->classes[AS_CLASS(value)];
+        printf("<class %.*s>", klass->nameLength, klass->name);
+    }else
+    {
+        printValue(value);
+        flushOutput();
+    }
+    printf("'\n");
+    return offset + 1 + width;
+}
+
+/*
+    Handler function of instructions with a one-byte operand.
+*/
+static int byteInstruction(const char *name, Bytecode *bytecode, int offset)
+{
+    uint8_t operand = bytecode->code[offset + 1];
+    printf("%-16s %4d\n", name, operand);
+    return offset + 2;
+}
+
+/*
+    Handler function of instructions with a 16-bit operand.
+*/
+static int shortInstruction(const char *name, Bytecode *bytecode, int offset)
+{
+    printf("%-16s %4d\n", name, readShort(bytecode, offset + 1));
+    return offset + 3;
+}
+
+/*
+    Handler function of jump instructions with a 16-bit operand.
+    @param sign 1 for forward jumps, -1 for backward ones.
+*/
+static int jumpInstruction(const char *name, int sign, Bytecode *bytecode, int offset)
+{
+    uint16_t jump = (uint16_t)((bytecode->code[offset + 1] << 8) | bytecode->code[offset + 2]);
+    printf("%-16s %4d -> %d\n", name, offset, offset + 3 + sign * jump);
+    return offset + 3;
+}
+
+/*
+    Handler function of jump instructions with an 8-bit operand.
+*/
+static int shortJumpInstruction(const char *name, int sign, Bytecode *bytecode, int offset)
+{
+    uint8_t jump = bytecode->code[offset + 1];
+    printf("%-16s %4d -> %d\n", name, offset, offset + 2 + sign * jump);
+    return offset + 2;
+}
+
+/*
+    Handler function of loop back-edges: [loop, offset, counter].
+    @param int width of the offset operand in bytes.
+*/
+static int loopInstruction(const char *name, int width, Bytecode *bytecode, int offset)
+{
+    int jump = width == 1 ? bytecode->code[offset + 1]
+                          : (bytecode->code[offset + 1] << 8) | bytecode->code[offset + 2];
+    int end = offset + 3 + width;
+    uint16_t counter = readShort(bytecode, end - 2);
+    printf("%-16s %4d -> %d counter %d\n", name, offset, end - jump, counter);
+    return end;
+}
+
+static int32_t readInt32(Bytecode *bytecode, int offset)
+{
+    return (int32_t)(((uint32_t)bytecode->code[offset] << 24) |
+                     ((uint32_t)bytecode->code[offset + 1] << 16) |
+                     ((uint32_t)bytecode->code[offset + 2] << 8) |
+                      (uint32_t)bytecode->code[offset + 3]);
+}
+
+static int caseInstruction(const char *name, Bytecode *bytecode, int offset)
+{
+    uint16_t constant = readShort(bytecode, offset + 1);
+    uint16_t jump = readShort(bytecode, offset + 3);
+    printf("%-16s %4d '", name, constant);
     printValue(bytecode->constantPool.constants[constant]);
+    flushOutput();
+    printf("' -> %d\n", offset + 5 - jump);
+    return offset + 5;
+}
+
+static int tableSwitchInstruction(const char *name, Bytecode *bytecode, int offset)
+{
+    int32_t low = readInt32(bytecode, offset + 1);
+    uint16_t count = readShort(bytecode, offset + 5);
+    int end = offset + 9 + count * 2;
+
+    printf("%-16s %4d..%d default -> %d\n", name, low, low + count - 1,
+           end - readShort(bytecode, offset + 7));
+    for (int i = 0; i < count; i++)
+        printf("%21d -> %d\n", low + i, end - readShort(bytecode, offset + 9 + i * 2));
+
+    return end;
+}
+
+static int lookupSwitchInstruction(const char *name, Bytecode *bytecode, int offset)
+{
+    uint16_t count = readShort(bytecode, offset + 1);
+    int end = offset + 5 + count * 6;
+
+    printf("%-16s %4d keys default -> %d\n", name, count,
+           end - readShort(bytecode, offset + 3));
+    for (int i = 0; i < count; i++)
+    {
+        int entry = offset + 5 + i * 6;
+        printf("%21d -> %d\n", readInt32(bytecode, entry),
+               end - readShort(bytecode, entry + 4));
+    }
+
+    return end;
+}
+
+static int intrinsicInstruction(const char *name, Bytecode *bytecode, int offset)
+{
+    uint8_t intrinsic = bytecode->code[offset + 1];
+    printf("%-16s %4d '%s'\n", name, intrinsic,
+           intrinsic < INTRINSIC_COUNT ? arrayIntrinsics[intrinsic].name : "?");
     return offset + 2;
 }
 
+static int nativeInstruction(const char *name, Bytecode *bytecode, int offset)
+{
+    uint8_t native = bytecode->code[offset + 1];
+    uint8_t argCount = bytecode->code[offset + 2];
+    printf("%-16s %4d '%s' (%d args)\n", name, native,
+           native < vm.nativeCount ? vm.natives[native].name : "?", argCount);
+    return offset + 3;
+}
+
+static int closureInstruction(const char *name, Bytecode *bytecode, int offset)
+{
+    uint8_t function = bytecode->code[offset + 1];
+    uint8_t captureCount = bytecode->code[offset + 2];
+    if (function < bytecode->functionCount)
+        printf("%-16s %4d <fn %.*s>\n", name, function, bytecode->functions[function].nameLength,
+               bytecode->functions[function].name);
+    else
+        printf("%-16s %4d <fn>\n", name, function);
+
+    for (int i = 0; i < captureCount; i++)
+    {
+        uint8_t flags = bytecode->code[offset + 3 + 2 * i];
+        printf("%21d <- %s %d%s\n", i, (flags & CAPTURE_LOCAL) ? "local" : "capture",
+               bytecode->code[offset + 4 + 2 * i], (flags & CAPTURE_BOXED) ? " boxed" : "");
+    }
+
+    return offset + 3 + 2 * captureCount;
+}
+
+/*
+    Handler function of property accesses: [op, name, cache16], and
+    [op, name, argCount, cache16] for invocations.
+*/
+static int propertyInstruction(const char *name, bool invoke, Bytecode *bytecode, int offset)
+{
+    uint8_t property = bytecode->code[offset + 1];
+    int length = invoke ? 5 : 4;
+    uint16_t cache = readShort(bytecode, offset + length - 2);
+
+    printf("%-16s %4d '", name, property);
+    if (property < bytecode->nameCount)
+        printf("%.*s", bytecode->names[property].length, bytecode->names[property].chars);
+    if (invoke)
+        printf("' (%d args) cache %d\n", bytecode->code[offset + 2], cache);
+    else
+        printf("' cache %d\n", cache);
+    return offset + length;
+}
+
 /*
     Handler function of simple instructions.
     The 'simple' instruction means a one-byte instruction.
@@ -65,10 +239,10 @@ int disassembleInstruction(Bytecode *bytecode, int offset)
     uint8_t instruction = bytecode->code[offset];
     switch (instruction)
     {
-        // case OP_CONSTANT_LONG:
-        //     return lconstantInstruction("OP_CONSTANT_LONG", bytecode, offset);
         case OP_CONSTANT:
-            return constantInstruction("OP_CONSTANT", bytecode, offset);
+            return constantInstruction("OP_CONSTANT", bytecode, offset, 1);
+        case OP_CONSTANT_LONG:
+            return constantInstruction("OP_CONSTANT_LONG", bytecode, offset, 2);
         case OP_NIL:
             return simpleInstruction("OP_NIL", offset);
         case OP_TRUE:
@@ -93,10 +267,133 @@ int disassembleInstruction(Bytecode *bytecode, int offset)
             return simpleInstruction("OP_NOT", offset);
         case OP_NEGATE:
             return simpleInstruction("OP_NEGATE", offset);
+        case OP_ARRAY:
+            return byteInstruction("OP_ARRAY", bytecode, offset);
+        case OP_INDEX_GET:
+            return simpleInstruction("OP_INDEX_GET", offset);
+        case OP_INDEX_SET:
+            return simpleInstruction("OP_INDEX_SET", offset);
+        case OP_INTRINSIC:
+            return intrinsicInstruction("OP_INTRINSIC", bytecode, offset);
+        case OP_NATIVE:
+            return nativeInstruction("OP_NATIVE", bytecode, offset);
+        case OP_POP:
+            return simpleInstruction("OP_POP", offset);
+        case OP_PRINT:
+            return simpleInstruction("OP_PRINT", offset);
+        case OP_GET_LOCAL:
+            return byteInstruction("OP_GET_LOCAL", bytecode, offset);
+        case OP_SET_LOCAL:
+            return byteInstruction("OP_SET_LOCAL", bytecode, offset);
+        case OP_GET_BOXED:
+            return byteInstruction("OP_GET_BOXED", bytecode, offset);
+        case OP_SET_BOXED:
+            return byteInstruction("OP_SET_BOXED", bytecode, offset);
+        case OP_GET_CAPTURE:
+            return byteInstruction("OP_GET_CAPTURE", bytecode, offset);
+        case OP_GET_CAPTURE_BOXED:
+            return byteInstruction("OP_GET_CAPTURE_BOXED", bytecode, offset);
+        case OP_SET_CAPTURE:
+            return byteInstruction("OP_SET_CAPTURE", bytecode, offset);
+        case OP_GET_GLOBAL:
+            return shortInstruction("OP_GET_GLOBAL", bytecode, offset);
+        case OP_SET_GLOBAL:
+            return shortInstruction("OP_SET_GLOBAL", bytecode, offset);
+        case OP_DEFINE_GLOBAL:
+            return shortInstruction("OP_DEFINE_GLOBAL", bytecode, offset);
+        case OP_GET_PROPERTY:
+            return propertyInstruction("OP_GET_PROPERTY", false, bytecode, offset);
+        case OP_SET_PROPERTY:
+            return propertyInstruction("OP_SET_PROPERTY", false, bytecode, offset);
+        case OP_INVOKE:
+            return propertyInstruction("OP_INVOKE", true, bytecode, offset);
+        case OP_JUMP:
+            return jumpInstruction("OP_JUMP", 1, bytecode, offset);
+        case OP_JUMP_SHORT:
+            return shortJumpInstruction("OP_JUMP_SHORT", 1, bytecode, offset);
+        case OP_JUMP_BACK:
+            return jumpInstruction("OP_JUMP_BACK", -1, bytecode, offset);
+        case OP_JUMP_BACK_SHORT:
+            return shortJumpInstruction("OP_JUMP_BACK_SHORT", -1, bytecode, offset);
+        case OP_JUMP_IF_FALSE:
+            return jumpInstruction("OP_JUMP_IF_FALSE", 1, bytecode, offset);
+        case OP_JUMP_IF_FALSE_SHORT:
+            return shortJumpInstruction("OP_JUMP_IF_FALSE_SHORT", 1, bytecode, offset);
+        case OP_JUMP_IF_FALSE_OR_POP:
+            return jumpInstruction("OP_JUMP_IF_FALSE_OR_POP", 1, bytecode, offset);
+        case OP_JUMP_IF_FALSE_OR_POP_SHORT:
+            return shortJumpInstruction("OP_JUMP_IF_FALSE_OR_POP_SHORT", 1, bytecode, offset);
+        case OP_JUMP_IF_TRUE_OR_POP:
+            return jumpInstruction("OP_JUMP_IF_TRUE_OR_POP", 1, bytecode, offset);
+        case OP_JUMP_IF_TRUE_OR_POP_SHORT:
+            return shortJumpInstruction("OP_JUMP_IF_TRUE_OR_POP_SHORT", 1, bytecode, offset);
+        case OP_JUMP_IF_LESS:
+            return jumpInstruction("OP_JUMP_IF_LESS", 1, bytecode, offset);
+        case OP_JUMP_IF_LESS_SHORT:
+            return shortJumpInstruction("OP_JUMP_IF_LESS_SHORT", 1, bytecode, offset);
+        case OP_JUMP_IF_NOT_LESS:
+            return jumpInstruction("OP_JUMP_IF_NOT_LESS", 1, bytecode, offset);
+        case OP_JUMP_IF_NOT_LESS_SHORT:
+            return shortJumpInstruction("OP_JUMP_IF_NOT_LESS_SHORT", 1, bytecode, offset);
+        case OP_JUMP_IF_GREATER:
+            return jumpInstruction("OP_JUMP_IF_GREATER", 1, bytecode, offset);
+        case OP_JUMP_IF_GREATER_SHORT:
+            return shortJumpInstruction("OP_JUMP_IF_GREATER_SHORT", 1, bytecode, offset);
+        case OP_JUMP_IF_NOT_GREATER:
+            return jumpInstruction("OP_JUMP_IF_NOT_GREATER", 1, bytecode, offset);
+        case OP_JUMP_IF_NOT_GREATER_SHORT:
+            return shortJumpInstruction("OP_JUMP_IF_NOT_GREATER_SHORT", 1, bytecode, offset);
+        case OP_JUMP_IF_EQUAL:
+            return jumpInstruction("OP_JUMP_IF_EQUAL", 1, bytecode, offset);
+        case OP_JUMP_IF_EQUAL_SHORT:
+            return shortJumpInstruction("OP_JUMP_IF_EQUAL_SHORT", 1, bytecode, offset);
+        case OP_JUMP_IF_NOT_EQUAL:
+            return jumpInstruction("OP_JUMP_IF_NOT_EQUAL", 1, bytecode, offset);
+        case OP_JUMP_IF_NOT_EQUAL_SHORT:
+            return shortJumpInstruction("OP_JUMP_IF_NOT_EQUAL_SHORT", 1, bytecode, offset);
+        case OP_LOOP:
+            return loopInstruction("OP_LOOP", 2, bytecode, offset);
+        case OP_LOOP_SHORT:
+            return loopInstruction("OP_LOOP_SHORT", 1, bytecode, offset);
+        case OP_CASE:
+            return caseInstruction("OP_CASE", bytecode, offset);
+        case OP_TABLESWITCH:
+            return tableSwitchInstruction("OP_TABLESWITCH", bytecode, offset);
+        case OP_LOOKUPSWITCH:
+            return lookupSwitchInstruction("OP_LOOKUPSWITCH", bytecode, offset);
+        case OP_CALL:
+            return byteInstruction("OP_CALL", bytecode, offset);
+        case OP_CALL_SELF:
+            return byteInstruction("OP_CALL_SELF", bytecode, offset);
+        case OP_TAIL_CALL:
+            return byteInstruction("OP_TAIL_CALL", bytecode, offset);
+        case OP_TAIL_CALL_SELF:
+            return byteInstruction("OP_TAIL_CALL_SELF", bytecode, offset);
+        case OP_CLOSURE:
+            return closureInstruction("OP_CLOSURE", bytecode, offset);
+        case OP_SELF:
+            return simpleInstruction("OP_SELF", offset);
+        case OP_RETURN_VALUE:
+            return simpleInstruction("OP_RETURN_VALUE", offset);
         case OP_RETURN:
             return simpleInstruction("OP_RETURN", offset);
         default:
             printf("Unknown opcode %d\n", instruction);
             return offset + 1;
     }
+}
+
+void printLoopCounters(Bytecode *bytecode)
+{
+    for (int offset = 0; offset < bytecode->count; offset += instructionLength(bytecode, offset))
+    {
+        uint8_t instruction = bytecode->code[offset];
+        if (instruction != OP_LOOP && instruction != OP_LOOP_SHORT)
+            continue;
+
+        int length = instructionLength(bytecode, offset);
+        uint16_t counter = readShort(bytecode, offset + length - 2);
+        printf("loop %3d at %04d [line %d]: %u\n", counter, offset,
+               bytecode->lines[offset], bytecode->loopCounters[counter]);
+    }
 }
\ No newline at end of file
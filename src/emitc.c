@@ -0,0 +1,361 @@
+#include <math.h>
+#include "../include/analysis.h"
+#include "../include/array.h"
+#include "../include/emitc.h"
+#include "../include/memory.h"
+
+/*
+    The part of the output which doesn't depend on the script.
+*/
+static const char *prelude =
+    "/*\n"
+    "    Generated by bee --emit-c. Build it with the runtime:\n"
+    "    cc -Iinclude script.c src/value.c src/object.c src/shape.c src/array.c src/memory.c src/output.c \\\n"
+    "       src/number.c\n"
+    "*/\n"
+    "#include <math.h>\n"
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "#include \"array.h\"\n"
+    "#include \"memory.h\"\n"
+    "#include \"vm.h\"\n"
+    "\n"
+    "THREAD_LOCAL VM vm;\n"
+    "\n"
+    "static void fail(const char *message, int line)\n"
+    "{\n"
+    "    flushOutput();\n"
+    "    fflush(stdout);\n"
+    "    fprintf(stderr, \"%s\\n[line %d] in script\\n\", message, line);\n"
+    "    exit(70);\n"
+    "}\n"
+    "\n"
+    "static inline void check(const char *error, int line)\n"
+    "{\n"
+    "    if (error != NULL)\n"
+    "        fail(error, line);\n"
+    "}\n"
+    "\n"
+    "static inline bool isFalsey(Value value)\n"
+    "{\n"
+    "    switch (value.type)\n"
+    "    {\n"
+    "        case VAL_NIL:   return true;\n"
+    "        case VAL_BOOL:  return !AS_BOOL(value);\n"
+    "        default:        return false;\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "static inline bool switchKey(Value subject, int32_t *key)\n"
+    "{\n"
+    "    if (!IS_NUMBER(subject))\n"
+    "        return false;\n"
+    "\n"
+    "    double number = AS_NUMBER(subject);\n"
+    "    if (!(number >= INT32_MIN && number <= INT32_MAX) || (double)(int32_t)number != number)\n"
+    "        return false;\n"
+    "\n"
+    "    *key = (int32_t)number;\n"
+    "    return true;\n"
+    "}\n"
+    "\n"
+    "#define NUMBER(a, line) \\\n"
+    "    if (!IS_NUMBER(a)) fail(\"Operand must be a number.\", line)\n"
+    "#define NUMBERS(a, b, line) \\\n"
+    "    if (!IS_NUMBER(a) || !IS_NUMBER(b)) fail(\"Operands must be numbers.\", line)\n"
+    "\n";
+
+static uint16_t readShort(uint8_t *code)
+{
+    return (uint16_t)((code[0] << 8) | code[1]);
+}
+
+static int32_t readInt32(uint8_t *code)
+{
+    return (int32_t)(((uint32_t)code[0] << 24) | ((uint32_t)code[1] << 16) |
+                     ((uint32_t)code[2] << 8)  |  (uint32_t)code[3]);
+}
+
+/*
+    Writes a C expression producing the constant.
+    Numbers are written in hexadecimal, so that they round-trip exactly.
+    Heap objects can't be written as a literal: emitC() refuses them.
+*/
+static void writeValue(FILE *out, Value value)
+{
+    switch (value.type)
+    {
+        case VAL_BOOL:  fprintf(out, "BOOL_VAL(%s)", AS_BOOL(value) ? "true" : "false"); break;
+        case VAL_NIL:   fprintf(out, "NIL_VAL"); break;
+        case VAL_NUMBER:
+        {
+            double number = AS_NUMBER(value);
+            if (isnan(number))
+                fprintf(out, "NUMBER_VAL(NAN)");
+            else if (isinf(number))
+                fprintf(out, "NUMBER_VAL(%sHUGE_VAL)", number < 0 ? "-" : "");
+            else
+                fprintf(out, "NUMBER_VAL(%a)", number);
+        }break;
+        case VAL_OBJ:
+        case VAL_FUNCTION:
+        case VAL_CLASS:
+        break;
+    }
+}
+
+/*
+    Marks the instructions control can be transferred to by a goto.
+*/
+static void markTargets(Bytecode *bytecode, int *depths, bool *isTarget)
+{
+    for (int offset = 0; offset < bytecode->count; offset += instructionLength(bytecode, offset))
+    {
+        uint8_t *code = bytecode->code + offset;
+        if (depths[offset] < 0)
+            continue;
+
+        if (code[0] >= OP_JUMP && code[0] <= OP_CASE)
+        {
+            isTarget[branchTarget(bytecode, offset)] = true;
+        }else if (code[0] == OP_TABLESWITCH || code[0] == OP_LOOKUPSWITCH)
+        {
+            bool isTable = code[0] == OP_TABLESWITCH;
+            int next = offset + instructionLength(bytecode, offset);
+            int entries = readShort(code + (isTable ? 5 : 1));
+
+            isTarget[next - readShort(code + (isTable ? 7 : 3))] = true;
+            for (int i = 0; i < entries; i++)
+                isTarget[next - readShort(code + 9 + i * (isTable ? 2 : 6))] = true;
+        }
+    }
+}
+
+/*
+    Writes the statements of a single instruction.
+    'd' is the stack depth before it: the top of the stack is s[d - 1].
+*/
+static void translate(Bytecode *bytecode, int offset, int d, FILE *out)
+{
+    uint8_t *code = bytecode->code + offset;
+    int line = bytecode->lines[offset];
+    int next = offset + instructionLength(bytecode, offset);
+
+    switch (code[0])
+    {
+        case OP_CONSTANT:
+        case OP_CONSTANT_LONG:
+            fprintf(out, "    s%d = ", d);
+            writeValue(out, bytecode->constantPool.constants[code[0] == OP_CONSTANT ? code[1] : readShort(code + 1)]);
+            fprintf(out, ";\n");
+        break;
+        case OP_NIL:    fprintf(out, "    s%d = NIL_VAL;\n", d);           break;
+        case OP_TRUE:   fprintf(out, "    s%d = BOOL_VAL(true);\n", d);    break;
+        case OP_FALSE:  fprintf(out, "    s%d = BOOL_VAL(false);\n", d);   break;
+        case OP_EQUAL:
+            fprintf(out, "    s%d = BOOL_VAL(valuesEqual(s%d, s%d));\n", d - 2, d - 2, d - 1);
+        break;
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        {
+            const char *operators = "><+-*/";
+            char operator = operators[code[0] - OP_GREATER];
+            const char *valueType = code[0] <= OP_LESS ? "BOOL_VAL" : "NUMBER_VAL";
+
+            fprintf(out, "    NUMBERS(s%d, s%d, %d);\n", d - 2, d - 1, line);
+            fprintf(out, "    s%d = %s(AS_NUMBER(s%d) %c AS_NUMBER(s%d));\n",
+                    d - 2, valueType, d - 2, operator, d - 1);
+        }break;
+        case OP_NOT:
+            fprintf(out, "    s%d = BOOL_VAL(isFalsey(s%d));\n", d - 1, d - 1);
+        break;
+        case OP_NEGATE:
+            fprintf(out, "    NUMBER(s%d, %d);\n", d - 1, line);
+            fprintf(out, "    s%d = NUMBER_VAL(-AS_NUMBER(s%d));\n", d - 1, d - 1);
+        break;
+        case OP_ARRAY:
+        case OP_INTRINSIC:
+        {
+            // The C locals are invisible to the collector, so the live ones
+            // are spilled to the VM stack, its roots, before an allocation.
+            if (code[0] == OP_ARRAY || code[1] <= INTRINSIC_BOOLS)
+            {
+                for (int i = 0; i < d; i++)
+                    fprintf(out, "    vm.stack[%d] = s%d;\n", i, i);
+                fprintf(out, "    vm.stackTop = vm.stack + %d;\n", d);
+            }
+
+            // the values are gathered into an array to be passed by pointer
+            int count = code[0] == OP_ARRAY ? code[1] : arrayIntrinsics[code[1]].arity;
+            fprintf(out, "    {\n        Value values[] = {");
+            for (int i = 0; i < count; i++)
+                fprintf(out, "%ss%d", i > 0 ? ", " : "", d - count + i);
+            if (count == 0)
+                fprintf(out, "NIL_VAL");
+
+            if (code[0] == OP_ARRAY)
+                fprintf(out, "};\n        check(arrayFromValues(values, %d, &s%d), %d);\n    }\n",
+                        count, d - count, line);
+            else
+                fprintf(out, "};\n        check(arrayCallIntrinsic(%d, values, &s%d), %d);\n    }\n",
+                        code[1], d - count, line);
+        }break;
+        case OP_INDEX_GET:
+            fprintf(out, "    check(arrayIndexGet(s%d, s%d, &s%d), %d);\n", d - 2, d - 1, d - 2, line);
+        break;
+        case OP_INDEX_SET:
+            fprintf(out, "    check(arrayIndexSet(s%d, s%d, s%d), %d);\n", d - 3, d - 2, d - 1, line);
+            fprintf(out, "    s%d = s%d;\n", d - 3, d - 1);
+        break;
+        case OP_POP:
+        break;
+        case OP_PRINT:
+            fprintf(out, "    printValue(s%d);\n    writeOutput(\"\\n\", 1);\n", d - 1);
+        break;
+        case OP_GET_LOCAL:      fprintf(out, "    s%d = s%d;\n", d, code[1]);               break;
+        case OP_SET_LOCAL:      fprintf(out, "    s%d = s%d;\n", code[1], d - 1);           break;
+        case OP_GET_GLOBAL:     fprintf(out, "    s%d = vm.globals[%d];\n", d, readShort(code + 1));    break;
+        case OP_SET_GLOBAL:
+        case OP_DEFINE_GLOBAL:  fprintf(out, "    vm.globals[%d] = s%d;\n", readShort(code + 1), d - 1); break;
+        case OP_JUMP:
+        case OP_JUMP_SHORT:
+        case OP_JUMP_BACK:
+        case OP_JUMP_BACK_SHORT:
+        case OP_LOOP:
+        case OP_LOOP_SHORT:
+            fprintf(out, "    goto L%d;\n", branchTarget(bytecode, offset));
+        break;
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_FALSE_SHORT:
+        case OP_JUMP_IF_FALSE_OR_POP:
+        case OP_JUMP_IF_FALSE_OR_POP_SHORT:
+            fprintf(out, "    if (isFalsey(s%d)) goto L%d;\n", d - 1, branchTarget(bytecode, offset));
+        break;
+        case OP_JUMP_IF_TRUE_OR_POP:
+        case OP_JUMP_IF_TRUE_OR_POP_SHORT:
+            fprintf(out, "    if (!isFalsey(s%d)) goto L%d;\n", d - 1, branchTarget(bytecode, offset));
+        break;
+        case OP_JUMP_IF_LESS:
+        case OP_JUMP_IF_LESS_SHORT:
+        case OP_JUMP_IF_NOT_LESS:
+        case OP_JUMP_IF_NOT_LESS_SHORT:
+        case OP_JUMP_IF_GREATER:
+        case OP_JUMP_IF_GREATER_SHORT:
+        case OP_JUMP_IF_NOT_GREATER:
+        case OP_JUMP_IF_NOT_GREATER_SHORT:
+        {
+            bool less = code[0] <= OP_JUMP_IF_NOT_LESS_SHORT;
+            bool negated = code[0] == OP_JUMP_IF_NOT_LESS || code[0] == OP_JUMP_IF_NOT_LESS_SHORT ||
+                           code[0] == OP_JUMP_IF_NOT_GREATER || code[0] == OP_JUMP_IF_NOT_GREATER_SHORT;
+
+            fprintf(out, "    NUMBERS(s%d, s%d, %d);\n", d - 2, d - 1, line);
+            fprintf(out, "    if (%s(AS_NUMBER(s%d) %c AS_NUMBER(s%d))) goto L%d;\n",
+                    negated ? "!" : "", d - 2, less ? '<' : '>', d - 1,
+                    branchTarget(bytecode, offset));
+        }break;
+        case OP_JUMP_IF_EQUAL:
+        case OP_JUMP_IF_EQUAL_SHORT:
+        case OP_JUMP_IF_NOT_EQUAL:
+        case OP_JUMP_IF_NOT_EQUAL_SHORT:
+        {
+            bool ifEqual = code[0] == OP_JUMP_IF_EQUAL || code[0] == OP_JUMP_IF_EQUAL_SHORT;
+            fprintf(out, "    if (%svaluesEqual(s%d, s%d)) goto L%d;\n",
+                    ifEqual ? "" : "!", d - 2, d - 1, branchTarget(bytecode, offset));
+        }break;
+        case OP_CASE:
+            fprintf(out, "    if (valuesEqual(s%d, ", d - 1);
+            writeValue(out, bytecode->constantPool.constants[readShort(code + 1)]);
+            fprintf(out, ")) goto L%d;\n", branchTarget(bytecode, offset));
+        break;
+        case OP_TABLESWITCH:
+        case OP_LOOKUPSWITCH:
+        {
+            // [tableswitch, low32, count16, default16, count x offset16]
+            // [lookupswitch, count16, default16, count x (key32, offset16)]
+            bool isTable = code[0] == OP_TABLESWITCH;
+            int entries = readShort(code + (isTable ? 5 : 1));
+            int defaultTarget = next - readShort(code + (isTable ? 7 : 3));
+
+            fprintf(out, "    {\n        int32_t key;\n");
+            fprintf(out, "        if (!switchKey(s%d, &key)) goto L%d;\n", d - 1, defaultTarget);
+            fprintf(out, "        switch (key)\n        {\n");
+            for (int i = 0; i < entries; i++)
+            {
+                int32_t key = isTable ? readInt32(code + 1) + i : readInt32(code + 5 + i * 6);
+                int target = next - readShort(code + 9 + i * (isTable ? 2 : 6));
+                // a table maps the holes to the default
+                if (target != defaultTarget)
+                    fprintf(out, "            case %ld: goto L%d;\n", (long)key, target);
+            }
+            fprintf(out, "            default: goto L%d;\n        }\n    }\n", defaultTarget);
+        }break;
+        case OP_RETURN:
+            fprintf(out, "    goto done;\n");
+        break;
+    }
+}
+
+bool emitC(Bytecode *bytecode, FILE *out)
+{
+    for (int i = 0; i < bytecode->constantPool.count; i++)
+    {
+        if (IS_OBJ(bytecode->constantPool.constants[i]))
+            return false;
+    }
+
+    // stackDepths() also rejects unknown instructions
+    int maxDepth;
+    int *depths = stackDepths(bytecode, &maxDepth);
+    if (depths == NULL)
+        return false;
+
+    // the natives belong to the process registering them, not to the output,
+    // and the call frames to the interpreter
+    if (bytecode->functionCount > 0)
+    {
+        FREE_SCRATCH(int, depths, bytecode->count + 1);
+        return false;
+    }
+
+    for (int offset = 0; offset < bytecode->count; offset += instructionLength(bytecode, offset))
+    {
+        if (bytecode->code[offset] == OP_NATIVE)
+        {
+            FREE_SCRATCH(int, depths, bytecode->count + 1);
+            return false;
+        }
+    }
+
+    bool *isTarget = ALLOCATE(bool, bytecode->count + 1);
+    for (int i = 0; i <= bytecode->count; i++)
+        isTarget[i] = false;
+    markTargets(bytecode, depths, isTarget);
+
+    fputs(prelude, out);
+    fprintf(out, "int main(void)\n{\n");
+    for (int i = 0; i < maxDepth; i++)
+        fprintf(out, "    Value s%d = NIL_VAL;\n", i);
+    // the VM of the output is only this much of what initVM() sets up
+    fprintf(out, "\n    vm.memoryLimit = MEMORY_UNLIMITED;\n    initCollector();\n\n");
+
+    for (int offset = 0; offset < bytecode->count; offset += instructionLength(bytecode, offset))
+    {
+        if (isTarget[offset])
+            fprintf(out, "L%d:\n", offset);
+        // unreachable code is left out
+        if (depths[offset] >= 0)
+            translate(bytecode, offset, depths[offset], out);
+    }
+
+    if (isTarget[bytecode->count])
+        fprintf(out, "L%d:\n", bytecode->count);
+    fprintf(out, "done:\n    flushOutput();\n    freeObjects();\n    return 0;\n}\n");
+
+    FREE_ARRAY(bool, isTarget, bytecode->count + 1);
+    FREE_SCRATCH(int, depths, bytecode->count + 1);
+    return true;
+}
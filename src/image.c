@@ -0,0 +1,304 @@
+#include <string.h>
+#include "../include/image.h"
+#include "../include/memory.h"
+
+uint64_t fnv1a(uint64_t hash, const uint8_t *bytes, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+void writeBytes(Writer *writer, const void *bytes, size_t length)
+{
+    fwrite(bytes, 1, length, writer->file);
+    writer->checksum = fnv1a(writer->checksum, (const uint8_t*)bytes, length);
+}
+
+void writeU8(Writer *writer, uint8_t value)
+{
+    writeBytes(writer, &value, 1);
+}
+
+void writeU32(Writer *writer, uint32_t value)
+{
+    uint8_t bytes[4];
+    for (int i = 0; i < 4; i++)
+        bytes[i] = (uint8_t)(value >> (8 * i));
+    writeBytes(writer, bytes, 4);
+}
+
+void writeU64(Writer *writer, uint64_t value)
+{
+    writeU32(writer, (uint32_t)value);
+    writeU32(writer, (uint32_t)(value >> 32));
+}
+
+const uint8_t* readBytes(Reader *reader, size_t length)
+{
+    if (!reader->ok || (size_t)(reader->end - reader->at) < length)
+    {
+        reader->ok = false;
+        return NULL;
+    }
+
+    const uint8_t *bytes = reader->at;
+    reader->at += length;
+    return bytes;
+}
+
+uint8_t readU8(Reader *reader)
+{
+    const uint8_t *bytes = readBytes(reader, 1);
+    return bytes != NULL ? bytes[0] : 0;
+}
+
+uint32_t readU32(Reader *reader)
+{
+    const uint8_t *bytes = readBytes(reader, 4);
+    if (bytes == NULL)
+        return 0;
+
+    return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) |
+           ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+uint64_t readU64(Reader *reader)
+{
+    uint64_t low = readU32(reader);
+    return low | ((uint64_t)readU32(reader) << 32);
+}
+
+void writeValue(Writer *writer, Value value)
+{
+    writeU8(writer, (uint8_t)value.type);
+    if (IS_BOOL(value))
+    {
+        writeU8(writer, AS_BOOL(value));
+    }else if (IS_NUMBER(value))
+    {
+        uint64_t bits;
+        double number = AS_NUMBER(value);
+        memcpy(&bits, &number, sizeof(bits));
+        writeU64(writer, bits);
+    }else if (IS_FUNCTION(value))
+    {
+        writeU32(writer, (uint32_t)AS_FUNCTION(value));
+    }else if (IS_CLASS(value))
+    {
+        writeU32(writer, (uint32_t)AS_CLASS(value));
+    }
+}
+
+Value readValue(Reader *reader, uint8_t type)
+{
+    if (type == VAL_BOOL)
+    {
+        return BOOL_VAL(readU8(reader) != 0);
+    }else if (type == VAL_NIL)
+    {
+        return NIL_VAL;
+    }else if (type == VAL_NUMBER)
+    {
+        uint64_t bits = readU64(reader);
+        double number;
+        memcpy(&number, &bits, sizeof(number));
+        return NUMBER_VAL(number);
+    }else if (type == VAL_FUNCTION)
+    {
+        return FUNCTION_VAL((int)readU32(reader));
+    }else if (type == VAL_CLASS)
+    {
+        return CLASS_VAL((int)readU32(reader));
+    }
+
+    reader->ok = false;
+    return NIL_VAL;
+}
+
+bool isWritable(Bytecode *bytecode)
+{
+    for (int i = 0; i < bytecode->constantPool.count; i++)
+    {
+        if (IS_OBJ(bytecode->constantPool.constants[i]))
+            return false;
+    }
+
+    return true;
+}
+
+void writeBytecode(Writer *writer, Bytecode *bytecode)
+{
+    writeU32(writer, (uint32_t)bytecode->count);
+    writeU32(writer, (uint32_t)bytecode->constantPool.count);
+    writeU32(writer, (uint32_t)bytecode->loopCount);
+    writeU32(writer, (uint32_t)bytecode->functionCount);
+    writeU32(writer, (uint32_t)bytecode->nameCount);
+    writeU32(writer, (uint32_t)bytecode->classCount);
+    writeU32(writer, (uint32_t)bytecode->cacheCount);
+
+    writeBytes(writer, bytecode->code, bytecode->count);
+
+    // the lines as runs of (line, length), most instructions sharing theirs
+    for (int i = 0; i < bytecode->count; )
+    {
+        int run = 1;
+        while (i + run < bytecode->count && bytecode->lines[i + run] == bytecode->lines[i])
+            run++;
+
+        writeU32(writer, (uint32_t)bytecode->lines[i]);
+        writeU32(writer, (uint32_t)run);
+        i += run;
+    }
+
+    for (int i = 0; i < bytecode->functionCount; i++)
+    {
+        Function *function = &bytecode->functions[i];
+        writeU32(writer, (uint32_t)function->entry);
+        writeU32(writer, (uint32_t)function->end);
+        writeU8(writer, (uint8_t)function->arity);
+        writeU8(writer, (uint8_t)function->captureCount);
+        writeU32(writer, (uint32_t)function->nameLength);
+        writeBytes(writer, function->name, function->nameLength);
+    }
+
+    for (int i = 0; i < bytecode->nameCount; i++)
+    {
+        writeU32(writer, (uint32_t)bytecode->names[i].length);
+        writeBytes(writer, bytecode->names[i].chars, bytecode->names[i].length);
+    }
+
+    // the methods inherited included, the order of the class kept
+    for (int i = 0; i < bytecode->classCount; i++)
+    {
+        Class *klass = &bytecode->classes[i];
+        writeU32(writer, (uint32_t)klass->nameLength);
+        writeBytes(writer, klass->name, klass->nameLength);
+        writeU32(writer, (uint32_t)klass->superclass);
+        writeU32(writer, (uint32_t)klass->initializer);
+        writeU32(writer, (uint32_t)klass->methodCount);
+        for (int j = 0; j < klass->methodCount; j++)
+        {
+            writeU32(writer, (uint32_t)klass->methods[j].name);
+            writeU32(writer, (uint32_t)klass->methods[j].function);
+        }
+    }
+
+    for (int i = 0; i < bytecode->constantPool.count; i++)
+        writeValue(writer, bytecode->constantPool.constants[i]);
+}
+
+bool readBytecode(Reader *reader, Bytecode *bytecode)
+{
+    uint32_t count = readU32(reader);
+    uint32_t constantCount = readU32(reader);
+    uint32_t loopCount = readU32(reader);
+    uint32_t functionCount = readU32(reader);
+    uint32_t nameCount = readU32(reader);
+    uint32_t classCount = readU32(reader);
+    uint32_t cacheCount = readU32(reader);
+
+    size_t left = (size_t)(reader->end - reader->at);
+    if (!reader->ok || count > left || constantCount > UINT16_COUNT || loopCount > UINT16_COUNT ||
+        functionCount > left || nameCount > UINT8_COUNT || classCount > UINT8_COUNT ||
+        cacheCount > count)
+        return false;
+
+    const uint8_t *code = readBytes(reader, count);
+    if (code != NULL)
+    {
+        bytecode->code = ALLOCATE(uint8_t, count);
+        bytecode->lines = ALLOCATE(int, count);
+        bytecode->capacity = count;
+        bytecode->count = count;
+        memcpy(bytecode->code, code, count);
+
+        for (uint32_t i = 0; i < count && reader->ok; )
+        {
+            int line = (int)readU32(reader);
+            uint32_t run = readU32(reader);
+            if (run == 0 || run > count - i)
+            {
+                reader->ok = false;
+                break;
+            }
+
+            while (run-- > 0)
+                bytecode->lines[i++] = line;
+        }
+    }
+
+    for (uint32_t i = 0; i < functionCount && reader->ok; i++)
+    {
+        uint32_t entry = readU32(reader);
+        uint32_t end = readU32(reader);
+        int arity = readU8(reader);
+        int captureCount = readU8(reader);
+        uint32_t nameLength = readU32(reader);
+        const uint8_t *name = readBytes(reader, nameLength);
+        if (name == NULL || entry >= count || end < entry || end > count)
+        {
+            reader->ok = false;
+            break;
+        }
+
+        int function = addFunction(bytecode, (const char*)name, (int)nameLength);
+        bytecode->functions[function].entry = (int)entry;
+        bytecode->functions[function].end = (int)end;
+        bytecode->functions[function].arity = arity;
+        bytecode->functions[function].captureCount = captureCount;
+    }
+
+    for (uint32_t i = 0; i < nameCount && reader->ok; i++)
+    {
+        uint32_t length = readU32(reader);
+        const uint8_t *chars = readBytes(reader, length);
+        // the names are interned, a duplicate would shift the others
+        reader->ok = chars != NULL && addName(bytecode, (const char*)chars, (int)length) == (int)i;
+    }
+
+    // the indices are checked by verifyBytecode() before the code runs
+    for (uint32_t i = 0; i < classCount && reader->ok; i++)
+    {
+        uint32_t nameLength = readU32(reader);
+        const uint8_t *name = readBytes(reader, nameLength);
+        if (name == NULL)
+        {
+            reader->ok = false;
+            break;
+        }
+
+        int klass = addClass(bytecode, (const char*)name, (int)nameLength);
+        bytecode->classes[klass].superclass = (int)readU32(reader);
+        bytecode->classes[klass].initializer = (int)readU32(reader);
+        uint32_t methodCount = readU32(reader);
+        for (uint32_t j = 0; j < methodCount && reader->ok; j++)
+        {
+            int method = (int)readU32(reader);
+            int function = (int)readU32(reader);
+            if (findMethod(&bytecode->classes[klass], method) >= 0)
+                reader->ok = false;
+            else
+                addMethod(bytecode, klass, method, function);
+        }
+    }
+
+    for (uint32_t i = 0; i < constantCount && reader->ok; i++)
+    {
+        Value value = readValue(reader, readU8(reader));
+        if ((IS_FUNCTION(value) && (uint32_t)AS_FUNCTION(value) >= functionCount) ||
+            (IS_CLASS(value) && (uint32_t)AS_CLASS(value) >= classCount))
+            reader->ok = false;
+        addConstant(bytecode, value);
+    }
+
+    for (uint32_t i = 0; i < loopCount; i++)
+        addLoopCounter(bytecode);
+    for (uint32_t i = 0; i < cacheCount; i++)
+        addInlineCache(bytecode);
+
+    return reader->ok;
+}
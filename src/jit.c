@@ -0,0 +1,711 @@
+#include <stdio.h>
+#include <string.h>
+#include "../include/jit.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "../include/analysis.h"
+#include "../include/array.h"
+#include "../include/memory.h"
+#include "../include/output.h"
+#include "../include/vm.h"
+
+struct JitCode
+{
+    uint8_t *entry;         // executable memory
+    size_t size;
+    int *nativeOffsets;     // native offset of each instruction, -1 for operands
+    int count;              // the length of bytecode
+};
+
+/*
+    The code being executed. Needed by jitSwitch() to map the bytecode
+    target of a switch onto native code.
+*/
+static THREAD_LOCAL JitCode *running = NULL;
+
+/*
+    Where a rel32 operand of the native code has to point to.
+*/
+typedef enum
+{
+    FIXUP_BRANCH,   // an instruction of the bytecode
+    FIXUP_DEOPT,    // a stub resuming the interpreter from an instruction
+    FIXUP_ERROR,    // the stub reporting a runtime error
+    FIXUP_EXIT,     // the epilogue
+} FixupKind;
+
+typedef struct
+{
+    FixupKind kind;
+    int at;         // native offset of the rel32 operand
+    int target;     // bytecode offset for FIXUP_BRANCH and FIXUP_DEOPT
+} Fixup;
+
+typedef struct
+{
+    uint8_t *code;
+    int count;
+    int capacity;
+    Fixup *fixups;
+    int fixupCount;
+    int fixupCapacity;
+} Assembler;
+
+/*
+    Runtime helpers called from the native code.
+    They take the operands from the VM stack, just like the interpreter.
+*/
+static void jitPrint(void)
+{
+    printValue(pop());
+    writeOutput("\n", 1);
+}
+
+static void jitEqual(void)
+{
+    Value b = pop();
+    Value a = pop();
+    push(BOOL_VAL(valuesEqual(a, b)));
+}
+
+static bool jitNative(int operands)
+{
+    return callNative(operands >> 8, operands & 0xFF);
+}
+
+static bool jitPopEqual(void)
+{
+    Value b = pop();
+    Value a = pop();
+    return valuesEqual(a, b);
+}
+
+static bool jitCase(int constant)
+{
+    if (!valuesEqual(vm.stackTop[-1], vm.bytecode->constantPool.constants[constant]))
+        return false;
+
+    pop();
+    return true;
+}
+
+static uint8_t* jitSwitch(int offset)
+{
+    uint8_t *code = vm.bytecode->code;
+    uint8_t *target = code[offset] == OP_TABLESWITCH ? tableSwitch(code + offset + 1, pop())
+                                                     : lookupSwitch(code + offset + 1, pop());
+    return running->entry + running->nativeOffsets[target - code];
+}
+
+static void emitByte(Assembler *as, uint8_t byte)
+{
+    if (as->capacity < as->count + 1)
+    {
+        int oldCapacity = as->capacity;
+        as->capacity = INCREASE_CAPACITY(oldCapacity);
+        as->code = INCREASE_SCRATCH(uint8_t, as->code, oldCapacity, as->capacity);
+    }
+
+    as->code[as->count++] = byte;
+}
+
+static void emitBytes(Assembler *as, const uint8_t *bytes, int count)
+{
+    for (int i = 0; i < count; i++)
+        emitByte(as, bytes[i]);
+}
+
+static void emitInt32(Assembler *as, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        emitByte(as, (value >> (i * 8)) & 0xff);
+}
+
+static void emitInt64(Assembler *as, uint64_t value)
+{
+    for (int i = 0; i < 8; i++)
+        emitByte(as, (value >> (i * 8)) & 0xff);
+}
+
+/*
+    Emits a rel32 placeholder to be resolved once all the code is emitted.
+*/
+static void emitRel32(Assembler *as, FixupKind kind, int target)
+{
+    if (as->fixupCapacity < as->fixupCount + 1)
+    {
+        int oldCapacity = as->fixupCapacity;
+        as->fixupCapacity = INCREASE_CAPACITY(oldCapacity);
+        as->fixups = INCREASE_SCRATCH(Fixup, as->fixups, oldCapacity, as->fixupCapacity);
+    }
+
+    as->fixups[as->fixupCount++] = (Fixup){kind, as->count, target};
+    emitInt32(as, 0);
+}
+
+/*
+    Emits an instruction with a [r12 + disp32] memory operand,
+    i.e. a field of the VM.
+*/
+static void emitVMOperand(Assembler *as, const uint8_t *opcode, int length, uint8_t reg, int disp)
+{
+    emitBytes(as, opcode, length);
+    emitByte(as, 0x84 | (reg << 3));    // ModRM: mod=10, rm=100 (SIB follows)
+    emitByte(as, 0x24);                 // SIB: base=r12
+    emitInt32(as, (uint32_t)disp);
+}
+
+static void emitMovImm64(Assembler *as, uint64_t value)
+{
+    emitBytes(as, (const uint8_t[]){0x48, 0xB8}, 2);            // mov rax, imm64
+    emitInt64(as, value);
+}
+
+static void emitSubStack(Assembler *as, int values)
+{
+    emitBytes(as, (const uint8_t[]){0x48, 0x83, 0xEB}, 3);      // sub rbx, imm8
+    emitByte(as, (uint8_t)(values * sizeof(Value)));
+}
+
+static void emitLoadStackTop(Assembler *as)
+{
+    // mov rbx, [r12 + stackTop]
+    emitVMOperand(as, (const uint8_t[]){0x49, 0x8B}, 2, 3, offsetof(VM, stackTop));
+}
+
+static void emitStoreStackTop(Assembler *as)
+{
+    // mov [r12 + stackTop], rbx
+    emitVMOperand(as, (const uint8_t[]){0x49, 0x89}, 2, 3, offsetof(VM, stackTop));
+}
+
+/*
+    Pushes a value known at compile time.
+*/
+static void emitPushValue(Assembler *as, Value value)
+{
+    uint64_t payload;
+    memcpy(&payload, &value.as, sizeof(payload));
+
+    emitBytes(as, (const uint8_t[]){0xC7, 0x03}, 2);            // mov dword [rbx], type
+    emitInt32(as, value.type);
+    emitMovImm64(as, payload);
+    emitBytes(as, (const uint8_t[]){0x48, 0x89, 0x43, 0x08,     // mov [rbx + 8], rax
+                                    0x48, 0x83, 0xC3, 0x10}, 8);// add rbx, 16
+}
+
+/*
+    Leaves for the interpreter at 'offset' unless the value at [rbx + disp]
+    is a number.
+*/
+static void emitCheckNumber(Assembler *as, int8_t disp, int offset)
+{
+    emitBytes(as, (const uint8_t[]){0x83, 0x7B, (uint8_t)disp, VAL_NUMBER, // cmp dword [rbx + disp], VAL_NUMBER
+                                    0x0F, 0x85}, 6);                       // jne deopt
+    emitRel32(as, FIXUP_DEOPT, offset);
+}
+
+/*
+    Sets al to 1 if the value on top of the stack is falsey, to 0 otherwise.
+*/
+static void emitIsFalsey(Assembler *as)
+{
+    const uint8_t code[] = {
+        0x31, 0xC0,                     //       xor eax, eax
+        0x83, 0x7B, 0xF0, VAL_BOOL,     //       cmp dword [rbx - 16], VAL_BOOL
+        0x75, 0x09,                     //       jne nil
+        0x80, 0x7B, 0xF8, 0x00,         //       cmp byte [rbx - 8], 0
+        0x0F, 0x94, 0xC0,               //       sete al
+        0xEB, 0x07,                     //       jmp done
+        0x83, 0x7B, 0xF0, VAL_NIL,      // nil:  cmp dword [rbx - 16], VAL_NIL
+        0x0F, 0x94, 0xC0,               //       sete al
+    };                                  // done:
+    emitBytes(as, code, sizeof(code));
+}
+
+/*
+    Stores the boolean in al as the value 'depth' slots below the top.
+*/
+static void emitPushFlag(Assembler *as, int depth)
+{
+    int8_t at = (int8_t)(-depth * (int)sizeof(Value));
+
+    emitBytes(as, (const uint8_t[]){0x0F, 0xB6, 0xC0,           // movzx eax, al
+                                    0xC7, 0x43, (uint8_t)at}, 6);// mov dword [rbx + at], VAL_BOOL
+    emitInt32(as, VAL_BOOL);
+    emitBytes(as, (const uint8_t[]){0x48, 0x89, 0x43, (uint8_t)(at + 8)}, 4); // mov [rbx + at + 8], rax
+}
+
+/*
+    Compares the two numbers on top of the stack, setting the flags as
+    'above' if a > b (or b > a when 'swap' is true). NaN compares unordered,
+    which is never 'above', just like a C comparison.
+*/
+static void emitCompare(Assembler *as, bool swap)
+{
+    uint8_t left = swap ? 0xF8 : 0xE8;
+    uint8_t right = swap ? 0xE8 : 0xF8;
+
+    emitBytes(as, (const uint8_t[]){0xF2, 0x0F, 0x10, 0x43, left,      // movsd xmm0, [rbx + left]
+                                    0x66, 0x0F, 0x2E, 0x43, right}, 10);// ucomisd xmm0, [rbx + right]
+}
+
+/*
+    Calls a C helper with a single integer argument. The VM state is
+    published before the call, so that the helper works on the current stack
+    and can report an error at the right line, and reloaded afterwards.
+*/
+static void emitCall(Assembler *as, Bytecode *bytecode, int end, void *helper, int arg)
+{
+    emitMovImm64(as, (uint64_t)(uintptr_t)(bytecode->code + end));
+    emitVMOperand(as, (const uint8_t[]){0x49, 0x89}, 2, 0, offsetof(VM, ip)); // mov [r12 + ip], rax
+    emitStoreStackTop(as);
+
+    // the argument goes into edi on System V and into ecx on Windows
+    emitByte(as, 0xBF);                                         // mov edi, imm32
+    emitInt32(as, (uint32_t)arg);
+    emitByte(as, 0xB9);                                         // mov ecx, imm32
+    emitInt32(as, (uint32_t)arg);
+    emitMovImm64(as, (uint64_t)(uintptr_t)helper);
+    emitBytes(as, (const uint8_t[]){0xFF, 0xD0}, 2);            // call rax
+    emitLoadStackTop(as);
+}
+
+static void emitCheckResult(Assembler *as)
+{
+    emitBytes(as, (const uint8_t[]){0x84, 0xC0, 0x0F, 0x84}, 4);// test al, al; jz error
+    emitRel32(as, FIXUP_ERROR, 0);
+}
+
+static void emitJump(Assembler *as, int target)
+{
+    emitByte(as, 0xE9);                                         // jmp rel32
+    emitRel32(as, FIXUP_BRANCH, target);
+}
+
+static void emitJumpIf(Assembler *as, uint8_t condition, int target)
+{
+    emitBytes(as, (const uint8_t[]){0x0F, condition}, 2);       // jcc rel32
+    emitRel32(as, FIXUP_BRANCH, target);
+}
+
+/*
+    Charges a back-edge against the fuel, leaving for the interpreter at
+    'target', the instruction the edge jumps to, once it runs out.
+*/
+static void emitCharge(Assembler *as, int cost, int target)
+{
+    // sub qword [r12 + fuel], imm32
+    emitVMOperand(as, (const uint8_t[]){0x49, 0x81}, 2, 5, offsetof(VM, fuel));
+    emitInt32(as, (uint32_t)cost);
+    emitBytes(as, (const uint8_t[]){0x0F, 0x88}, 2);            // js deopt
+    emitRel32(as, FIXUP_DEOPT, target);
+}
+
+#define JA  0x87
+#define JBE 0x86
+#define JZ  0x84
+#define JNZ 0x85
+
+/*
+    Emits the template of the instruction at 'offset'.
+*/
+static void translate(Assembler *as, Bytecode *bytecode, int offset)
+{
+    uint8_t *code = bytecode->code + offset;
+    int end = offset + instructionLength(bytecode, offset);
+
+    switch (code[0])
+    {
+        case OP_CONSTANT:
+            emitPushValue(as, bytecode->constantPool.constants[code[1]]);
+        break;
+        case OP_CONSTANT_LONG:
+            emitPushValue(as, bytecode->constantPool.constants[(code[1] << 8) | code[2]]);
+        break;
+        case OP_NIL:    emitPushValue(as, NIL_VAL);         break;
+        case OP_TRUE:   emitPushValue(as, BOOL_VAL(true));  break;
+        case OP_FALSE:  emitPushValue(as, BOOL_VAL(false)); break;
+        case OP_EQUAL:  emitCall(as, bytecode, end, (void*)jitEqual, 0); break;
+        case OP_GREATER:
+        case OP_LESS:
+            emitCheckNumber(as, -16, offset);
+            emitCheckNumber(as, -32, offset);
+            emitCompare(as, code[0] == OP_LESS);
+            emitBytes(as, (const uint8_t[]){0x0F, 0x97, 0xC0}, 3);  // seta al
+            emitPushFlag(as, 2);
+            emitSubStack(as, 1);
+        break;
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        {
+            uint8_t operation = code[0] == OP_ADD      ? 0x58 :
+                                code[0] == OP_SUBTRACT ? 0x5C :
+                                code[0] == OP_MULTIPLY ? 0x59 : 0x5E;
+            emitCheckNumber(as, -16, offset);
+            emitCheckNumber(as, -32, offset);
+            emitBytes(as, (const uint8_t[]){0xF2, 0x0F, 0x10, 0x43, 0xE8,       // movsd xmm0, [rbx - 24]
+                                            0xF2, 0x0F, operation, 0x43, 0xF8,  // op xmm0, [rbx - 8]
+                                            0xF2, 0x0F, 0x11, 0x43, 0xE8}, 15); // movsd [rbx - 24], xmm0
+            emitSubStack(as, 1);
+        }break;
+        case OP_NOT:
+            emitIsFalsey(as);
+            emitPushFlag(as, 1);
+        break;
+        case OP_NEGATE:
+            emitCheckNumber(as, -16, offset);
+            emitBytes(as, (const uint8_t[]){0x80, 0x73, 0xFF, 0x80}, 4);  // xor byte [rbx - 1], 0x80
+        break;
+        case OP_ARRAY:
+            emitCall(as, bytecode, end, (void*)buildArray, code[1]);
+            emitCheckResult(as);
+        break;
+        case OP_INDEX_GET:
+            emitCall(as, bytecode, end, (void*)indexGet, 0);
+            emitCheckResult(as);
+        break;
+        case OP_INDEX_SET:
+            emitCall(as, bytecode, end, (void*)indexSet, 0);
+            emitCheckResult(as);
+        break;
+        case OP_INTRINSIC:
+            emitCall(as, bytecode, end, (void*)callIntrinsic, code[1]);
+            emitCheckResult(as);
+        break;
+        case OP_NATIVE:
+            emitCall(as, bytecode, end, (void*)jitNative, (code[1] << 8) | code[2]);
+            emitCheckResult(as);
+        break;
+        case OP_POP:    emitSubStack(as, 1);                break;
+        case OP_PRINT:  emitCall(as, bytecode, end, (void*)jitPrint, 0); break;
+        case OP_GET_LOCAL:
+        case OP_GET_GLOBAL:
+        {
+            int disp = code[0] == OP_GET_LOCAL ? offsetof(VM, stack) : offsetof(VM, globals);
+            disp += (code[0] == OP_GET_LOCAL ? code[1] : (code[1] << 8) | code[2]) * sizeof(Value);
+            // movups xmm0, [r12 + disp]
+            emitVMOperand(as, (const uint8_t[]){0x41, 0x0F, 0x10}, 3, 0, disp);
+            emitBytes(as, (const uint8_t[]){0x0F, 0x11, 0x03,           // movups [rbx], xmm0
+                                            0x48, 0x83, 0xC3, 0x10}, 7);// add rbx, 16
+        }break;
+        case OP_SET_LOCAL:
+        case OP_SET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        {
+            int disp = code[0] == OP_SET_LOCAL ? offsetof(VM, stack) : offsetof(VM, globals);
+            disp += (code[0] == OP_SET_LOCAL ? code[1] : (code[1] << 8) | code[2]) * sizeof(Value);
+            emitBytes(as, (const uint8_t[]){0x0F, 0x10, 0x43, 0xF0}, 4);    // movups xmm0, [rbx - 16]
+            // movups [r12 + disp], xmm0
+            emitVMOperand(as, (const uint8_t[]){0x41, 0x0F, 0x11}, 3, 0, disp);
+            if (code[0] == OP_DEFINE_GLOBAL)
+                emitSubStack(as, 1);
+        }break;
+        case OP_JUMP:
+        case OP_JUMP_SHORT:
+            emitJump(as, branchTarget(bytecode, offset));
+        break;
+        case OP_JUMP_BACK:
+        case OP_JUMP_BACK_SHORT:
+            emitCharge(as, end - branchTarget(bytecode, offset), branchTarget(bytecode, offset));
+            emitJump(as, branchTarget(bytecode, offset));
+        break;
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_FALSE_SHORT:
+            emitIsFalsey(as);
+            emitSubStack(as, 1);
+            emitBytes(as, (const uint8_t[]){0x84, 0xC0}, 2);        // test al, al
+            emitJumpIf(as, JNZ, branchTarget(bytecode, offset));
+        break;
+        case OP_JUMP_IF_FALSE_OR_POP:
+        case OP_JUMP_IF_FALSE_OR_POP_SHORT:
+        case OP_JUMP_IF_TRUE_OR_POP:
+        case OP_JUMP_IF_TRUE_OR_POP_SHORT:
+        {
+            bool ifFalse = code[0] == OP_JUMP_IF_FALSE_OR_POP ||
+                           code[0] == OP_JUMP_IF_FALSE_OR_POP_SHORT;
+            emitIsFalsey(as);
+            emitBytes(as, (const uint8_t[]){0x84, 0xC0}, 2);        // test al, al
+            emitJumpIf(as, ifFalse ? JNZ : JZ, branchTarget(bytecode, offset));
+            emitSubStack(as, 1);
+        }break;
+        case OP_JUMP_IF_LESS:
+        case OP_JUMP_IF_LESS_SHORT:
+        case OP_JUMP_IF_NOT_LESS:
+        case OP_JUMP_IF_NOT_LESS_SHORT:
+        case OP_JUMP_IF_GREATER:
+        case OP_JUMP_IF_GREATER_SHORT:
+        case OP_JUMP_IF_NOT_GREATER:
+        case OP_JUMP_IF_NOT_GREATER_SHORT:
+        {
+            // a < b is tested as b > a, so that both are 'above'
+            bool less = code[0] <= OP_JUMP_IF_NOT_LESS_SHORT;
+            bool negated = code[0] == OP_JUMP_IF_NOT_LESS || code[0] == OP_JUMP_IF_NOT_LESS_SHORT ||
+                           code[0] == OP_JUMP_IF_NOT_GREATER || code[0] == OP_JUMP_IF_NOT_GREATER_SHORT;
+            emitCheckNumber(as, -16, offset);
+            emitCheckNumber(as, -32, offset);
+            emitCompare(as, less);
+            emitBytes(as, (const uint8_t[]){0x48, 0x8D, 0x5B, 0xE0}, 4); // lea rbx, [rbx - 32]
+            emitJumpIf(as, negated ? JBE : JA, branchTarget(bytecode, offset));
+        }break;
+        case OP_JUMP_IF_EQUAL:
+        case OP_JUMP_IF_EQUAL_SHORT:
+        case OP_JUMP_IF_NOT_EQUAL:
+        case OP_JUMP_IF_NOT_EQUAL_SHORT:
+        {
+            bool ifEqual = code[0] == OP_JUMP_IF_EQUAL || code[0] == OP_JUMP_IF_EQUAL_SHORT;
+            emitCall(as, bytecode, end, (void*)jitPopEqual, 0);
+            emitBytes(as, (const uint8_t[]){0x84, 0xC0}, 2);        // test al, al
+            emitJumpIf(as, ifEqual ? JNZ : JZ, branchTarget(bytecode, offset));
+        }break;
+        case OP_LOOP:
+        case OP_LOOP_SHORT:
+        {
+            int at = code[0] == OP_LOOP ? 3 : 2;
+            int counter = (code[at] << 8) | code[at + 1];
+            emitMovImm64(as, (uint64_t)(uintptr_t)&bytecode->loopCounters[counter]);
+            emitBytes(as, (const uint8_t[]){0xFF, 0x00}, 2);        // inc dword [rax]
+            emitCharge(as, end - branchTarget(bytecode, offset), branchTarget(bytecode, offset));
+            emitJump(as, branchTarget(bytecode, offset));
+        }break;
+        case OP_CASE:
+            emitCall(as, bytecode, end, (void*)jitCase, (code[1] << 8) | code[2]);
+            emitBytes(as, (const uint8_t[]){0x84, 0xC0}, 2);        // test al, al
+            emitJumpIf(as, JNZ, branchTarget(bytecode, offset));
+        break;
+        case OP_TABLESWITCH:
+        case OP_LOOKUPSWITCH:
+            emitCall(as, bytecode, end, (void*)jitSwitch, offset);
+            emitBytes(as, (const uint8_t[]){0xFF, 0xE0}, 2);        // jmp rax
+        break;
+        case OP_CALL:
+        case OP_CALL_SELF:
+        case OP_TAIL_CALL:
+        case OP_TAIL_CALL_SELF:
+        case OP_RETURN_VALUE:
+        case OP_GET_BOXED:
+        case OP_SET_BOXED:
+        case OP_GET_CAPTURE:
+        case OP_GET_CAPTURE_BOXED:
+        case OP_SET_CAPTURE:
+        case OP_CLOSURE:
+        case OP_SELF:
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_INVOKE:
+            // the frames are the interpreter's: it takes over at the first call,
+            // the first variable shared with a closure or the first property
+            emitByte(as, 0xE9);                                     // jmp deopt
+            emitRel32(as, FIXUP_DEOPT, offset);
+        break;
+        case OP_RETURN:
+            emitByte(as, 0xB8);                                     // mov eax, JIT_DONE
+            emitInt32(as, (uint32_t)JIT_DONE);
+            emitByte(as, 0xE9);                                     // jmp epilogue
+            emitRel32(as, FIXUP_EXIT, 0);
+        break;
+    }
+}
+
+static void* allocateExecutable(size_t size)
+{
+#ifdef _WIN32
+    return VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return memory == MAP_FAILED ? NULL : memory;
+#endif
+}
+
+/*
+    Turns the written memory into read-only executable code.
+*/
+static bool protectExecutable(void *memory, size_t size)
+{
+#ifdef _WIN32
+    DWORD oldProtection;
+    return VirtualProtect(memory, size, PAGE_EXECUTE_READ, &oldProtection);
+#else
+    return mprotect(memory, size, PROT_READ | PROT_EXEC) == 0;
+#endif
+}
+
+static void freeExecutable(void *memory, size_t size)
+{
+#ifdef _WIN32
+    (void)size;
+    VirtualFree(memory, 0, MEM_RELEASE);
+#else
+    munmap(memory, size);
+#endif
+}
+
+JitCode* jitCompile(Bytecode *bytecode)
+{
+    // the templates address the tag and the payload of a Value directly
+    if (sizeof(Value) != 16 || offsetof(Value, as) != 8)
+        return NULL;
+
+    // The native code doesn't check for stack overflow on each push.
+    // Refuse the code whose depth can't be proven to fit the stack.
+    int maxDepth;
+    int *depths = stackDepths(bytecode, &maxDepth);
+    if (depths == NULL)
+        return NULL;
+    FREE_SCRATCH(int, depths, bytecode->count + 1);
+
+    Assembler as = {0};
+    // scratch until jitFree(), so that it goes as well if the run unwinds
+    int *nativeOffsets = ALLOCATE_SCRATCH(int, bytecode->count + 1);
+    for (int i = 0; i <= bytecode->count; i++)
+        nativeOffsets[i] = -1;
+
+    // prologue: rbx caches vm.stackTop, r12 points to the VM of this
+    // thread, the only one the code runs on
+    emitBytes(&as, (const uint8_t[]){0x53,                      // push rbx
+                                     0x41, 0x54,                // push r12
+                                     0x48, 0x83, 0xEC, 0x28,    // sub rsp, 40 (shadow space, alignment)
+                                     0x49, 0xBC}, 9);           // mov r12, &vm
+    emitInt64(&as, (uint64_t)(uintptr_t)&vm);
+    emitLoadStackTop(&as);
+
+    for (int offset = 0; offset < bytecode->count; offset += instructionLength(bytecode, offset))
+    {
+        nativeOffsets[offset] = as.count;
+        translate(&as, bytecode, offset);
+    }
+
+    // falling off the end of the code behaves like OP_RETURN
+    nativeOffsets[bytecode->count] = as.count;
+    emitByte(&as, 0xB8);
+    emitInt32(&as, (uint32_t)JIT_DONE);
+    emitByte(&as, 0xE9);
+    emitRel32(&as, FIXUP_EXIT, 0);
+
+    int errorStub = as.count;
+    emitByte(&as, 0xB8);                                        // mov eax, JIT_ERROR
+    emitInt32(&as, (uint32_t)JIT_ERROR);
+    emitByte(&as, 0xE9);                                        // jmp epilogue
+    emitRel32(&as, FIXUP_EXIT, 0);
+
+    // Each deoptimization point gets its own stub, which returns the offset
+    // of the instruction to resume from. The stubs emit more fixups, so the
+    // count is taken beforehand.
+    int fixupCount = as.fixupCount;
+    for (int i = 0; i < fixupCount; i++)
+    {
+        if (as.fixups[i].kind != FIXUP_DEOPT)
+            continue;
+
+        int stub = as.count;
+        emitByte(&as, 0xB8);                                    // mov eax, offset
+        emitInt32(&as, (uint32_t)as.fixups[i].target);
+        emitByte(&as, 0xE9);                                    // jmp epilogue
+        emitRel32(&as, FIXUP_EXIT, 0);
+        // reuse the resolved stub offset as the target
+        as.fixups[i].target = stub;
+    }
+
+    int epilogue = as.count;
+    emitStoreStackTop(&as);
+    emitBytes(&as, (const uint8_t[]){0x48, 0x83, 0xC4, 0x28,    // add rsp, 40
+                                     0x41, 0x5C,                // pop r12
+                                     0x5B,                      // pop rbx
+                                     0xC3}, 8);                 // ret
+
+    bool ok = true;
+    for (int i = 0; i < as.fixupCount; i++)
+    {
+        Fixup *fixup = &as.fixups[i];
+        int target = 0;
+        switch (fixup->kind)
+        {
+            case FIXUP_BRANCH:
+                ok = ok && fixup->target >= 0 && fixup->target <= bytecode->count &&
+                     nativeOffsets[fixup->target] >= 0;
+                target = ok ? nativeOffsets[fixup->target] : 0;
+            break;
+            case FIXUP_DEOPT:   target = fixup->target; break;
+            case FIXUP_ERROR:   target = errorStub;     break;
+            case FIXUP_EXIT:    target = epilogue;      break;
+        }
+
+        int32_t rel = target - (fixup->at + 4);
+        memcpy(as.code + fixup->at, &rel, sizeof(rel));
+    }
+
+    uint8_t *entry = ok ? allocateExecutable(as.count) : NULL;
+    JitCode *jit = NULL;
+
+    if (entry != NULL)
+    {
+        memcpy(entry, as.code, as.count);
+        if (protectExecutable(entry, as.count))
+        {
+            jit = ALLOCATE(JitCode, 1);
+            jit->entry = entry;
+            jit->size = as.count;
+            jit->nativeOffsets = nativeOffsets;
+            jit->count = bytecode->count;
+        }else
+        {
+            freeExecutable(entry, as.count);
+        }
+    }
+
+    if (jit == NULL)
+        FREE_SCRATCH(int, nativeOffsets, bytecode->count + 1);
+
+    FREE_SCRATCH(uint8_t, as.code, as.capacity);
+    FREE_SCRATCH(Fixup, as.fixups, as.fixupCapacity);
+    return jit;
+}
+
+int jitExecute(JitCode *jit)
+{
+    JitCode *outer = running;
+    running = jit;
+
+    int (*entry)(void) = (int (*)(void))(uintptr_t)jit->entry;
+    int result = entry();
+
+    running = outer;
+    return result;
+}
+
+void jitFree(JitCode *jit)
+{
+    freeExecutable(jit->entry, jit->size);
+    FREE_SCRATCH(int, jit->nativeOffsets, jit->count + 1);
+    FREE(JitCode, jit);
+}
+
+#else
+
+JitCode* jitCompile(Bytecode *bytecode)
+{
+    (void)bytecode;
+    return NULL;
+}
+
+int jitExecute(JitCode *jit)
+{
+    (void)jit;
+    return JIT_ERROR;
+}
+
+void jitFree(JitCode *jit)
+{
+    (void)jit;
+}
+
+#endif // __x86_64__ || _M_X64
@@ -2,9 +2,31 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "../include/cache.h"
 #include "../include/common.h"
+#include "../include/compiler.h"
+#include "../include/counters.h"
+#include "../include/emitc.h"
+#include "../include/memory.h"
+#include "../include/profile.h"
+#include "../include/snapshot.h"
 #include "../include/vm.h"
 
+/* The directory of compiled scripts (--cache), NULL if none */
+static const char *cacheDir = NULL;
+
+/* The snapshot the session starts from (--snapshot), NULL if none */
+static const char *snapshotPath = NULL;
+
+/* Where the session is saved once the script has run (--save-snapshot), NULL if nowhere */
+static const char *savePath = NULL;
+
+/* Where the profile of the run goes (--profile), NULL if it isn't profiled */
+static const char *profilePath = NULL;
+
+/* Where the hardware counters of the run go (--counters), NULL if they aren't read */
+static const char *countersPath = NULL;
+
 /* Executes a single command line passed via console */
 static void repl(void);
 
@@ -15,63 +37,312 @@ static void repl(void);
 static void runFile(const char *path);
 
 /*
-  Reads input script file into char* buffer.
+  Runs a script file as the input of a REPL session, for --snapshot and
+  --save-snapshot.
   @param path to script.
-  @returns buffer with input script.
 */
-static char* readFile(const char *path);
+static void runSession(const char *path);
+
+/*
+  Exits with the status of the failed run, if it has failed.
+*/
+static void exitOnError(InterpretResult result);
+
+/*
+  Writes the profile and the counters, once.
+  @returns false if one couldn't be written.
+*/
+static bool saveReports(void);
+
+/*
+  Writes the reports at exit, so that a run ending in an error has them too.
+*/
+static void saveReportsAtExit(void);
+
+/*
+  Translates a script file into C and writes it to stdout (--emit-c).
+  @param path to script.
+*/
+static void emitFile(const char *path);
+
+/*
+  Opens a script file for reading, "-" standing for stdin.
+  @param path to script.
+*/
+static FILE* openFile(const char *path);
+
+/*
+  Closes a script file, exiting if it couldn't be read to the end.
+*/
+static void closeFile(FILE *file, const char *path);
 
 int main(int argc, const char* argv[])
 {
     initVM();
 
-    if (argc == 1)
+    // options go before the script name, "-" being stdin
+    bool toC = false;
+    bool gcStats = false;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-' && argv[arg][1] != '\0'; arg++)
+    {
+        if (strcmp(argv[arg], "--jit") == 0)
+        {
+            vm.jitEnabled = true;
+        }else if (strcmp(argv[arg], "--emit-c") == 0)
+        {
+            toC = true;
+        }else if (strcmp(argv[arg], "--gc-stats") == 0)
+        {
+            gcStats = true;
+        }else if (strcmp(argv[arg], "-O1") == 0 || strcmp(argv[arg], "-O2") == 0)
+        {
+            setOptimizationLevel(argv[arg][2] - '0');
+        }else if (strcmp(argv[arg], "--cache") == 0 && arg + 1 < argc)
+        {
+            cacheDir = argv[++arg];
+        }else if (strcmp(argv[arg], "--snapshot") == 0 && arg + 1 < argc)
+        {
+            snapshotPath = argv[++arg];
+        }else if (strcmp(argv[arg], "--save-snapshot") == 0 && arg + 1 < argc)
+        {
+            savePath = argv[++arg];
+        }else if (strcmp(argv[arg], "--profile") == 0 && arg + 1 < argc)
+        {
+            profilePath = argv[++arg];
+        }else if (strcmp(argv[arg], "--counters") == 0 && arg + 1 < argc)
+        {
+            countersPath = argv[++arg];
+        }else if (strcmp(argv[arg], "--max-memory") == 0 && arg + 1 < argc)
+        {
+            char *end;
+            vm.memoryLimit = (size_t)strtoull(argv[++arg], &end, 10);
+            if (*end != '\0' || argv[arg][0] == '-')
+            {
+                fprintf(stderr, "Invalid memory limit \"%s\".\n", argv[arg]);
+                exit(64);
+            }
+        }else if (strcmp(argv[arg], "--fuel") == 0 && arg + 1 < argc)
+        {
+            char *end;
+            vm.fuel = strtoll(argv[++arg], &end, 10);
+            if (*end != '\0' || vm.fuel < 0)
+            {
+                fprintf(stderr, "Invalid fuel \"%s\".\n", argv[arg]);
+                exit(64);
+            }
+        }else
+        {
+            fprintf(stderr, "Unknown option \"%s\".\n", argv[arg]);
+            exit(64);
+        }
+    }
+
+    if (toC)
+    {
+        profilePath = NULL;
+        countersPath = NULL;
+    }
+    if ((profilePath != NULL && !startProfile()) || (countersPath != NULL && !openCounters()))
+        exit(70);
+    atexit(saveReportsAtExit);
+
+    if (arg == argc && !toC)
     {
         repl();
-    }else if (argc == 2)
+    }else if (arg == argc - 1)
     {
-        runFile(argv[1]);
+        if (toC)
+            emitFile(argv[arg]);
+        else if (snapshotPath != NULL || savePath != NULL)
+            runSession(argv[arg]);
+        else
+            runFile(argv[arg]);
     }else
     {
-        fprintf(stderr, "Usage: binch.exe C:\\path\\to\\script.txt\n");
+        fprintf(stderr, "Usage: binch.exe [--jit | --emit-c] [-O1 | -O2] [--gc-stats] [--fuel bytes] [--max-memory bytes] [--profile file] [--counters file] [--cache C:\\cache\\dir] [--snapshot file] [--save-snapshot file] C:\\path\\to\\script.txt | -\n");
         exit(64);
     }
-    
+
+    if (gcStats)
+        printGcStats();
+
+    bool saved = saveReports();
     freeVM();
 
-    return 0;
+    return saved ? 0 : 74;
+}
+
+/*
+  Reads a line of any length from stdin, the '\n' included.
+  @param char** the buffer, grown as needed.
+  @param size_t* the capacity of the buffer.
+  @returns false at the end of input.
+*/
+static bool readLine(char **buffer, size_t *capacity)
+{
+    size_t length = 0;
+
+    for (;;)
+    {
+        if (*capacity - length < 2)
+        {
+            *capacity = *capacity < 1024 ? 1024 : *capacity * 2;
+            *buffer = (char*) realloc(*buffer, *capacity);
+            if (NULL == *buffer)
+            {
+                fprintf(stderr, "Not enough memory to read the input.\n");
+                exit(74);
+            }
+        }
+
+        if (!fgets(*buffer + length, (int)(*capacity - length), stdin))
+            return length > 0;
+
+        length += strlen(*buffer + length);
+        if ((*buffer)[length - 1] == '\n')
+            return true;
+    }
 }
 
 static void repl(void)
 {
-    char line[1024];
-    
+    Session session;
+    initSession(&session);
+    if (snapshotPath != NULL && !loadSnapshot(&session, snapshotPath))
+        exit(74);
+
+    char *line = NULL;
+    size_t capacity = 0;
+
     for (;;)
     {
         printf(">> ");
 
-        if (!fgets(line, sizeof(line), stdin))
+        if (!readLine(&line, &capacity))
         {
             printf("\n");
             break;
         }
 
-        interpret(line);
+        interpretSession(&session, line);
     }
+
+    free(line);
+    freeSession(&session);
 }
 
 static void runFile(const char *path)
 {
-    char *source = readFile(path);
-    InterpretResult result = interpret(source);
+    FILE *file = openFile(path);
+    // stdin can't be read twice, for the hash and then for the compiler
+    InterpretResult result = cacheDir != NULL && file != stdin ? interpretCached(file, cacheDir)
+                                                               : interpretStream(file);
+    closeFile(file, path);
+    exitOnError(result);
+}
+
+static void runSession(const char *path)
+{
+    FILE *file = openFile(path);
+
+    // the session compiles from memory
+    char *source = NULL;
+    size_t length = 0;
+    size_t capacity = 0;
+    do
+    {
+        if (capacity - length < 4096)
+        {
+            capacity = capacity < 4096 ? 8192 : capacity * 2;
+            source = (char*) realloc(source, capacity);
+            if (NULL == source)
+            {
+                fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
+                exit(74);
+            }
+        }
+
+        length += fread(source + length, 1, capacity - length - 1, file);
+    } while (!feof(file) && !ferror(file));
+    source[length] = '\0';
+    closeFile(file, path);
+
+    Session session;
+    initSession(&session);
+    if (snapshotPath != NULL && !loadSnapshot(&session, snapshotPath))
+        exit(74);
+
+    InterpretResult result = interpretSession(&session, source);
     free(source);
+    if (result == INTERPRET_OK && savePath != NULL && !saveSnapshot(&session, savePath))
+        exit(74);
 
+    freeSession(&session);
+    exitOnError(result);
+}
+
+static void exitOnError(InterpretResult result)
+{
     if (result == INTERPRET_COMPILE_ERROR) exit(65);
     if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+    if (result == INTERPRET_OUT_OF_MEMORY) exit(70);
+    if (result == STACK_OVERFLOW || result == STACK_UNDERFLOW) exit(70);
+    if (result == INTERPRET_OUT_OF_FUEL)
+    {
+        fprintf(stderr, "Out of fuel.\n");
+        exit(70);
+    }
 }
 
-static char* readFile(const char *path)
+static bool saveReports(void)
 {
+    // freeVM() drops the samples and closes the counters
+    bool saved = true;
+    if (profilePath != NULL)
+    {
+        stopProfile();
+        saved = writeProfile(profilePath);
+        profilePath = NULL;
+    }
+    if (countersPath != NULL)
+    {
+        saved = writeCounters(countersPath) && saved;
+        countersPath = NULL;
+    }
+    return saved;
+}
+
+static void saveReportsAtExit(void)
+{
+    saveReports();
+}
+
+static void emitFile(const char *path)
+{
+    FILE *file = openFile(path);
+    Bytecode bytecode;
+    initBytecode(&bytecode);
+
+    bool compiled = compileStream(file, &bytecode);
+    closeFile(file, path);
+    if (!compiled)
+        exit(65);
+
+    if (!emitC(&bytecode, stdout))
+    {
+        fprintf(stderr, "Couldn't translate \"%s\" to C.\n", path);
+        exit(65);
+    }
+
+    freeBytecode(&bytecode);
+}
+
+static FILE* openFile(const char *path)
+{
+    if (strcmp(path, "-") == 0)
+        return stdin;
+
     FILE *file = fopen(path, "rb");
     if (NULL == file)
     {
@@ -79,29 +350,17 @@ static char* readFile(const char *path)
         exit(74);
     }
 
-    // shift file pointer (don't be confused with pointer to FILE) to the end of file
-    fseek(file, 0L, SEEK_END);
-    // fetch the index of file pointer. Its value determines the length of buffer to be created.
-    size_t fileSize = ftell(file);
-    // roll file pointer back so that we will read it from the start.
-    rewind(file);
-    // + 1 char for string terminating symbol ('\0')
-    char *buffer = (char*) malloc(fileSize + 1);
-    if (NULL == buffer)
-    {
-        fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
-        exit(74);
-    }
-    // read input data into the buffer. Store in 'bytesRead' the actual number of characters.
-    size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
-    if (bytesRead < fileSize)
+    return file;
+}
+
+static void closeFile(FILE *file, const char *path)
+{
+    if (ferror(file))
     {
         fprintf(stderr, "Couldn't read the whole data from the file \"%s\".\n", path);
         exit(74);
     }
 
-    buffer[bytesRead] = '\0';
-
-    fclose(file);
-    return buffer;
-}
\ No newline at end of file
+    if (file != stdin)
+        fclose(file);
+}
@@ -1,26 +1,581 @@
+#include <stdio.h>
 #include <stdlib.h>
+#include "../include/array.h"
 #include "../include/memory.h"
+#include "../include/pool.h"
+#include "../include/vm.h"
 
-void* reallocate(void* pointer, size_t oldSize, size_t newSize)
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#ifdef BEE_STATIC_POOL
+#define GC_FIRST_THRESHOLD  (BEE_POOL_SIZE / 4)
+#define GC_STEP_BYTES       (BEE_POOL_SIZE / 64)
+#else
+#define GC_FIRST_THRESHOLD  (1024 * 1024)
+#define GC_STEP_BYTES       (16 * 1024)     // allocation between two steps
+#endif
+#define GC_HEAP_GROW_FACTOR 2
+#define GC_STEP_MULTIPLIER  2               // heap bytes processed per allocated byte
+
+static void gcStep(size_t budget);
+
+/*
+    realloc() of the profile being built.
+*/
+static void* resize(void *pointer, size_t newSize)
 {
-    if (0 == newSize)   // deallocate memory if true
+#ifdef BEE_STATIC_POOL
+    return poolResize(pointer, newSize);
+#else
+    if (0 == newSize)
     {
         free(pointer);
         return NULL;
     }
 
+    return realloc(pointer, newSize);
+#endif
+}
+
+/*
+    Reports an allocation that can't be satisfied even after a full
+    collection, be it refused by the system or by the quota of the VM.
+    It unwinds to the running interpret(), which returns
+    INTERPRET_OUT_OF_MEMORY. Outside of one, the process exits.
+*/
+static void outOfMemory(size_t size)
+{
+    // what the script printed before comes first
+    flushOutput();
+    fflush(stdout);
+
+#ifdef BEE_STATIC_POOL
+    fprintf(stderr, "Out of memory: %lu bytes requested, %lu of %lu in use.\n",
+            (unsigned long)size, (unsigned long)poolUsed(), (unsigned long)BEE_POOL_SIZE);
+#else
+    if (vm.memoryLimit != MEMORY_UNLIMITED)
+        fprintf(stderr, "Out of memory: %lu bytes requested, %lu of %lu in use.\n",
+                (unsigned long)size, (unsigned long)vm.gc.bytesAllocated, (unsigned long)vm.memoryLimit);
+    else
+        fprintf(stderr, "Out of memory: %lu bytes requested.\n", (unsigned long)size);
+#endif
+    if (vm.unwind != NULL)
+        longjmp(*vm.unwind, INTERPRET_OUT_OF_MEMORY);
+    exit(1);
+}
+
+void* reallocate(void* pointer, size_t oldSize, size_t newSize)
+{
+    if (newSize > oldSize)
+    {
+        vm.gc.bytesAllocated += newSize - oldSize;
+        if (vm.gc.phase != GC_IDLE)
+            vm.gc.debt += newSize - oldSize;
+
+#ifdef DEBUG_STRESS_GC
+        collectGarbage();
+#else
+        if (vm.gc.phase == GC_IDLE ? vm.gc.bytesAllocated > vm.gc.nextGC
+                                   : vm.gc.debt >= GC_STEP_BYTES)
+        {
+            size_t debt = vm.gc.debt > GC_STEP_BYTES ? vm.gc.debt : GC_STEP_BYTES;
+            gcStep(debt * GC_STEP_MULTIPLIER);
+        }
+#endif
+
+        if (vm.gc.bytesAllocated > vm.memoryLimit)
+        {
+            // the garbage may be all it takes
+            collectGarbage();
+            if (vm.gc.bytesAllocated > vm.memoryLimit)
+            {
+                vm.gc.bytesAllocated -= newSize - oldSize;
+                outOfMemory(newSize);
+            }
+        }
+    }else
+    {
+        vm.gc.bytesAllocated -= oldSize - newSize;
+    }
+
+    if (0 == newSize)   // deallocate memory if true
+        return resize(pointer, 0);
+
     /*
         When oldSize == 0, behavior of realloc is equivalent to calling malloc().
         realloc() retrieves presize size of 'oldValue' implicitly by its own.
         if (oldSize > newSize): reduce the size
         if (oldSize < newSize): increase the size
     */
-    void* result = realloc(pointer, newSize);
-    
+    void* result = resize(pointer, newSize);
+
     if (NULL == result)
     {
-        exit(1);
+        // the garbage may be all it takes
+        collectGarbage();
+        result = resize(pointer, newSize);
     }
-    
+
+    if (NULL == result)
+    {
+        vm.gc.bytesAllocated -= newSize - oldSize;
+        outOfMemory(newSize);
+    }
+
     return result;
-}
\ No newline at end of file
+}
+
+/*
+    The header of a scratch array, aligned for any of the elements.
+*/
+typedef union Scratch
+{
+    struct
+    {
+        union Scratch *previous;
+        union Scratch *next;
+        size_t size;        // of the array, the header left out
+    } block;
+    double alignment;       // and so the array following it
+} Scratch;
+
+void* reallocateScratch(void *pointer, size_t oldSize, size_t newSize)
+{
+    (void)oldSize;  // kept in the header
+    Scratch *scratch = pointer != NULL ? (Scratch*)pointer - 1 : NULL;
+
+    if (0 == newSize)
+    {
+        if (scratch == NULL)
+            return NULL;
+
+        if (scratch->block.previous != NULL)
+            scratch->block.previous->block.next = scratch->block.next;
+        else
+            vm.gc.scratch = scratch->block.next;
+        if (scratch->block.next != NULL)
+            scratch->block.next->block.previous = scratch->block.previous;
+
+        reallocate(scratch, sizeof(Scratch) + scratch->block.size, 0);
+        return NULL;
+    }
+
+    size_t size = scratch != NULL ? sizeof(Scratch) + scratch->block.size : 0;
+    Scratch *resized = (Scratch*)reallocate(scratch, size, sizeof(Scratch) + newSize);
+    resized->block.size = newSize;
+
+    if (scratch == NULL)
+    {
+        resized->block.previous = NULL;
+        resized->block.next = vm.gc.scratch;
+        if (vm.gc.scratch != NULL)
+            vm.gc.scratch->block.previous = resized;
+        vm.gc.scratch = resized;
+    }else
+    {
+        // the neighbours still point to where it was
+        if (resized->block.previous != NULL)
+            resized->block.previous->block.next = resized;
+        else
+            vm.gc.scratch = resized;
+        if (resized->block.next != NULL)
+            resized->block.next->block.previous = resized;
+    }
+
+    return resized + 1;
+}
+
+void freeScratch(void)
+{
+    while (vm.gc.scratch != NULL)
+    {
+        Scratch *scratch = vm.gc.scratch;
+        vm.gc.scratch = scratch->block.next;
+        reallocate(scratch, sizeof(Scratch) + scratch->block.size, 0);
+    }
+}
+
+/*
+    @returns the number of bytes the object accounts for in the heap.
+*/
+static size_t objectSize(Obj *object)
+{
+    switch (object->type)
+    {
+        case OBJ_ARRAY:
+        {
+            ObjArray *array = (ObjArray*)object;
+            return sizeof(ObjArray) + arrayElementSize(array->elementType) * array->count;
+        }
+        case OBJ_CLOSURE:
+            return sizeof(ObjClosure) + sizeof(Value) * ((ObjClosure*)object)->captureCount;
+        case OBJ_BOX:
+            return sizeof(ObjBox);
+        case OBJ_INSTANCE:
+            return sizeof(ObjInstance) + sizeof(Value) * ((ObjInstance*)object)->capacity;
+        case OBJ_BOUND_METHOD:
+            return sizeof(ObjBoundMethod);
+    }
+
+    return 0; // unreachable
+}
+
+static void freeObject(Obj *object)
+{
+    switch (object->type)
+    {
+        case OBJ_ARRAY:
+        {
+            ObjArray *array = (ObjArray*)object;
+            reallocate(array->as.raw,
+                       arrayElementSize(array->elementType) * array->count, 0);
+            FREE(ObjArray, object);
+        }break;
+        case OBJ_CLOSURE:
+            reallocate(object, objectSize(object), 0);
+        break;
+        case OBJ_BOX:
+            FREE(ObjBox, object);
+        break;
+        case OBJ_INSTANCE:
+        {
+            ObjInstance *instance = (ObjInstance*)object;
+            FREE_ARRAY(Value, instance->fields, instance->capacity);
+            FREE(ObjInstance, object);
+        }break;
+        case OBJ_BOUND_METHOD:
+            FREE(ObjBoundMethod, object);
+        break;
+    }
+}
+
+static void freeList(Obj *object)
+{
+    while (object != NULL)
+    {
+        Obj *next = object->next;
+        freeObject(object);
+        object = next;
+    }
+}
+
+void freeObjects(void)
+{
+    freeList(vm.objects);
+    freeList(vm.gc.sweepList);
+    vm.objects = NULL;
+    vm.gc.sweepList = NULL;
+
+    // the gray stack isn't allocated through reallocate(),
+    // which could start a collection while it grows
+    resize(vm.gc.grayStack, 0);
+    vm.gc.grayStack = NULL;
+    vm.gc.grayCount = 0;
+    vm.gc.grayCapacity = 0;
+    vm.gc.phase = GC_IDLE;
+}
+
+void initCollector(void)
+{
+    vm.gc.phase = GC_IDLE;
+    vm.gc.bytesAllocated = 0;
+    vm.gc.nextGC = GC_FIRST_THRESHOLD;
+    vm.gc.debt = 0;
+    vm.gc.grayStack = NULL;
+    vm.gc.grayCount = 0;
+    vm.gc.grayCapacity = 0;
+    vm.gc.sweepList = NULL;
+    vm.gc.pinned = NULL;
+    vm.gc.pinnedCount = 0;
+    vm.gc.scratch = NULL;
+    vm.gc.stats = (GcStats){0};
+}
+
+/*
+    Drops the cycle being marked, the gray stack being unable to grow.
+    Unwinding from there would leave objects black whose references aren't
+    marked, so the objects go back to white and the collector to idle,
+    until the heap has grown some more.
+*/
+static void abandonCycle(void)
+{
+    for (Obj *object = vm.objects; object != NULL; object = object->next)
+        object->isMarked = false;
+
+    vm.gc.grayCount = 0;
+    vm.gc.phase = GC_IDLE;
+    vm.gc.nextGC = vm.gc.bytesAllocated * GC_HEAP_GROW_FACTOR;
+}
+
+/*
+    Turns a white object gray.
+*/
+static void markObject(Obj *object)
+{
+    if (object == NULL || object->isMarked || vm.gc.phase != GC_MARK)
+        return;
+
+    object->isMarked = true;
+
+    if (vm.gc.grayCapacity < vm.gc.grayCount + 1)
+    {
+        int capacity = INCREASE_CAPACITY(vm.gc.grayCapacity);
+        Obj **grayStack = (Obj**)resize(vm.gc.grayStack, sizeof(Obj*) * capacity);
+        if (NULL == grayStack)
+        {
+            abandonCycle();
+            return;
+        }
+        vm.gc.grayStack = grayStack;
+        vm.gc.grayCapacity = capacity;
+    }
+
+    vm.gc.grayStack[vm.gc.grayCount++] = object;
+}
+
+static void markValue(Value value)
+{
+    if (IS_OBJ(value))
+        markObject(AS_OBJ(value));
+}
+
+static void markRoots(void)
+{
+    for (Value *slot = vm.stack; slot < vm.stackTop; slot++)
+        markValue(*slot);
+
+    for (int i = 0; i < GLOBALS_MAX; i++)
+        markValue(vm.globals[i]);
+
+    // a tail call may have dropped the callee from the stack
+    for (int i = 0; i < vm.frameCount; i++)
+        markObject((Obj*)vm.frames[i].closure);
+
+    for (int i = 0; i < vm.gc.pinnedCount; i++)
+        markValue(vm.gc.pinned[i]);
+
+    if (vm.bytecode != NULL)
+    {
+        ConstantPool *constants = &vm.bytecode->constantPool;
+        for (int i = 0; i < constants->count; i++)
+            markValue(constants->constants[i]);
+    }
+}
+
+/*
+    Turns a gray object black by graying the objects it references.
+*/
+static void blackenObject(Obj *object)
+{
+    switch (object->type)
+    {
+        case OBJ_ARRAY:
+            // the elements are unboxed: there is nothing to trace
+        break;
+        case OBJ_CLOSURE:
+        {
+            ObjClosure *closure = (ObjClosure*)object;
+            for (int i = 0; i < closure->captureCount; i++)
+                markValue(closure->captures[i]);
+        }break;
+        case OBJ_BOX:
+            markValue(((ObjBox*)object)->value);
+        break;
+        case OBJ_INSTANCE:
+        {
+            ObjInstance *instance = (ObjInstance*)object;
+            for (int i = 0; i < instance->shape->slotCount; i++)
+                markValue(instance->fields[i]);
+        }break;
+        case OBJ_BOUND_METHOD:
+            markValue(((ObjBoundMethod*)object)->receiver);
+        break;
+    }
+}
+
+void writeBarrier(Obj *object, Value value)
+{
+    if (vm.gc.phase == GC_MARK && object->isMarked)
+        markValue(value);
+}
+
+/*
+    Scans gray objects until the budget runs out.
+    @returns the budget left.
+*/
+static size_t traceReferences(size_t budget)
+{
+    while (vm.gc.grayCount > 0 && budget > 0)
+    {
+        Obj *object = vm.gc.grayStack[--vm.gc.grayCount];
+        blackenObject(object);
+
+        size_t size = objectSize(object);
+        budget = size < budget ? budget - size : 0;
+    }
+
+    return budget;
+}
+
+/*
+    Frees the white objects of the sweep list and moves the black ones back
+    to vm.objects, whitening them for the next cycle.
+    @returns the budget left.
+*/
+static size_t sweep(size_t budget)
+{
+    while (vm.gc.sweepList != NULL && budget > 0)
+    {
+        Obj *object = vm.gc.sweepList;
+        vm.gc.sweepList = object->next;
+
+        size_t size = objectSize(object);
+        budget = size < budget ? budget - size : 0;
+
+        if (object->isMarked)
+        {
+            object->isMarked = false;
+            object->next = vm.objects;
+            vm.objects = object;
+        }else
+        {
+            freeObject(object);
+        }
+    }
+
+    return budget;
+}
+
+static uint64_t nanoseconds(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER counter;
+    LARGE_INTEGER frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (uint64_t)(counter.QuadPart * (1000000000.0 / frequency.QuadPart));
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+#endif
+}
+
+static void recordPause(uint64_t pause)
+{
+    GcStats *stats = &vm.gc.stats;
+    stats->pauses++;
+    stats->totalPause += pause;
+    if (pause > stats->maxPause)
+        stats->maxPause = pause;
+
+    int bucket = 0;
+    for (uint64_t micros = pause / 1000; micros > 0 && bucket < GC_PAUSE_BUCKETS - 1; micros >>= 1)
+        bucket++;
+    stats->histogram[bucket]++;
+}
+
+/*
+    Advances the current cycle by 'budget' bytes of work, starting a new
+    cycle if there is none.
+*/
+static void gcStep(size_t budget)
+{
+    uint64_t start = nanoseconds();
+    vm.gc.debt = 0;
+
+    if (vm.gc.phase == GC_IDLE)
+    {
+        vm.gc.phase = GC_MARK;
+        markRoots();
+    }
+
+    if (vm.gc.phase == GC_MARK)
+    {
+        budget = traceReferences(budget);
+        if (vm.gc.grayCount == 0)
+        {
+            // Roots aren't guarded by the barrier, so they may hold objects
+            // still white. Marking them finishes in this very pause.
+            markRoots();
+            traceReferences(SIZE_MAX);
+
+            if (vm.gc.phase == GC_MARK)
+            {
+                vm.gc.sweepList = vm.objects;
+                vm.objects = NULL;
+                vm.gc.phase = GC_SWEEP;
+            }
+        }
+    }
+
+    if (vm.gc.phase == GC_SWEEP && budget > 0)
+    {
+        sweep(budget);
+        if (vm.gc.sweepList == NULL)
+        {
+            vm.gc.phase = GC_IDLE;
+            vm.gc.nextGC = vm.gc.bytesAllocated * GC_HEAP_GROW_FACTOR;
+            if (vm.gc.nextGC < GC_FIRST_THRESHOLD)
+                vm.gc.nextGC = GC_FIRST_THRESHOLD;
+            vm.gc.stats.cycles++;
+        }
+    }
+
+    recordPause(nanoseconds() - start);
+}
+
+void collectGarbage(void)
+{
+    do
+    {
+        gcStep(SIZE_MAX);
+    } while (vm.gc.phase != GC_IDLE);
+}
+
+/*
+    @returns the upper bound of the bucket holding the given fraction of pauses.
+*/
+static uint64_t pausePercentile(double fraction)
+{
+    GcStats *stats = &vm.gc.stats;
+    uint64_t rank = (uint64_t)(stats->pauses * fraction);
+    uint64_t seen = 0;
+
+    for (int i = 0; i < GC_PAUSE_BUCKETS; i++)
+    {
+        seen += stats->histogram[i];
+        if (seen > rank)
+            return (uint64_t)1 << i;
+    }
+
+    return (uint64_t)1 << (GC_PAUSE_BUCKETS - 1);
+}
+
+void printGcStats(void)
+{
+    GcStats *stats = &vm.gc.stats;
+
+    fprintf(stderr, "gc: %llu cycles, %llu pauses, total %.1fus, max %.1fus",
+            (unsigned long long)stats->cycles, (unsigned long long)stats->pauses,
+            stats->totalPause / 1000.0, stats->maxPause / 1000.0);
+    if (stats->pauses > 0)
+        fprintf(stderr, ", p50 < %lluus, p99 < %lluus",
+                (unsigned long long)pausePercentile(0.5), (unsigned long long)pausePercentile(0.99));
+    fprintf(stderr, "\n");
+#ifdef BEE_STATIC_POOL
+    fprintf(stderr, "pool: %lu of %lu bytes in use, peak %lu\n", (unsigned long)poolUsed(),
+            (unsigned long)BEE_POOL_SIZE, (unsigned long)poolPeak());
+#endif
+
+    for (int i = 0; i < GC_PAUSE_BUCKETS; i++)
+    {
+        if (stats->histogram[i] > 0)
+            fprintf(stderr, "  < %8lluus: %llu\n",
+                    (unsigned long long)1 << i, (unsigned long long)stats->histogram[i]);
+    }
+}
@@ -0,0 +1,74 @@
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include "../include/native.h"
+#include "../include/vm.h"
+
+bool defineNative(const char *name, int arity, NativeFn function)
+{
+    int length = (int)strlen(name);
+    int index = findNative(name, length);
+    if (index < 0)
+    {
+        if (vm.nativeCount == UINT8_COUNT)
+            return false;
+
+        index = vm.nativeCount++;
+    }
+
+    vm.natives[index] = (Native){name, length, arity, function};
+    return true;
+}
+
+int findNative(const char *name, int length)
+{
+    for (int i = 0; i < vm.nativeCount; i++)
+    {
+        if (vm.natives[i].length == length &&
+            memcmp(vm.natives[i].name, name, length) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+static const char* clockNative(Value *args, int argCount)
+{
+    args[0] = NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
+    return NULL;
+}
+
+static const char* sqrtNative(Value *args, int argCount)
+{
+    if (!IS_NUMBER(args[0]))
+        return "Argument must be a number.";
+
+    args[0] = NUMBER_VAL(sqrt(AS_NUMBER(args[0])));
+    return NULL;
+}
+
+static const char* floorNative(Value *args, int argCount)
+{
+    if (!IS_NUMBER(args[0]))
+        return "Argument must be a number.";
+
+    args[0] = NUMBER_VAL(floor(AS_NUMBER(args[0])));
+    return NULL;
+}
+
+static const char* powNative(Value *args, int argCount)
+{
+    if (!IS_NUMBER(args[0]) || !IS_NUMBER(args[1]))
+        return "Arguments must be numbers.";
+
+    args[0] = NUMBER_VAL(pow(AS_NUMBER(args[0]), AS_NUMBER(args[1])));
+    return NULL;
+}
+
+void defineStandardNatives(void)
+{
+    defineNative("clock", 0, clockNative);
+    defineNative("sqrt",  1, sqrtNative);
+    defineNative("floor", 1, floorNative);
+    defineNative("pow",   2, powNative);
+}
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <string.h>
+#include "../include/array.h"
+#include "../include/memory.h"
+#include "../include/object.h"
+#include "../include/output.h"
+#include "../include/vm.h"
+
+#define ALLOCATE_OBJ(type, objectType) \
+    (type*)allocateObject(sizeof(type), objectType)
+
+/*
+    Allocates an object of the given size and links it into
+    the VM's list of objects.
+    The 'size' is passed explicitly, since the caller allocates the
+    concrete object type, which is larger than the Obj header.
+*/
+static Obj* allocateObject(size_t size, ObjType type)
+{
+    Obj *object = (Obj*)reallocate(NULL, 0, size);
+    object->type = type;
+    // Objects born during marking are black: the roots holding them
+    // are marked again anyway. Those born during sweeping are white, since
+    // they don't get into the list being swept.
+    object->isMarked = vm.gc.phase == GC_MARK;
+
+    object->next = vm.objects;
+    vm.objects = object;
+    return object;
+}
+
+ObjArray* newArray(ArrayType elementType, int count)
+{
+    size_t elementSize = arrayElementSize(elementType);
+    void *data = NULL;
+
+    if (count > 0)
+    {
+        data = reallocate(NULL, 0, elementSize * count);
+        memset(data, 0, elementSize * count);
+    }
+
+    ObjArray *array = ALLOCATE_OBJ(ObjArray, OBJ_ARRAY);
+    array->elementType = elementType;
+    array->count = count;
+    array->as.raw = data;
+    return array;
+}
+
+ObjClosure* newClosure(int function, int captureCount)
+{
+    ObjClosure *closure = (ObjClosure*)allocateObject(sizeof(ObjClosure) + sizeof(Value) * captureCount,
+                                                      OBJ_CLOSURE);
+    closure->function = function;
+    closure->captureCount = captureCount;
+    for (int i = 0; i < captureCount; i++)
+        closure->captures[i] = NIL_VAL;
+    return closure;
+}
+
+ObjBox* newBox(Value value)
+{
+    ObjBox *box = ALLOCATE_OBJ(ObjBox, OBJ_BOX);
+    box->value = value;
+    writeBarrier((Obj*)box, value);
+    return box;
+}
+
+ObjInstance* newInstance(int klass)
+{
+    Shape *shape = rootShape(klass);
+
+    ObjInstance *instance = ALLOCATE_OBJ(ObjInstance, OBJ_INSTANCE);
+    instance->shape = shape;
+    instance->capacity = 0;
+    instance->fields = NULL;
+    return instance;
+}
+
+void reserveField(ObjInstance *instance)
+{
+    if (instance->shape->slotCount < instance->capacity)
+        return;
+
+    int oldCapacity = instance->capacity;
+    int capacity = oldCapacity < 4 ? 4 : oldCapacity * 2;
+    instance->fields = INCREASE_ARRAY(Value, instance->fields, oldCapacity, capacity);
+    instance->capacity = capacity;
+}
+
+ObjBoundMethod* newBoundMethod(Value receiver, int function)
+{
+    ObjBoundMethod *bound = ALLOCATE_OBJ(ObjBoundMethod, OBJ_BOUND_METHOD);
+    bound->receiver = receiver;
+    bound->function = function;
+    writeBarrier((Obj*)bound, receiver);
+    return bound;
+}
+
+static void printInstance(ObjInstance *instance)
+{
+    int klass = instance->shape->klass;
+    writeOutput("<", 1);
+    if (vm.bytecode != NULL && klass < vm.bytecode->classCount)
+    {
+        writeOutput(vm.bytecode->classes[klass].name, vm.bytecode->classes[klass].nameLength);
+        writeOutput(" ", 1);
+    }
+    writeOutput("instance>", 9);
+}
+
+static void printArray(ObjArray *array)
+{
+    writeOutput("[", 1);
+    for (int i = 0; i < array->count; i++)
+    {
+        if (i > 0)
+            writeOutput(", ", 2);
+
+        printValue(arrayGet(array, i));
+    }
+    writeOutput("]", 1);
+}
+
+void printObject(Value value)
+{
+    switch (OBJ_TYPE(value))
+    {
+        case OBJ_ARRAY: printArray(AS_ARRAY(value)); break;
+        case OBJ_CLOSURE: printFunction(AS_CLOSURE(value)->function); break;
+        case OBJ_BOX: printValue(AS_BOX(value)->value); break;
+        case OBJ_INSTANCE: printInstance(AS_INSTANCE(value)); break;
+        case OBJ_BOUND_METHOD: printFunction(AS_BOUND_METHOD(value)->function); break;
+    }
+}
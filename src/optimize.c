@@ -0,0 +1,2426 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../include/analysis.h"
+#include "../include/memory.h"
+#include "../include/optimize.h"
+#include "../include/vm.h"
+
+// The temporaries a function may get, each costing an OP_NIL per call.
+#define MAX_TEMPORARIES 16
+
+/*
+    A set of stack slots. The slots past UINT8_MAX can't be named by an
+    instruction, so they aren't tracked.
+*/
+typedef struct
+{
+    uint64_t bits[UINT8_COUNT / 64];
+} SlotSet;
+
+static void addSlot(SlotSet *set, int slot)
+{
+    if (slot >= 0 && slot < UINT8_COUNT)
+        set->bits[slot / 64] |= (uint64_t)1 << (slot % 64);
+}
+
+static void removeSlot(SlotSet *set, int slot)
+{
+    if (slot >= 0 && slot < UINT8_COUNT)
+        set->bits[slot / 64] &= ~((uint64_t)1 << (slot % 64));
+}
+
+static bool hasSlot(SlotSet *set, int slot)
+{
+    return slot >= 0 && slot < UINT8_COUNT && (set->bits[slot / 64] >> (slot % 64)) & 1;
+}
+
+typedef enum
+{
+    NODE_CONSTANT,
+    NODE_LEAF,      // a value not seen through: an argument, the result of
+                    // a call, a phi...
+    NODE_UNARY,
+    NODE_BINARY
+} NodeKind;
+
+/*
+    A value number. Constants and operations are hash-consed, so that the
+    same computation gets the same node wherever it is.
+*/
+typedef struct
+{
+    NodeKind kind;
+    uint8_t op;         // the instruction computing it
+    bool number;        // known to be a number
+    int a, b;           // the operands
+    int block;          // where a leaf appears, -1 if before the code
+    int capture;        // the capture a leaf reads, -1 if none
+    int constant;       // index of a constant in the pool, -1 if not there
+    Value value;        // of a constant
+    int temporary;      // the temporary keeping it, -1 if none
+    int definitions;    // the latest computation of it that may be kept, -1 if none
+    int facts;          // the latest block it is checked to be a number in, -1 if none
+} Node;
+
+typedef struct
+{
+    int first;          // index of its first instruction in the region
+    int last;           // and of its last one
+    int depth;          // stack depth on entry
+    int exitDepth;      // before its last instruction if that one branches, after it otherwise
+    int firstEdge;      // its successors are Region.successors[firstEdge .. + edgeCount)
+    int edgeCount;
+    int order;          // position in reverse postorder
+    int idom;           // immediate dominator, -1 for the entry
+    int loop;           // innermost loop holding it, -1 if none
+    bool live;          // still reached once the constant branches are folded
+    int *entry;         // value numbers of the slots, then of the globals, on entry
+    int *exit;          // and on exit
+    SlotSet liveIn;     // slots read before being written from its entry
+} Block;
+
+typedef struct
+{
+    int header;         // block
+    int parent;         // innermost enclosing loop, -1 if none
+    int size;           // number of blocks
+    bool *members;      // by block
+    int low, high;      // the offsets its blocks span
+    bool contiguous;    // no other block of the region lies in [low, high)
+    bool callsOut;      // holds a call, which may assign any global
+    int minDepth;       // the shallowest the stack gets inside
+    SlotSet writtenSlots;
+    SlotSet writtenGlobals;     // by their index in the region
+    int guardA, guardB; // values the header checks to be numbers before any effect, -1 if none
+    int guardLine;
+} Loop;
+
+typedef enum
+{
+    REPLACE_REMOVE,     // by nothing
+    REPLACE_CONSTANT,   // by the push of the constant node
+    REPLACE_TEMPORARY,  // by the read of the temporary of the node
+    REPLACE_JUMP,       // by an OP_JUMP to 'target'
+    REPLACE_STORE,      // by itself followed by a store into the temporary of the node
+} ReplacementKind;
+
+typedef struct
+{
+    ReplacementKind kind;
+    int first, last;    // instructions replaced
+    int node;
+    int target;         // an offset in the code before the pass
+} Replacement;
+
+/*
+    An expression computed once before a loop.
+*/
+typedef struct
+{
+    int loop;
+    int node;
+} Hoist;
+
+/*
+    A change of the code, applied once all the regions are done.
+*/
+typedef struct
+{
+    int offset;         // in the code before the pass
+    int length;         // of the code it replaces, 0 for an insertion
+    int order;          // among the edits at the same offset
+    int insideStart;    // the jumps from [insideStart, insideEnd) to an insertion
+    int insideEnd;      // land after it: it runs once, before a loop or a body
+    int bytes;          // index of its code in Optimizer.code
+    int byteCount;
+    int jump;           // where the OP_JUMP its code ends with goes, -1 if none
+} Edit;
+
+typedef struct
+{
+    Bytecode *bytecode;
+    int start;
+    int *depths;
+    int *owners;
+    int *indexAt;       // index of each instruction in its region, -1 elsewhere
+    int *bases;         // by function + 1: the slot of the first temporary
+    int *temporaries;   // and how many there are
+    Edit *edits;
+    int editCount;
+    int editCapacity;
+    uint8_t *code;      // of the edits
+    int *lines;
+    int codeCount;
+    int codeCapacity;
+} Optimizer;
+
+/*
+    The script or a function, and what is found out about it.
+*/
+typedef struct
+{
+    Optimizer *optimizer;
+    Bytecode *bytecode;
+    int function;       // -1 for the script
+    int low, high;      // the offsets its code spans
+    int base;           // the slot of the first temporary
+    int maxTemporaries;
+    int temporaryCount;
+
+    int count;          // instructions, in the order of the code
+    int *offsets;
+    int *blockOf;
+    int *topNode;       // value on top of the stack before each instruction, -1 if none
+    int *topStart;      // first instruction of the pure code pushing it right before, -1 if none
+    int *secondNode;    // the same for the value below it
+    int *secondStart;
+    int *spanStart;     // first instruction of the pure code each one ends, -1 if none
+    int *spanNode;      // and the value it computes
+    int *nextDefinition;    // older computation of the same value that may be kept
+    bool *stored;       // computation kept in a temporary
+    bool *removed;      // replaced by an edit
+    bool *deadStore;    // OP_SET_LOCAL of a local not read afterwards
+
+    Block *blocks;
+    int blockCount;
+    int *successors;    // by block
+    bool *deadEdges;
+    int edgeCount;
+    int *predecessors;  // by block, from predecessorStart[block]
+    int *predecessorStart;
+    int *reversePostorder;
+
+    Loop *loops;
+    int loopCount;
+    int *headerOf;      // the loop a block heads, -1 if none
+
+    Node *nodes;
+    int nodeCount;
+    int nodeCapacity;
+    int *table;         // of the hash-consed nodes, -1 for an empty entry
+    int tableCapacity;
+    int *factBlocks;    // the block of each fact
+    int *nextFacts;     // and the older fact on the same node
+    int factCount;
+    int factCapacity;
+
+    int globalCount;
+    int globalIndex[GLOBALS_MAX];   // index in the region of each global, -1 if unused
+    int globals[UINT8_COUNT];       // and back, a region using more isn't optimized
+
+    Replacement *replacements;
+    int replacementCount;
+    int replacementCapacity;
+    Hoist *hoists;
+    int hoistCount;
+    int hoistCapacity;
+
+    // scratch for the numbering of a block
+    int slots[STACK_MAX + 1];
+    int starts[STACK_MAX + 1];
+    int ends[STACK_MAX + 1];
+    int blockGlobals[UINT8_COUNT];
+    bool merged[STACK_MAX + 1 + UINT8_COUNT];
+    bool numbers[STACK_MAX + 1 + UINT8_COUNT];
+} Region;
+
+static uint16_t readShort(uint8_t *code)
+{
+    return (uint16_t)((code[0] << 8) | code[1]);
+}
+
+static void writeShort(uint8_t *code, int value)
+{
+    code[0] = (value >> 8) & 0xff;
+    code[1] = value & 0xff;
+}
+
+static bool isShortJump(uint8_t instruction)
+{
+    return instruction >= OP_JUMP && instruction <= OP_LOOP_SHORT && (instruction - OP_JUMP) % 2 == 1;
+}
+
+static bool isFusedJump(uint8_t instruction)
+{
+    return instruction >= OP_JUMP_IF_LESS && instruction <= OP_JUMP_IF_NOT_EQUAL_SHORT;
+}
+
+/*
+    @returns true for the instructions a basic block ends with.
+*/
+static bool endsBlock(uint8_t instruction)
+{
+    switch (instruction)
+    {
+        case OP_JUMP:
+        case OP_JUMP_BACK:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_FALSE_OR_POP:
+        case OP_JUMP_IF_TRUE_OR_POP:
+        case OP_LOOP:
+        case OP_CASE:
+        case OP_TABLESWITCH:
+        case OP_LOOKUPSWITCH:
+        case OP_TAIL_CALL:
+        case OP_TAIL_CALL_SELF:
+        case OP_RETURN_VALUE:
+        case OP_RETURN:         return true;
+        default:                return isFusedJump(instruction);
+    }
+}
+
+/*
+    @returns true for the instructions that may run code assigning globals.
+*/
+static bool callsOut(uint8_t instruction)
+{
+    return instruction == OP_CALL || instruction == OP_CALL_SELF ||
+           instruction == OP_INVOKE || instruction == OP_NATIVE;
+}
+
+/*
+    @returns the number of places the instruction may go on to.
+*/
+static int successorCount(uint8_t *code)
+{
+    switch (code[0])
+    {
+        case OP_TABLESWITCH:    return readShort(code + 5) + 1;
+        case OP_LOOKUPSWITCH:   return readShort(code + 1) + 1;
+        case OP_TAIL_CALL:
+        case OP_TAIL_CALL_SELF:
+        case OP_RETURN_VALUE:
+        case OP_RETURN:         return 0;
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_FALSE_OR_POP:
+        case OP_JUMP_IF_TRUE_OR_POP:
+        case OP_CASE:           return 2;
+        default:                return isFusedJump(code[0]) ? 2 : 1;
+    }
+}
+
+/*
+    @returns the offset of the index-th place the instruction goes on to:
+             the next instruction first for a conditional jump, the
+             default first for a switch.
+*/
+static int successorAt(Bytecode *bytecode, int offset, int index)
+{
+    uint8_t *code = bytecode->code + offset;
+    int next = offset + instructionLength(bytecode, offset);
+
+    switch (code[0])
+    {
+        case OP_TABLESWITCH:
+        case OP_LOOKUPSWITCH:
+        {
+            bool isTable = code[0] == OP_TABLESWITCH;
+            int at = index == 0 ? (isTable ? 7 : 3) : 9 + (index - 1) * (isTable ? 2 : 6);
+            return next - readShort(code + at);
+        }
+        case OP_JUMP:
+        case OP_JUMP_BACK:
+        case OP_LOOP:
+            return branchTarget(bytecode, offset);
+        default:
+            return endsBlock(code[0]) && index == 1 ? branchTarget(bytecode, offset) : next;
+    }
+}
+
+static bool isFalsey(Value value)
+{
+    switch (value.type)
+    {
+        case VAL_NIL:   return true;
+        case VAL_BOOL:  return !AS_BOOL(value);
+        default:        return false;
+    }
+}
+
+/*
+    @returns true if the constants are the very same value: unlike
+             valuesEqual(), -0 differs from 0 and a NaN equals itself.
+*/
+static bool sameConstant(Value a, Value b)
+{
+    if (a.type != b.type)
+        return false;
+
+    switch (a.type)
+    {
+        case VAL_NUMBER:    return memcmp(&a.as.number, &b.as.number, sizeof(double)) == 0;
+        case VAL_NIL:       return true;
+        default:            return valuesEqual(a, b);
+    }
+}
+
+static uint64_t constantBits(Value value)
+{
+    uint64_t bits = 0;
+    switch (value.type)
+    {
+        case VAL_NUMBER:    memcpy(&bits, &value.as.number, sizeof(double)); break;
+        case VAL_BOOL:      bits = AS_BOOL(value); break;
+        case VAL_OBJ:       bits = (uint64_t)(uintptr_t)AS_OBJ(value); break;
+        case VAL_FUNCTION:  bits = (uint64_t)AS_FUNCTION(value); break;
+        case VAL_CLASS:     bits = (uint64_t)AS_CLASS(value); break;
+        default:            break;
+    }
+    return bits * 31 + value.type;
+}
+
+static uint32_t hashNode(Node *node)
+{
+    uint64_t hash = node->kind == NODE_CONSTANT ? constantBits(node->value) : 0;
+    hash = hash * 0x9e3779b97f4a7c15u + ((uint64_t)node->kind << 8 | node->op);
+    hash = hash * 0x9e3779b97f4a7c15u + (uint32_t)node->a;
+    hash = hash * 0x9e3779b97f4a7c15u + (uint32_t)node->b;
+    hash = hash * 0x9e3779b97f4a7c15u + (uint32_t)node->capture;
+    return (uint32_t)(hash ^ (hash >> 29));
+}
+
+static bool sameNode(Node *a, Node *b)
+{
+    return a->kind == b->kind && a->op == b->op && a->a == b->a && a->b == b->b &&
+           a->capture == b->capture &&
+           (a->kind != NODE_CONSTANT || sameConstant(a->value, b->value));
+}
+
+static Node makeNode(NodeKind kind, uint8_t op, int a, int b)
+{
+    Node node;
+    node.kind = kind;
+    node.op = op;
+    node.number = false;
+    node.a = a;
+    node.b = b;
+    node.block = -1;
+    node.capture = -1;
+    node.constant = -1;
+    node.value = NIL_VAL;
+    node.temporary = -1;
+    node.definitions = -1;
+    node.facts = -1;
+    return node;
+}
+
+static int addNode(Region *region, Node node)
+{
+    if (region->nodeCapacity < region->nodeCount + 1)
+    {
+        int oldCapacity = region->nodeCapacity;
+        region->nodeCapacity = INCREASE_CAPACITY(oldCapacity);
+        region->nodes = INCREASE_SCRATCH(Node, region->nodes, oldCapacity, region->nodeCapacity);
+    }
+
+    region->nodes[region->nodeCount] = node;
+    return region->nodeCount++;
+}
+
+/*
+    @returns the node equal to the given one, added if there is none.
+*/
+static int internNode(Region *region, Node node)
+{
+    if (region->tableCapacity < 2 * (region->nodeCount + 1))
+    {
+        int oldCapacity = region->tableCapacity;
+        region->tableCapacity = oldCapacity < 64 ? 64 : oldCapacity * 2;
+        FREE_SCRATCH(int, region->table, oldCapacity);
+        region->table = ALLOCATE_SCRATCH(int, region->tableCapacity);
+        for (int i = 0; i < region->tableCapacity; i++)
+            region->table[i] = -1;
+
+        // only the hash-consed nodes go back into the table
+        for (int i = 0; i < region->nodeCount; i++)
+        {
+            Node *old = &region->nodes[i];
+            if (old->kind == NODE_LEAF && old->capture < 0)
+                continue;
+
+            uint32_t at = hashNode(old) & (region->tableCapacity - 1);
+            while (region->table[at] >= 0)
+                at = (at + 1) & (region->tableCapacity - 1);
+            region->table[at] = i;
+        }
+    }
+
+    uint32_t at = hashNode(&node) & (region->tableCapacity - 1);
+    while (region->table[at] >= 0)
+    {
+        if (sameNode(&region->nodes[region->table[at]], &node))
+            return region->table[at];
+        at = (at + 1) & (region->tableCapacity - 1);
+    }
+
+    int index = addNode(region, node);
+    region->table[at] = index;
+    return index;
+}
+
+static int newLeaf(Region *region, int block, bool number)
+{
+    Node node = makeNode(NODE_LEAF, 0, -1, -1);
+    node.block = block;
+    node.number = number;
+    return addNode(region, node);
+}
+
+static int constantNode(Region *region, Value value, int constant)
+{
+    Node node = makeNode(NODE_CONSTANT, 0, -1, -1);
+    node.value = value;
+    node.number = IS_NUMBER(value);
+    int index = internNode(region, node);
+    if (region->nodes[index].constant < 0)
+        region->nodes[index].constant = constant;
+    return index;
+}
+
+static int captureNode(Region *region, int capture)
+{
+    // copied into the closure, a capture never changes
+    Node node = makeNode(NODE_LEAF, OP_GET_CAPTURE, -1, -1);
+    node.capture = capture;
+    return internNode(region, node);
+}
+
+static int unaryNode(Region *region, uint8_t op, int a)
+{
+    Node *operand = &region->nodes[a];
+    if (operand->kind == NODE_CONSTANT)
+    {
+        if (op == OP_NOT)
+            return constantNode(region, BOOL_VAL(isFalsey(operand->value)), -1);
+        if (IS_NUMBER(operand->value))
+            return constantNode(region, NUMBER_VAL(-AS_NUMBER(operand->value)), -1);
+    }
+
+    Node node = makeNode(NODE_UNARY, op, a, -1);
+    node.number = op == OP_NEGATE;
+    return internNode(region, node);
+}
+
+static int binaryNode(Region *region, uint8_t op, int a, int b)
+{
+    Node *left = &region->nodes[a];
+    Node *right = &region->nodes[b];
+    if (left->kind == NODE_CONSTANT && right->kind == NODE_CONSTANT)
+    {
+        Value x = left->value;
+        Value y = right->value;
+        if (op == OP_EQUAL)
+            return constantNode(region, BOOL_VAL(valuesEqual(x, y)), -1);
+
+        // anything else fails on other operands, which must be kept
+        if (IS_NUMBER(x) && IS_NUMBER(y))
+        {
+            double p = AS_NUMBER(x);
+            double q = AS_NUMBER(y);
+            switch (op)
+            {
+                case OP_GREATER:    return constantNode(region, BOOL_VAL(p > q), -1);
+                case OP_LESS:       return constantNode(region, BOOL_VAL(p < q), -1);
+                case OP_ADD:        return constantNode(region, NUMBER_VAL(p + q), -1);
+                case OP_SUBTRACT:   return constantNode(region, NUMBER_VAL(p - q), -1);
+                case OP_MULTIPLY:   return constantNode(region, NUMBER_VAL(p * q), -1);
+                case OP_DIVIDE:     return constantNode(region, NUMBER_VAL(p / q), -1);
+            }
+        }
+    }
+
+    // the order of the operands doesn't matter to these
+    if ((op == OP_EQUAL || op == OP_ADD || op == OP_MULTIPLY) && a > b)
+    {
+        int swap = a;
+        a = b;
+        b = swap;
+    }
+
+    Node node = makeNode(NODE_BINARY, op, a, b);
+    node.number = op == OP_ADD || op == OP_SUBTRACT || op == OP_MULTIPLY || op == OP_DIVIDE;
+    return internNode(region, node);
+}
+
+/*
+    Records that the value is a number past the given block, which checks it.
+*/
+static void addFact(Region *region, int node, int block)
+{
+    if (node < 0 || region->nodes[node].number)
+        return;
+
+    if (region->factCapacity < region->factCount + 1)
+    {
+        int oldCapacity = region->factCapacity;
+        region->factCapacity = INCREASE_CAPACITY(oldCapacity);
+        region->factBlocks = INCREASE_SCRATCH(int, region->factBlocks, oldCapacity, region->factCapacity);
+        region->nextFacts = INCREASE_SCRATCH(int, region->nextFacts, oldCapacity, region->factCapacity);
+    }
+
+    region->factBlocks[region->factCount] = block;
+    region->nextFacts[region->factCount] = region->nodes[node].facts;
+    region->nodes[node].facts = region->factCount++;
+}
+
+static bool dominates(Region *region, int dominator, int block)
+{
+    for (; block >= 0; block = region->blocks[block].idom)
+    {
+        if (block == dominator)
+            return true;
+    }
+    return false;
+}
+
+/*
+    @returns true if the value is known to be a number on entry to the block.
+*/
+static bool numberAt(Region *region, int node, int block)
+{
+    if (region->nodes[node].number)
+        return true;
+
+    for (int fact = region->nodes[node].facts; fact >= 0; fact = region->nextFacts[fact])
+    {
+        int checked = region->factBlocks[fact];
+        if (checked != block && dominates(region, checked, block))
+            return true;
+    }
+    return false;
+}
+
+/*
+    @returns true if computing the value can't fail.
+*/
+static bool cannotFail(Region *region, int node)
+{
+    Node *n = &region->nodes[node];
+    switch (n->kind)
+    {
+        case NODE_CONSTANT:
+        case NODE_LEAF:
+            return true;
+        case NODE_UNARY:
+            return (n->op == OP_NOT || region->nodes[n->a].number) && cannotFail(region, n->a);
+        default:
+            return (n->op == OP_EQUAL || (region->nodes[n->a].number && region->nodes[n->b].number)) &&
+                   cannotFail(region, n->a) && cannotFail(region, n->b);
+    }
+}
+
+/*
+    @returns true if the value can be computed before the loop: its
+             operands don't change in it, and computing it there either
+             can't fail or fails like the check the loop starts with.
+*/
+static bool hoistable(Region *region, int node, Loop *loop)
+{
+    Node *n = &region->nodes[node];
+    switch (n->kind)
+    {
+        case NODE_CONSTANT:
+            return true;
+        case NODE_LEAF:
+            return n->block < 0 || !loop->members[n->block];
+        case NODE_UNARY:
+            return (n->op == OP_NOT || numberAt(region, n->a, loop->header)) &&
+                   hoistable(region, n->a, loop);
+        default:
+        {
+            if (n->op != OP_EQUAL)
+            {
+                for (int i = 0; i < 2; i++)
+                {
+                    int operand = i == 0 ? n->a : n->b;
+                    if (operand != loop->guardA && operand != loop->guardB &&
+                        !numberAt(region, operand, loop->header))
+                    {
+                        return false;
+                    }
+                }
+            }
+            return hoistable(region, n->a, loop) && hoistable(region, n->b, loop);
+        }
+    }
+}
+
+/*
+    @returns the index of the constant in the pool, added if it isn't
+             there, or -1 if the pool is full.
+*/
+static int constantIndex(Region *region, int node)
+{
+    Node *n = &region->nodes[node];
+    if (n->constant >= 0)
+        return n->constant;
+
+    ConstantPool *pool = &region->bytecode->constantPool;
+    for (int i = 0; i < pool->count; i++)
+    {
+        if (sameConstant(pool->constants[i], n->value))
+            return n->constant = i;
+    }
+
+    if (pool->count >= UINT16_COUNT)
+        return -1;
+    return n->constant = addConstant(region->bytecode, n->value);
+}
+
+static void emitCode(Optimizer *optimizer, uint8_t byte, int line)
+{
+    if (optimizer->codeCapacity < optimizer->codeCount + 1)
+    {
+        int oldCapacity = optimizer->codeCapacity;
+        optimizer->codeCapacity = INCREASE_CAPACITY(oldCapacity);
+        optimizer->code = INCREASE_SCRATCH(uint8_t, optimizer->code, oldCapacity, optimizer->codeCapacity);
+        optimizer->lines = INCREASE_SCRATCH(int, optimizer->lines, oldCapacity, optimizer->codeCapacity);
+    }
+
+    optimizer->code[optimizer->codeCount] = byte;
+    optimizer->lines[optimizer->codeCount] = line;
+    optimizer->codeCount++;
+}
+
+/*
+    @returns the slot a local of the code before the pass moves to.
+*/
+static int movedSlot(Region *region, int slot)
+{
+    return slot >= region->base ? slot + region->temporaryCount : slot;
+}
+
+/*
+    Writes the code computing the value on entry to the block, or only
+    checks that it can be written if 'emit' is false.
+    @returns false if a leaf isn't in a local, a global or a capture then.
+*/
+static bool materialize(Region *region, int node, Block *block, bool emit, int line)
+{
+    Optimizer *optimizer = region->optimizer;
+    Node *n = &region->nodes[node];
+    switch (n->kind)
+    {
+        case NODE_CONSTANT:
+        {
+            if (IS_NIL(n->value) || IS_BOOL(n->value))
+            {
+                if (emit)
+                    emitCode(optimizer, IS_NIL(n->value) ? OP_NIL : AS_BOOL(n->value) ? OP_TRUE : OP_FALSE, line);
+                return true;
+            }
+
+            int constant = constantIndex(region, node);
+            if (constant < 0)
+                return false;
+            if (emit && constant <= UINT8_MAX)
+            {
+                emitCode(optimizer, OP_CONSTANT, line);
+                emitCode(optimizer, (uint8_t)constant, line);
+            }else if (emit)
+            {
+                emitCode(optimizer, OP_CONSTANT_LONG, line);
+                emitCode(optimizer, (uint8_t)(constant >> 8), line);
+                emitCode(optimizer, (uint8_t)constant, line);
+            }
+            return true;
+        }
+        case NODE_LEAF:
+        {
+            int instruction = -1;
+            int operand = 0;
+            if (n->capture >= 0)
+            {
+                instruction = OP_GET_CAPTURE;
+                operand = n->capture;
+            }
+
+            // a local no longer read may have lost the stores into it
+            for (int slot = 0; instruction < 0 && slot < block->depth && slot < UINT8_COUNT; slot++)
+            {
+                if (block->entry[slot] == node && hasSlot(&block->liveIn, slot))
+                {
+                    instruction = OP_GET_LOCAL;
+                    operand = movedSlot(region, slot);
+                }
+            }
+
+            for (int global = 0; instruction < 0 && global < region->globalCount; global++)
+            {
+                if (block->entry[block->depth + global] == node)
+                {
+                    instruction = OP_GET_GLOBAL;
+                    operand = region->globals[global];
+                }
+            }
+
+            if (instruction < 0)
+                return false;
+            if (emit)
+            {
+                emitCode(optimizer, (uint8_t)instruction, line);
+                if (instruction == OP_GET_GLOBAL)
+                    emitCode(optimizer, (uint8_t)(operand >> 8), line);
+                emitCode(optimizer, (uint8_t)operand, line);
+            }
+            return true;
+        }
+        case NODE_UNARY:
+        {
+            uint8_t op = n->op;
+            if (!materialize(region, n->a, block, emit, line))
+                return false;
+            if (emit)
+                emitCode(optimizer, op, line);
+            return true;
+        }
+        default:
+        {
+            uint8_t op = n->op;
+            int b = n->b;
+            if (!materialize(region, n->a, block, emit, line) || !materialize(region, b, block, emit, line))
+                return false;
+            if (emit)
+                emitCode(optimizer, op, line);
+            return true;
+        }
+    }
+}
+
+static void replace(Region *region, ReplacementKind kind, int first, int last, int node, int target)
+{
+    if (region->replacementCapacity < region->replacementCount + 1)
+    {
+        int oldCapacity = region->replacementCapacity;
+        region->replacementCapacity = INCREASE_CAPACITY(oldCapacity);
+        region->replacements = INCREASE_SCRATCH(Replacement, region->replacements,
+                                              oldCapacity, region->replacementCapacity);
+    }
+
+    Replacement *replacement = &region->replacements[region->replacementCount++];
+    replacement->kind = kind;
+    replacement->first = first;
+    replacement->last = last;
+    replacement->node = node;
+    replacement->target = target;
+
+    if (kind != REPLACE_STORE)
+    {
+        for (int i = first; i <= last; i++)
+            region->removed[i] = true;
+    }
+}
+
+static bool anyRemoved(Region *region, int first, int last)
+{
+    for (int i = first; i <= last; i++)
+    {
+        if (region->removed[i])
+            return true;
+    }
+    return false;
+}
+
+/*
+    @returns the temporary of the node, taking a new one if it has none,
+             or -1 if there are no more.
+*/
+static int temporaryOf(Region *region, int node)
+{
+    Node *n = &region->nodes[node];
+    if (n->temporary < 0 && region->temporaryCount < region->maxTemporaries)
+        n->temporary = region->temporaryCount++;
+    return n->temporary;
+}
+
+/*
+    Splits the instructions into basic blocks.
+    @returns false if the code isn't made of them as expected.
+*/
+static bool findBlocks(Region *region)
+{
+    Bytecode *bytecode = region->bytecode;
+    int *indexAt = region->optimizer->indexAt;
+    int count = region->count;
+    bool *leaders = ALLOCATE_SCRATCH(bool, count);
+    bool ok = true;
+
+    memset(leaders, 0, count * sizeof(bool));
+    leaders[0] = true;
+    for (int i = 0; i < count && ok; i++)
+    {
+        uint8_t *code = bytecode->code + region->offsets[i];
+        if (isShortJump(code[0]))
+            ok = false;
+        if (!endsBlock(code[0]))
+            continue;
+
+        if (i + 1 < count)
+            leaders[i + 1] = true;
+        for (int k = 0; k < successorCount(code) && ok; k++)
+        {
+            int target = indexAt[successorAt(bytecode, region->offsets[i], k)];
+            if (target < 0)
+                ok = false;
+            else
+                leaders[target] = true;
+        }
+    }
+
+    region->blockCount = 0;
+    for (int i = 0; i < count; i++)
+        region->blockCount += leaders[i];
+
+    region->blocks = ALLOCATE_SCRATCH(Block, region->blockCount);
+    region->edgeCount = 0;
+    for (int i = 0, block = -1; i < count; i++)
+    {
+        if (leaders[i])
+        {
+            Block *b = &region->blocks[++block];
+            b->first = i;
+            b->entry = NULL;
+            b->exit = NULL;
+            b->loop = -1;
+            b->live = true;
+            b->depth = region->optimizer->depths[region->offsets[i]];
+            memset(&b->liveIn, 0, sizeof(SlotSet));
+        }
+        region->blocks[block].last = i;
+        region->blockOf[i] = block;
+    }
+
+    for (int b = 0; b < region->blockCount; b++)
+    {
+        Block *block = &region->blocks[b];
+        uint8_t *code = bytecode->code + region->offsets[block->last];
+        block->edgeCount = endsBlock(code[0]) ? successorCount(code) : 1;
+        region->edgeCount += block->edgeCount;
+    }
+
+    // one more, the code may have no edges
+    region->successors = ALLOCATE_SCRATCH(int, region->edgeCount + 1);
+    region->deadEdges = ALLOCATE_SCRATCH(bool, region->edgeCount + 1);
+    region->predecessors = ALLOCATE_SCRATCH(int, region->edgeCount + 1);
+    region->predecessorStart = ALLOCATE_SCRATCH(int, region->blockCount + 1);
+    memset(region->deadEdges, 0, region->edgeCount * sizeof(bool));
+    memset(region->predecessorStart, 0, (region->blockCount + 1) * sizeof(int));
+
+    for (int b = 0, edge = 0; b < region->blockCount && ok; b++)
+    {
+        Block *block = &region->blocks[b];
+        block->firstEdge = edge;
+        for (int k = 0; k < block->edgeCount && ok; k++)
+        {
+            int target = indexAt[successorAt(bytecode, region->offsets[block->last], k)];
+            ok = target >= 0 && leaders[target];
+            region->successors[edge++] = ok ? region->blockOf[target] : 0;
+        }
+    }
+
+    if (ok)
+    {
+        for (int edge = 0; edge < region->edgeCount; edge++)
+            region->predecessorStart[region->successors[edge] + 1]++;
+        for (int b = 0; b < region->blockCount; b++)
+            region->predecessorStart[b + 1] += region->predecessorStart[b];
+
+        int *filled = ALLOCATE_SCRATCH(int, region->blockCount);
+        memset(filled, 0, region->blockCount * sizeof(int));
+        for (int b = 0; b < region->blockCount; b++)
+        {
+            Block *block = &region->blocks[b];
+            for (int edge = block->firstEdge; edge < block->firstEdge + block->edgeCount; edge++)
+            {
+                int to = region->successors[edge];
+                region->predecessors[region->predecessorStart[to] + filled[to]++] = b;
+            }
+        }
+        FREE_SCRATCH(int, filled, region->blockCount);
+    }
+
+    FREE_SCRATCH(bool, leaders, count);
+    return ok;
+}
+
+/*
+    Orders the blocks in reverse postorder and finds their dominators with
+    the iterative algorithm of Cooper, Harvey and Kennedy.
+    @returns false if a block isn't reached from the entry.
+*/
+static bool findDominators(Region *region)
+{
+    int count = region->blockCount;
+    int *stack = ALLOCATE_SCRATCH(int, count);
+    int *next = ALLOCATE_SCRATCH(int, count);
+    bool *visited = ALLOCATE_SCRATCH(bool, count);
+    int sorted = count;
+
+    region->reversePostorder = ALLOCATE_SCRATCH(int, count);
+    memset(visited, 0, count * sizeof(bool));
+
+    int pending = 0;
+    stack[pending++] = 0;
+    next[0] = 0;
+    visited[0] = true;
+    while (pending > 0)
+    {
+        int b = stack[pending - 1];
+        Block *block = &region->blocks[b];
+        if (next[b] < block->edgeCount)
+        {
+            int successor = region->successors[block->firstEdge + next[b]++];
+            if (!visited[successor])
+            {
+                visited[successor] = true;
+                next[successor] = 0;
+                stack[pending++] = successor;
+            }
+        }else
+        {
+            pending--;
+            region->reversePostorder[--sorted] = b;
+        }
+    }
+
+    FREE_SCRATCH(bool, visited, count);
+    FREE_SCRATCH(int, next, count);
+    FREE_SCRATCH(int, stack, count);
+    if (sorted != 0)
+        return false;
+
+    for (int i = 0; i < count; i++)
+    {
+        region->blocks[region->reversePostorder[i]].order = i;
+        region->blocks[i].idom = -1;
+    }
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int i = 1; i < count; i++)
+        {
+            int b = region->reversePostorder[i];
+            int idom = -1;
+            for (int k = region->predecessorStart[b]; k < region->predecessorStart[b + 1]; k++)
+            {
+                int p = region->predecessors[k];
+                if (p != 0 && region->blocks[p].idom < 0)
+                    continue;   // not processed yet
+
+                if (idom < 0)
+                {
+                    idom = p;
+                    continue;
+                }
+
+                int x = p;
+                while (x != idom)
+                {
+                    while (region->blocks[x].order > region->blocks[idom].order)
+                        x = region->blocks[x].idom;
+                    while (region->blocks[idom].order > region->blocks[x].order)
+                        idom = region->blocks[idom].idom;
+                }
+            }
+
+            if (region->blocks[b].idom != idom)
+            {
+                region->blocks[b].idom = idom;
+                changed = true;
+            }
+        }
+        // the entry is its own dominator while the others are found
+        region->blocks[0].idom = 0;
+    }
+    region->blocks[0].idom = -1;
+
+    return true;
+}
+
+/*
+    Finds the natural loops, from their back edges.
+    @returns false if a jump enters a loop elsewhere than at its header.
+*/
+static bool findLoops(Region *region)
+{
+    Bytecode *bytecode = region->bytecode;
+    int count = region->blockCount;
+    int *worklist = ALLOCATE_SCRATCH(int, count);
+
+    region->headerOf = ALLOCATE_SCRATCH(int, count);
+    for (int b = 0; b < count; b++)
+        region->headerOf[b] = -1;
+
+    bool ok = true;
+    for (int u = 0; u < count && ok; u++)
+    {
+        Block *block = &region->blocks[u];
+        for (int edge = block->firstEdge; edge < block->firstEdge + block->edgeCount && ok; edge++)
+        {
+            int header = region->successors[edge];
+            if (region->blocks[header].order > block->order)
+                continue;
+
+            if (!dominates(region, header, u))
+            {
+                ok = false;
+                break;
+            }
+
+            int index = region->headerOf[header];
+            if (index < 0)
+            {
+                index = region->loopCount++;
+                region->loops = INCREASE_SCRATCH(Loop, region->loops, index, region->loopCount);
+                region->headerOf[header] = index;
+
+                Loop *loop = &region->loops[index];
+                memset(loop, 0, sizeof(Loop));
+                loop->header = header;
+                loop->members = ALLOCATE_SCRATCH(bool, count);
+                memset(loop->members, 0, count * sizeof(bool));
+                loop->members[header] = true;
+                loop->size = 1;
+            }
+
+            Loop *loop = &region->loops[index];
+            int pending = 0;
+            if (!loop->members[u])
+            {
+                loop->members[u] = true;
+                loop->size++;
+                worklist[pending++] = u;
+            }
+            while (pending > 0)
+            {
+                int b = worklist[--pending];
+                for (int k = region->predecessorStart[b]; k < region->predecessorStart[b + 1]; k++)
+                {
+                    int p = region->predecessors[k];
+                    if (!loop->members[p])
+                    {
+                        loop->members[p] = true;
+                        loop->size++;
+                        worklist[pending++] = p;
+                    }
+                }
+            }
+        }
+    }
+    FREE_SCRATCH(int, worklist, count);
+    if (!ok)
+        return false;
+
+    for (int l = 0; l < region->loopCount; l++)
+    {
+        Loop *loop = &region->loops[l];
+        loop->parent = -1;
+        for (int other = 0; other < region->loopCount; other++)
+        {
+            Loop *outer = &region->loops[other];
+            if (other != l && outer->members[loop->header] &&
+                (loop->parent < 0 || outer->size < region->loops[loop->parent].size))
+            {
+                loop->parent = other;
+            }
+        }
+
+        loop->low = bytecode->count;
+        loop->high = 0;
+        loop->minDepth = STACK_MAX;
+        loop->guardA = -1;
+        loop->guardB = -1;
+        for (int b = 0; b < count; b++)
+        {
+            if (!loop->members[b])
+                continue;
+
+            Block *block = &region->blocks[b];
+            if (block->loop < 0 || region->loops[block->loop].size > loop->size)
+                block->loop = l;
+
+            int end = region->offsets[block->last] + instructionLength(bytecode, region->offsets[block->last]);
+            if (region->offsets[block->first] < loop->low)
+                loop->low = region->offsets[block->first];
+            if (end > loop->high)
+                loop->high = end;
+
+            for (int i = block->first; i <= block->last; i++)
+            {
+                uint8_t *code = bytecode->code + region->offsets[i];
+                int depth = region->optimizer->depths[region->offsets[i]];
+                if (depth < loop->minDepth)
+                    loop->minDepth = depth;
+
+                if (code[0] == OP_SET_LOCAL)
+                {
+                    addSlot(&loop->writtenSlots, code[1]);
+                }else if (code[0] == OP_SET_GLOBAL || code[0] == OP_DEFINE_GLOBAL)
+                {
+                    addSlot(&loop->writtenGlobals, region->globalIndex[readShort(code + 1)]);
+                }else if (code[0] == OP_CLOSURE)
+                {
+                    for (int j = 0; j < code[2]; j++)
+                    {
+                        if ((code[3 + 2 * j] & CAPTURE_LOCAL) && (code[3 + 2 * j] & CAPTURE_BOXED))
+                            addSlot(&loop->writtenSlots, code[4 + 2 * j]);
+                    }
+                }else if (callsOut(code[0]))
+                {
+                    loop->callsOut = true;
+                }
+            }
+        }
+
+        // the code moved before the loop has to be run by the jumps from
+        // outside of it only, which are told apart by where they are
+        loop->contiguous = true;
+        for (int b = 0; b < count; b++)
+        {
+            int offset = region->offsets[region->blocks[b].first];
+            if (!loop->members[b] && offset >= loop->low && offset < loop->high)
+                loop->contiguous = false;
+        }
+    }
+
+    return true;
+}
+
+/*
+    Sets the value numbers on entry to the block from its predecessors,
+    giving a new number to a slot they disagree on.
+*/
+static void enterBlock(Region *region, int b)
+{
+    Block *block = &region->blocks[b];
+    int size = block->depth + region->globalCount;
+    int *entry = ALLOCATE_SCRATCH(int, size + 1);   // never empty
+    block->entry = entry;
+
+    bool first = true;
+    for (int k = region->predecessorStart[b]; k < region->predecessorStart[b + 1]; k++)
+    {
+        Block *predecessor = &region->blocks[region->predecessors[k]];
+        if (predecessor->order >= block->order)
+            continue;   // a back edge, see below
+
+        for (int s = 0; s < size; s++)
+        {
+            int value = s < block->depth ? predecessor->exit[s]
+                                         : predecessor->exit[predecessor->exitDepth + s - block->depth];
+            if (first)
+            {
+                entry[s] = value;
+                region->merged[s] = false;
+                region->numbers[s] = region->nodes[value].number;
+            }else
+            {
+                region->merged[s] |= entry[s] != value;
+                region->numbers[s] &= region->nodes[value].number;
+            }
+        }
+        first = false;
+    }
+
+    for (int s = 0; s < size; s++)
+    {
+        // the arguments and the globals on entry come from before the code
+        if (first)
+            entry[s] = newLeaf(region, b == 0 ? -1 : b, false);
+        else if (region->merged[s])
+            entry[s] = newLeaf(region, b, region->numbers[s]);
+    }
+
+    // a loop header keeps what the loop leaves alone
+    int index = region->headerOf[b];
+    if (index >= 0)
+    {
+        Loop *loop = &region->loops[index];
+        for (int s = 0; s < block->depth; s++)
+        {
+            if (s >= loop->minDepth || s >= UINT8_COUNT || hasSlot(&loop->writtenSlots, s))
+                entry[s] = newLeaf(region, b, false);
+        }
+        for (int g = 0; g < region->globalCount; g++)
+        {
+            if (loop->callsOut || hasSlot(&loop->writtenGlobals, g))
+                entry[block->depth + g] = newLeaf(region, b, false);
+        }
+    }
+}
+
+/*
+    Numbers the values the instructions of the block compute, and finds
+    the pure code computing each: a run of instructions that only read
+    variables and constants and operate on them.
+*/
+static void numberBlock(Region *region, int b)
+{
+    Bytecode *bytecode = region->bytecode;
+    Block *block = &region->blocks[b];
+    int *slots = region->slots;
+    int *starts = region->starts;
+    int *ends = region->ends;
+    int *globals = region->blockGlobals;
+    int depth = block->depth;
+
+    memcpy(slots, block->entry, depth * sizeof(int));
+    memcpy(globals, block->entry + depth, region->globalCount * sizeof(int));
+    for (int s = 0; s < depth; s++)
+        starts[s] = -1;
+
+    for (int i = block->first; i <= block->last; i++)
+    {
+        int offset = region->offsets[i];
+        uint8_t *code = bytecode->code + offset;
+        int top = depth - 1;
+
+        region->topNode[i] = depth > 0 ? slots[top] : -1;
+        region->topStart[i] = depth > 0 && starts[top] >= 0 && ends[top] == i - 1 ? starts[top] : -1;
+        region->secondNode[i] = depth > 1 ? slots[top - 1] : -1;
+        region->secondStart[i] = region->topStart[i] >= 0 && depth > 1 && starts[top - 1] >= 0 &&
+                                 ends[top - 1] == region->topStart[i] - 1 ? starts[top - 1] : -1;
+        region->spanStart[i] = -1;
+
+        if (i == block->last && endsBlock(code[0]))
+        {
+            if (code[0] >= OP_JUMP_IF_LESS && code[0] <= OP_JUMP_IF_NOT_GREATER_SHORT)
+            {
+                addFact(region, region->secondNode[i], b);
+                addFact(region, region->topNode[i], b);
+            }
+            break;
+        }
+
+        int node = -1;      // the value pushed
+        int first = -1;     // the first instruction of the pure code computing it
+        switch (code[0])
+        {
+            case OP_CONSTANT:
+                node = constantNode(region, bytecode->constantPool.constants[code[1]], code[1]);
+                first = i;
+            break;
+            case OP_CONSTANT_LONG:
+                node = constantNode(region, bytecode->constantPool.constants[readShort(code + 1)], readShort(code + 1));
+                first = i;
+            break;
+            case OP_NIL:        node = constantNode(region, NIL_VAL, -1);         first = i; break;
+            case OP_TRUE:       node = constantNode(region, BOOL_VAL(true), -1);  first = i; break;
+            case OP_FALSE:      node = constantNode(region, BOOL_VAL(false), -1); first = i; break;
+            case OP_GET_LOCAL:  node = slots[code[1]];                            first = i; break;
+            case OP_GET_CAPTURE: node = captureNode(region, code[1]);             first = i; break;
+            case OP_GET_GLOBAL: node = globals[region->globalIndex[readShort(code + 1)]]; first = i; break;
+            case OP_EQUAL:
+            case OP_GREATER:
+            case OP_LESS:
+            case OP_ADD:
+            case OP_SUBTRACT:
+            case OP_MULTIPLY:
+            case OP_DIVIDE:
+                node = binaryNode(region, code[0], slots[top - 1], slots[top]);
+                first = region->secondStart[i];
+                if (code[0] != OP_EQUAL)
+                {
+                    addFact(region, slots[top - 1], b);
+                    addFact(region, slots[top], b);
+                }
+                depth -= 2;
+            break;
+            case OP_NOT:
+            case OP_NEGATE:
+                node = unaryNode(region, code[0], slots[top]);
+                first = region->topStart[i];
+                if (code[0] == OP_NEGATE)
+                    addFact(region, slots[top], b);
+                depth--;
+            break;
+            case OP_POP:
+                depth--;
+            break;
+            case OP_SET_LOCAL:
+                slots[code[1]] = slots[top];
+                starts[top] = -1;
+            break;
+            case OP_SET_GLOBAL:
+                globals[region->globalIndex[readShort(code + 1)]] = slots[top];
+                starts[top] = -1;
+            break;
+            case OP_DEFINE_GLOBAL:
+                globals[region->globalIndex[readShort(code + 1)]] = slots[top];
+                depth--;
+            break;
+            case OP_SET_BOXED:
+            case OP_SET_CAPTURE:
+                starts[top] = -1;
+            break;
+            case OP_GET_BOXED:
+                node = newLeaf(region, b, false);
+            break;
+            case OP_CLOSURE:
+                for (int j = 0; j < code[2]; j++)
+                {
+                    // boxing a local puts the box in its slot
+                    if ((code[3 + 2 * j] & CAPTURE_LOCAL) && (code[3 + 2 * j] & CAPTURE_BOXED))
+                        slots[code[4 + 2 * j]] = newLeaf(region, b, false);
+                }
+                node = newLeaf(region, b, false);
+            break;
+            default:
+            {
+                // anything else replaces its operands with values not known
+                int after = region->optimizer->depths[offset + instructionLength(bytecode, offset)];
+                depth -= stackReach(code);
+                while (depth < after)
+                {
+                    slots[depth] = newLeaf(region, b, false);
+                    starts[depth] = -1;
+                    depth++;
+                }
+
+                if (callsOut(code[0]))
+                {
+                    for (int g = 0; g < region->globalCount; g++)
+                        globals[g] = newLeaf(region, b, false);
+                }
+            }break;
+        }
+
+        if (node >= 0)
+        {
+            slots[depth] = node;
+            starts[depth] = first;
+            ends[depth] = i;
+            depth++;
+            if (first >= 0 && first < i)
+            {
+                region->spanStart[i] = first;
+                region->spanNode[i] = node;
+            }
+        }
+    }
+
+    block->exitDepth = depth;
+    block->exit = ALLOCATE_SCRATCH(int, depth + region->globalCount + 1);
+    memcpy(block->exit, slots, depth * sizeof(int));
+    memcpy(block->exit + depth, globals, region->globalCount * sizeof(int));
+}
+
+/*
+    Finds what the loop header checks to be numbers before doing anything
+    else. The code moved before the loop may rely on it: if it fails there,
+    the check would have failed the same way.
+*/
+static void findGuard(Region *region, Loop *loop)
+{
+    Bytecode *bytecode = region->bytecode;
+    Block *header = &region->blocks[loop->header];
+    for (int i = header->first; i <= header->last; i++)
+    {
+        int offset = region->offsets[i];
+        uint8_t op = bytecode->code[offset];
+        switch (op)
+        {
+            case OP_CONSTANT:
+            case OP_CONSTANT_LONG:
+            case OP_NIL:
+            case OP_TRUE:
+            case OP_FALSE:
+            case OP_GET_LOCAL:
+            case OP_GET_CAPTURE:
+            case OP_GET_GLOBAL:
+            case OP_EQUAL:
+            case OP_NOT:
+            case OP_POP:
+                continue;
+            case OP_GREATER:
+            case OP_LESS:
+            case OP_ADD:
+            case OP_SUBTRACT:
+            case OP_MULTIPLY:
+            case OP_DIVIDE:
+            case OP_JUMP_IF_LESS:
+            case OP_JUMP_IF_NOT_LESS:
+            case OP_JUMP_IF_GREATER:
+            case OP_JUMP_IF_NOT_GREATER:
+                loop->guardA = region->secondNode[i];
+                loop->guardB = region->topNode[i];
+                loop->guardLine = bytecode->lines[offset];
+            return;
+            default:
+            return;
+        }
+    }
+}
+
+/*
+    The backward transfer of liveness over one instruction.
+*/
+static void liveStep(Region *region, int i, SlotSet *live)
+{
+    Bytecode *bytecode = region->bytecode;
+    int offset = region->offsets[i];
+    uint8_t *code = bytecode->code + offset;
+    int depth = region->optimizer->depths[offset];
+
+    switch (code[0])
+    {
+        case OP_GET_LOCAL:
+        case OP_GET_BOXED:
+            removeSlot(live, depth);
+            addSlot(live, code[1]);
+        break;
+        case OP_SET_LOCAL:
+            removeSlot(live, code[1]);
+            addSlot(live, depth - 1);
+        break;
+        case OP_SET_BOXED:
+            addSlot(live, code[1]);
+            addSlot(live, depth - 1);
+        break;
+        case OP_CLOSURE:
+            removeSlot(live, depth);
+            for (int j = 0; j < code[2]; j++)
+            {
+                if (code[3 + 2 * j] & CAPTURE_LOCAL)
+                    addSlot(live, code[4 + 2 * j]);
+            }
+        break;
+        case OP_POP:
+            // dropped unread
+            removeSlot(live, depth - 1);
+        break;
+        default:
+        {
+            int reach = stackReach(code);
+            if (!endsBlock(code[0]))
+            {
+                int after = region->optimizer->depths[offset + instructionLength(bytecode, offset)];
+                for (int s = depth - reach; s < after; s++)
+                    removeSlot(live, s);
+            }
+            for (int s = depth - reach; s < depth; s++)
+                addSlot(live, s);
+        }break;
+    }
+}
+
+/*
+    Finds the slots live on entry to each block, and the stores into
+    locals no path reads afterwards.
+*/
+static void findLiveness(Region *region)
+{
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int k = region->blockCount - 1; k >= 0; k--)
+        {
+            int b = region->reversePostorder[k];
+            Block *block = &region->blocks[b];
+            SlotSet live;
+            memset(&live, 0, sizeof(live));
+            for (int edge = block->firstEdge; edge < block->firstEdge + block->edgeCount; edge++)
+            {
+                SlotSet *in = &region->blocks[region->successors[edge]].liveIn;
+                for (int w = 0; w < UINT8_COUNT / 64; w++)
+                    live.bits[w] |= in->bits[w];
+            }
+
+            for (int i = block->last; i >= block->first; i--)
+            {
+                uint8_t *code = region->bytecode->code + region->offsets[i];
+                if (code[0] == OP_SET_LOCAL)
+                    region->deadStore[i] = !hasSlot(&live, code[1]);
+                liveStep(region, i, &live);
+            }
+
+            if (memcmp(&live, &block->liveIn, sizeof(live)) != 0)
+            {
+                block->liveIn = live;
+                changed = true;
+            }
+        }
+    }
+}
+
+/*
+    Folds the conditional jumps on constants, and drops the blocks no
+    longer reached.
+*/
+static void foldBranches(Region *region)
+{
+    Bytecode *bytecode = region->bytecode;
+    int *spans = ALLOCATE_SCRATCH(int, region->blockCount);     // the start of the condition, -1 if not folded
+    bool *taken = ALLOCATE_SCRATCH(bool, region->blockCount);
+
+    for (int b = 0; b < region->blockCount; b++)
+    {
+        Block *block = &region->blocks[b];
+        int i = block->last;
+        uint8_t *code = bytecode->code + region->offsets[i];
+        spans[b] = -1;
+
+        if (code[0] == OP_JUMP_IF_FALSE && region->topStart[i] >= 0 &&
+            region->nodes[region->topNode[i]].kind == NODE_CONSTANT)
+        {
+            spans[b] = region->topStart[i];
+            taken[b] = isFalsey(region->nodes[region->topNode[i]].value);
+        }else if (isFusedJump(code[0]) && region->secondStart[i] >= 0 &&
+                  region->nodes[region->secondNode[i]].kind == NODE_CONSTANT &&
+                  region->nodes[region->topNode[i]].kind == NODE_CONSTANT)
+        {
+            Value a = region->nodes[region->secondNode[i]].value;
+            Value c = region->nodes[region->topNode[i]].value;
+            // the comparisons fail on anything but numbers
+            bool folds = IS_NUMBER(a) && IS_NUMBER(c);
+            double x = folds ? AS_NUMBER(a) : 0;
+            double y = folds ? AS_NUMBER(c) : 0;
+            switch (code[0])
+            {
+                case OP_JUMP_IF_LESS:       taken[b] = x < y;     break;
+                case OP_JUMP_IF_NOT_LESS:   taken[b] = !(x < y);  break;
+                case OP_JUMP_IF_GREATER:    taken[b] = x > y;     break;
+                case OP_JUMP_IF_NOT_GREATER: taken[b] = !(x > y); break;
+                case OP_JUMP_IF_EQUAL:      taken[b] = valuesEqual(a, c); folds = true; break;
+                default:                    taken[b] = !valuesEqual(a, c); folds = true; break;
+            }
+            if (folds)
+                spans[b] = region->secondStart[i];
+        }
+
+        if (spans[b] >= 0)
+            region->deadEdges[block->firstEdge + (taken[b] ? 0 : 1)] = true;
+    }
+
+    for (int b = 0; b < region->blockCount; b++)
+        region->blocks[b].live = false;
+
+    int *worklist = ALLOCATE_SCRATCH(int, region->blockCount);
+    int pending = 0;
+    worklist[pending++] = 0;
+    region->blocks[0].live = true;
+    while (pending > 0)
+    {
+        Block *block = &region->blocks[worklist[--pending]];
+        for (int edge = block->firstEdge; edge < block->firstEdge + block->edgeCount; edge++)
+        {
+            Block *successor = &region->blocks[region->successors[edge]];
+            if (!region->deadEdges[edge] && !successor->live)
+            {
+                successor->live = true;
+                worklist[pending++] = region->successors[edge];
+            }
+        }
+    }
+    FREE_SCRATCH(int, worklist, region->blockCount);
+
+    for (int b = 0; b < region->blockCount; b++)
+    {
+        Block *block = &region->blocks[b];
+        if (!block->live)
+            replace(region, REPLACE_REMOVE, block->first, block->last, -1, -1);
+        else if (spans[b] >= 0 && taken[b])
+            replace(region, REPLACE_JUMP, spans[b], block->last, -1,
+                    branchTarget(bytecode, region->offsets[block->last]));
+        else if (spans[b] >= 0)
+            replace(region, REPLACE_REMOVE, spans[b], block->last, -1, -1);
+    }
+
+    FREE_SCRATCH(bool, taken, region->blockCount);
+    FREE_SCRATCH(int, spans, region->blockCount);
+}
+
+/*
+    Drops the stores into locals not read afterwards and the expression
+    statements that can have no effect.
+*/
+static void removeDeadCode(Region *region)
+{
+    Bytecode *bytecode = region->bytecode;
+    for (int i = 0; i < region->count; i++)
+    {
+        uint8_t *code = bytecode->code + region->offsets[i];
+        int start = region->topStart[i];
+        bool pure = start >= 0 && cannotFail(region, region->topNode[i]);
+
+        if (region->removed[i] || !region->blocks[region->blockOf[i]].live)
+            continue;
+
+        if (code[0] == OP_POP && pure && !anyRemoved(region, start, i))
+        {
+            replace(region, REPLACE_REMOVE, start, i, -1, -1);
+        }else if (code[0] == OP_SET_LOCAL && region->deadStore[i] &&
+                  i < region->blocks[region->blockOf[i]].last &&
+                  bytecode->code[region->offsets[i + 1]] == OP_POP &&
+                  code[1] < region->optimizer->depths[region->offsets[i]] - 1)
+        {
+            if (pure && !anyRemoved(region, start, i + 1))
+                replace(region, REPLACE_REMOVE, start, i + 1, -1, -1);
+            else
+                replace(region, REPLACE_REMOVE, i, i, -1, -1);
+        }
+    }
+}
+
+/*
+    @returns the outermost loop the value can be computed before, -1 if none.
+*/
+static int hoistTarget(Region *region, int node, int block)
+{
+    int target = -1;
+    for (int l = region->blocks[block].loop; l >= 0; l = region->loops[l].parent)
+    {
+        Loop *loop = &region->loops[l];
+        Block *header = &region->blocks[loop->header];
+        if (loop->contiguous && header->live && hoistable(region, node, loop) &&
+            materialize(region, node, header, false, 0))
+        {
+            target = l;
+        }
+    }
+    return target;
+}
+
+/*
+    The pure code of the region, the longest first among those starting
+    at the same instruction.
+*/
+static THREAD_LOCAL Region *sortedRegion;
+
+static int compareOccurrences(const void *a, const void *b)
+{
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    int startX = sortedRegion->spanStart[x];
+    int startY = sortedRegion->spanStart[y];
+    if (startX != startY)
+        return startX < startY ? -1 : 1;
+    return x > y ? -1 : x < y ? 1 : 0;
+}
+
+/*
+    Replaces the pure code by a constant, a temporary computed before
+    a loop, or one computed earlier.
+*/
+static void reuseValues(Region *region)
+{
+    int *occurrences = ALLOCATE_SCRATCH(int, region->count);
+    int count = 0;
+    for (int i = 0; i < region->count; i++)
+    {
+        if (region->spanStart[i] >= 0)
+            occurrences[count++] = i;
+    }
+
+    sortedRegion = region;
+    qsort(occurrences, count, sizeof(int), compareOccurrences);
+
+    for (int k = 0; k < count; k++)
+    {
+        int last = occurrences[k];
+        int first = region->spanStart[last];
+        int node = region->spanNode[last];
+        int block = region->blockOf[last];
+        if (anyRemoved(region, first, last) || !region->blocks[block].live)
+            continue;
+
+        if (region->nodes[node].kind == NODE_CONSTANT)
+        {
+            if (IS_NIL(region->nodes[node].value) || IS_BOOL(region->nodes[node].value) ||
+                constantIndex(region, node) >= 0)
+            {
+                replace(region, REPLACE_CONSTANT, first, last, node, -1);
+            }
+            continue;
+        }
+
+        int loop = hoistTarget(region, node, block);
+        if (loop >= 0 && temporaryOf(region, node) >= 0)
+        {
+            bool hoisted = false;
+            for (int h = 0; h < region->hoistCount; h++)
+                hoisted |= region->hoists[h].loop == loop && region->hoists[h].node == node;
+
+            if (!hoisted)
+            {
+                if (region->hoistCapacity < region->hoistCount + 1)
+                {
+                    int oldCapacity = region->hoistCapacity;
+                    region->hoistCapacity = INCREASE_CAPACITY(oldCapacity);
+                    region->hoists = INCREASE_SCRATCH(Hoist, region->hoists, oldCapacity, region->hoistCapacity);
+                }
+                region->hoists[region->hoistCount].loop = loop;
+                region->hoists[region->hoistCount].node = node;
+                region->hoistCount++;
+            }
+
+            replace(region, REPLACE_TEMPORARY, first, last, node, -1);
+            continue;
+        }
+
+        // worth a store only if it saves at least two instructions
+        int definition = -1;
+        for (int d = region->nodes[node].definitions; d >= 0 && last - first >= 2; d = region->nextDefinition[d])
+        {
+            int at = region->blockOf[d];
+            if (at == block ? d < first : dominates(region, at, block))
+            {
+                definition = d;
+                break;
+            }
+        }
+
+        if (definition >= 0 && temporaryOf(region, node) >= 0)
+        {
+            region->stored[definition] = true;
+            replace(region, REPLACE_TEMPORARY, first, last, node, -1);
+        }else
+        {
+            region->nextDefinition[last] = region->nodes[node].definitions;
+            region->nodes[node].definitions = last;
+        }
+    }
+
+    for (int i = 0; i < region->count; i++)
+    {
+        if (region->stored[i])
+            replace(region, REPLACE_STORE, i, i, region->spanNode[i], -1);
+    }
+
+    FREE_SCRATCH(int, occurrences, region->count);
+}
+
+static void addEdit(Optimizer *optimizer, int offset, int length, int order, int bytes, int jump)
+{
+    if (optimizer->editCapacity < optimizer->editCount + 1)
+    {
+        int oldCapacity = optimizer->editCapacity;
+        optimizer->editCapacity = INCREASE_CAPACITY(oldCapacity);
+        optimizer->edits = INCREASE_SCRATCH(Edit, optimizer->edits, oldCapacity, optimizer->editCapacity);
+    }
+
+    Edit *edit = &optimizer->edits[optimizer->editCount++];
+    edit->offset = offset;
+    edit->length = length;
+    edit->order = order;
+    edit->insideStart = 0;
+    edit->insideEnd = 0;
+    edit->bytes = bytes;
+    edit->byteCount = optimizer->codeCount - bytes;
+    edit->jump = jump;
+}
+
+/*
+    Turns what was decided for the region into edits of the code.
+*/
+static void emitEdits(Region *region)
+{
+    Optimizer *optimizer = region->optimizer;
+    Bytecode *bytecode = region->bytecode;
+    int entry = region->offsets[0];
+    int temporaries = region->temporaryCount;
+
+    optimizer->bases[region->function + 1] = region->base;
+    optimizer->temporaries[region->function + 1] = temporaries;
+
+    if (temporaries > 0)
+    {
+        int bytes = optimizer->codeCount;
+        for (int t = 0; t < temporaries; t++)
+            emitCode(optimizer, OP_NIL, bytecode->lines[entry]);
+        addEdit(optimizer, entry, 0, 0, bytes, -1);
+        optimizer->edits[optimizer->editCount - 1].insideStart = region->low;
+        optimizer->edits[optimizer->editCount - 1].insideEnd = region->high;
+    }
+
+    for (int l = 0; l < region->loopCount; l++)
+    {
+        Loop *loop = &region->loops[l];
+        Block *header = &region->blocks[loop->header];
+        int offset = region->offsets[header->first];
+        int line = loop->guardA >= 0 ? loop->guardLine : bytecode->lines[offset];
+        int bytes = optimizer->codeCount;
+
+        for (int h = 0; h < region->hoistCount; h++)
+        {
+            if (region->hoists[h].loop != l)
+                continue;
+
+            int node = region->hoists[h].node;
+            materialize(region, node, header, true, line);
+            emitCode(optimizer, OP_SET_LOCAL, line);
+            emitCode(optimizer, (uint8_t)(region->base + region->nodes[node].temporary), line);
+            emitCode(optimizer, OP_POP, line);
+        }
+
+        if (optimizer->codeCount > bytes)
+        {
+            addEdit(optimizer, offset, 0, 1, bytes, -1);
+            optimizer->edits[optimizer->editCount - 1].insideStart = loop->low;
+            optimizer->edits[optimizer->editCount - 1].insideEnd = loop->high;
+        }
+    }
+
+    for (int r = 0; r < region->replacementCount; r++)
+    {
+        Replacement *replacement = &region->replacements[r];
+        int offset = region->offsets[replacement->first];
+        int lastOffset = region->offsets[replacement->last];
+        int end = lastOffset + instructionLength(bytecode, lastOffset);
+        int line = bytecode->lines[lastOffset];
+        int bytes = optimizer->codeCount;
+        int jump = -1;
+        Node *node = replacement->node >= 0 ? &region->nodes[replacement->node] : NULL;
+
+        switch (replacement->kind)
+        {
+            case REPLACE_REMOVE:
+            break;
+            case REPLACE_CONSTANT:
+                materialize(region, replacement->node, NULL, true, line);
+            break;
+            case REPLACE_TEMPORARY:
+                emitCode(optimizer, OP_GET_LOCAL, line);
+                emitCode(optimizer, (uint8_t)(region->base + node->temporary), line);
+            break;
+            case REPLACE_JUMP:
+                emitCode(optimizer, OP_JUMP, line);
+                emitCode(optimizer, 0, line);
+                emitCode(optimizer, 0, line);
+                jump = replacement->target;
+            break;
+            case REPLACE_STORE:
+                for (int at = offset; at < end; at++)
+                    emitCode(optimizer, bytecode->code[at], bytecode->lines[at]);
+                emitCode(optimizer, OP_SET_LOCAL, line);
+                emitCode(optimizer, (uint8_t)(region->base + node->temporary), line);
+            break;
+        }
+
+        addEdit(optimizer, offset, end - offset, 2, bytes, jump);
+    }
+}
+
+static void freeRegion(Region *region)
+{
+    int count = region->count;
+    FREE_SCRATCH(int, region->blockOf, count);
+    FREE_SCRATCH(int, region->topNode, count);
+    FREE_SCRATCH(int, region->topStart, count);
+    FREE_SCRATCH(int, region->secondNode, count);
+    FREE_SCRATCH(int, region->secondStart, count);
+    FREE_SCRATCH(int, region->spanStart, count);
+    FREE_SCRATCH(int, region->spanNode, count);
+    FREE_SCRATCH(int, region->nextDefinition, count);
+    FREE_SCRATCH(bool, region->stored, count);
+    FREE_SCRATCH(bool, region->removed, count);
+    FREE_SCRATCH(bool, region->deadStore, count);
+
+    for (int b = 0; b < region->blockCount; b++)
+    {
+        Block *block = &region->blocks[b];
+        if (block->entry != NULL)
+            FREE_SCRATCH(int, block->entry, block->depth + region->globalCount + 1);
+        if (block->exit != NULL)
+            FREE_SCRATCH(int, block->exit, block->exitDepth + region->globalCount + 1);
+    }
+    FREE_SCRATCH(Block, region->blocks, region->blockCount);
+    FREE_SCRATCH(int, region->successors, region->edgeCount + 1);
+    FREE_SCRATCH(bool, region->deadEdges, region->edgeCount + 1);
+    FREE_SCRATCH(int, region->predecessors, region->edgeCount + 1);
+    FREE_SCRATCH(int, region->predecessorStart, region->blockCount + 1);
+    FREE_SCRATCH(int, region->reversePostorder, region->blockCount);
+    FREE_SCRATCH(int, region->headerOf, region->blockCount);
+    for (int l = 0; l < region->loopCount; l++)
+        FREE_SCRATCH(bool, region->loops[l].members, region->blockCount);
+    FREE_SCRATCH(Loop, region->loops, region->loopCount);
+    FREE_SCRATCH(Node, region->nodes, region->nodeCapacity);
+    FREE_SCRATCH(int, region->table, region->tableCapacity);
+    FREE_SCRATCH(int, region->factBlocks, region->factCapacity);
+    FREE_SCRATCH(int, region->nextFacts, region->factCapacity);
+    FREE_SCRATCH(Replacement, region->replacements, region->replacementCapacity);
+    FREE_SCRATCH(Hoist, region->hoists, region->hoistCapacity);
+}
+
+/*
+    Optimizes the script or a function, whose instructions are given in
+    the order of the code.
+*/
+static void optimizeRegion(Optimizer *optimizer, int function, int *offsets, int count)
+{
+    Bytecode *bytecode = optimizer->bytecode;
+    Region *region = ALLOCATE_SCRATCH(Region, 1);
+    memset(region, 0, sizeof(Region));
+
+    region->optimizer = optimizer;
+    region->bytecode = bytecode;
+    region->function = function;
+    region->offsets = offsets;
+    region->count = count;
+    region->low = function >= 0 ? bytecode->functions[function].entry : optimizer->start;
+    region->high = function >= 0 ? bytecode->functions[function].end : bytecode->count;
+    region->base = function >= 0 ? bytecode->functions[function].arity : 0;
+
+    region->blockOf = ALLOCATE_SCRATCH(int, count);
+    region->topNode = ALLOCATE_SCRATCH(int, count);
+    region->topStart = ALLOCATE_SCRATCH(int, count);
+    region->secondNode = ALLOCATE_SCRATCH(int, count);
+    region->secondStart = ALLOCATE_SCRATCH(int, count);
+    region->spanStart = ALLOCATE_SCRATCH(int, count);
+    region->spanNode = ALLOCATE_SCRATCH(int, count);
+    region->nextDefinition = ALLOCATE_SCRATCH(int, count);
+    region->stored = ALLOCATE_SCRATCH(bool, count);
+    region->removed = ALLOCATE_SCRATCH(bool, count);
+    region->deadStore = ALLOCATE_SCRATCH(bool, count);
+    memset(region->stored, 0, count * sizeof(bool));
+    memset(region->removed, 0, count * sizeof(bool));
+    memset(region->deadStore, 0, count * sizeof(bool));
+
+    // the temporaries go after the arguments, and must neither push the
+    // locals out of reach of their 8-bit operands nor the stack past its end
+    int maxSlot = region->base;
+    int maxDepth = 0;
+    bool recursive = false;
+    bool tooManyGlobals = false;
+    for (int g = 0; g < GLOBALS_MAX; g++)
+        region->globalIndex[g] = -1;
+
+    for (int i = 0; i < count; i++)
+    {
+        uint8_t *code = bytecode->code + offsets[i];
+        int depth = optimizer->depths[offsets[i]];
+        optimizer->indexAt[offsets[i]] = i;
+        if (depth + 1 > maxDepth)
+            maxDepth = depth + 1;
+
+        switch (code[0])
+        {
+            case OP_GET_LOCAL:
+            case OP_SET_LOCAL:
+            case OP_GET_BOXED:
+            case OP_SET_BOXED:
+                if (code[1] > maxSlot)
+                    maxSlot = code[1];
+            break;
+            case OP_CLOSURE:
+                for (int j = 0; j < code[2]; j++)
+                {
+                    if ((code[3 + 2 * j] & CAPTURE_LOCAL) && code[4 + 2 * j] > maxSlot)
+                        maxSlot = code[4 + 2 * j];
+                }
+            break;
+            case OP_GET_GLOBAL:
+            case OP_SET_GLOBAL:
+            case OP_DEFINE_GLOBAL:
+            {
+                int global = readShort(code + 1);
+                if (region->globalIndex[global] >= 0)
+                    break;
+                if (region->globalCount == UINT8_COUNT)
+                {
+                    tooManyGlobals = true;
+                    break;
+                }
+                region->globalIndex[global] = region->globalCount;
+                region->globals[region->globalCount++] = global;
+            }break;
+            case OP_CALL_SELF:
+            case OP_TAIL_CALL_SELF:
+            case OP_SELF:
+                recursive = true;
+            break;
+        }
+    }
+    if (maxDepth - 1 > maxSlot)
+        maxSlot = maxDepth - 1;
+
+    region->maxTemporaries = MAX_TEMPORARIES;
+    if (UINT8_MAX - maxSlot < region->maxTemporaries)
+        region->maxTemporaries = UINT8_MAX - maxSlot;
+    if (STACK_MAX - maxDepth < region->maxTemporaries)
+        region->maxTemporaries = STACK_MAX - maxDepth;
+    if (recursive || region->maxTemporaries < 0)
+        region->maxTemporaries = 0;
+
+    if (!tooManyGlobals && findBlocks(region) && findDominators(region) && findLoops(region))
+    {
+        for (int k = 0; k < region->blockCount; k++)
+        {
+            int b = region->reversePostorder[k];
+            enterBlock(region, b);
+            numberBlock(region, b);
+        }
+
+        for (int l = 0; l < region->loopCount; l++)
+            findGuard(region, &region->loops[l]);
+
+        findLiveness(region);
+        foldBranches(region);
+        removeDeadCode(region);
+        reuseValues(region);
+        emitEdits(region);
+    }
+
+    for (int i = 0; i < count; i++)
+        optimizer->indexAt[offsets[i]] = -1;
+
+    freeRegion(region);
+    FREE_SCRATCH(Region, region, 1);
+}
+
+static int compareEdits(const void *a, const void *b)
+{
+    const Edit *x = (const Edit*)a;
+    const Edit *y = (const Edit*)b;
+    if (x->offset != y->offset)
+        return x->offset < y->offset ? -1 : 1;
+    return x->order - y->order;
+}
+
+/*
+    The code laid out by applyEdits().
+*/
+typedef struct
+{
+    int *editAt;        // the first edit at each offset, -1 if none
+    int *editStarts;    // where the code of each edit goes
+    int *newOffsets;    // where each instruction goes
+} Layout;
+
+/*
+    @returns where a branch from 'source' to 'target' lands once edited.
+*/
+static int newTarget(Optimizer *optimizer, Layout *layout, int target, int source)
+{
+    int start = optimizer->start;
+    for (int e = layout->editAt[target - start];
+         e >= 0 && e < optimizer->editCount && optimizer->edits[e].offset == target; e++)
+    {
+        Edit *edit = &optimizer->edits[e];
+        if (edit->length == 0 && source >= edit->insideStart && source < edit->insideEnd)
+            continue;
+        return layout->editStarts[e];
+    }
+    return layout->newOffsets[target - start];
+}
+
+/*
+    Rewrites a distance of a branch whose end moves to 'end'.
+    @returns false if it no longer fits into 16 bits.
+*/
+static bool writeDistance(uint8_t *operand, int end, int target, bool backward)
+{
+    int distance = backward ? end - target : target - end;
+    if (distance < 0 || distance > UINT16_MAX)
+        return false;
+
+    writeShort(operand, distance);
+    return true;
+}
+
+/*
+    Points the branches of the instruction moved from 'offset' to 'to' at
+    the new places of their targets, and moves the locals past the
+    temporaries.
+*/
+static bool moveInstruction(Optimizer *optimizer, Layout *layout, int offset, uint8_t *to, int position)
+{
+    Bytecode *bytecode = optimizer->bytecode;
+    uint8_t *from = bytecode->code + offset;
+    int length = instructionLength(bytecode, offset);
+    int end = position + length;
+    bool ok = true;
+
+    switch (from[0])
+    {
+        case OP_JUMP:
+        case OP_JUMP_BACK:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_FALSE_OR_POP:
+        case OP_JUMP_IF_TRUE_OR_POP:
+        case OP_LOOP:
+        case OP_JUMP_IF_LESS:
+        case OP_JUMP_IF_NOT_LESS:
+        case OP_JUMP_IF_GREATER:
+        case OP_JUMP_IF_NOT_GREATER:
+        case OP_JUMP_IF_EQUAL:
+        case OP_JUMP_IF_NOT_EQUAL:
+            ok = writeDistance(to + 1, end, newTarget(optimizer, layout, branchTarget(bytecode, offset), offset),
+                               from[0] == OP_JUMP_BACK || from[0] == OP_LOOP);
+        break;
+        case OP_CASE:
+            ok = writeDistance(to + 3, end, newTarget(optimizer, layout, branchTarget(bytecode, offset), offset), true);
+        break;
+        case OP_TABLESWITCH:
+        case OP_LOOKUPSWITCH:
+        {
+            bool isTable = from[0] == OP_TABLESWITCH;
+            int entries = successorCount(from);
+            for (int k = 0; k < entries && ok; k++)
+            {
+                int at = k == 0 ? (isTable ? 7 : 3) : 9 + (k - 1) * (isTable ? 2 : 6);
+                int target = newTarget(optimizer, layout, successorAt(bytecode, offset, k), offset);
+                ok = writeDistance(to + at, end, target, true);
+            }
+        }break;
+    }
+
+    if (optimizer->depths[offset] < 0)
+        return ok;
+
+    int owner = optimizer->owners[offset] + 1;
+    int base = optimizer->bases[owner];
+    int temporaries = optimizer->temporaries[owner];
+    switch (from[0])
+    {
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_BOXED:
+        case OP_SET_BOXED:
+            if (to[1] >= base)
+                to[1] += temporaries;
+        break;
+        case OP_CLOSURE:
+            for (int j = 0; j < to[2]; j++)
+            {
+                if ((to[3 + 2 * j] & CAPTURE_LOCAL) && to[4 + 2 * j] >= base)
+                    to[4 + 2 * j] += temporaries;
+            }
+        break;
+    }
+
+    return ok;
+}
+
+/*
+    Lays the code out again with the edits, keeping the old code if a
+    jump gets out of range or the result is malformed.
+*/
+static void applyEdits(Optimizer *optimizer)
+{
+    Bytecode *bytecode = optimizer->bytecode;
+    int start = optimizer->start;
+    int oldCount = bytecode->count;
+    int size = oldCount - start;
+    Layout layout;
+
+    qsort(optimizer->edits, optimizer->editCount, sizeof(Edit), compareEdits);
+
+    layout.editAt = ALLOCATE_SCRATCH(int, size + 1);
+    layout.editStarts = ALLOCATE_SCRATCH(int, optimizer->editCount);
+    layout.newOffsets = ALLOCATE_SCRATCH(int, size + 1);
+    for (int i = 0; i <= size; i++)
+        layout.editAt[i] = -1;
+    for (int e = optimizer->editCount - 1; e >= 0; e--)
+        layout.editAt[optimizer->edits[e].offset - start] = e;
+
+    // where everything goes
+    int position = start;
+    for (int offset = start, e = 0; offset < oldCount; )
+    {
+        int skipTo = -1;
+        for (; e < optimizer->editCount && optimizer->edits[e].offset == offset; e++)
+        {
+            layout.editStarts[e] = position;
+            position += optimizer->edits[e].byteCount;
+            if (optimizer->edits[e].length > 0)
+                skipTo = offset + optimizer->edits[e].length;
+        }
+
+        if (skipTo >= 0)
+        {
+            // what the jumps into replaced code would find next
+            for (int at = offset; at < skipTo; at++)
+                layout.newOffsets[at - start] = position;
+            offset = skipTo;
+            continue;
+        }
+
+        layout.newOffsets[offset - start] = position;
+        position += instructionLength(bytecode, offset);
+        offset += instructionLength(bytecode, offset);
+    }
+    layout.newOffsets[size] = position;
+
+    int newSize = position - start;
+    uint8_t *newCode = ALLOCATE_SCRATCH(uint8_t, newSize);
+    int *newLines = ALLOCATE_SCRATCH(int, newSize);
+    bool ok = true;
+
+    for (int offset = start, e = 0; offset < oldCount && ok; )
+    {
+        int skipTo = -1;
+        for (; e < optimizer->editCount && optimizer->edits[e].offset == offset; e++)
+        {
+            Edit *edit = &optimizer->edits[e];
+            int at = layout.editStarts[e] - start;
+            if (edit->byteCount > 0)
+            {
+                memcpy(newCode + at, optimizer->code + edit->bytes, edit->byteCount);
+                memcpy(newLines + at, optimizer->lines + edit->bytes, edit->byteCount * sizeof(int));
+            }
+            if (edit->jump >= 0)
+            {
+                int end = layout.editStarts[e] + edit->byteCount;
+                ok = ok && writeDistance(newCode + at + edit->byteCount - 2, end,
+                                         newTarget(optimizer, &layout, edit->jump, edit->offset), false);
+            }
+            if (edit->length > 0)
+                skipTo = offset + edit->length;
+        }
+
+        if (skipTo >= 0)
+        {
+            offset = skipTo;
+            continue;
+        }
+
+        int length = instructionLength(bytecode, offset);
+        int at = layout.newOffsets[offset - start] - start;
+        memcpy(newCode + at, bytecode->code + offset, length);
+        memcpy(newLines + at, bytecode->lines + offset, length * sizeof(int));
+        ok = moveInstruction(optimizer, &layout, offset, newCode + at, at + start);
+        offset += length;
+    }
+
+    if (ok)
+    {
+        uint8_t *oldCode = ALLOCATE_SCRATCH(uint8_t, size);
+        int *oldLines = ALLOCATE_SCRATCH(int, size);
+        int *oldBounds = ALLOCATE_SCRATCH(int, 2 * bytecode->functionCount);
+        memcpy(oldCode, bytecode->code + start, size);
+        memcpy(oldLines, bytecode->lines + start, size * sizeof(int));
+        for (int i = 0; i < bytecode->functionCount; i++)
+        {
+            Function *function = &bytecode->functions[i];
+            oldBounds[2 * i] = function->entry;
+            oldBounds[2 * i + 1] = function->end;
+            if (function->entry >= start)
+            {
+                function->entry = newTarget(optimizer, &layout, function->entry, -1);
+                function->end = newTarget(optimizer, &layout, function->end, -1);
+            }
+        }
+
+        if (bytecode->capacity < start + newSize)
+            reserveCode(bytecode, start + newSize);
+        memcpy(bytecode->code + start, newCode, newSize);
+        memcpy(bytecode->lines + start, newLines, newSize * sizeof(int));
+        bytecode->count = start + newSize;
+
+        // a last line of defense: the code has to stay well-formed
+        int *depths = regionDepths(bytecode, start, NULL);
+        if (depths != NULL)
+        {
+            FREE_SCRATCH(int, depths, bytecode->count + 1);
+        }else
+        {
+            memcpy(bytecode->code + start, oldCode, size);
+            memcpy(bytecode->lines + start, oldLines, size * sizeof(int));
+            bytecode->count = oldCount;
+            for (int i = 0; i < bytecode->functionCount; i++)
+            {
+                bytecode->functions[i].entry = oldBounds[2 * i];
+                bytecode->functions[i].end = oldBounds[2 * i + 1];
+            }
+        }
+
+        FREE_SCRATCH(int, oldBounds, 2 * bytecode->functionCount);
+        FREE_SCRATCH(int, oldLines, size);
+        FREE_SCRATCH(uint8_t, oldCode, size);
+    }
+
+    FREE_SCRATCH(int, newLines, newSize);
+    FREE_SCRATCH(uint8_t, newCode, newSize);
+    FREE_SCRATCH(int, layout.newOffsets, size + 1);
+    FREE_SCRATCH(int, layout.editStarts, optimizer->editCount);
+    FREE_SCRATCH(int, layout.editAt, size + 1);
+}
+
+void optimizeBytecode(Bytecode *bytecode, int start)
+{
+    if (start >= bytecode->count)
+        return;
+
+    for (int offset = start; offset < bytecode->count; offset += instructionLength(bytecode, offset))
+    {
+        // the pass runs before relaxJumps()
+        if (isShortJump(bytecode->code[offset]))
+            return;
+    }
+
+    Optimizer optimizer;
+    memset(&optimizer, 0, sizeof(optimizer));
+    optimizer.bytecode = bytecode;
+    optimizer.start = start;
+    optimizer.owners = ALLOCATE_SCRATCH(int, bytecode->count + 1);
+    optimizer.depths = regionDepths(bytecode, start, optimizer.owners);
+    if (optimizer.depths == NULL)
+    {
+        FREE_SCRATCH(int, optimizer.owners, bytecode->count + 1);
+        return;
+    }
+
+    int regionCount = bytecode->functionCount + 1;
+    int *regionStarts = ALLOCATE_SCRATCH(int, regionCount + 1);
+    int instructionCount = 0;
+    memset(regionStarts, 0, (regionCount + 1) * sizeof(int));
+
+    // the instructions of each region, in the order of the code
+    for (int offset = start; offset < bytecode->count; offset += instructionLength(bytecode, offset))
+    {
+        if (optimizer.depths[offset] >= 0)
+        {
+            regionStarts[optimizer.owners[offset] + 2]++;
+            instructionCount++;
+        }
+    }
+    for (int r = 0; r < regionCount; r++)
+        regionStarts[r + 1] += regionStarts[r];
+
+    int *offsets = ALLOCATE_SCRATCH(int, instructionCount);
+    int *filled = ALLOCATE_SCRATCH(int, regionCount);
+    memset(filled, 0, regionCount * sizeof(int));
+    for (int offset = start; offset < bytecode->count; offset += instructionLength(bytecode, offset))
+    {
+        if (optimizer.depths[offset] >= 0)
+        {
+            int r = optimizer.owners[offset] + 1;
+            offsets[regionStarts[r] + filled[r]++] = offset;
+        }
+    }
+
+    optimizer.indexAt = ALLOCATE_SCRATCH(int, bytecode->count + 1);
+    optimizer.bases = ALLOCATE_SCRATCH(int, regionCount);
+    optimizer.temporaries = ALLOCATE_SCRATCH(int, regionCount);
+    for (int i = 0; i <= bytecode->count; i++)
+        optimizer.indexAt[i] = -1;
+    memset(optimizer.bases, 0, regionCount * sizeof(int));
+    memset(optimizer.temporaries, 0, regionCount * sizeof(int));
+
+    for (int r = 0; r < regionCount; r++)
+    {
+        int count = regionStarts[r + 1] - regionStarts[r];
+        if (count > 0)
+            optimizeRegion(&optimizer, r - 1, offsets + regionStarts[r], count);
+    }
+
+    int oldCount = bytecode->count;
+    if (optimizer.editCount > 0)
+        applyEdits(&optimizer);
+
+    FREE_SCRATCH(int, optimizer.temporaries, regionCount);
+    FREE_SCRATCH(int, optimizer.bases, regionCount);
+    FREE_SCRATCH(int, optimizer.indexAt, oldCount + 1);
+    FREE_SCRATCH(int, filled, regionCount);
+    FREE_SCRATCH(int, offsets, instructionCount);
+    FREE_SCRATCH(int, regionStarts, regionCount + 1);
+    FREE_SCRATCH(int, optimizer.depths, oldCount + 1);
+    FREE_SCRATCH(int, optimizer.owners, oldCount + 1);
+    FREE_SCRATCH(Edit, optimizer.edits, optimizer.editCapacity);
+    FREE_SCRATCH(uint8_t, optimizer.code, optimizer.codeCapacity);
+    FREE_SCRATCH(int, optimizer.lines, optimizer.codeCapacity);
+}
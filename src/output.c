@@ -0,0 +1,92 @@
+#include <string.h>
+#include "../include/number.h"
+#include "../include/output.h"
+#include "../include/vm.h"
+
+#ifdef _WIN32
+#include <io.h>
+#define write _write
+#else
+#include <unistd.h>
+#endif
+
+void setOutputSink(OutputSink sink, void *context)
+{
+    flushOutput();
+    vm.output.sink = sink;
+    vm.output.context = context;
+}
+
+void flushOutput(void)
+{
+    Output *output = &vm.output;
+    if (output->count == 0)
+        return;
+
+    if (output->sink != NULL)
+        output->sink(output->buffer, output->count, output->context);
+    else
+        fileSink(output->buffer, output->count, stdout);
+    output->count = 0;
+}
+
+void writeOutput(const char *bytes, size_t length)
+{
+    Output *output = &vm.output;
+    if (output->count + length > OUTPUT_BUFFER_SIZE)
+    {
+        flushOutput();
+
+        // too large to be worth copying
+        if (length > OUTPUT_BUFFER_SIZE)
+        {
+            if (output->sink != NULL)
+                output->sink(bytes, length, output->context);
+            else
+                fileSink(bytes, length, stdout);
+            return;
+        }
+    }
+
+    memcpy(output->buffer + output->count, bytes, length);
+    output->count += length;
+}
+
+void writeNumber(double number)
+{
+    Output *output = &vm.output;
+    if (output->count + NUMBER_BUFFER_SIZE > OUTPUT_BUFFER_SIZE)
+        flushOutput();
+
+    output->count += (size_t)formatNumber(number, output->buffer + output->count);
+}
+
+void fileSink(const char *bytes, size_t length, void *context)
+{
+    fwrite(bytes, 1, length, (FILE*)context);
+}
+
+void fdSink(const char *bytes, size_t length, void *context)
+{
+    int fd = (int)(intptr_t)context;
+    while (length > 0)
+    {
+        long written = (long)write(fd, bytes, length);
+        if (written <= 0)
+            return;
+
+        bytes += written;
+        length -= (size_t)written;
+    }
+}
+
+void memorySink(const char *bytes, size_t length, void *context)
+{
+    OutputBuffer *buffer = (OutputBuffer*)context;
+    if (buffer->count < buffer->capacity)
+    {
+        size_t room = buffer->capacity - buffer->count;
+        memcpy(buffer->bytes + buffer->count, bytes, length < room ? length : room);
+    }
+    buffer->count += length;
+}
@@ -0,0 +1,182 @@
+#include <string.h>
+#include "../include/pool.h"
+
+#define POOL_ALIGN 8
+
+typedef struct Block
+{
+    size_t size;            // of the whole block, the header included
+    struct Block *next;     // the next free block. Unused while allocated.
+} Block;
+
+static uint64_t pool[BEE_POOL_SIZE / sizeof(uint64_t)];
+static Block *freeList = NULL;     // in address order
+static bool initialized = false;
+static size_t used = 0;
+static size_t peak = 0;
+
+void poolReset(void)
+{
+    freeList = (Block*)pool;
+    freeList->size = sizeof(pool);
+    freeList->next = NULL;
+    used = 0;
+    initialized = true;
+}
+
+size_t poolUsed(void)
+{
+    return used;
+}
+
+size_t poolPeak(void)
+{
+    return peak;
+}
+
+/*
+    @returns the size of the block holding 'size' bytes.
+*/
+static size_t blockSize(size_t size)
+{
+    size += sizeof(Block);
+    return (size + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+}
+
+static void addUsed(size_t size)
+{
+    used += size;
+    if (used > peak)
+        peak = used;
+}
+
+static void freeBlock(Block *block)
+{
+    used -= block->size;
+
+    Block **link = &freeList;
+    while (*link != NULL && *link < block)
+        link = &(*link)->next;
+
+    // merge with the following block
+    Block *next = *link;
+    if (next != NULL && (uint8_t*)block + block->size == (uint8_t*)next)
+    {
+        block->size += next->size;
+        block->next = next->next;
+    }else
+    {
+        block->next = next;
+    }
+
+    // merge with the preceding block, whose 'next' field 'link' points to
+    if (link != &freeList)
+    {
+        Block *previous = (Block*)((uint8_t*)link - offsetof(Block, next));
+        if ((uint8_t*)previous + previous->size == (uint8_t*)block)
+        {
+            previous->size += block->size;
+            previous->next = block->next;
+            return;
+        }
+    }
+
+    *link = block;
+}
+
+/*
+    Gives the tail of the block beyond 'size' bytes back to the pool,
+    if it is large enough to make a block of its own.
+*/
+static void trimBlock(Block *block, size_t size)
+{
+    if (block->size - size < sizeof(Block) + POOL_ALIGN)
+        return;
+
+    Block *rest = (Block*)((uint8_t*)block + size);
+    rest->size = block->size - size;
+    block->size = size;
+    freeBlock(rest);
+}
+
+/*
+    First fit.
+*/
+static Block* allocateBlock(size_t size)
+{
+    for (Block **link = &freeList; *link != NULL; link = &(*link)->next)
+    {
+        Block *block = *link;
+        if (block->size < size)
+            continue;
+
+        *link = block->next;
+        addUsed(block->size);
+        trimBlock(block, size);
+        return block;
+    }
+
+    return NULL;
+}
+
+/*
+    Extends the block over the free block following it, if there is one
+    and both make at least 'size' bytes.
+*/
+static bool growBlock(Block *block, size_t size)
+{
+    Block *next = (Block*)((uint8_t*)block + block->size);
+
+    Block **link = &freeList;
+    while (*link != NULL && *link < next)
+        link = &(*link)->next;
+
+    if (*link != next || block->size + next->size < size)
+        return false;
+
+    *link = next->next;
+    addUsed(next->size);
+    block->size += next->size;
+    trimBlock(block, size);
+    return true;
+}
+
+void* poolResize(void *pointer, size_t newSize)
+{
+    if (!initialized)
+        poolReset();
+
+    if (NULL == pointer)
+    {
+        if (0 == newSize)
+            return NULL;
+
+        Block *block = allocateBlock(blockSize(newSize));
+        return block != NULL ? block + 1 : NULL;
+    }
+
+    Block *block = (Block*)pointer - 1;
+    if (0 == newSize)
+    {
+        freeBlock(block);
+        return NULL;
+    }
+
+    size_t size = blockSize(newSize);
+    if (size <= block->size)
+    {
+        trimBlock(block, size);
+        return pointer;
+    }
+
+    if (growBlock(block, size))
+        return pointer;
+
+    Block *moved = allocateBlock(size);
+    if (NULL == moved)
+        return NULL;
+
+    memcpy(moved + 1, pointer, block->size - sizeof(Block));
+    freeBlock(block);
+    return moved + 1;
+}
@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/image.h"
+#include "../include/profile.h"
+#include "../include/vm.h"
+
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
+volatile sig_atomic_t profileTicks = 0;
+
+// a VM is being profiled, the timer running
+static bool timerRunning = false;
+
+#ifndef _WIN32
+// the handler of SIGPROF before startProfile()
+static struct sigaction previousAction;
+
+static void onTick(int signal)
+{
+    (void)signal;
+    profileTicks++;
+}
+#endif
+
+/*
+    The samples live outside the heap of the VM, so that taking one
+    neither starts a collection nor counts toward vm.memoryLimit. A
+    sample that runs out of memory is dropped.
+*/
+static bool reserve(void **array, int *capacity, int needed, size_t size)
+{
+    if (needed <= *capacity)
+        return true;
+
+    int grown = *capacity < 8 ? 8 : *capacity;
+    while (grown < needed)
+        grown *= 2;
+
+    void *resized = realloc(*array, (size_t)grown * size);
+    if (resized == NULL)
+        return false;
+
+    *array = resized;
+    *capacity = grown;
+    return true;
+}
+
+static void clearSamples(Profile *profile)
+{
+    for (int i = 0; i < profile->stackCount; i++)
+        free(profile->stacks[i].text);
+    free(profile->stacks);
+    free(profile->index);
+    free(profile->buffer);
+    *profile = (Profile){0};
+}
+
+bool startProfile(void)
+{
+#ifdef _WIN32
+    fprintf(stderr, "Profiling isn't supported on this platform.\n");
+    return false;
+#else
+    if (timerRunning)
+    {
+        fprintf(stderr, "Another VM is being profiled.\n");
+        return false;
+    }
+
+    clearSamples(&vm.profile);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onTick;
+    sigemptyset(&action.sa_mask);
+    // the host's reads and writes go on across the ticks
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGPROF, &action, &previousAction);
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec = PROFILE_INTERVAL / 1000000;
+    timer.it_interval.tv_usec = PROFILE_INTERVAL % 1000000;
+    timer.it_value = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, NULL) != 0)
+    {
+        sigaction(SIGPROF, &previousAction, NULL);
+        fprintf(stderr, "Couldn't start the profiling timer.\n");
+        return false;
+    }
+
+    profileTicks = 0;
+    timerRunning = true;
+    vm.profile.active = true;
+    return true;
+#endif
+}
+
+void stopProfile(void)
+{
+#ifndef _WIN32
+    if (!vm.profile.active)
+        return;
+
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    sigaction(SIGPROF, &previousAction, NULL);
+
+    timerRunning = false;
+    vm.profile.active = false;
+#endif
+}
+
+void freeProfile(void)
+{
+    stopProfile();
+    clearSamples(&vm.profile);
+}
+
+/*
+    Appends the frame to the stack being sampled, "name:line" after a
+    semicolon if it isn't the first one.
+    @returns the new length, -1 if the buffer can't grow.
+*/
+static int appendFrame(Profile *profile, int length, const char *name, int nameLength, int line)
+{
+    // ';', the name, ':', the digits of an int and the terminator
+    if (!reserve((void**)&profile->buffer, &profile->bufferCapacity,
+                 length + nameLength + 14, sizeof(char)))
+        return -1;
+
+    char *at = profile->buffer + length;
+    if (length > 0)
+        *at++ = ';';
+    memcpy(at, name, nameLength);
+    at += nameLength;
+    at += sprintf(at, ":%d", line);
+    return (int)(at - profile->buffer);
+}
+
+/*
+    Makes room for one more stack, rehashing the table at half load.
+*/
+static bool growStacks(Profile *profile)
+{
+    if (!reserve((void**)&profile->stacks, &profile->stackCapacity,
+                 profile->stackCount + 1, sizeof(ProfileStack)))
+        return false;
+
+    if (2 * (profile->stackCount + 1) <= profile->indexCapacity)
+        return true;
+
+    int capacity = profile->indexCapacity < 16 ? 16 : 2 * profile->indexCapacity;
+    int *index = (int*)malloc((size_t)capacity * sizeof(int));
+    if (index == NULL)
+        return false;
+
+    for (int i = 0; i < capacity; i++)
+        index[i] = -1;
+    for (int i = 0; i < profile->stackCount; i++)
+    {
+        ProfileStack *stack = &profile->stacks[i];
+        int slot = (int)(fnv1a(FNV_OFFSET, (const uint8_t*)stack->text, stack->length) & (capacity - 1));
+        while (index[slot] >= 0)
+            slot = (slot + 1) & (capacity - 1);
+        index[slot] = i;
+    }
+
+    free(profile->index);
+    profile->index = index;
+    profile->indexCapacity = capacity;
+    return true;
+}
+
+void sampleProfile(const uint8_t *ip)
+{
+    Profile *profile = &vm.profile;
+    int samples = profileTicks;
+    profileTicks = 0;
+
+    // the outermost frame first, each but the innermost resuming past its call
+    int length = 0;
+    for (int i = 0; i < vm.frameCount && length >= 0; i++)
+    {
+        CallFrame *frame = &vm.frames[i];
+        const uint8_t *at = i == vm.frameCount - 1 ? ip : frame->ip - 1;
+        int line = vm.bytecode->lines[at - vm.bytecode->code];
+
+        if (frame->function < 0)
+        {
+            length = appendFrame(profile, length, "script", 6, line);
+        }else
+        {
+            Function *function = &vm.bytecode->functions[frame->function];
+            length = appendFrame(profile, length, function->name, function->nameLength, line);
+        }
+    }
+    if (length <= 0 || !growStacks(profile))
+        return;
+
+    const char *text = profile->buffer;
+    int mask = profile->indexCapacity - 1;
+    int slot = (int)(fnv1a(FNV_OFFSET, (const uint8_t*)text, length) & mask);
+    for (; profile->index[slot] >= 0; slot = (slot + 1) & mask)
+    {
+        ProfileStack *stack = &profile->stacks[profile->index[slot]];
+        if (stack->length == length && memcmp(stack->text, text, length) == 0)
+        {
+            stack->samples += samples;
+            return;
+        }
+    }
+
+    char *copy = (char*)malloc(length);
+    if (copy == NULL)
+        return;
+
+    memcpy(copy, text, length);
+    profile->stacks[profile->stackCount] = (ProfileStack){copy, length, samples};
+    profile->index[slot] = profile->stackCount++;
+}
+
+bool writeProfile(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Couldn't write the profile \"%s\".\n", path);
+        return false;
+    }
+
+    for (int i = 0; i < vm.profile.stackCount; i++)
+    {
+        ProfileStack *stack = &vm.profile.stacks[i];
+        fprintf(file, "%.*s %d\n", stack->length, stack->text, stack->samples);
+    }
+
+    if (fclose(file) != 0)
+    {
+        fprintf(stderr, "Couldn't write the profile \"%s\".\n", path);
+        return false;
+    }
+    return true;
+}
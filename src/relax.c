@@ -0,0 +1,207 @@
+#include <string.h>
+#include "../include/memory.h"
+#include "../include/relax.h"
+
+/*
+    @returns the _SHORT counterpart of a long jump or -1 if the
+    instruction isn't a relaxable jump.
+*/
+static int shortForm(uint8_t instruction)
+{
+    switch (instruction)
+    {
+        case OP_JUMP:                   return OP_JUMP_SHORT;
+        case OP_JUMP_BACK:              return OP_JUMP_BACK_SHORT;
+        case OP_JUMP_IF_FALSE:          return OP_JUMP_IF_FALSE_SHORT;
+        case OP_JUMP_IF_FALSE_OR_POP:   return OP_JUMP_IF_FALSE_OR_POP_SHORT;
+        case OP_JUMP_IF_TRUE_OR_POP:    return OP_JUMP_IF_TRUE_OR_POP_SHORT;
+        case OP_JUMP_IF_LESS:           return OP_JUMP_IF_LESS_SHORT;
+        case OP_JUMP_IF_NOT_LESS:       return OP_JUMP_IF_NOT_LESS_SHORT;
+        case OP_JUMP_IF_GREATER:        return OP_JUMP_IF_GREATER_SHORT;
+        case OP_JUMP_IF_NOT_GREATER:    return OP_JUMP_IF_NOT_GREATER_SHORT;
+        case OP_JUMP_IF_EQUAL:          return OP_JUMP_IF_EQUAL_SHORT;
+        case OP_JUMP_IF_NOT_EQUAL:      return OP_JUMP_IF_NOT_EQUAL_SHORT;
+        case OP_LOOP:                   return OP_LOOP_SHORT;
+        default:                        return -1;
+    }
+}
+
+static bool isBackward(uint8_t instruction)
+{
+    return instruction == OP_JUMP_BACK || instruction == OP_LOOP;
+}
+
+static uint16_t readShort(uint8_t *code)
+{
+    return (uint16_t)((code[0] << 8) | code[1]);
+}
+
+static void writeShort(uint8_t *code, int value)
+{
+    code[0] = (value >> 8) & 0xff;
+    code[1] = value & 0xff;
+}
+
+/*
+    @returns the absolute target of a long jump at 'offset'.
+    Offsets of all the jumps are relative to the end of the instruction.
+*/
+static int jumpTarget(uint8_t *code, int offset, int length)
+{
+    int end = offset + length;
+    int distance = readShort(code + offset + 1);
+    return isBackward(code[offset]) ? end - distance : end + distance;
+}
+
+void relaxJumps(Bytecode *bytecode, int start)
+{
+    uint8_t *code = bytecode->code;
+    int end = bytecode->count;
+    int size = end - start;
+
+    if (size <= 0)
+        return;
+
+    // Index of the instruction starting at each offset, or -1 for operands.
+    // The extra element stands for the end of code, a valid jump target.
+    int *indexAt = ALLOCATE_SCRATCH(int, size + 1);
+    int count = 0;
+    for (int offset = start; offset < end; offset += instructionLength(bytecode, offset))
+        count++;
+
+    int *oldOffsets = ALLOCATE_SCRATCH(int, count + 1);
+    int *newOffsets = ALLOCATE_SCRATCH(int, count + 1);
+    bool *narrow = ALLOCATE_SCRATCH(bool, count);
+
+    for (int i = 0; i <= size; i++)
+        indexAt[i] = -1;
+
+    for (int i = 0, offset = start; i < count; i++)
+    {
+        oldOffsets[i] = offset;
+        indexAt[offset - start] = i;
+        narrow[i] = false;
+        offset += instructionLength(bytecode, offset);
+    }
+    oldOffsets[count] = end;
+    indexAt[size] = count;
+
+    bool changed;
+    do
+    {
+        changed = false;
+
+        newOffsets[0] = start;
+        for (int i = 0; i < count; i++)
+        {
+            int length = oldOffsets[i + 1] - oldOffsets[i];
+            newOffsets[i + 1] = newOffsets[i] + length - (narrow[i] ? 1 : 0);
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            int offset = oldOffsets[i];
+            if (narrow[i] || shortForm(code[offset]) < 0)
+                continue;
+
+            int length = oldOffsets[i + 1] - offset;
+            int target = newOffsets[indexAt[jumpTarget(code, offset, length) - start]];
+            // the end of the instruction if it were already narrowed
+            int shortEnd = newOffsets[i] + length - 1;
+            int distance = isBackward(code[offset]) ? shortEnd - target : target - shortEnd;
+
+            if (distance <= UINT8_MAX)
+            {
+                narrow[i] = true;
+                changed = true;
+            }
+        }
+    } while (changed);
+
+    int newEnd = newOffsets[count];
+    uint8_t *newCode = ALLOCATE_SCRATCH(uint8_t, size);
+    int *newLines = ALLOCATE_SCRATCH(int, size);
+
+#define NEW_OFFSET(oldOffset) (newOffsets[indexAt[(oldOffset) - start]])
+
+    for (int i = 0; i < count; i++)
+    {
+        int offset = oldOffsets[i];
+        int length = oldOffsets[i + 1] - offset;
+        int newOffset = newOffsets[i];
+        int newLength = newOffsets[i + 1] - newOffset;
+        uint8_t *from = code + offset;
+        uint8_t *to = newCode + (newOffset - start);
+
+        memcpy(to, from, newLength);
+        for (int j = 0; j < newLength; j++)
+            newLines[newOffset - start + j] = bytecode->lines[offset];
+
+        if (shortForm(from[0]) >= 0)
+        {
+            int target = NEW_OFFSET(jumpTarget(code, offset, length));
+            int newInstructionEnd = newOffset + newLength;
+            int distance = isBackward(from[0]) ? newInstructionEnd - target
+                                               : target - newInstructionEnd;
+            if (narrow[i])
+            {
+                to[0] = (uint8_t)shortForm(from[0]);
+                to[1] = (uint8_t)distance;
+                if (from[0] == OP_LOOP)
+                    memcpy(to + 2, from + 3, 2);    // the loop counter index
+            }else
+            {
+                writeShort(to + 1, distance);
+            }
+        }else if (from[0] == OP_CASE)
+        {
+            int target = NEW_OFFSET(offset + length - readShort(from + 3));
+            writeShort(to + 3, newOffset + newLength - target);
+        }else if (from[0] == OP_TABLESWITCH || from[0] == OP_LOOKUPSWITCH)
+        {
+            // Each entry is a backward distance from the end of instruction.
+            // The first distance is at 9 in both: after [op, low32, count16,
+            // default16] in a table, and after [op, count16, default16, key32]
+            // in a lookup switch, whose entries also carry the key.
+            int first = 9;
+            int stride = from[0] == OP_TABLESWITCH ? 2 : 6;
+            int entries = from[0] == OP_TABLESWITCH ? readShort(from + 5)
+                                                    : readShort(from + 1);
+            int defaultAt = from[0] == OP_TABLESWITCH ? 7 : 3;
+
+            int target = NEW_OFFSET(offset + length - readShort(from + defaultAt));
+            writeShort(to + defaultAt, newOffset + newLength - target);
+
+            for (int j = 0; j < entries; j++)
+            {
+                int at = first + j * stride;
+                target = NEW_OFFSET(offset + length - readShort(from + at));
+                writeShort(to + at, newOffset + newLength - target);
+            }
+        }
+    }
+
+    // the bodies of the functions move along with the code around them
+    for (int i = 0; i < bytecode->functionCount; i++)
+    {
+        Function *function = &bytecode->functions[i];
+        if (function->entry >= start)
+        {
+            function->entry = NEW_OFFSET(function->entry);
+            function->end = NEW_OFFSET(function->end);
+        }
+    }
+
+#undef NEW_OFFSET
+
+    memcpy(code + start, newCode, newEnd - start);
+    memcpy(bytecode->lines + start, newLines, (newEnd - start) * sizeof(int));
+    bytecode->count = newEnd;
+
+    FREE_SCRATCH(uint8_t, newCode, size);
+    FREE_SCRATCH(int, newLines, size);
+    FREE_SCRATCH(bool, narrow, count);
+    FREE_SCRATCH(int, newOffsets, count + 1);
+    FREE_SCRATCH(int, oldOffsets, count + 1);
+    FREE_SCRATCH(int, indexAt, size + 1);
+}
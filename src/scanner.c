@@ -1,22 +1,200 @@
 #include <stdio.h>
 #include <string.h>
 #include "../include/common.h"
+#include "../include/memory.h"
 #include "../include/scanner.h"
 
+/*
+    When the source is read from a stream, it passes through a window of
+    SCANNER_WINDOW bytes, refilled as the scanning goes on. The lexemes are
+    copied out of the window, so that it can be refilled at any moment:
+    the identifiers into a table living as long as the Scanner does, since
+    the compiler keeps the names of the variables, and the other lexemes into
+    a few rotating slots, since the parser only looks at the last two tokens.
+*/
+#ifndef SCANNER_WINDOW
+#ifdef BEE_STATIC_POOL
+#define SCANNER_WINDOW  256
+#else
+#define SCANNER_WINDOW  4096
+#endif
+#endif
+#define LEXEME_SLOTS    3
+
+typedef struct
+{
+    char *chars;
+    int length;
+    uint32_t hash;
+} Name;
+
 typedef struct
 {
     const char *start;
     const char *current;
     int line;
+
+    FILE *file;         // the stream being read. NULL when scanning a string.
+    char *window;
+    char *end;          // the end of the data read into the window.
+    bool overflow;      // the lexeme being scanned doesn't fit into the window.
+    char *slots[LEXEME_SLOTS];
+    int nextSlot;
+    Name *names;        // the identifiers met so far (open addressing).
+    int nameCount;
+    int nameCapacity;
 } Scanner;
 
-Scanner scanner;
+THREAD_LOCAL Scanner scanner;
 
 void initScanner(const char *source)
 {
     scanner.start = source;
     scanner.current = source;
     scanner.line = 1;
+    scanner.file = NULL;
+    scanner.overflow = false;
+}
+
+void initStreamScanner(FILE *file)
+{
+    scanner.names = NULL;
+    scanner.nameCount = 0;
+    scanner.nameCapacity = 0;
+
+    scanner.window = ALLOCATE(char, SCANNER_WINDOW);
+    scanner.end = scanner.window;
+    *scanner.end = '\0';
+    scanner.start = scanner.window;
+    scanner.current = scanner.window;
+    scanner.line = 1;
+    scanner.overflow = false;
+
+    for (int i = 0; i < LEXEME_SLOTS; i++)
+        scanner.slots[i] = ALLOCATE(char, SCANNER_WINDOW);
+    scanner.nextSlot = 0;
+
+    // set last: freeScanner() only frees the buffers of a complete scanner
+    scanner.file = file;
+}
+
+void freeScanner(void)
+{
+    if (scanner.file == NULL)
+        return;
+
+    FREE_ARRAY(char, scanner.window, SCANNER_WINDOW);
+    for (int i = 0; i < LEXEME_SLOTS; i++)
+        FREE_ARRAY(char, scanner.slots[i], SCANNER_WINDOW);
+
+    for (int i = 0; i < scanner.nameCapacity; i++)
+    {
+        if (scanner.names[i].chars != NULL)
+            FREE_ARRAY(char, scanner.names[i].chars, scanner.names[i].length);
+    }
+    FREE_ARRAY(Name, scanner.names, scanner.nameCapacity);
+
+    scanner.file = NULL;
+}
+
+/*
+    Moves the lexeme being scanned to the beginning of the window and fills
+    the rest of it from the stream. Does nothing unless the scanner has
+    reached the end of the data read so far.
+*/
+static void refill(void)
+{
+    if (scanner.file == NULL || scanner.end - scanner.current > 1 ||
+        feof(scanner.file) || ferror(scanner.file))
+    {
+        return;
+    }
+
+    size_t kept = scanner.end - scanner.start;
+    if (kept == SCANNER_WINDOW - 1)
+    {
+        scanner.overflow = true;
+        return;
+    }
+
+    memmove(scanner.window, scanner.start, kept);
+    scanner.current = scanner.window + (scanner.current - scanner.start);
+    scanner.start = scanner.window;
+    scanner.end = scanner.window + kept;
+    scanner.end += fread(scanner.end, sizeof(char), SCANNER_WINDOW - 1 - kept, scanner.file);
+    *scanner.end = '\0';
+}
+
+/*
+    FNV-1a.
+*/
+static uint32_t hashName(const char *chars, int length)
+{
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; i++)
+    {
+        hash ^= (uint8_t)chars[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+static void growNames(void)
+{
+    int capacity = INCREASE_CAPACITY(scanner.nameCapacity);
+    Name *names = ALLOCATE(Name, capacity);
+    for (int i = 0; i < capacity; i++)
+        names[i].chars = NULL;
+
+    for (int i = 0; i < scanner.nameCapacity; i++)
+    {
+        Name *name = &scanner.names[i];
+        if (name->chars == NULL)
+            continue;
+
+        uint32_t at = name->hash & (capacity - 1);
+        while (names[at].chars != NULL)
+            at = (at + 1) & (capacity - 1);
+        names[at] = *name;
+    }
+
+    FREE_ARRAY(Name, scanner.names, scanner.nameCapacity);
+    scanner.names = names;
+    scanner.nameCapacity = capacity;
+}
+
+/*
+    @returns the copy of the identifier which stays valid until freeScanner().
+*/
+static const char* internName(const char *chars, int length)
+{
+    if (scanner.nameCount + 1 > scanner.nameCapacity * 3 / 4)
+        growNames();
+
+    uint32_t hash = hashName(chars, length);
+    uint32_t at = hash & (scanner.nameCapacity - 1);
+
+    for (;;)
+    {
+        Name *name = &scanner.names[at];
+        if (name->chars == NULL)
+        {
+            name->chars = ALLOCATE(char, length);
+            memcpy(name->chars, chars, length);
+            name->length = length;
+            name->hash = hash;
+            scanner.nameCount++;
+            return name->chars;
+        }
+
+        if (name->hash == hash && name->length == length &&
+            memcmp(name->chars, chars, length) == 0)
+        {
+            return name->chars;
+        }
+
+        at = (at + 1) & (scanner.nameCapacity - 1);
+    }
 }
 
 static bool isAlpha(char c)
@@ -31,9 +209,17 @@ static bool isDigit(char c)
     return (c >= '0') && (c <= '9');
 }
 
+static char peek(void)
+{
+    if (*scanner.current == '\0')
+        refill();
+
+    return *scanner.current;
+}
+
 static bool isAtEnd(void)
 {
-    return *scanner.current == '\0';
+    return peek() == '\0';
 }
 
 static char advance(void)
@@ -42,16 +228,14 @@ static char advance(void)
     return scanner.current[-1];
 }
 
-static char peek(void)
-{
-    return *scanner.current;
-}
-
 static char peekNext(void)
 {
     if (isAtEnd())
         return '\0';
-    
+
+    if (scanner.current[1] == '\0')
+        refill();
+
     return scanner.current[1];
 }
 
@@ -72,23 +256,46 @@ static bool match(char expected)
     return true;
 }
 
-static Token makeToken(TokenType type)
+static Token errorToken(const char* message)
 {
     Token token;
-    token.type = type;
-    token.start = scanner.start;
-    token.length = (int)(scanner.current - scanner.start);
+    token.type = TOKEN_ERROR;
+    token.start = message;
+    token.length = (int)strlen(message);
     token.line = scanner.line;
     return token;
 }
 
-static Token errorToken(const char* message)
+static Token makeToken(TokenType type)
 {
+    if (scanner.overflow)
+    {
+        scanner.overflow = false;
+        return errorToken("Lexeme is too long.");
+    }
+
     Token token;
-    token.type = TOKEN_ERROR;
-    token.start = message;
-    token.length = (int)strlen(message);
+    token.type = type;
+    token.start = scanner.start;
+    token.length = (int)(scanner.current - scanner.start);
     token.line = scanner.line;
+
+    if (scanner.file != NULL)
+    {
+        // take the lexeme out of the window
+        if (type == TOKEN_IDENTIFIER)
+        {
+            token.start = internName(token.start, token.length);
+        }else
+        {
+            char *slot = scanner.slots[scanner.nextSlot];
+            scanner.nextSlot = (scanner.nextSlot + 1) % LEXEME_SLOTS;
+            memcpy(slot, token.start, token.length);
+            slot[token.length] = '\0';
+            token.start = slot;
+        }
+    }
+
     return token;
 }
 
@@ -104,6 +311,9 @@ static void skipWhitespace(void)
 {
     for (;;)
     {
+        // nothing before this point has to stay in the window
+        scanner.start = scanner.current;
+
         // using peek() instead of advance() is to avoid
         // unintentional non-whitespace character consuming.
         char c = peek();
@@ -123,7 +333,10 @@ static void skipWhitespace(void)
                 {
                     // A comment goes until the end of the line.
                     while (peek() != '\n' && !isAtEnd())
+                    {
                         advance();
+                        scanner.start = scanner.current;
+                    }
                 } else
                 {
                     return;
@@ -163,7 +376,17 @@ static TokenType identifierType(void)
     switch (scanner.start[0])
     {
         case 'a': return checkKeyword(1, 2, "nd", TOKEN_AND);
-        case 'c': return checkKeyword(1, 4, "lass", TOKEN_CLASS);
+        case 'c':
+            if (scanner.current - scanner.start > 1)
+            {
+                switch (scanner.start[1])
+                {
+                    case 'a': return checkKeyword(2, 2, "se", TOKEN_CASE);
+                    case 'l': return checkKeyword(2, 3, "ass", TOKEN_CLASS);
+                }
+            }
+        break;
+        case 'd': return checkKeyword(1, 6, "efault", TOKEN_DEFAULT);
         case 'e': return checkKeyword(1, 3, "lse", TOKEN_ELSE);
         case 'f':
             // may be 'f' is the only character? (consider "var f = 0.2;")
@@ -182,7 +405,16 @@ static TokenType identifierType(void)
         case 'o': return checkKeyword(1, 1, "r", TOKEN_OR);
         case 'p': return checkKeyword(1, 4, "rint", TOKEN_PRINT);
         case 'r': return checkKeyword(1, 5, "eturn", TOKEN_RETURN);
-        case 's': return checkKeyword(1, 4, "uper", TOKEN_SUPER);
+        case 's':
+            if (scanner.current - scanner.start > 1)
+            {
+                switch (scanner.start[1])
+                {
+                    case 'u': return checkKeyword(2, 3, "per", TOKEN_SUPER);
+                    case 'w': return checkKeyword(2, 4, "itch", TOKEN_SWITCH);
+                }
+            }
+        break;
         case 't':
             // may be 't' is the only character? (consider "var t = 10;")
             if (scanner.current - scanner.start > 1)
@@ -268,7 +500,10 @@ Token scanToken(void)
         case ')': return makeToken(TOKEN_RIGHT_PAREN);
         case '{': return makeToken(TOKEN_LEFT_BRACE);
         case '}': return makeToken(TOKEN_RIGHT_BRACE);
+        case '[': return makeToken(TOKEN_LEFT_BRACKET);
+        case ']': return makeToken(TOKEN_RIGHT_BRACKET);
         case ';': return makeToken(TOKEN_SEMICOLON);
+        case ':': return makeToken(TOKEN_COLON);
         case ',': return makeToken(TOKEN_COMMA);
         case '.': return makeToken(TOKEN_DOT);
         case '-': return makeToken(TOKEN_MINUS);
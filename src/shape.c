@@ -0,0 +1,69 @@
+#include "../include/memory.h"
+#include "../include/shape.h"
+#include "../include/vm.h"
+
+static Shape* newShape(Shape *parent, int klass, int name)
+{
+    Shape *shape = ALLOCATE(Shape, 1);
+    shape->parent = parent;
+    shape->children = NULL;
+    shape->sibling = NULL;
+    shape->klass = klass;
+    shape->name = name;
+    shape->slotCount = parent != NULL ? parent->slotCount + 1 : 0;
+    return shape;
+}
+
+Shape* rootShape(int klass)
+{
+    if (vm.shapes[klass] == NULL)
+        vm.shapes[klass] = newShape(NULL, klass, -1);
+    return vm.shapes[klass];
+}
+
+Shape* addField(Shape *shape, int name)
+{
+    // a shape seldom has more than a few children: most classes set
+    // their fields in the same order
+    for (Shape *child = shape->children; child != NULL; child = child->sibling)
+    {
+        if (child->name == name)
+            return child;
+    }
+
+    Shape *child = newShape(shape, shape->klass, name);
+    child->sibling = shape->children;
+    shape->children = child;
+    return child;
+}
+
+int findField(Shape *shape, int name)
+{
+    for (; shape->parent != NULL; shape = shape->parent)
+    {
+        if (shape->name == name)
+            return shape->slotCount - 1;
+    }
+
+    return -1;
+}
+
+static void freeTree(Shape *shape)
+{
+    while (shape != NULL)
+    {
+        Shape *sibling = shape->sibling;
+        freeTree(shape->children);
+        FREE(Shape, shape);
+        shape = sibling;
+    }
+}
+
+void freeShapes(void)
+{
+    for (int i = 0; i < UINT8_COUNT; i++)
+    {
+        freeTree(vm.shapes[i]);
+        vm.shapes[i] = NULL;
+    }
+}
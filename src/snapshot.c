@@ -0,0 +1,821 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/analysis.h"
+#include "../include/array.h"
+#include "../include/compiler.h"
+#include "../include/image.h"
+#include "../include/memory.h"
+#include "../include/snapshot.h"
+
+#ifdef _WIN32
+#include <process.h>
+#include <windows.h>
+#define getpid _getpid
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define SNAPSHOT_MAGIC      "BEES"
+
+// the layout of the objects, to be bumped by any change to it, that of
+// the code being BYTECODE_VERSION
+#define SNAPSHOT_VERSION    1
+
+// header: magic, versions, natives, globals, shapes, objects
+#define HEADER_SIZE         (4 + 4 + 4 + 4 + 4 + 4 + 4)
+
+// the parent of a root shape in the file
+#define NO_PARENT           UINT32_MAX
+
+/*
+    An object or a shape by its address, along with its index in the file,
+    -1 until it has one.
+*/
+typedef struct
+{
+    const void *address;
+    int index;
+} Entry;
+
+static int compareEntries(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t)((const Entry*)a)->address;
+    uintptr_t y = (uintptr_t)((const Entry*)b)->address;
+    return (x > y) - (x < y);
+}
+
+/*
+    @returns the entry of the address among the sorted entries, NULL if
+             there is none.
+*/
+static Entry* findEntry(Entry *entries, int count, const void *address)
+{
+    if (count == 0)
+        return NULL;
+
+    Entry key = {address, -1};
+    return (Entry*)bsearch(&key, entries, count, sizeof(Entry), compareEntries);
+}
+
+/*
+    What saveSnapshot() allocates, freed whether it succeeds or not.
+*/
+typedef struct
+{
+    Entry *objects;     // all the objects of the VM, by address
+    int objectCapacity;
+    int objectCount;
+    Obj **order;        // those the globals reach, by index in the file
+    int orderCount;
+    Entry *shapes;      // the shapes of the classes of the session, by address
+    Shape **shapeOrder; // the same by index in the file, parents first
+    int shapeCount;
+    Name *names;        // of the globals, by index in VM.globals
+    int globalCount;
+    FILE *file;         // the temporary file being written, if open
+    char temporary[1024];
+} Saver;
+
+static void freeSaver(Saver *saver)
+{
+    FREE_ARRAY(Entry, saver->objects, saver->objectCapacity);
+    FREE_ARRAY(Obj*, saver->order, saver->objectCapacity);
+    FREE_ARRAY(Entry, saver->shapes, saver->shapeCount);
+    FREE_ARRAY(Shape*, saver->shapeOrder, saver->shapeCount);
+    FREE_ARRAY(Name, saver->names, saver->globalCount);
+    if (saver->file != NULL)
+    {
+        fclose(saver->file);
+        remove(saver->temporary);
+    }
+}
+
+/*
+    Gives the object of the value, if any, the next index in the file
+    unless it has one already.
+    @returns false if the object isn't one of the VM.
+*/
+static bool reach(Saver *saver, Value value)
+{
+    if (!IS_OBJ(value))
+        return true;
+
+    Entry *entry = findEntry(saver->objects, saver->objectCount, AS_OBJ(value));
+    if (entry == NULL)
+        return false;
+
+    if (entry->index < 0)
+    {
+        entry->index = saver->orderCount;
+        saver->order[saver->orderCount++] = AS_OBJ(value);
+    }
+    return true;
+}
+
+/*
+    reach() for the values the object holds.
+*/
+static bool reachFrom(Saver *saver, Obj *object)
+{
+    bool ok = true;
+    switch (object->type)
+    {
+        case OBJ_ARRAY:
+        break;
+        case OBJ_CLOSURE:
+        {
+            ObjClosure *closure = (ObjClosure*)object;
+            for (int i = 0; i < closure->captureCount && ok; i++)
+                ok = reach(saver, closure->captures[i]);
+        }break;
+        case OBJ_BOX:
+            ok = reach(saver, ((ObjBox*)object)->value);
+        break;
+        case OBJ_INSTANCE:
+        {
+            ObjInstance *instance = (ObjInstance*)object;
+            ok = findEntry(saver->shapes, saver->shapeCount, instance->shape) != NULL;
+            for (int i = 0; i < instance->shape->slotCount && ok; i++)
+                ok = reach(saver, instance->fields[i]);
+        }break;
+        case OBJ_BOUND_METHOD:
+            ok = reach(saver, ((ObjBoundMethod*)object)->receiver);
+        break;
+    }
+    return ok;
+}
+
+static int countShapes(Shape *shape)
+{
+    int count = 0;
+    for (; shape != NULL; shape = shape->sibling)
+        count += 1 + countShapes(shape->children);
+    return count;
+}
+
+/*
+    Appends the shapes of the tree to 'order', each one before its children.
+*/
+static void listShapes(Shape *shape, Shape **order, int *count)
+{
+    for (; shape != NULL; shape = shape->sibling)
+    {
+        order[(*count)++] = shape;
+        listShapes(shape->children, order, count);
+    }
+}
+
+/*
+    Writes the value, an object by its index in the file.
+*/
+static void storeValue(Writer *writer, Saver *saver, Value value)
+{
+    if (IS_OBJ(value))
+    {
+        writeU8(writer, VAL_OBJ);
+        writeU32(writer, (uint32_t)findEntry(saver->objects, saver->objectCount, AS_OBJ(value))->index);
+    }else
+    {
+        writeValue(writer, value);
+    }
+}
+
+/*
+    Writes what is needed to allocate the object: its type and its size.
+*/
+static void storeHeader(Writer *writer, Saver *saver, Obj *object)
+{
+    writeU8(writer, (uint8_t)object->type);
+    switch (object->type)
+    {
+        case OBJ_ARRAY:
+            writeU8(writer, (uint8_t)((ObjArray*)object)->elementType);
+            writeU32(writer, (uint32_t)((ObjArray*)object)->count);
+        break;
+        case OBJ_CLOSURE:
+            writeU32(writer, (uint32_t)((ObjClosure*)object)->function);
+            writeU32(writer, (uint32_t)((ObjClosure*)object)->captureCount);
+        break;
+        case OBJ_BOX:
+        break;
+        case OBJ_INSTANCE:
+            writeU32(writer, (uint32_t)findEntry(saver->shapes, saver->shapeCount,
+                                                 ((ObjInstance*)object)->shape)->index);
+        break;
+        case OBJ_BOUND_METHOD:
+            writeU32(writer, (uint32_t)((ObjBoundMethod*)object)->function);
+        break;
+    }
+}
+
+/*
+    Writes the values the object holds.
+*/
+static void storeContent(Writer *writer, Saver *saver, Obj *object)
+{
+    switch (object->type)
+    {
+        case OBJ_ARRAY:
+        {
+            ObjArray *array = (ObjArray*)object;
+            for (int i = 0; i < array->count; i++)
+            {
+                if (array->elementType == ARRAY_NUMBER)
+                {
+                    uint64_t bits;
+                    memcpy(&bits, &array->as.numbers[i], sizeof(bits));
+                    writeU64(writer, bits);
+                }else if (array->elementType == ARRAY_INT)
+                {
+                    writeU32(writer, (uint32_t)array->as.ints[i]);
+                }else
+                {
+                    writeU8(writer, array->as.bools[i]);
+                }
+            }
+        }break;
+        case OBJ_CLOSURE:
+        {
+            ObjClosure *closure = (ObjClosure*)object;
+            for (int i = 0; i < closure->captureCount; i++)
+                storeValue(writer, saver, closure->captures[i]);
+        }break;
+        case OBJ_BOX:
+            storeValue(writer, saver, ((ObjBox*)object)->value);
+        break;
+        case OBJ_INSTANCE:
+        {
+            ObjInstance *instance = (ObjInstance*)object;
+            for (int i = 0; i < instance->shape->slotCount; i++)
+                storeValue(writer, saver, instance->fields[i]);
+        }break;
+        case OBJ_BOUND_METHOD:
+            storeValue(writer, saver, ((ObjBoundMethod*)object)->receiver);
+        break;
+    }
+}
+
+static bool writeSnapshot(Saver *saver, Session *session, const char *path)
+{
+    Bytecode *bytecode = &session->bytecode;
+    saver->names = ALLOCATE(Name, globalNames(NULL));
+    saver->globalCount = globalNames(saver->names);
+    int globalCount = saver->globalCount;
+    Name *names = saver->names;
+
+    int count = 0;
+    for (Obj *object = vm.objects; object != NULL; object = object->next)
+        count++;
+    for (Obj *object = vm.gc.sweepList; object != NULL; object = object->next)
+        count++;
+
+    saver->objects = ALLOCATE(Entry, count);
+    saver->order = ALLOCATE(Obj*, count);
+    saver->objectCapacity = count;
+
+    for (int i = 0; i < bytecode->classCount; i++)
+        saver->shapeCount += countShapes(vm.shapes[i]);
+    saver->shapes = ALLOCATE(Entry, saver->shapeCount);
+    saver->shapeOrder = ALLOCATE(Shape*, saver->shapeCount);
+
+    // the allocations above may have swept a few objects
+    for (Obj *object = vm.objects; object != NULL && saver->objectCount < count; object = object->next)
+        saver->objects[saver->objectCount++] = (Entry){object, -1};
+    for (Obj *object = vm.gc.sweepList; object != NULL && saver->objectCount < count; object = object->next)
+        saver->objects[saver->objectCount++] = (Entry){object, -1};
+    if (saver->objectCount > 0)
+        qsort(saver->objects, saver->objectCount, sizeof(Entry), compareEntries);
+
+    int shapeCount = 0;
+    for (int i = 0; i < bytecode->classCount; i++)
+        listShapes(vm.shapes[i], saver->shapeOrder, &shapeCount);
+    for (int i = 0; i < shapeCount; i++)
+        saver->shapes[i] = (Entry){saver->shapeOrder[i], i};
+    if (shapeCount > 0)
+        qsort(saver->shapes, shapeCount, sizeof(Entry), compareEntries);
+
+    // the objects the globals reach, numbered as they are found
+    bool ok = true;
+    for (int i = 0; i < globalCount && ok; i++)
+        ok = reach(saver, vm.globals[i]);
+    for (int i = 0; i < saver->orderCount && ok; i++)
+        ok = reachFrom(saver, saver->order[i]);
+
+    if (!ok || !isWritable(bytecode))
+    {
+        fprintf(stderr, "Couldn't save the snapshot: the session holds values it can't write.\n");
+        return false;
+    }
+
+    snprintf(saver->temporary, sizeof(saver->temporary), "%s.%d.tmp", path, (int)getpid());
+    saver->file = fopen(saver->temporary, "wb");
+    if (saver->file == NULL)
+    {
+        fprintf(stderr, "Couldn't write the snapshot \"%s\".\n", path);
+        return false;
+    }
+
+    Writer writer = {saver->file, FNV_OFFSET};
+    writeBytes(&writer, SNAPSHOT_MAGIC, 4);
+    writeU32(&writer, BYTECODE_VERSION);
+    writeU32(&writer, SNAPSHOT_VERSION);
+    writeU32(&writer, (uint32_t)vm.nativeCount);
+    writeU32(&writer, (uint32_t)globalCount);
+    writeU32(&writer, (uint32_t)saver->shapeCount);
+    writeU32(&writer, (uint32_t)saver->orderCount);
+
+    for (int i = 0; i < vm.nativeCount; i++)
+    {
+        writeU32(&writer, (uint32_t)vm.natives[i].length);
+        writeBytes(&writer, vm.natives[i].name, vm.natives[i].length);
+    }
+
+    writeBytecode(&writer, bytecode);
+
+    for (int i = 0; i < globalCount; i++)
+    {
+        writeU32(&writer, (uint32_t)names[i].length);
+        writeBytes(&writer, names[i].chars, names[i].length);
+    }
+
+    // a root by its class, any other shape by its parent and its last field
+    for (int i = 0; i < saver->shapeCount; i++)
+    {
+        Shape *shape = saver->shapeOrder[i];
+        if (shape->parent == NULL)
+        {
+            writeU32(&writer, NO_PARENT);
+            writeU32(&writer, (uint32_t)shape->klass);
+        }else
+        {
+            writeU32(&writer, (uint32_t)findEntry(saver->shapes, saver->shapeCount, shape->parent)->index);
+            writeU32(&writer, (uint32_t)shape->name);
+        }
+    }
+
+    // all the objects are allocated before any of them is filled, since
+    // they may refer to each other in any order
+    for (int i = 0; i < saver->orderCount; i++)
+        storeHeader(&writer, saver, saver->order[i]);
+    for (int i = 0; i < saver->orderCount; i++)
+        storeContent(&writer, saver, saver->order[i]);
+
+    for (int i = 0; i < globalCount; i++)
+        storeValue(&writer, saver, vm.globals[i]);
+
+    uint64_t checksum = writer.checksum;
+    writeU64(&writer, checksum);
+
+    bool written = !ferror(saver->file);
+    written = fclose(saver->file) == 0 && written;
+    saver->file = NULL;
+
+    // the snapshot appears whole or not at all
+#ifdef _WIN32
+    written = written && MoveFileExA(saver->temporary, path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    written = written && rename(saver->temporary, path) == 0;
+#endif
+    if (!written)
+    {
+        remove(saver->temporary);
+        fprintf(stderr, "Couldn't write the snapshot \"%s\".\n", path);
+    }
+    return written;
+}
+
+bool saveSnapshot(Session *session, const char *path)
+{
+    if (vm.suspension.active)
+    {
+        fprintf(stderr, "Couldn't save the snapshot: a run is out of fuel.\n");
+        return false;
+    }
+
+    Saver saver = {0};
+    jmp_buf handler;
+    if (setjmp(handler) != 0)
+    {
+        vm.unwind = NULL;
+        freeSaver(&saver);
+        return false;
+    }
+
+    vm.unwind = &handler;
+    bool saved = writeSnapshot(&saver, session, path);
+    vm.unwind = NULL;
+    freeSaver(&saver);
+    return saved;
+}
+
+/*
+    @returns the content of the file, mapped read-only, NULL if it can't
+             be read or is empty. Windows reads it into the heap instead.
+*/
+static const uint8_t* mapFile(const char *path, size_t *size)
+{
+#ifdef _WIN32
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return NULL;
+
+    fseek(file, 0L, SEEK_END);
+    long length = ftell(file);
+    rewind(file);
+
+    uint8_t *bytes = length > 0 ? ALLOCATE(uint8_t, length) : NULL;
+    if (bytes != NULL && fread(bytes, 1, length, file) != (size_t)length)
+    {
+        FREE_ARRAY(uint8_t, bytes, length);
+        bytes = NULL;
+    }
+
+    fclose(file);
+    *size = (size_t)length;
+    return bytes;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat info;
+    void *bytes = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+        bytes = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (bytes == MAP_FAILED)
+        return NULL;
+
+    *size = (size_t)info.st_size;
+    return (const uint8_t*)bytes;
+#endif
+}
+
+static void unmapFile(const uint8_t *bytes, size_t size)
+{
+#ifdef _WIN32
+    FREE_ARRAY(uint8_t, (uint8_t*)bytes, size);
+#else
+    munmap((void*)bytes, size);
+#endif
+}
+
+/*
+    What loadSnapshot() allocates, freed whether it succeeds or not.
+*/
+typedef struct
+{
+    const uint8_t *bytes;   // the file, mapped
+    size_t size;
+    Bytecode bytecode;      // until it is handed to the session
+    int *closures;          // the offset of the OP_CLOSURE making each function, -1 if none
+    int functionCount;
+    Shape **shapes;         // by index in the file
+    int shapeCount;
+    Value *objects;         // likewise, pinned while they are being built
+    int objectCount;
+    Name *names;            // of the globals, pointing into the file
+    Value *globals;
+    int globalCount;
+} Loader;
+
+static void freeLoader(Loader *loader)
+{
+    vm.gc.pinned = NULL;
+    vm.gc.pinnedCount = 0;
+    FREE_ARRAY(Value, loader->objects, loader->objectCount);
+    FREE_ARRAY(Shape*, loader->shapes, loader->shapeCount);
+    FREE_ARRAY(int, loader->closures, loader->functionCount);
+    FREE_ARRAY(Name, loader->names, loader->globalCount);
+    FREE_ARRAY(Value, loader->globals, loader->globalCount);
+    freeBytecode(&loader->bytecode);
+    if (loader->bytes != NULL)
+        unmapFile(loader->bytes, loader->size);
+}
+
+/*
+    @returns false if the function can't be called without a closure, or
+             as a method when 'method' is set, see validClasses().
+*/
+static bool validFunction(Loader *loader, uint32_t function, bool method)
+{
+    if (function >= (uint32_t)loader->bytecode.functionCount)
+        return false;
+
+    Function *info = &loader->bytecode.functions[function];
+    return info->captureCount == 0 && (!method || info->arity >= 1);
+}
+
+/*
+    Reads a value, an object by its index in the file.
+    The verified code takes a boxed capture for a box without checking, so
+    the value has to be a box if and only if 'boxed' is set: a box is
+    never a value of its own.
+*/
+static Value loadValue(Reader *reader, Loader *loader, bool boxed)
+{
+    uint8_t type = readU8(reader);
+    if (type == VAL_OBJ)
+    {
+        uint32_t index = readU32(reader);
+        reader->ok = reader->ok && index < (uint32_t)loader->objectCount &&
+                     IS_BOX(loader->objects[index]) == boxed;
+        return reader->ok ? loader->objects[index] : NIL_VAL;
+    }
+
+    reader->ok = reader->ok && !boxed;
+
+    Value value = readValue(reader, type);
+    if ((IS_FUNCTION(value) && !validFunction(loader, (uint32_t)AS_FUNCTION(value), false)) ||
+        (IS_CLASS(value) && (uint32_t)AS_CLASS(value) >= (uint32_t)loader->bytecode.classCount))
+    {
+        reader->ok = false;
+        return NIL_VAL;
+    }
+    return value;
+}
+
+/*
+    Allocates the object storeHeader() has written, its values nil.
+    @returns NULL if the header is malformed.
+*/
+static Obj* loadHeader(Reader *reader, Loader *loader, int index)
+{
+    Obj *object = NULL;
+    uint8_t type = readU8(reader);
+    switch (type)
+    {
+        case OBJ_ARRAY:
+        {
+            ArrayType elementType = (ArrayType)readU8(reader);
+            uint32_t count = readU32(reader);
+            // the elements have to be in the file
+            if (reader->ok && elementType <= ARRAY_BOOL && count <= INT32_MAX &&
+                count <= (size_t)(reader->end - reader->at) / arrayElementSize(elementType))
+                object = (Obj*)newArray(elementType, (int)count);
+        }break;
+        case OBJ_CLOSURE:
+        {
+            uint32_t function = readU32(reader);
+            uint32_t captureCount = readU32(reader);
+            if (reader->ok && function < (uint32_t)loader->bytecode.functionCount &&
+                loader->closures[function] >= 0 && captureCount > 0 &&
+                captureCount == (uint32_t)loader->bytecode.functions[function].captureCount)
+                object = (Obj*)newClosure((int)function, (int)captureCount);
+        }break;
+        case OBJ_BOX:
+            object = (Obj*)newBox(NIL_VAL);
+        break;
+        case OBJ_INSTANCE:
+        {
+            uint32_t shape = readU32(reader);
+            if (reader->ok && shape < (uint32_t)loader->shapeCount)
+            {
+                ObjInstance *instance = newInstance(loader->shapes[shape]->klass);
+                // pinned before its fields are allocated
+                loader->objects[index] = OBJ_VAL(instance);
+
+                int slotCount = loader->shapes[shape]->slotCount;
+                if (slotCount > 0)
+                {
+                    instance->fields = ALLOCATE(Value, slotCount);
+                    instance->capacity = slotCount;
+                    for (int i = 0; i < slotCount; i++)
+                        instance->fields[i] = NIL_VAL;
+                }
+                instance->shape = loader->shapes[shape];
+                object = (Obj*)instance;
+            }
+        }break;
+        case OBJ_BOUND_METHOD:
+        {
+            uint32_t function = readU32(reader);
+            if (reader->ok && validFunction(loader, function, true))
+                object = (Obj*)newBoundMethod(NIL_VAL, (int)function);
+        }break;
+    }
+
+    if (object != NULL)
+        loader->objects[index] = OBJ_VAL(object);
+    return object;
+}
+
+/*
+    Fills the object with the values storeContent() has written.
+*/
+static void loadContent(Reader *reader, Loader *loader, Obj *object)
+{
+    switch (object->type)
+    {
+        case OBJ_ARRAY:
+        {
+            ObjArray *array = (ObjArray*)object;
+            for (int i = 0; i < array->count && reader->ok; i++)
+            {
+                if (array->elementType == ARRAY_NUMBER)
+                {
+                    uint64_t bits = readU64(reader);
+                    memcpy(&array->as.numbers[i], &bits, sizeof(bits));
+                }else if (array->elementType == ARRAY_INT)
+                {
+                    array->as.ints[i] = (int32_t)readU32(reader);
+                }else
+                {
+                    array->as.bools[i] = readU8(reader) != 0;
+                }
+            }
+        }break;
+        case OBJ_CLOSURE:
+        {
+            // boxed as the OP_CLOSURE making the function takes them
+            ObjClosure *closure = (ObjClosure*)object;
+            uint8_t *flags = loader->bytecode.code + loader->closures[closure->function] + 3;
+            for (int i = 0; i < closure->captureCount; i++)
+            {
+                closure->captures[i] = loadValue(reader, loader, (flags[2 * i] & CAPTURE_BOXED) != 0);
+                writeBarrier(object, closure->captures[i]);
+            }
+        }break;
+        case OBJ_BOX:
+        {
+            ObjBox *box = (ObjBox*)object;
+            box->value = loadValue(reader, loader, false);
+            writeBarrier(object, box->value);
+        }break;
+        case OBJ_INSTANCE:
+        {
+            ObjInstance *instance = (ObjInstance*)object;
+            for (int i = 0; i < instance->shape->slotCount; i++)
+            {
+                instance->fields[i] = loadValue(reader, loader, false);
+                writeBarrier(object, instance->fields[i]);
+            }
+        }break;
+        case OBJ_BOUND_METHOD:
+        {
+            ObjBoundMethod *bound = (ObjBoundMethod*)object;
+            bound->receiver = loadValue(reader, loader, false);
+            writeBarrier(object, bound->receiver);
+        }break;
+    }
+}
+
+static bool readSnapshot(Loader *loader, Session *session, const char *path)
+{
+    loader->bytes = mapFile(path, &loader->size);
+    if (loader->bytes == NULL)
+    {
+        fprintf(stderr, "Couldn't open the snapshot \"%s\".\n", path);
+        return false;
+    }
+
+    if (loader->size < HEADER_SIZE + 8)
+    {
+        fprintf(stderr, "Invalid snapshot \"%s\".\n", path);
+        return false;
+    }
+
+    // the checksum covers everything before it
+    Reader reader = {loader->bytes, loader->bytes + loader->size - 8, true};
+    Reader trailer = {loader->bytes + loader->size - 8, loader->bytes + loader->size, true};
+    bool ok = readU64(&trailer) == fnv1a(FNV_OFFSET, loader->bytes, loader->size - 8);
+
+    ok = ok && memcmp(readBytes(&reader, 4), SNAPSHOT_MAGIC, 4) == 0;
+    ok = ok && readU32(&reader) == BYTECODE_VERSION;
+    ok = ok && readU32(&reader) == SNAPSHOT_VERSION;
+
+    uint32_t nativeCount = readU32(&reader);
+    uint32_t globalCount = readU32(&reader);
+    uint32_t shapeCount = readU32(&reader);
+    uint32_t objectCount = readU32(&reader);
+    size_t left = (size_t)(reader.end - reader.at);
+    ok = ok && nativeCount <= UINT8_COUNT && globalCount <= GLOBALS_MAX &&
+         shapeCount <= left && objectCount <= left;
+
+    for (uint32_t i = 0; i < nativeCount && ok; i++)
+    {
+        uint32_t length = readU32(&reader);
+        const char *name = (const char*)readBytes(&reader, length);
+        ok = name != NULL;
+        if (ok && findNative(name, (int)length) != (int)i)
+        {
+            fprintf(stderr, "The snapshot \"%s\" needs the native '%.*s' registered as number %d.\n",
+                    path, (int)length, name, (int)i);
+            return false;
+        }
+    }
+
+    ok = ok && readBytecode(&reader, &loader->bytecode);
+    Bytecode *bytecode = &loader->bytecode;
+
+    loader->globalCount = ok ? (int)globalCount : 0;
+    loader->names = ALLOCATE(Name, loader->globalCount);
+    loader->globals = ALLOCATE(Value, loader->globalCount);
+    Name *names = loader->names;
+    for (uint32_t i = 0; i < globalCount && ok; i++)
+    {
+        uint32_t length = readU32(&reader);
+        names[i].chars = (char*)readBytes(&reader, length);
+        names[i].length = (int)length;
+        ok = names[i].chars != NULL;
+    }
+
+    if (!ok)
+    {
+        fprintf(stderr, "Invalid snapshot \"%s\".\n", path);
+        return false;
+    }
+
+    // the shapes are made with the code they serve
+    const char *error = verifyBytecode(bytecode, 0);
+    if (error != NULL)
+    {
+        fprintf(stderr, "Invalid bytecode: %s\n", error);
+        return false;
+    }
+
+    loader->closures = ALLOCATE(int, bytecode->functionCount);
+    loader->functionCount = bytecode->functionCount;
+    for (int i = 0; i < bytecode->functionCount; i++)
+        loader->closures[i] = -1;
+    for (int offset = 0; offset < bytecode->count; offset += instructionLength(bytecode, offset))
+    {
+        if (bytecode->code[offset] == OP_CLOSURE)
+            loader->closures[bytecode->code[offset + 1]] = offset;
+    }
+
+    loader->shapes = ALLOCATE(Shape*, shapeCount);
+    loader->shapeCount = (int)shapeCount;
+    for (uint32_t i = 0; i < shapeCount && ok; i++)
+    {
+        uint32_t parent = readU32(&reader);
+        uint32_t id = readU32(&reader);
+        if (parent == NO_PARENT)
+        {
+            ok = reader.ok && id < (uint32_t)bytecode->classCount;
+            loader->shapes[i] = ok ? rootShape((int)id) : NULL;
+        }else
+        {
+            ok = reader.ok && parent < i && id < (uint32_t)bytecode->nameCount;
+            loader->shapes[i] = ok ? addField(loader->shapes[parent], (int)id) : NULL;
+        }
+    }
+
+    loader->objects = ALLOCATE(Value, objectCount);
+    loader->objectCount = (int)objectCount;
+    for (uint32_t i = 0; i < objectCount; i++)
+        loader->objects[i] = NIL_VAL;
+    vm.gc.pinned = loader->objects;
+    vm.gc.pinnedCount = loader->objectCount;
+
+    for (uint32_t i = 0; i < objectCount && ok; i++)
+        ok = loadHeader(&reader, loader, (int)i) != NULL;
+    for (uint32_t i = 0; i < objectCount && ok; i++)
+        loadContent(&reader, loader, AS_OBJ(loader->objects[i]));
+
+    Value *globals = loader->globals;
+    for (uint32_t i = 0; i < globalCount && ok; i++)
+        globals[i] = loadValue(&reader, loader, false);
+
+    if (!ok || !reader.ok || reader.at != reader.end)
+    {
+        fprintf(stderr, "Invalid snapshot \"%s\".\n", path);
+        return false;
+    }
+
+    setGlobalNames(names, (int)globalCount);
+    freeBytecode(&session->bytecode);
+    session->bytecode = loader->bytecode;
+    session->declared = markBytecode(&session->bytecode);
+    initBytecode(&loader->bytecode);
+    for (uint32_t i = 0; i < globalCount; i++)
+        vm.globals[i] = globals[i];
+    return true;
+}
+
+bool loadSnapshot(Session *session, const char *path)
+{
+    Loader loader = {0};
+    initBytecode(&loader.bytecode);
+
+    jmp_buf handler;
+    if (setjmp(handler) != 0)
+    {
+        // setGlobalNames() may have been cut short
+        vm.unwind = NULL;
+        setGlobalNames(NULL, 0);
+        freeLoader(&loader);
+        return false;
+    }
+
+    vm.unwind = &handler;
+    bool loaded = readSnapshot(&loader, session, path);
+    vm.unwind = NULL;
+    freeLoader(&loader);
+    return loaded;
+}
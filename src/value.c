@@ -1,6 +1,9 @@
 #include <stdio.h>
 #include "../include/memory.h"
+#include "../include/object.h"
+#include "../include/output.h"
 #include "../include/value.h"
+#include "../include/vm.h"
 
 
 void initConstantPool(ConstantPool *constantPool)
@@ -16,13 +19,46 @@ void freeConstantPool(ConstantPool *constantPool)
     initConstantPool(constantPool);
 }
 
+/*
+    A function is known by its index: its name is in the running bytecode.
+*/
+void printFunction(int function)
+{
+    writeOutput("<fn", 3);
+    if (vm.bytecode != NULL && function < vm.bytecode->functionCount)
+    {
+        writeOutput(" ", 1);
+        writeOutput(vm.bytecode->functions[function].name, vm.bytecode->functions[function].nameLength);
+    }
+    writeOutput(">", 1);
+}
+
+void printClass(int klass)
+{
+    writeOutput("<class", 6);
+    if (vm.bytecode != NULL && klass < vm.bytecode->classCount)
+    {
+        writeOutput(" ", 1);
+        writeOutput(vm.bytecode->classes[klass].name, vm.bytecode->classes[klass].nameLength);
+    }
+    writeOutput(">", 1);
+}
+
 void printValue(Value value)
 {
     switch (value.type)
     {
-        case VAL_BOOL:   printf(AS_BOOL(value) ? "true" : "false"); break;
-        case VAL_NIL:    printf("nil");                             break;
-        case VAL_NUMBER: printf("%g", AS_NUMBER(value));            break;
+        case VAL_BOOL:
+            if (AS_BOOL(value))
+                writeOutput("true", 4);
+            else
+                writeOutput("false", 5);
+            break;
+        case VAL_NIL:    writeOutput("nil", 3);                    break;
+        case VAL_NUMBER: writeNumber(AS_NUMBER(value));            break;
+        case VAL_OBJ:    printObject(value);                        break;
+        case VAL_FUNCTION: printFunction(AS_FUNCTION(value));      break;
+        case VAL_CLASS:    printClass(AS_CLASS(value));            break;
     }
 }
 
@@ -36,6 +72,9 @@ bool valuesEqual(Value a, Value b)
         case VAL_BOOL: return AS_BOOL(a) == AS_BOOL(b);
         case VAL_NIL: return true;
         case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
+        case VAL_OBJ: return AS_OBJ(a) == AS_OBJ(b);
+        case VAL_FUNCTION: return AS_FUNCTION(a) == AS_FUNCTION(b);
+        case VAL_CLASS: return AS_CLASS(a) == AS_CLASS(b);
         default: return false;
     }
 }
@@ -46,11 +85,10 @@ void appendConstant(ConstantPool *constantPool, Value constant)
     if (constantPool->capacity < constantPool->count + 1)
     {
         int oldCapacity = constantPool->capacity;
-        
-        constantPool->capacity = INCREASE_CAPACITY(oldCapacity);
+        int capacity = INCREASE_CAPACITY(oldCapacity);
         constantPool->constants = INCREASE_ARRAY(Value, constantPool->constants,
-                                        oldCapacity, constantPool->capacity);
-        
+                                                 oldCapacity, capacity);
+        constantPool->capacity = capacity;
     }
 
     constantPool->constants[constantPool->count] = constant;
@@ -1,53 +1,141 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include "../include/analysis.h"
+#include "../include/array.h"
 #include "../include/common.h"
 #include "../include/compiler.h"
+#include "../include/counters.h"
 #include "../include/debug.h"
+#include "../include/jit.h"
+#include "../include/memory.h"
+#include "../include/pool.h"
+#include "../include/profile.h"
 #include "../include/vm.h"
 
-VM vm;
+THREAD_LOCAL VM vm;
+
+#if defined(__GNUC__)
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#define UNLIKELY(condition) __builtin_expect(!!(condition), 0)
+#else
+#define ALWAYS_INLINE inline
+#define UNLIKELY(condition) (condition)
+#endif
 
 /*
   The core function which intended to interpret bytecode and output result.
+  @param bool verified the code has passed verifyBytecode().
 */
-static InterpretResult run(void);
+static InterpretResult run(bool verified);
 
 static void resetStack(void)
 {
     vm.stackTop = vm.stack;
+    vm.frameCount = 0;
 }
 
 static void runtimeError(const char *format, ...)
 {
     va_list args;
 
+    // what the script printed before comes first
+    flushOutput();
+    fflush(stdout);
+
     va_start(args, format);
     vfprintf(stderr, format, args);
     va_end(args);
     fputs("\n", stderr);
 
-    size_t instruction = vm.ip - vm.bytecode->code - 1;
-    int line = vm.bytecode->lines[instruction];
-    fprintf(stderr, "[line %d] in script\n", line);
+    // vm.ip is the one of the innermost frame, the others keep their own
+    for (int i = vm.frameCount - 1; i >= 0; i--)
+    {
+        CallFrame *frame = &vm.frames[i];
+        uint8_t *ip = i == vm.frameCount - 1 ? vm.ip : frame->ip;
+        int line = vm.bytecode->lines[ip - vm.bytecode->code - 1];
+
+        if (frame->function < 0)
+        {
+            fprintf(stderr, "[line %d] in script\n", line);
+        }else
+        {
+            Function *function = &vm.bytecode->functions[frame->function];
+            fprintf(stderr, "[line %d] in %.*s()\n", line, function->nameLength, function->name);
+        }
+    }
     resetStack();
 }
 
+/*
+    Makes the code at 'ip' the script, running in the bottom frame.
+*/
+static void enterScript(Bytecode *bytecode, uint8_t *ip, uint32_t *loopCounters,
+                        InlineCache *caches)
+{
+    vm.bytecode = bytecode;
+    vm.ip = ip;
+    vm.loopCounters = loopCounters;
+    vm.caches = caches;
+    vm.frameCount = 1;
+    vm.frames[0] = (CallFrame){-1, NULL, NULL, vm.stack, vm.stack};
+}
+
 void initVM(void)
 {
     resetStack();
+    vm.objects = NULL;
+    vm.bytecode = NULL;
+    memset(vm.shapes, 0, sizeof(vm.shapes));
+    vm.jitEnabled = false;
+    vm.fuel = FUEL_UNLIMITED;
+    vm.suspension = (Suspension){0};
+    vm.memoryLimit = MEMORY_UNLIMITED;
+    vm.unwind = NULL;
+    vm.nativeCount = 0;
+    vm.output.count = 0;
+    vm.output.sink = NULL;
+    vm.output.context = NULL;
+    vm.profile = (Profile){0};
+    vm.counters = (Counters){0};
+    initCollector();
+    defineStandardNatives();
 }
 
 void freeVM(void)
 {
+    abandonInterpret();
+    flushOutput();
+    freeProfile();
+    closeCounters();
+    freeObjects();
+    freeShapes();
+}
+
+/*
+    Reports a push() or a pop() past the bounds of the stack, which the
+    verified code never does, and unwinds to the running interpret().
+    Outside of one, the process exits.
+*/
+static void brokenStack(InterpretResult result)
+{
+    const char *message = result == STACK_OVERFLOW ? "Stack overflow." : "Stack underflow.";
+    if (vm.bytecode != NULL)
+        runtimeError("%s", message);
+    else
+        fprintf(stderr, "%s\n", message);
 
+    if (vm.unwind != NULL)
+        longjmp(*vm.unwind, result);
+    exit(result);
 }
 
 void push(Value value)
 {
-    if ((vm.stackTop - vm.stack) >= (STACK_MAX * sizeof(Value)))
+    if ((vm.stackTop - vm.stack) >= STACK_MAX)
     {
-        exit(STACK_OVERFLOW);
+        brokenStack(STACK_OVERFLOW);
     }
 
     *vm.stackTop = value;
@@ -56,9 +144,9 @@ void push(Value value)
 
 Value pop(void)
 {
-    if (((int64_t)vm.stackTop - (int64_t)vm.stack) < 0)
+    if (vm.stackTop == vm.stack)
     {
-        exit(STACK_UNDERFLOW);
+        brokenStack(STACK_UNDERFLOW);
     }
 
     vm.stackTop--;
@@ -70,58 +158,537 @@ static Value peek(int idx)
     return vm.stackTop[-1 - idx];
 }
 
+/*
+    The type is tested before the boolean is read: the byte of a number
+    in its place isn't a valid bool, and gcc -O2 moves the read ahead of
+    a test joined by && or ||.
+*/
 static bool isFalsey(Value value)
 {
-    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+    switch (value.type)
+    {
+        case VAL_NIL:   return true;
+        case VAL_BOOL:  return !AS_BOOL(value);
+        default:        return false;
+    }
+}
+
+/*
+    Packs 'count' values on top of the stack into a new typed array.
+    The element type is inferred from the values: all of them must be
+    either numbers or booleans. An empty literal produces a number array.
+*/
+bool buildArray(int count)
+{
+    Value array;
+    const char *error = arrayFromValues(vm.stackTop - count, count, &array);
+    if (error != NULL)
+    {
+        runtimeError("%s", error);
+        return false;
+    }
+
+    vm.stackTop -= count;
+    push(array);
+    return true;
+}
+
+bool indexGet(void)
+{
+    Value element;
+    const char *error = arrayIndexGet(peek(1), peek(0), &element);
+    if (error != NULL)
+    {
+        runtimeError("%s", error);
+        return false;
+    }
+
+    vm.stackTop -= 2;
+    push(element);
+    return true;
+}
+
+bool indexSet(void)
+{
+    Value value = peek(0);
+    const char *error = arrayIndexSet(peek(2), peek(1), value);
+    if (error != NULL)
+    {
+        runtimeError("%s", error);
+        return false;
+    }
+
+    // assignment is an expression: leave the assigned value
+    vm.stackTop -= 3;
+    push(value);
+    return true;
+}
+
+/*
+    Executes one of the built-in array functions.
+    The arguments are on top of the stack. They are replaced with the result.
+*/
+bool callIntrinsic(int intrinsic)
+{
+    int arity = arrayIntrinsics[intrinsic].arity;
+    Value result;
+    const char *error = arrayCallIntrinsic(intrinsic, vm.stackTop - arity, &result);
+    if (error != NULL)
+    {
+        runtimeError("%s", error);
+        return false;
+    }
+
+    vm.stackTop -= arity;
+    push(result);
+    return true;
+}
+
+bool callNative(int native, int argCount)
+{
+    if (native >= vm.nativeCount)
+    {
+        runtimeError("Undefined native function.");
+        return false;
+    }
+
+    int arity = vm.natives[native].arity;
+    if (arity != NATIVE_VARIADIC && arity != argCount)
+    {
+        runtimeError("Expected %d arguments but got %d.", arity, argCount);
+        return false;
+    }
+
+    if (vm.stackTop - vm.stack < argCount)
+        brokenStack(STACK_UNDERFLOW);
+    if (vm.stackTop == vm.stack + STACK_MAX)
+        brokenStack(STACK_OVERFLOW);    // no room for the result of a call without arguments
+
+    Value *args = vm.stackTop - argCount;
+    const char *error = vm.natives[native].function(args, argCount);
+    if (error != NULL)
+    {
+        runtimeError("%s", error);
+        return false;
+    }
+
+    vm.stackTop = args + 1;
+    return true;
+}
+
+static void setBox(ObjBox *box, Value value)
+{
+    box->value = value;
+    writeBarrier((Obj*)box, value);
+}
+
+/*
+    @returns true if the closure has the capture, boxed if 'boxed'.
+*/
+static bool isCapture(ObjClosure *closure, int index, bool boxed)
+{
+    return closure != NULL && index < closure->captureCount &&
+           IS_BOX(closure->captures[index]) == boxed;
+}
+
+/*
+    Pushes a closure of the function, taking the captures described by
+    the operands of OP_CLOSURE from the running frame. A boxed local is
+    boxed in its slot first, unless an earlier closure already did.
+*/
+static bool pushClosure(int function, int captureCount, uint8_t *captures, CallFrame *frame,
+                        bool checked)
+{
+    if (checked)
+    {
+        bool valid = function < vm.bytecode->functionCount &&
+                     captureCount == vm.bytecode->functions[function].captureCount;
+        for (int i = 0; valid && i < captureCount; i++)
+        {
+            uint8_t flags = captures[2 * i];
+            int index = captures[2 * i + 1];
+            valid = (flags & CAPTURE_LOCAL) ? frame->slots + index < vm.stackTop
+                                            : isCapture(frame->closure, index, (flags & CAPTURE_BOXED) != 0);
+        }
+
+        if (!valid)
+        {
+            runtimeError("Invalid closure.");
+            return false;
+        }
+    }
+
+    // the boxes are allocated first: the closure isn't reachable until pushed
+    for (int i = 0; i < captureCount; i++)
+    {
+        Value *slot = &frame->slots[captures[2 * i + 1]];
+        if (captures[2 * i] == (CAPTURE_LOCAL | CAPTURE_BOXED) && !IS_BOX(*slot))
+            *slot = OBJ_VAL(newBox(*slot));
+    }
+
+    ObjClosure *closure = newClosure(function, captureCount);
+    for (int i = 0; i < captureCount; i++)
+    {
+        int index = captures[2 * i + 1];
+        Value capture = (captures[2 * i] & CAPTURE_LOCAL) ? frame->slots[index]
+                                                          : frame->closure->captures[index];
+        closure->captures[i] = capture;
+        writeBarrier((Obj*)closure, capture);
+    }
+
+    push(OBJ_VAL(closure));
+    return true;
+}
+
+static void undefinedProperty(int name)
+{
+    if (name < vm.bytecode->nameCount)
+        runtimeError("Undefined property '%.*s'.", vm.bytecode->names[name].length,
+                     vm.bytecode->names[name].chars);
+    else
+        runtimeError("Undefined property.");
+}
+
+/*
+    @returns the method of the class of the instance, -1 if it has none by
+             that name.
+*/
+static int instanceMethod(ObjInstance *instance, int name)
+{
+    int klass = instance->shape->klass;
+    return klass < vm.bytecode->classCount ? findMethod(&vm.bytecode->classes[klass], name) : -1;
+}
+
+/*
+    Slow path of OP_GET_PROPERTY: replaces the instance on top of the stack
+    with its field or, failing that, with its method bound to it. Then
+    fills the cache, if any, for the shape of the instance.
+*/
+static bool getProperty(int name, InlineCache *cache)
+{
+    Value receiver = peek(0);
+    if (!IS_INSTANCE(receiver))
+    {
+        runtimeError("Only instances have properties.");
+        return false;
+    }
+
+    ObjInstance *instance = AS_INSTANCE(receiver);
+    int slot = findField(instance->shape, name);
+    int function = slot < 0 ? instanceMethod(instance, name) : -1;
+    if (slot < 0 && function < 0)
+    {
+        undefinedProperty(name);
+        return false;
+    }
+
+    if (cache != NULL)
+        *cache = (InlineCache){instance->shape, NULL, slot, function};
+
+    if (slot >= 0)
+        vm.stackTop[-1] = instance->fields[slot];
+    else
+        vm.stackTop[-1] = OBJ_VAL(newBoundMethod(receiver, function));
+    return true;
+}
+
+/*
+    Slow path of OP_SET_PROPERTY: assigns the value on top of the stack to
+    the field of the instance below, adding the field if the instance has
+    none by that name, and leaves the value alone on the stack.
+*/
+static bool setProperty(int name, InlineCache *cache)
+{
+    Value receiver = peek(1);
+    if (!IS_INSTANCE(receiver))
+    {
+        runtimeError("Only instances have fields.");
+        return false;
+    }
+
+    ObjInstance *instance = AS_INSTANCE(receiver);
+    Shape *shape = instance->shape;
+    Shape *next = NULL;
+    int slot = findField(shape, name);
+    if (slot < 0)
+    {
+        next = addField(shape, name);
+        slot = shape->slotCount;
+        reserveField(instance);
+    }
+
+    if (cache != NULL)
+        *cache = (InlineCache){shape, next, slot, -1};
+
+    // the shape changes once the slot is set, for the collector to see it
+    Value value = peek(0);
+    instance->fields[slot] = value;
+    writeBarrier((Obj*)instance, value);
+    if (next != NULL)
+        instance->shape = next;
+
+    vm.stackTop[-2] = value;
+    vm.stackTop--;
+    return true;
+}
+
+/*
+    Slow path of OP_INVOKE, the receiver being below the arguments. A field
+    holding a function is called like any callee: it takes the place of the
+    receiver. Otherwise the method is looked up and the cache filled.
+    @param int* method receives the method to call with the receiver as
+                its first argument, -1 if it is the field to call.
+*/
+static bool invokeProperty(int name, int argCount, InlineCache *cache, int *method)
+{
+    Value *receiver = vm.stackTop - argCount - 1;
+    if (!IS_INSTANCE(*receiver))
+    {
+        runtimeError("Only instances have methods.");
+        return false;
+    }
+
+    ObjInstance *instance = AS_INSTANCE(*receiver);
+    int slot = findField(instance->shape, name);
+    if (slot >= 0)
+    {
+        *receiver = instance->fields[slot];
+        *method = -1;
+        return true;
+    }
+
+    *method = instanceMethod(instance, name);
+    if (*method < 0)
+    {
+        undefinedProperty(name);
+        return false;
+    }
+
+    if (cache != NULL)
+        *cache = (InlineCache){instance->shape, NULL, -1, *method};
+    return true;
+}
+
+/*
+    Puts the receiver of a bound method, or a new instance of a class, in
+    place of the callee, so that it becomes the first argument.
+    @returns the method or the initializer to call, -1 if the callee can't
+             be called.
+*/
+static int bindReceiver(Value *callee)
+{
+    if (IS_BOUND_METHOD(*callee))
+    {
+        ObjBoundMethod *bound = AS_BOUND_METHOD(*callee);
+        *callee = bound->receiver;
+        return bound->function;
+    }
+
+    if (IS_CLASS(*callee) && AS_CLASS(*callee) < vm.bytecode->classCount)
+    {
+        // the class stays on the stack while the instance is allocated
+        int klass = AS_CLASS(*callee);
+        *callee = OBJ_VAL(newInstance(klass));
+        return vm.bytecode->classes[klass].initializer;
+    }
+
+    return -1;
+}
+
+/*
+    Converts the subject of OP_TABLESWITCH/OP_LOOKUPSWITCH into an integer key.
+    @returns false if the subject can't match any integer case.
+*/
+static bool switchKey(Value subject, int32_t *key)
+{
+    if (!IS_NUMBER(subject))
+        return false;
+
+    double number = AS_NUMBER(subject);
+    if (!(number >= INT32_MIN && number <= INT32_MAX) || (double)(int32_t)number != number)
+        return false;
+
+    *key = (int32_t)number;
+    return true;
+}
+
+/*
+    Reads the big-endian operands of the switch instructions.
+*/
+static uint16_t readShort(uint8_t *code)
+{
+    return (uint16_t)((code[0] << 8) | code[1]);
+}
+
+static int32_t readInt32(uint8_t *code)
+{
+    return (int32_t)(((uint32_t)code[0] << 24) | ((uint32_t)code[1] << 16) |
+                     ((uint32_t)code[2] << 8)  |  (uint32_t)code[3]);
 }
 
-static InterpretResult run(void)
+uint8_t* tableSwitch(uint8_t *ip, Value subject)
 {
-#define READ_BYTE() (*vm.ip++)
+    int32_t low = readInt32(ip);
+    uint16_t count = readShort(ip + 4);
+    uint16_t offset = readShort(ip + 6);
+    uint8_t *table = ip + 8;
+    uint8_t *end = table + count * 2;
+
+    int32_t key;
+    if (switchKey(subject, &key) && key >= low && (int64_t)key - low < count)
+        offset = readShort(table + (key - low) * 2);
+
+    return end - offset;
+}
+
+uint8_t* lookupSwitch(uint8_t *ip, Value subject)
+{
+    uint16_t count = readShort(ip);
+    uint16_t offset = readShort(ip + 2);
+    uint8_t *table = ip + 4;
+    uint8_t *end = table + count * 6;
+
+    int32_t key;
+    if (switchKey(subject, &key))
+    {
+        // binary search over the keys sorted in ascending order
+        int low = 0;
+        int high = count - 1;
+        while (low <= high)
+        {
+            int middle = (low + high) / 2;
+            int32_t candidate = readInt32(table + middle * 6);
+            if (candidate < key)
+            {
+                low = middle + 1;
+            }else if (candidate > key)
+            {
+                high = middle - 1;
+            }else
+            {
+                offset = readShort(table + middle * 6 + 4);
+                break;
+            }
+        }
+    }
+
+    return end - offset;
+}
+
+/*
+    The dispatch loop. With 'checked' false, it trusts the code to have
+    passed verifyBytecode() and leaves out the stack bounds checks. With
+    'profiled', it takes the samples of the profiler before each
+    instruction, see profile.h. Being inlined into run() four times, it is
+    compiled once for each case, the runs that aren't profiled paying
+    nothing for it.
+*/
+static ALWAYS_INLINE InterpretResult dispatch(bool checked, bool profiled)
+{
+#define PUSH(value) \
+    do { \
+        Value pushed = (value); \
+        if (checked) push(pushed); \
+        else *vm.stackTop++ = pushed; \
+    } while (false)
+#define POP() (checked ? pop() : *--vm.stackTop)
+#define READ_BYTE() (*ip++)
 #define READ_CONSTANT() (vm.bytecode->constantPool.constants[READ_BYTE()])
+#define READ_SHORT() \
+    (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
 #define BINARY_OP(valueType, op) \
     do { \
         if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
+            vm.ip = ip; \
             runtimeError("Operands must be numbers."); \
             return INTERPRET_RUNTIME_ERROR; \
         } \
-        double b = AS_NUMBER(pop()); \
-        double a = AS_NUMBER(pop()); \
-        push(valueType(a op b)); \
+        double b = AS_NUMBER(POP()); \
+        double a = AS_NUMBER(POP()); \
+        PUSH(valueType(a op b)); \
+    } while (false)
+// Fused comparison and conditional jump. 'condition' is written in terms
+// of the operands 'a' and 'b'. The offset is read before the operands are
+// checked, so that an error reports the line of this very instruction.
+#define COMPARE_JUMP(condition, readOffset) \
+    do { \
+        uint16_t offset = readOffset; \
+        if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
+            vm.ip = ip; \
+            runtimeError("Operands must be numbers."); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } \
+        double b = AS_NUMBER(POP()); \
+        double a = AS_NUMBER(POP()); \
+        if (condition) \
+            ip += offset; \
+    } while (false)
+#define JUMP_IF(condition, readOffset) \
+    do { \
+        uint16_t offset = readOffset; \
+        if (condition) \
+            ip += offset; \
+    } while (false)
+// Charges the code about to run again against the fuel, see vm.h. The jump
+// or the call is already taken, so that the run resumes from 'ip'.
+#define CHARGE(cost) \
+    do { \
+        if ((vm.fuel -= (cost)) < 0) { \
+            vm.ip = ip; \
+            return INTERPRET_OUT_OF_FUEL; \
+        } \
     } while (false)
 
+    // the innermost frame lives in locals, written back on calls and errors
+    CallFrame *frame = &vm.frames[vm.frameCount - 1];
+    uint8_t *ip = vm.ip;
+    Value *slots = frame->slots;
+
     for (;;)
     {
 #ifdef DEBUG_TRACE_VM
         // stack trace start
+        flushOutput();
         printf("          ");
         for (Value* slot = vm.stack; slot < vm.stackTop; slot++)
         {
             printf("[ ");
             printValue(*slot);
+            flushOutput();
             printf(" ]");
         }
         printf("\n");
         // stack trace end
 
-        disassembleInstruction(vm.bytecode, (int)(vm.ip - vm.bytecode->code));
+        disassembleInstruction(vm.bytecode, (int)(ip - vm.bytecode->code));
 #endif //DEBUG_TRACE_VM
 
+        if (profiled && UNLIKELY(profileTicks != 0))
+            sampleProfile(ip);
+#ifdef BEE_OPCODE_COUNTERS
+        countOpcode(*ip);
+#endif
+
         uint8_t instruction;
         switch (instruction = READ_BYTE())
         {
             case OP_CONSTANT:
             {
                 Value constant = READ_CONSTANT();
-                push(constant);
+                PUSH(constant);
+            }break;
+            case OP_CONSTANT_LONG:
+            {
+                Value constant = vm.bytecode->constantPool.constants[READ_SHORT()];
+                PUSH(constant);
             }break;
-            case OP_NIL: push(NIL_VAL);                     break;
-            case OP_TRUE: push(BOOL_VAL(true));             break;
-            case OP_FALSE: push(BOOL_VAL(false));           break;
+            case OP_NIL: PUSH(NIL_VAL);                     break;
+            case OP_TRUE: PUSH(BOOL_VAL(true));             break;
+            case OP_FALSE: PUSH(BOOL_VAL(false));           break;
             case OP_EQUAL:
-                Value b = pop();
-                Value a = pop();
-                push(BOOL_VAL(valuesEqual(a, b)));
+                Value b = POP();
+                Value a = POP();
+                PUSH(BOOL_VAL(valuesEqual(a, b)));
             break;
             case OP_GREATER: BINARY_OP(BOOL_VAL, >);        break;
             case OP_LESS: BINARY_OP(BOOL_VAL, <);           break;
@@ -129,21 +696,439 @@ static InterpretResult run(void)
             case OP_SUBTRACT: BINARY_OP(NUMBER_VAL, -);     break;
             case OP_MULTIPLY: BINARY_OP(NUMBER_VAL, *);     break;
             case OP_DIVIDE: BINARY_OP(NUMBER_VAL, /);       break;
-            case OP_NOT: push(BOOL_VAL(isFalsey(pop())));   break;
+            case OP_NOT: PUSH(BOOL_VAL(isFalsey(POP())));   break;
             case OP_NEGATE:
             {
                 if (!IS_NUMBER(peek(0)))
                 {
+                    vm.ip = ip;
                     runtimeError("Operand must be a number.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                //push(-pop());
-                push(NUMBER_VAL(-AS_NUMBER(pop())));
+                //PUSH(-POP());
+                PUSH(NUMBER_VAL(-AS_NUMBER(POP())));
+            }break;
+            case OP_ARRAY:
+            {
+                uint8_t count = READ_BYTE();
+                vm.ip = ip;
+                if (!buildArray(count))
+                    return INTERPRET_RUNTIME_ERROR;
+            }break;
+            case OP_INDEX_GET:
+            {
+                vm.ip = ip;
+                if (!indexGet())
+                    return INTERPRET_RUNTIME_ERROR;
+            }break;
+            case OP_INDEX_SET:
+            {
+                vm.ip = ip;
+                if (!indexSet())
+                    return INTERPRET_RUNTIME_ERROR;
+            }break;
+            case OP_INTRINSIC:
+            {
+                uint8_t intrinsic = READ_BYTE();
+                vm.ip = ip;
+                if (!callIntrinsic(intrinsic))
+                    return INTERPRET_RUNTIME_ERROR;
+            }break;
+            case OP_NATIVE:
+            {
+                uint8_t native = READ_BYTE();
+                uint8_t argCount = READ_BYTE();
+                if (checked)
+                {
+                    vm.ip = ip;
+                    if (!callNative(native, argCount))
+                        return INTERPRET_RUNTIME_ERROR;
+                    break;
+                }
+
+                // the verifier has matched the call against the native
+                Value *args = vm.stackTop - argCount;
+                const char *error = vm.natives[native].function(args, argCount);
+                if (error != NULL)
+                {
+                    vm.ip = ip;
+                    runtimeError("%s", error);
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                vm.stackTop = args + 1;
+            }break;
+            case OP_POP: POP();                             break;
+            case OP_PRINT:
+            {
+                printValue(POP());
+                writeOutput("\n", 1);
+            }break;
+            case OP_GET_LOCAL:
+            {
+                uint8_t slot = READ_BYTE();
+                PUSH(slots[slot]);
+            }break;
+            case OP_SET_LOCAL:
+            {
+                uint8_t slot = READ_BYTE();
+                slots[slot] = peek(0);
+            }break;
+            case OP_GET_BOXED:
+            {
+                // the local is boxed once a closure captures it
+                Value value = slots[READ_BYTE()];
+                PUSH(IS_BOX(value) ? AS_BOX(value)->value : value);
+            }break;
+            case OP_SET_BOXED:
+            {
+                Value *slot = &slots[READ_BYTE()];
+                if (IS_BOX(*slot))
+                    setBox(AS_BOX(*slot), peek(0));
+                else
+                    *slot = peek(0);
+            }break;
+            case OP_GET_CAPTURE:
+            case OP_GET_CAPTURE_BOXED:
+            case OP_SET_CAPTURE:
+            {
+                uint8_t index = READ_BYTE();
+                if (checked && !isCapture(frame->closure, index, instruction != OP_GET_CAPTURE))
+                {
+                    vm.ip = ip;
+                    runtimeError("Invalid capture.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                Value capture = frame->closure->captures[index];
+                if (instruction == OP_GET_CAPTURE)
+                    PUSH(capture);
+                else if (instruction == OP_GET_CAPTURE_BOXED)
+                    PUSH(AS_BOX(capture)->value);
+                else
+                    setBox(AS_BOX(capture), peek(0));
+            }break;
+            case OP_GET_PROPERTY:
+            {
+                uint8_t name = READ_BYTE();
+                InlineCache *cache = checked ? NULL : &vm.caches[READ_SHORT()];
+                if (checked)
+                    ip += 2;
+
+                Value receiver = peek(0);
+                if (!checked && IS_INSTANCE(receiver) &&
+                    AS_INSTANCE(receiver)->shape == cache->shape && cache->slot >= 0)
+                {
+                    vm.stackTop[-1] = AS_INSTANCE(receiver)->fields[cache->slot];
+                    break;
+                }
+
+                vm.ip = ip;
+                if (!getProperty(name, cache))
+                    return INTERPRET_RUNTIME_ERROR;
+            }break;
+            case OP_SET_PROPERTY:
+            {
+                uint8_t name = READ_BYTE();
+                InlineCache *cache = checked ? NULL : &vm.caches[READ_SHORT()];
+                if (checked)
+                    ip += 2;
+
+                // the cache of an added field holds the shape the instance moves to
+                Value receiver = peek(1);
+                if (!checked && IS_INSTANCE(receiver) &&
+                    AS_INSTANCE(receiver)->shape == cache->shape &&
+                    cache->slot < AS_INSTANCE(receiver)->capacity)
+                {
+                    ObjInstance *instance = AS_INSTANCE(receiver);
+                    Value value = peek(0);
+                    instance->fields[cache->slot] = value;
+                    writeBarrier((Obj*)instance, value);
+                    if (cache->next != NULL)
+                        instance->shape = cache->next;
+
+                    vm.stackTop[-2] = value;
+                    vm.stackTop--;
+                    break;
+                }
+
+                vm.ip = ip;
+                if (!setProperty(name, cache))
+                    return INTERPRET_RUNTIME_ERROR;
+            }break;
+            case OP_GET_GLOBAL: PUSH(vm.globals[READ_SHORT()]);  break;
+            case OP_SET_GLOBAL: vm.globals[READ_SHORT()] = peek(0); break;
+            case OP_DEFINE_GLOBAL: vm.globals[READ_SHORT()] = POP(); break;
+            case OP_JUMP:
+            {
+                uint16_t offset = READ_SHORT();
+                ip += offset;
+            }break;
+            case OP_JUMP_SHORT:
+            {
+                uint8_t offset = READ_BYTE();
+                ip += offset;
+            }break;
+            case OP_JUMP_BACK:
+            {
+                uint16_t offset = READ_SHORT();
+                ip -= offset;
+                CHARGE(offset);
+            }break;
+            case OP_JUMP_BACK_SHORT:
+            {
+                uint8_t offset = READ_BYTE();
+                ip -= offset;
+                CHARGE(offset);
+            }break;
+            case OP_JUMP_IF_FALSE:        JUMP_IF(isFalsey(POP()), READ_SHORT()); break;
+            case OP_JUMP_IF_FALSE_SHORT:  JUMP_IF(isFalsey(POP()), READ_BYTE());  break;
+            case OP_JUMP_IF_FALSE_OR_POP:
+            case OP_JUMP_IF_FALSE_OR_POP_SHORT:
+            {
+                uint16_t offset = instruction == OP_JUMP_IF_FALSE_OR_POP ? READ_SHORT() : READ_BYTE();
+                if (isFalsey(peek(0)))
+                    ip += offset;
+                else
+                    POP();
+            }break;
+            case OP_JUMP_IF_TRUE_OR_POP:
+            case OP_JUMP_IF_TRUE_OR_POP_SHORT:
+            {
+                uint16_t offset = instruction == OP_JUMP_IF_TRUE_OR_POP ? READ_SHORT() : READ_BYTE();
+                if (!isFalsey(peek(0)))
+                    ip += offset;
+                else
+                    POP();
+            }break;
+            case OP_JUMP_IF_LESS:               COMPARE_JUMP(a < b, READ_SHORT());     break;
+            case OP_JUMP_IF_LESS_SHORT:         COMPARE_JUMP(a < b, READ_BYTE());      break;
+            case OP_JUMP_IF_NOT_LESS:           COMPARE_JUMP(!(a < b), READ_SHORT());  break;
+            case OP_JUMP_IF_NOT_LESS_SHORT:     COMPARE_JUMP(!(a < b), READ_BYTE());   break;
+            case OP_JUMP_IF_GREATER:            COMPARE_JUMP(a > b, READ_SHORT());     break;
+            case OP_JUMP_IF_GREATER_SHORT:      COMPARE_JUMP(a > b, READ_BYTE());      break;
+            case OP_JUMP_IF_NOT_GREATER:        COMPARE_JUMP(!(a > b), READ_SHORT());  break;
+            case OP_JUMP_IF_NOT_GREATER_SHORT:  COMPARE_JUMP(!(a > b), READ_BYTE());   break;
+            case OP_JUMP_IF_EQUAL:
+            case OP_JUMP_IF_EQUAL_SHORT:
+            case OP_JUMP_IF_NOT_EQUAL:
+            case OP_JUMP_IF_NOT_EQUAL_SHORT:
+            {
+                bool isShort = instruction == OP_JUMP_IF_EQUAL_SHORT ||
+                               instruction == OP_JUMP_IF_NOT_EQUAL_SHORT;
+                uint16_t offset = isShort ? READ_BYTE() : READ_SHORT();
+                Value b = POP();
+                Value a = POP();
+                bool jumpIfEqual = instruction == OP_JUMP_IF_EQUAL ||
+                                   instruction == OP_JUMP_IF_EQUAL_SHORT;
+                if (valuesEqual(a, b) == jumpIfEqual)
+                    ip += offset;
+            }break;
+            case OP_LOOP:
+            {
+                uint16_t offset = READ_SHORT();
+                vm.loopCounters[READ_SHORT()]++;
+                ip -= offset;
+                CHARGE(offset);
+            }break;
+            case OP_LOOP_SHORT:
+            {
+                uint8_t offset = READ_BYTE();
+                vm.loopCounters[READ_SHORT()]++;
+                ip -= offset;
+                CHARGE(offset);
+            }break;
+            case OP_CASE:
+            {
+                Value key = vm.bytecode->constantPool.constants[READ_SHORT()];
+                uint16_t offset = READ_SHORT();
+                if (valuesEqual(peek(0), key))
+                {
+                    POP();
+                    ip -= offset;
+                }
+            }break;
+            case OP_TABLESWITCH:  ip = tableSwitch(ip, POP());  break;
+            case OP_LOOKUPSWITCH: ip = lookupSwitch(ip, POP()); break;
+            case OP_CALL:
+            case OP_CALL_SELF:
+            case OP_TAIL_CALL:
+            case OP_TAIL_CALL_SELF:
+            case OP_INVOKE:
+            {
+                uint8_t name = instruction == OP_INVOKE ? READ_BYTE() : 0;
+                int argCount = READ_BYTE();
+                Value *args = vm.stackTop - argCount;
+                bool isTail = instruction == OP_TAIL_CALL || instruction == OP_TAIL_CALL_SELF;
+                int function = -1;
+                ObjClosure *closure = NULL;
+                Value *result;
+
+                if (checked && isTail && vm.frameCount == 1)
+                {
+                    vm.ip = ip;
+                    runtimeError("Can't return from top-level code.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                if (instruction == OP_CALL_SELF || instruction == OP_TAIL_CALL_SELF)
+                {
+                    // the compiler has matched the call against the arity
+                    function = frame->function;
+                    closure = frame->closure;
+                    result = args;
+                }else
+                {
+                    // A method gets the receiver as its first argument, in
+                    // the slot of the callee, where the result goes.
+                    bool hasReceiver = false;
+                    if (instruction == OP_INVOKE)
+                    {
+                        InlineCache *cache = checked ? NULL : &vm.caches[READ_SHORT()];
+                        if (checked)
+                            ip += 2;
+
+                        Value receiver = args[-1];
+                        if (!checked && IS_INSTANCE(receiver) &&
+                            AS_INSTANCE(receiver)->shape == cache->shape && cache->slot < 0)
+                        {
+                            function = cache->function;
+                        }else
+                        {
+                            vm.ip = ip;
+                            if (!invokeProperty(name, argCount, cache, &function))
+                                return INTERPRET_RUNTIME_ERROR;
+                        }
+                        hasReceiver = function >= 0;
+                    }
+
+                    if (function < 0)
+                    {
+                        Value callee = args[-1];
+                        if (IS_FUNCTION(callee))
+                        {
+                            function = AS_FUNCTION(callee);
+                        }else if (IS_CLOSURE(callee))
+                        {
+                            closure = AS_CLOSURE(callee);
+                            function = closure->function;
+                        }else
+                        {
+                            vm.ip = ip;
+                            function = bindReceiver(&args[-1]);
+                            hasReceiver = true;
+                        }
+                    }
+
+                    if (checked ? (unsigned)function >= (unsigned)vm.bytecode->functionCount : function < 0)
+                    {
+                        vm.ip = ip;
+                        runtimeError("Can only call functions and classes.");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+
+                    if (hasReceiver)
+                    {
+                        args--;
+                        argCount++;
+                    }
+
+                    result = hasReceiver ? args : args - 1;
+                    if (vm.bytecode->functions[function].arity != argCount)
+                    {
+                        vm.ip = ip;
+                        runtimeError("Expected %d arguments but got %d.",
+                                     vm.bytecode->functions[function].arity - hasReceiver,
+                                     argCount - hasReceiver);
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                }
+
+                Function *callee = &vm.bytecode->functions[function];
+                if (isTail)
+                {
+                    // The callee takes over the frame and returns straight
+                    // to its caller. Its arguments move down to the slots
+                    // right above the result, dropping the locals.
+                    Value *base = instruction == OP_TAIL_CALL_SELF ? slots : frame->result + 1;
+                    if (base + callee->stackMax > vm.stack + STACK_MAX)
+                    {
+                        vm.ip = ip;
+                        runtimeError("Stack overflow.");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+
+                    memmove(base, args, argCount * sizeof(Value));
+                    vm.stackTop = base + argCount;
+                    frame->function = function;
+                    frame->closure = closure;
+                    frame->slots = base;
+                    slots = base;
+                    ip = vm.bytecode->code + callee->entry;
+                    CHARGE(callee->end - callee->entry);
+                    break;
+                }
+
+                if (vm.frameCount == FRAMES_MAX ||
+                    args + callee->stackMax > vm.stack + STACK_MAX)
+                {
+                    vm.ip = ip;
+                    runtimeError("Stack overflow.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                // the arguments stay where they are and become the first locals
+                frame->ip = ip;
+                frame = &vm.frames[vm.frameCount++];
+                frame->function = function;
+                frame->closure = closure;
+                frame->slots = args;
+                frame->result = result;
+                slots = args;
+                ip = vm.bytecode->code + callee->entry;
+                CHARGE(callee->end - callee->entry);
+            }break;
+            case OP_CLOSURE:
+            {
+                uint8_t function = READ_BYTE();
+                uint8_t captureCount = READ_BYTE();
+                uint8_t *captures = ip;
+                ip += 2 * captureCount;
+
+                vm.ip = ip;
+                if (!pushClosure(function, captureCount, captures, frame, checked))
+                    return INTERPRET_RUNTIME_ERROR;
+            }break;
+            case OP_SELF:
+            {
+                if (checked && frame->function < 0)
+                {
+                    vm.ip = ip;
+                    runtimeError("The script isn't a function.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                PUSH(frame->closure != NULL ? OBJ_VAL(frame->closure) : FUNCTION_VAL(frame->function));
+            }break;
+            case OP_RETURN_VALUE:
+            {
+                if (checked && vm.frameCount == 1)
+                {
+                    vm.ip = ip;
+                    runtimeError("Can't return from top-level code.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                Value value = POP();
+                *frame->result = value;
+                vm.stackTop = frame->result + 1;
+
+                vm.frameCount--;
+                frame = &vm.frames[vm.frameCount - 1];
+                ip = frame->ip;
+                slots = frame->slots;
             }break;
             case OP_RETURN:
             {
-                printValue(pop());
-                printf("\n");
                 return INTERPRET_OK;
             }
         }
@@ -151,25 +1136,396 @@ static InterpretResult run(void)
 
 #undef READ_BYTE
 #undef READ_CONSTANT
+#undef READ_SHORT
 #undef BINARY_OP
+#undef COMPARE_JUMP
+#undef JUMP_IF
+#undef CHARGE
+#undef PUSH
+#undef POP
 }
 
-InterpretResult interpret(const char *source)
+static InterpretResult run(bool verified)
 {
-    Bytecode bytecode;
-    initBytecode(&bytecode);
+    InterpretResult result;
+    startCounters();
+    if (vm.profile.active)
+    {
+        // the ticks of the compile aren't the script's
+        profileTicks = 0;
+        result = verified ? dispatch(false, true) : dispatch(true, true);
+    }else
+    {
+        result = verified ? dispatch(false, false) : dispatch(true, false);
+    }
+    stopCounters();
+    return result;
+}
+
+/*
+    Frees what the run of vm.bytecode owns and forgets the bytecode.
+*/
+static void endRun(void)
+{
+    Suspension *run = &vm.suspension;
+    FREE_ARRAY(uint32_t, run->loopCounters, run->loopCount);
+    FREE_ARRAY(InlineCache, run->caches, run->cacheCount);
+    if (run->bytecode != NULL)
+    {
+        freeBytecode(run->bytecode);
+        FREE(Bytecode, run->bytecode);
+    }
+
+    *run = (Suspension){0};
+    // the constants are no longer roots
+    vm.bytecode = NULL;
+}
+
+/*
+    Ends the run, unless it has run out of fuel, in which case it is kept
+    for resumeInterpret().
+*/
+static InterpretResult leaveRun(InterpretResult result, bool verified)
+{
+    if (result == INTERPRET_OUT_OF_FUEL)
+    {
+        vm.suspension.active = true;
+        vm.suspension.verified = verified;
+    }else
+    {
+        endRun();
+    }
+    return result;
+}
+
+static THREAD_LOCAL JitCode *runningJit = NULL;
+
+/*
+    Runs a bytecode from its first instruction.
+    @param bool verified the code has passed verifyBytecode().
+*/
+static InterpretResult execute(Bytecode *bytecode, bool verified)
+{
+    enterScript(bytecode, bytecode->code, bytecode->loopCounters, bytecode->caches);
+
+    InterpretResult result;
+    // the profiler needs the instruction pointer the native code doesn't keep
+    JitCode *jit = vm.jitEnabled && !vm.profile.active ? jitCompile(bytecode) : NULL;
+
+    if (jit != NULL)
+    {
+        runningJit = jit;
+        startCounters();
+        int exit = jitExecute(jit);
+        stopCounters();
+        runningJit = NULL;
+        jitFree(jit);
+
+        if (exit == JIT_DONE)
+        {
+            result = INTERPRET_OK;
+        }else if (exit == JIT_ERROR)
+        {
+            result = INTERPRET_RUNTIME_ERROR;
+        }else
+        {
+            // the native code bailed out: the interpreter takes over,
+            // unless the fuel has run out
+            vm.ip = bytecode->code + exit;
+            result = vm.fuel < 0 ? INTERPRET_OUT_OF_FUEL : run(verified);
+        }
+    }else
+    {
+        result = run(verified);
+    }
+
+#ifdef DEBUG_PRINT_LOOP_COUNTERS
+    printLoopCounters(bytecode);
+#endif
+
+    return leaveRun(result, verified);
+}
+
+/*
+    Hands the bytecode of a run out of fuel over to the VM, leaving an
+    empty one for the caller to free.
+*/
+static InterpretResult keepBytecode(Bytecode *bytecode, InterpretResult result)
+{
+    if (result == INTERPRET_OUT_OF_FUEL)
+    {
+        vm.suspension.bytecode = ALLOCATE(Bytecode, 1);
+        *vm.suspension.bytecode = *bytecode;
+        vm.bytecode = vm.suspension.bytecode;
+        initBytecode(bytecode);
+    }
+    return result;
+}
+
+/*
+    What interpret() and its variants do, apart from the memory management.
+*/
+typedef InterpretResult (*Job)(Bytecode *bytecode, const void *input);
+
+static InterpretResult runSource(Bytecode *bytecode, const void *source)
+{
+    if (!compile((const char*)source, bytecode))
+        return INTERPRET_COMPILE_ERROR;
+
+    return keepBytecode(bytecode, execute(bytecode, verifyBytecode(bytecode, 0) == NULL));
+}
+
+static InterpretResult runStream(Bytecode *bytecode, const void *file)
+{
+    if (!compileStream((FILE*)file, bytecode))
+        return INTERPRET_COMPILE_ERROR;
+
+    return keepBytecode(bytecode, execute(bytecode, verifyBytecode(bytecode, 0) == NULL));
+}
+
+static InterpretResult runCompiled(Bytecode *bytecode, const void *unused)
+{
+    // no compiler vouches for this code
+    const char *error = verifyBytecode(bytecode, 0);
+    if (error != NULL)
+    {
+        fprintf(stderr, "Invalid bytecode: %s\n", error);
+        return INTERPRET_COMPILE_ERROR;
+    }
+
+    return execute(bytecode, true);
+}
+
+typedef struct
+{
+    Session *session;
+    const char *source;
+} AppendedRun;
+
+static InterpretResult runAppended(Bytecode *bytecode, const void *input)
+{
+    const AppendedRun *appended = (const AppendedRun*)input;
+    BytecodeMark *declared = &appended->session->declared;
+
+    // the pool has dropped the area, see recoverMemory()
+    if (declared->count > bytecode->count)
+        *declared = (BytecodeMark){0};
 
-    if (!compile(source, &bytecode))
+    // The code of the previous inputs has already run. Once the area holds
+    // more than a few hundred constants or loops, it is rewound to the last
+    // declaration, keeping its buffers, so that a long session stays small.
+    // The names stay: the shapes of the instances key their fields by them.
+    if (bytecode->constantPool.count > UINT8_COUNT / 2 || bytecode->loopCount > UINT8_COUNT / 2)
     {
-        freeBytecode(&bytecode);
+        BytecodeMark mark = *declared;
+        mark.nameCount = bytecode->nameCount;
+        truncateBytecode(bytecode, mark);
+    }
+
+    int start = bytecode->count;
+    int functionCount = bytecode->functionCount;
+    int classCount = bytecode->classCount;
+    if (!compileAppend(appended->source, bytecode))
         return INTERPRET_COMPILE_ERROR;
+
+    if (bytecode->functionCount > functionCount || bytecode->classCount > classCount)
+        *declared = markBytecode(bytecode);
+
+    enterScript(bytecode, bytecode->code + start, bytecode->loopCounters, bytecode->caches);
+
+    bool verified = verifyBytecode(bytecode, start) == NULL;
+    return leaveRun(run(verified), verified);
+}
+
+static InterpretResult runResumed(Bytecode *unused, const void *input)
+{
+    (void)unused;
+    (void)input;
+
+    bool verified = vm.suspension.verified;
+    return leaveRun(run(verified), verified);
+}
+
+/*
+    Drops the run, and the compile, that a failed allocation or a broken
+    stack has unwound from. The globals and the objects stay.
+*/
+static void recoverRun(void)
+{
+    stopCounters();
+    if (runningJit != NULL)
+    {
+        jitFree(runningJit);
+        runningJit = NULL;
     }
 
-    vm.bytecode = &bytecode;
-    vm.ip = vm.bytecode->code;
+    rollBackCompiler();
+    endRun();
+    resetStack();
+}
 
-    InterpretResult result = run();
+#ifdef BEE_STATIC_POOL
+/*
+    Drops everything the pool holds after an allocation has failed,
+    leaving the VM as initVM() does. 'bytecode', if any, lived in the pool
+    as well.
+*/
+static void recoverMemory(Bytecode *bytecode)
+{
+    stopCounters();
+    if (runningJit != NULL)
+    {
+        jitFree(runningJit);
+        runningJit = NULL;
+    }
+
+    abandonCompiler();
+    poolReset();
+
+    memset(vm.globals, 0, sizeof(vm.globals));
+    memset(vm.shapes, 0, sizeof(vm.shapes));
+    vm.objects = NULL;
+    vm.bytecode = NULL;
+    vm.suspension = (Suspension){0};
+    initCollector();
+    resetStack();
+    if (bytecode != NULL)
+        initBytecode(bytecode);
+}
+#endif
 
+/*
+    Runs the job so that a failed allocation or a broken stack makes it
+    return INTERPRET_OUT_OF_MEMORY, STACK_OVERFLOW or STACK_UNDERFLOW
+    rather than end the process. What the job printed is flushed either way.
+*/
+static InterpretResult guard(Job job, Bytecode *bytecode, const void *input)
+{
+    // a new run drops the one out of fuel
+    abandonInterpret();
+
+    jmp_buf handler;
+    int unwound = setjmp(handler);
+    if (unwound != 0)
+    {
+        vm.unwind = NULL;
+#ifdef BEE_STATIC_POOL
+        if (unwound == INTERPRET_OUT_OF_MEMORY)
+            recoverMemory(bytecode);
+        else
+            recoverRun();
+#else
+        recoverRun();
+#endif
+        flushOutput();
+        return (InterpretResult)unwound;
+    }
+
+    vm.unwind = &handler;
+    InterpretResult result = job(bytecode, input);
+    vm.unwind = NULL;
+    flushOutput();
+    return result;
+}
+
+InterpretResult interpret(const char *source)
+{
+    Bytecode bytecode;
+    initBytecode(&bytecode);
+
+    InterpretResult result = guard(runSource, &bytecode, source);
     freeBytecode(&bytecode);
     return result;
-}
\ No newline at end of file
+}
+
+InterpretResult interpretStream(FILE *file)
+{
+    Bytecode bytecode;
+    initBytecode(&bytecode);
+
+    InterpretResult result = guard(runStream, &bytecode, file);
+    freeBytecode(&bytecode);
+    return result;
+}
+
+InterpretResult interpretBytecode(Bytecode *bytecode)
+{
+    return guard(runCompiled, bytecode, NULL);
+}
+
+typedef struct
+{
+    const Bytecode *bytecode;
+    bool verified;
+} SharedRun;
+
+static InterpretResult runShared(Bytecode *unused, const void *input)
+{
+    (void)unused;
+    const SharedRun *shared = (const SharedRun*)input;
+
+    // The counters and the caches of a shared bytecode are dropped rather
+    // than raced for. They belong to the run, which may outlive the call.
+    Suspension *owned = &vm.suspension;
+    owned->loopCounters = ALLOCATE(uint32_t, shared->bytecode->loopCount);
+    owned->loopCount = shared->bytecode->loopCount;
+    for (int i = 0; i < owned->loopCount; i++)
+        owned->loopCounters[i] = 0;
+
+    owned->caches = ALLOCATE(InlineCache, shared->bytecode->cacheCount);
+    owned->cacheCount = shared->bytecode->cacheCount;
+    for (int i = 0; i < owned->cacheCount; i++)
+        owned->caches[i] = (InlineCache){NULL, NULL, -1, -1};
+
+    // nothing writes through it: the VM only reads the code and the constants
+    enterScript((Bytecode*)shared->bytecode, shared->bytecode->code, owned->loopCounters, owned->caches);
+
+    return leaveRun(run(shared->verified), shared->verified);
+}
+
+InterpretResult interpretShared(const Bytecode *bytecode, bool verified)
+{
+    // the guard is given no bytecode, so that recovering from a failed
+    // allocation leaves the shared one alone
+    SharedRun shared = {bytecode, verified};
+    return guard(runShared, NULL, &shared);
+}
+
+void initSession(Session *session)
+{
+    initBytecode(&session->bytecode);
+    session->declared = (BytecodeMark){0};
+}
+
+void freeSession(Session *session)
+{
+    freeBytecode(&session->bytecode);
+}
+
+InterpretResult interpretSession(Session *session, const char *source)
+{
+    AppendedRun appended = {session, source};
+    return guard(runAppended, &session->bytecode, &appended);
+}
+
+InterpretResult resumeInterpret(void)
+{
+    if (!vm.suspension.active)
+    {
+        fprintf(stderr, "No run to resume.\n");
+        return INTERPRET_RUNTIME_ERROR;
+    }
+
+    // taken out of the suspension, so that the guard doesn't drop it
+    vm.suspension.active = false;
+    return guard(runResumed, NULL, NULL);
+}
+
+void abandonInterpret(void)
+{
+    if (!vm.suspension.active)
+        return;
+
+    endRun();
+    resetStack();
+}
@@ -0,0 +1,125 @@
+/*
+    Benchmark of the start of a script with the cache of compiled scripts,
+    in microseconds per start:  sh tests/run.sh bench
+    A cold start compiles the script and stores the entry, a warm one loads
+    the entry and skips the scanner and the compiler.
+*/
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "cache.h"
+
+#define FUNCTIONS   200
+#define STARTS      100
+#define ROUNDS      5
+
+static FILE *script;
+static char dir[] = "/tmp/bee-cache-XXXXXX";
+static char entry[1024];
+
+static double now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+// a script declaring many small functions and calling a few of them once
+static void writeScript(void)
+{
+    script = tmpfile();
+    for (int i = 0; i < FUNCTIONS; i++)
+    {
+        fprintf(script, "fun handler%d(request, limit)\n{\n", i);
+        fprintf(script, "    var total = 0;\n");
+        fprintf(script, "    for (var i = 0; i < limit; i = i + 1)\n");
+        fprintf(script, "        if (i > request) total = total + i * %d; else total = total - 1;\n", i);
+        fprintf(script, "    return total;\n}\n");
+    }
+    fprintf(script, "var result = handler0(1, 10) + handler%d(2, 10);\n", FUNCTIONS - 1);
+}
+
+static double start(bool cached)
+{
+    rewind(script);
+    double begin = now();
+    InterpretResult result = cached ? interpretCached(script, dir) : interpretStream(script);
+    double elapsed = now() - begin;
+    if (result != INTERPRET_OK)
+    {
+        fprintf(stderr, "The script failed.\n");
+        exit(1);
+    }
+    return elapsed;
+}
+
+typedef double (*Starts)(void);
+
+static double uncachedStarts(void)
+{
+    double total = 0;
+    for (int i = 0; i < STARTS; i++)
+        total += start(false);
+    return total;
+}
+
+static double coldStarts(void)
+{
+    double total = 0;
+    for (int i = 0; i < STARTS; i++)
+    {
+        remove(entry);
+        total += start(true);
+    }
+    return total;
+}
+
+static double warmStarts(void)
+{
+    double total = 0;
+    for (int i = 0; i < STARTS; i++)
+        total += start(true);
+    return total;
+}
+
+// the best of the rounds, in microseconds per start
+static void measure(const char *name, Starts starts)
+{
+    double best = 0;
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        double elapsed = starts();
+        if (round == 0 || elapsed < best)
+            best = elapsed;
+    }
+    printf("%-28s %7.1f us\n", name, best / STARTS / 1000);
+}
+
+int main(void)
+{
+    initVM();
+    if (mkdtemp(dir) == NULL)
+        return 1;
+    writeScript();
+
+    // the one entry of the script
+    start(true);
+    DIR *entries = opendir(dir);
+    struct dirent *file;
+    while ((file = readdir(entries)) != NULL)
+        if (file->d_name[0] != '.')
+            snprintf(entry, sizeof(entry), "%s/%s", dir, file->d_name);
+    closedir(entries);
+
+    measure("no cache", uncachedStarts);
+    measure("cold start, stored", coldStarts);
+    measure("warm start, loaded", warmStarts);
+
+    fclose(script);
+    remove(entry);
+    rmdir(dir);
+    freeVM();
+    return 0;
+}
@@ -0,0 +1,50 @@
+/*
+    Benchmark of the calls: fib(30), in milliseconds, by the interpreter,
+    at -O2 and with the JIT:  sh tests/run.sh bench
+*/
+#include <stdio.h>
+#include <time.h>
+#include "compiler.h"
+#include "vm.h"
+
+#define ROUNDS  5
+
+static const char *script =
+    "fun fib(n) { if (n < 2) return n; return fib(n - 2) + fib(n - 1); }\n"
+    "var result = fib(30);\n";
+
+static double now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+// the best of the rounds, in milliseconds
+static void measure(const char *name, int level, bool jit)
+{
+    setOptimizationLevel(level);
+    vm.jitEnabled = jit;
+
+    double best = 0;
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        double start = now();
+        if (interpret(script) != INTERPRET_OK)
+            return;
+        double elapsed = now() - start;
+        if (round == 0 || elapsed < best)
+            best = elapsed;
+    }
+    printf("%-28s %7.1f ms\n", name, best / 1e6);
+}
+
+int main(void)
+{
+    initVM();
+    measure("fib(30)", 1, false);
+    measure("fib(30), -O2", 2, false);
+    measure("fib(30), --jit", 1, true);
+    freeVM();
+    return 0;
+}
@@ -0,0 +1,48 @@
+/*
+    Stress benchmark of the incremental collector: a steady allocation load
+    over a live set of 10000 objects, each step dropping one of them for a
+    new one. Prints the pauses, their p50 and p99 and their histogram:
+    sh tests/run.sh bench
+*/
+#include <stdio.h>
+#include <time.h>
+#include "vm.h"
+
+static const char *script =
+    "class Holder { init(next) { this.next = next; this.payload = nil; } }\n"
+    "class Payload { init(values, at) { this.values = values; this.at = at; } }\n"
+    "\n"
+    "// a ring of holders, each keeping a payload alive until its next turn\n"
+    "var first = Holder(nil);\n"
+    "var last = first;\n"
+    "for (var i = 1; i < 10000; i = i + 1) first = Holder(first);\n"
+    "last.next = first;\n"
+    "\n"
+    "var h = first;\n"
+    "for (var i = 0; i < 1000000; i = i + 1)\n"
+    "{\n"
+    "    h = h.next;\n"
+    "    h.payload = Payload(numbers(16), i);\n"
+    "}\n";
+
+static double now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+int main(void)
+{
+    initVM();
+
+    double start = now();
+    if (interpret(script) != INTERPRET_OK)
+        return 1;
+    printf("%-28s %7.1f ms\n", "1000000 allocation steps", (now() - start) / 1e6);
+    fflush(stdout);
+    printGcStats();
+
+    freeVM();
+    return 0;
+}
@@ -0,0 +1,73 @@
+/*
+    Benchmark of the overhead of a call to a native, in nanoseconds per
+    call over that of an iteration of the empty loop:  sh tests/run.sh bench
+*/
+#include <stdio.h>
+#include <time.h>
+#include "vm.h"
+
+#define CALLS   10000000
+#define ROUNDS  5
+
+static double now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+static const char* nothing(Value *args, int argCount)
+{
+    args[0] = NIL_VAL;
+    return NULL;
+}
+
+static const char* identity(Value *args, int argCount)
+{
+    return NULL;
+}
+
+static const char* sum(Value *args, int argCount)
+{
+    double total = 0;
+    for (int i = 0; i < argCount; i++)
+        total += AS_NUMBER(args[i]);
+    args[0] = NUMBER_VAL(total);
+    return NULL;
+}
+
+// the best of the rounds, in nanoseconds per iteration
+static double measure(const char *body)
+{
+    char source[256];
+    snprintf(source, sizeof(source), "for (var i = 0; i < %d; i = i + 1) %s", CALLS, body);
+
+    double best = 0;
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        double start = now();
+        if (interpret(source) != INTERPRET_OK)
+            return 0;
+        double elapsed = now() - start;
+        if (round == 0 || elapsed < best)
+            best = elapsed;
+    }
+    return best / CALLS;
+}
+
+int main(void)
+{
+    initVM();
+    defineNative("nothing", 0, nothing);
+    defineNative("identity", 1, identity);
+    defineNative("sum", NATIVE_VARIADIC, sum);
+
+    double empty = measure("{}");
+    printf("%-28s %7.2f ns\n", "empty loop, per iteration", empty);
+    printf("%-28s %7.2f ns\n", "nothing()", measure("nothing();") - empty);
+    printf("%-28s %7.2f ns\n", "identity(i)", measure("identity(i);") - empty);
+    printf("%-28s %7.2f ns\n", "sum(i, 1, 2), variadic", measure("sum(i, 1, 2);") - empty);
+
+    freeVM();
+    return 0;
+}
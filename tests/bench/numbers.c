@@ -0,0 +1,128 @@
+/*
+    Benchmark of formatNumber() and parseNumber() against the C library,
+    in nanoseconds per conversion:  sh tests/run.sh bench
+*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "number.h"
+
+#define COUNT   1000000
+#define ROUNDS  5
+
+static double numbers[COUNT];
+static char texts[COUNT][NUMBER_BUFFER_SIZE + 1];
+static char integers[COUNT][24];
+static volatile double sink;
+
+static uint64_t random64(void)
+{
+    static uint64_t state = 0x9e3779b97f4a7c15u;
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545f4914f6cdd1du;
+}
+
+static double now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+typedef void (*Loop)(void);
+
+static void formatLoop(void)
+{
+    char buffer[NUMBER_BUFFER_SIZE];
+    for (int i = 0; i < COUNT; i++)
+        sink += formatNumber(numbers[i], buffer);
+}
+
+static void shortestGLoop(void)
+{
+    char buffer[32];
+    for (int i = 0; i < COUNT; i++)
+        sink += snprintf(buffer, sizeof(buffer), "%g", numbers[i]);
+}
+
+static void exactGLoop(void)
+{
+    char buffer[32];
+    for (int i = 0; i < COUNT; i++)
+        sink += snprintf(buffer, sizeof(buffer), "%.17g", numbers[i]);
+}
+
+static void parseLoop(void)
+{
+    double number;
+    for (int i = 0; i < COUNT; i++)
+    {
+        parseNumber(texts[i], (int)strlen(texts[i]), &number);
+        sink += number;
+    }
+}
+
+static void strtodLoop(void)
+{
+    for (int i = 0; i < COUNT; i++)
+        sink += strtod(texts[i], NULL);
+}
+
+static void parseIntegerLoop(void)
+{
+    double number;
+    for (int i = 0; i < COUNT; i++)
+    {
+        parseNumber(integers[i], (int)strlen(integers[i]), &number);
+        sink += number;
+    }
+}
+
+static void strtodIntegerLoop(void)
+{
+    for (int i = 0; i < COUNT; i++)
+        sink += strtod(integers[i], NULL);
+}
+
+// the best of the rounds, in nanoseconds per conversion
+static void measure(const char *name, Loop loop)
+{
+    double best = 0;
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        double start = now();
+        loop();
+        double elapsed = now() - start;
+        if (round == 0 || elapsed < best)
+            best = elapsed;
+    }
+    printf("%-28s %7.1f ns\n", name, best / COUNT);
+}
+
+int main(void)
+{
+    // random finite doubles, spread over all the exponents
+    for (int i = 0; i < COUNT; i++)
+    {
+        do
+        {
+            uint64_t bits = random64();
+            memcpy(&numbers[i], &bits, sizeof(double));
+        } while (!isfinite(numbers[i]));
+        texts[i][formatNumber(numbers[i], texts[i])] = '\0';
+        snprintf(integers[i], sizeof(integers[i]), "%u", (unsigned)(random64() % 1000000000));
+    }
+
+    measure("formatNumber", formatLoop);
+    measure("snprintf %g", shortestGLoop);
+    measure("snprintf %.17g", exactGLoop);
+    measure("parseNumber", parseLoop);
+    measure("strtod", strtodLoop);
+    measure("parseNumber, integers", parseIntegerLoop);
+    measure("strtod, integers", strtodIntegerLoop);
+    return 0;
+}
@@ -0,0 +1,109 @@
+/*
+    Benchmark of the -O2 optimizer over a small corpus: the time each
+    script takes to compile, in microseconds, and to run, in milliseconds,
+    without and with it:  sh tests/run.sh bench
+*/
+#include <stdio.h>
+#include <time.h>
+#include "compiler.h"
+#include "vm.h"
+
+#define ROUNDS  5
+
+typedef struct
+{
+    const char *name;
+    const char *source;
+} Script;
+
+static const Script corpus[] =
+{
+    {"loop-invariant code",
+        "var scale = 3;\n"
+        "var offset = 7;\n"
+        "var total = 0;\n"
+        "for (var i = 0; i < 3000000; i = i + 1)\n"
+        "    total = total + (scale * offset + scale) * i;\n"},
+    {"common subexpressions",
+        "fun f(a, b)\n"
+        "{\n"
+        "    var t = 0;\n"
+        "    for (var i = 0; i < 2000000; i = i + 1)\n"
+        "        t = t + (a * b + i) * (a * b + i) - a * b;\n"
+        "    return t;\n"
+        "}\n"
+        "var result = f(3, 4);\n"},
+    {"dead code",
+        "fun g(n)\n"
+        "{\n"
+        "    var t = 0;\n"
+        "    for (var i = 0; i < n; i = i + 1)\n"
+        "    {\n"
+        "        var unused = i * 2 + 1;\n"
+        "        if (false) t = t - 1;\n"
+        "        t = t + i;\n"
+        "    }\n"
+        "    return t;\n"
+        "}\n"
+        "var result = g(3000000);\n"},
+    {"calls",
+        "fun fib(n) { if (n < 2) return n; return fib(n - 2) + fib(n - 1); }\n"
+        "var result = fib(27);\n"},
+};
+
+static double now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+// the best of the rounds of compiling and running the script, in nanoseconds
+static bool measure(const char *source, int level, double *compileTime, double *runTime)
+{
+    setOptimizationLevel(level);
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        Bytecode bytecode;
+        initBytecode(&bytecode);
+
+        double start = now();
+        bool compiled = compile(source, &bytecode);
+        double compiling = now() - start;
+
+        start = now();
+        InterpretResult result = compiled ? interpretBytecode(&bytecode) : INTERPRET_COMPILE_ERROR;
+        double running = now() - start;
+        freeBytecode(&bytecode);
+        if (result != INTERPRET_OK)
+            return false;
+
+        if (round == 0 || compiling < *compileTime)
+            *compileTime = compiling;
+        if (round == 0 || running < *runTime)
+            *runTime = running;
+    }
+    return true;
+}
+
+int main(void)
+{
+    initVM();
+    printf("%-24s %12s %12s %10s %10s\n", "", "compile -O1", "-O2", "run -O1", "-O2");
+
+    for (size_t i = 0; i < sizeof(corpus) / sizeof(corpus[0]); i++)
+    {
+        double compiled[2], ran[2];
+        if (!measure(corpus[i].source, 1, &compiled[0], &ran[0]) ||
+            !measure(corpus[i].source, 2, &compiled[1], &ran[1]))
+        {
+            printf("%-24s failed\n", corpus[i].name);
+            continue;
+        }
+        printf("%-24s %9.1f us %9.1f us %7.1f ms %7.1f ms\n", corpus[i].name,
+               compiled[0] / 1e3, compiled[1] / 1e3, ran[0] / 1e6, ran[1] / 1e6);
+    }
+
+    freeVM();
+    return 0;
+}
@@ -0,0 +1,107 @@
+/*
+    Benchmark of the start of a session from a prelude: run from its source
+    against loaded from a snapshot of the session once it has run, in
+    microseconds per start:  sh tests/run.sh bench
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "snapshot.h"
+
+#define FUNCTIONS   100
+#define STARTS      100
+#define ROUNDS      5
+
+static char prelude[65536];
+static char dir[] = "/tmp/bee-snapshot-XXXXXX";
+static char path[64];
+
+static double now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+// many small functions, and a table of objects built by running some
+static void writePrelude(void)
+{
+    int length = snprintf(prelude, sizeof(prelude),
+                          "class Entry { init(key, next) { this.key = key; this.next = next; } }\n"
+                          "var table = nil;\n");
+    for (int i = 0; i < FUNCTIONS; i++)
+    {
+        length += snprintf(prelude + length, sizeof(prelude) - length,
+                           "fun rule%d(x) { if (x > %d) return x * %d; return x - %d; }\n", i, i, i, i);
+    }
+    snprintf(prelude + length, sizeof(prelude) - length,
+             "for (var i = 0; i < 2000; i = i + 1) table = Entry(rule7(i) + rule42(i), table);\n");
+}
+
+typedef bool (*Start)(Session *session);
+
+static bool runPrelude(Session *session)
+{
+    return interpretSession(session, prelude) == INTERPRET_OK;
+}
+
+static bool loadPrelude(Session *session)
+{
+    return loadSnapshot(session, path);
+}
+
+// the best of the rounds, in microseconds per start
+static void measure(const char *name, Start start)
+{
+    double best = 0;
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        double elapsed = 0;
+        for (int i = 0; i < STARTS; i++)
+        {
+            Session session;
+            initSession(&session);
+            double begin = now();
+            bool started = start(&session);
+            elapsed += now() - begin;
+            freeSession(&session);
+            if (!started)
+            {
+                fprintf(stderr, "The prelude didn't start.\n");
+                exit(1);
+            }
+        }
+        if (round == 0 || elapsed < best)
+            best = elapsed;
+    }
+    printf("%-28s %7.1f us\n", name, best / STARTS / 1000);
+}
+
+int main(void)
+{
+    initVM();
+    if (mkdtemp(dir) == NULL)
+        return 1;
+    snprintf(path, sizeof(path), "%s/prelude", dir);
+    writePrelude();
+
+    Session session;
+    initSession(&session);
+    if (!runPrelude(&session) || !saveSnapshot(&session, path))
+        return 1;
+    freeSession(&session);
+
+    FILE *file = fopen(path, "rb");
+    fseek(file, 0L, SEEK_END);
+    printf("%-28s %7ld bytes\n", "snapshot", ftell(file));
+    fclose(file);
+
+    measure("prelude run from source", runPrelude);
+    measure("prelude loaded", loadPrelude);
+
+    remove(path);
+    rmdir(dir);
+    freeVM();
+    return 0;
+}
@@ -0,0 +1,102 @@
+/*
+    An entry of the cache that passes its checksum but not verifyBytecode()
+    is a miss: the script is compiled anew and the entry overwritten.
+*/
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "cache.h"
+#include "image.h"
+
+// the magic, the version, the hash, the source length, the check and the sizes of the parts
+#define CODE_OFFSET (4 + 4 + 8 + 8 + 8 + 7 * 4)
+
+static int failures = 0;
+
+static void fail(const char *what)
+{
+    fprintf(stderr, "%s\n", what);
+    failures++;
+}
+
+static void run(FILE *script, const char *dir)
+{
+    rewind(script);
+    if (interpretCached(script, dir) != INTERPRET_OK)
+        fail("the cached run failed");
+}
+
+static long readFile(const char *path, uint8_t *bytes, long capacity)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return -1;
+    long length = (long)fread(bytes, 1, (size_t)capacity, file);
+    fclose(file);
+    return length;
+}
+
+static void writeFile(const char *path, const uint8_t *bytes, long length)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL || fwrite(bytes, 1, (size_t)length, file) != (size_t)length)
+        fail("the entry can't be written");
+    if (file != NULL)
+        fclose(file);
+}
+
+int main(void)
+{
+    initVM();
+
+    char dir[] = "/tmp/bee-cache-XXXXXX";
+    if (mkdtemp(dir) == NULL)
+        return 1;
+
+    FILE *script = tmpfile();
+    fputs("print 1 + 2;\n", script);
+
+    run(script, dir);   // expect: 3
+
+    // the one entry stored
+    char path[1024] = "";
+    DIR *entries = opendir(dir);
+    struct dirent *entry;
+    while ((entry = readdir(entries)) != NULL)
+        if (entry->d_name[0] != '.')
+            snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+    closedir(entries);
+
+    static uint8_t stored[65536];
+    static uint8_t damaged[65536];
+    long length = readFile(path, stored, sizeof(stored));
+    if (length <= CODE_OFFSET + 8)
+    {
+        fail("no entry stored");
+        return 1;
+    }
+
+    // an opcode that doesn't exist, summed up again as the writer would
+    memcpy(damaged, stored, (size_t)length);
+    damaged[CODE_OFFSET] = 0xff;
+    uint64_t checksum = fnv1a(FNV_OFFSET, damaged, (size_t)length - 8);
+    for (int i = 0; i < 8; i++)
+        damaged[length - 8 + i] = (uint8_t)(checksum >> (8 * i));
+    writeFile(path, damaged, length);
+
+    run(script, dir);   // expect: 3
+
+    uint8_t *replaced = damaged;
+    if (readFile(path, replaced, sizeof(damaged)) != length || memcmp(replaced, stored, (size_t)length) != 0)
+        fail("the entry wasn't replaced");
+
+    run(script, dir);   // expect: 3
+
+    fclose(script);
+    remove(path);
+    rmdir(dir);
+    freeVM();
+    return failures > 0;
+}
@@ -0,0 +1,157 @@
+/*
+    The embedding API stopping a run and going on with it: a run out of
+    fuel resumed as many times as it takes, a suspension deep in the calls
+    keeping the frames, the locals and the output, and a run over its
+    memory quota unwinding through guard() and leaving the VM usable.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "bee.h"
+
+static char bytes[1024];
+static OutputBuffer output = {bytes, sizeof(bytes), 0};
+static int failures = 0;
+
+// stderr takes the reports of the failed allocations
+static void fail(const char *what)
+{
+    printf("%s\n", what);
+    failures++;
+}
+
+static void expectResult(const char *what, InterpretResult result, InterpretResult expected)
+{
+    if (result != expected)
+    {
+        printf("%s: result %d, %d expected\n", what, (int)result, (int)expected);
+        failures++;
+    }
+}
+
+// what the scripts have printed since the last call
+static void expectOutput(const char *what, const char *expected)
+{
+    if (output.count != strlen(expected) || memcmp(output.bytes, expected, output.count) != 0)
+    {
+        printf("%s: printed \"%.*s\", \"%s\" expected\n", what, (int)output.count, output.bytes, expected);
+        failures++;
+    }
+    output.count = 0;
+}
+
+// runs the script on so little fuel that it stops many times
+static InterpretResult runStarved(VM *instance, const BeeScript *script, int *stops)
+{
+    beeSetFuel(instance, 64);
+    InterpretResult result = beeRun(instance, script);
+    for (*stops = 0; result == INTERPRET_OUT_OF_FUEL; (*stops)++)
+    {
+        beeSetFuel(instance, 64);
+        result = beeResume(instance);
+    }
+    beeSetFuel(instance, FUEL_UNLIMITED);
+    return result;
+}
+
+static void outOfFuel(VM *instance)
+{
+    BeeScript *script = beeCompile("var total = 0;\n"
+                                   "for (var i = 0; i < 1000; i = i + 1) total = total + i;\n"
+                                   "print total;\n");
+
+    beeSetFuel(instance, 64);
+    expectResult("the first stop", beeRun(instance, script), INTERPRET_OUT_OF_FUEL);
+    expectOutput("the first stop", "");
+
+    int stops;
+    expectResult("the starved loop", runStarved(instance, script, &stops), INTERPRET_OK);
+    expectOutput("the starved loop", "499500\n");
+    if (stops < 100)
+        fail("the loop didn't stop at each of its turns");
+
+    beeFree(script);
+}
+
+static void suspendedCalls(VM *instance)
+{
+    BeeScript *script = beeCompile(
+        "fun sum(n) { var t = 0; for (var i = 1; i <= n; i = i + 1) t = t + i; return t; }\n"
+        "fun outer(k) { print k; var s = sum(200); print s + k; return s; }\n"
+        "print outer(1) + outer(2);\n");
+
+    // stopped in sum(), called by outer(), once outer() has printed
+    beeSetFuel(instance, 64);
+    expectResult("the suspension", beeRun(instance, script), INTERPRET_OUT_OF_FUEL);
+    expectOutput("the suspension", "1\n");
+
+    beeSetFuel(instance, FUEL_UNLIMITED);
+    expectResult("the resumed calls", beeResume(instance), INTERPRET_OK);
+    expectOutput("the resumed calls", "20101\n2\n20102\n40200\n");
+
+    // the native code of the JIT leaves the rest of the run to the interpreter
+    instance->jitEnabled = true;
+    int stops;
+    expectResult("the starved calls, --jit", runStarved(instance, script, &stops), INTERPRET_OK);
+    expectOutput("the starved calls, --jit", "1\n20101\n2\n20102\n40200\n");
+    instance->jitEnabled = false;
+
+    beeFree(script);
+}
+
+static void overQuota(VM *instance)
+{
+    BeeScript *hoarder = beeCompile("var kept = nil;\n"
+                                    "class Node { init(next) { this.next = next; } }\n"
+                                    "for (var i = 0; i < 100000; i = i + 1) kept = Node(kept);\n"
+                                    "print 1;\n");
+    // its global takes the slot of 'kept', dropping what the hoarder kept
+    BeeScript *check = beeCompile("var t = 0;\n"
+                                  "for (var i = 0; i < 100; i = i + 1) t = t + i;\n"
+                                  "print t;\n");
+
+    beeSetMemoryLimit(instance, instance->gc.bytesAllocated + 65536);
+    expectResult("the hoarder", beeRun(instance, hoarder), INTERPRET_OUT_OF_MEMORY);
+    expectOutput("the hoarder", "");
+    expectResult("the run after the hoarder", beeRun(instance, check), INTERPRET_OK);
+    expectOutput("the run after the hoarder", "4950\n");
+
+    // from a resumed run as well, which guard() unwinds the same way
+    int stops;
+    expectResult("the starved hoarder", runStarved(instance, hoarder, &stops), INTERPRET_OUT_OF_MEMORY);
+    expectOutput("the starved hoarder", "");
+    if (stops == 0)
+        fail("the hoarder didn't stop");
+    expectResult("the run after the starved hoarder", beeRun(instance, check), INTERPRET_OK);
+    expectOutput("the run after the starved hoarder", "4950\n");
+
+    // nothing left behind by the unwinding: the quota lifted, the heap
+    // falls back to what the check keeps
+    beeSetMemoryLimit(instance, MEMORY_UNLIMITED);
+    collectGarbage();
+    size_t kept = instance->gc.bytesAllocated;
+    beeSetMemoryLimit(instance, kept + 65536);
+    expectResult("the hoarder once more", beeRun(instance, hoarder), INTERPRET_OUT_OF_MEMORY);
+    expectResult("the check once more", beeRun(instance, check), INTERPRET_OK);
+    expectOutput("the check once more", "4950\n");
+    beeSetMemoryLimit(instance, MEMORY_UNLIMITED);
+    collectGarbage();
+    if (instance->gc.bytesAllocated != kept)
+        fail("the unwinding leaked memory");
+
+    beeFree(check);
+    beeFree(hoarder);
+}
+
+int main(void)
+{
+    VM *instance = beeOpenVM();
+    freopen("/dev/null", "w", stderr);
+    beeSetOutput(instance, memorySink, &output);
+
+    outOfFuel(instance);
+    suspendedCalls(instance);
+    overQuota(instance);
+
+    beeCloseVM(instance);
+    return failures > 0;
+}
@@ -0,0 +1,146 @@
+/*
+    formatNumber() and parseNumber() on random doubles and random decimal
+    text: the text read back is the same double, it has no more digits than
+    the shortest "%.*e" that reads back, and parseNumber() agrees with
+    strtod() bit for bit.
+*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "number.h"
+
+#define DOUBLES 50000
+#define TEXTS   100000
+
+static int failures = 0;
+
+static uint64_t random64(void)
+{
+    // xorshift64*, seeded the same on every run
+    static uint64_t state = 0x9e3779b97f4a7c15u;
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545f4914f6cdd1du;
+}
+
+static uint64_t bitsOf(double number)
+{
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    return bits;
+}
+
+static void fail(const char *what, const char *text, double number)
+{
+    if (failures++ < 10)
+        printf("%s: \"%s\" for %.17g\n", what, text, number);
+}
+
+/*
+    @returns the number of significant digits of the text: its mantissa
+             less the sign, the point, the leading and the trailing zeros.
+*/
+static int significantDigits(const char *text)
+{
+    char digits[NUMBER_BUFFER_SIZE];
+    int count = 0;
+    for (const char *c = text; *c != '\0' && *c != 'e'; c++)
+    {
+        if (*c >= '0' && *c <= '9' && (count > 0 || *c != '0'))
+            digits[count++] = *c;
+    }
+    while (count > 0 && digits[count - 1] == '0')
+        count--;
+    return count;
+}
+
+/*
+    @returns the fewest digits "%.*e" needs for the number to read back.
+*/
+static int shortestPrecision(double number)
+{
+    char text[64];
+    for (int digits = 1; digits < 17; digits++)
+    {
+        snprintf(text, sizeof(text), "%.*e", digits - 1, number);
+        if (strtod(text, NULL) == number)
+            return digits;
+    }
+    return 17;
+}
+
+static void checkDouble(double number)
+{
+    char text[NUMBER_BUFFER_SIZE + 1];
+    int length = formatNumber(number, text);
+    text[length] = '\0';
+
+    double parsed;
+    if (!parseNumber(text, length, &parsed) || bitsOf(parsed) != bitsOf(number))
+        fail("parseNumber() doesn't read back", text, number);
+    else if (bitsOf(strtod(text, NULL)) != bitsOf(number))
+        fail("strtod() doesn't read back", text, number);
+    else if (number != 0 && significantDigits(text) > shortestPrecision(number))
+        fail("not the shortest", text, number);
+}
+
+static void checkText(const char *text)
+{
+    double parsed;
+    double expected = strtod(text, NULL);
+    if (!parseNumber(text, (int)strlen(text), &parsed))
+        fail("parseNumber() refuses", text, expected);
+    else if (bitsOf(parsed) != bitsOf(expected))
+        fail("parseNumber() differs from strtod()", text, parsed);
+}
+
+int main(void)
+{
+    for (int i = 0; i < DOUBLES; i++)
+    {
+        // any finite double, then the integers and the short decimals
+        // scripts are made of
+        uint64_t bits = random64();
+        double number;
+        memcpy(&number, &bits, sizeof(number));
+        if (isfinite(number))
+            checkDouble(number);
+        checkDouble((double)(int64_t)(random64() >> (random64() % 64)));
+        checkDouble((double)(random64() % 100000) / 1000);
+    }
+
+    char text[64];
+    for (int i = 0; i < TEXTS; i++)
+    {
+        // 1 to 25 digits with the point anywhere, from 1e-350 to 1e+350
+        int digits = 1 + (int)(random64() % 25);
+        int point = (int)(random64() % (digits + 1));
+        int at = 0;
+        for (int d = 0; d < digits; d++)
+        {
+            if (d == point && d > 0)
+                text[at++] = '.';
+            text[at++] = (char)('0' + random64() % 10);
+        }
+        if (random64() % 4 != 0)
+            at += sprintf(text + at, "e%d", (int)(random64() % 701) - 350);
+        text[at] = '\0';
+        checkText(text);
+    }
+
+    // the limits and the halfway cases
+    checkDouble(5e-324);
+    checkDouble(2.2250738585072014e-308);
+    checkDouble(1.7976931348623157e308);
+    checkDouble(9007199254740993.0);
+    checkText("2.4703282292062327e-324");
+    checkText("2.4703282292062328e-324");
+    checkText("9007199254740993");
+    checkText("1.00000000000000011102230246251565404236316680908203125");
+    checkText("179769313486231580793728971405301e276");
+
+    printf("%d failures\n", failures);  // expect: 0 failures
+    return failures > 0;
+}
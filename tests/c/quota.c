@@ -0,0 +1,76 @@
+/*
+    Running out of the quota anywhere in a compile, a verification or a run
+    gives back all the memory the input took: the quota left to the next
+    inputs doesn't shrink.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "vm.h"
+
+static char source[16384];
+static int failures = 0;
+
+static void fail(const char *what, size_t expected)
+{
+    // stderr takes the reports of the failed allocations
+    printf("%s: %lu bytes allocated, %lu expected\n", what,
+           (unsigned long)vm.gc.bytesAllocated, (unsigned long)expected);
+    failures++;
+}
+
+int main(void)
+{
+    initVM();
+    freopen("/dev/null", "w", stderr);
+
+    // a switch and the increment of a loop, held by the compiler while
+    // it compiles the body of the loop
+    strcpy(source, "var t = 0;\nfor (var i = 0; i < 3; i = i + 1) {\n    switch (i) {");
+    for (int k = 0; k < 40; k++)
+        sprintf(source + strlen(source), " case %d: t = t + %d;", k, k);
+    strcat(source, " }\n");
+    for (int k = 0; k < 400; k++)
+        strcat(source, "    t = t + i;\n");
+    strcat(source, "}\nprint t;\n");
+
+    // from an allocation refused right away to the one that succeeds
+    size_t before = vm.gc.bytesAllocated;
+    InterpretResult result = INTERPRET_OUT_OF_MEMORY;
+    for (size_t room = 0; result == INTERPRET_OUT_OF_MEMORY; room += 64)
+    {
+        vm.memoryLimit = before + room;
+        result = interpret(source);     // expect: 1203
+        if (vm.gc.bytesAllocated != before)
+        {
+            fail("interpret()", before);
+            break;
+        }
+    }
+    if (result != INTERPRET_OK)
+        fail("the last interpret()", before);
+
+    // the same in a session, which keeps the buffers of its code area
+    Session session;
+    initSession(&session);
+    vm.memoryLimit = MEMORY_UNLIMITED;
+    interpretSession(&session, "var u = 1;");
+
+    vm.memoryLimit = vm.gc.bytesAllocated + 2048;
+    interpretSession(&session, source);
+    size_t kept = vm.gc.bytesAllocated;
+    for (int i = 0; i < 20; i++)
+    {
+        if (interpretSession(&session, source) != INTERPRET_OUT_OF_MEMORY || vm.gc.bytesAllocated != kept)
+        {
+            fail("interpretSession()", kept);
+            break;
+        }
+    }
+
+    if (interpretSession(&session, "print u + 1;") != INTERPRET_OK)   // expect: 2
+        fail("the input after", kept);
+
+    freeSession(&session);
+    freeVM();
+    return failures > 0;
+}
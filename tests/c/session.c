@@ -0,0 +1,54 @@
+/*
+    A REPL session running many more constants and loops than it keeps,
+    its code area rewound to the last declaration over and over.
+*/
+#include <stdio.h>
+#include "vm.h"
+
+static int failures = 0;
+
+static void input(Session *session, const char *source)
+{
+    if (interpretSession(session, source) != INTERPRET_OK)
+    {
+        fprintf(stderr, "failed: %s\n", source);
+        failures++;
+    }
+}
+
+int main(void)
+{
+    initVM();
+
+    Session session;
+    initSession(&session);
+
+    input(&session, "class Point { init(x) { this.x = x; } get() { return this.x; } }\n"
+                    "fun adder(k) { fun add(x) { return x + k; } return add; }\n"
+                    "var p = Point(1); var add = adder(2); var total = 0;\n");
+    // a name interned after the last declaration, which the shape of p keys by
+    input(&session, "p.y = 3;");
+
+    char source[128];
+    for (int i = 0; i < 1000; i++)
+    {
+        snprintf(source, sizeof(source),
+                 "for (var i = 0; i < 2; i = i + 1) total = total + %d.5;", i);
+        input(&session, source);
+    }
+    input(&session, "print total;");           // expect: 1000000
+    input(&session, "print p.get() + p.y;");   // expect: 4
+
+    // declarations past the first rewind are kept as well
+    input(&session, "fun twice(x) { return add(add(x)); }");
+    for (int i = 0; i < 1000; i++)
+    {
+        snprintf(source, sizeof(source), "total = total - %d.25;", i);
+        input(&session, source);
+    }
+    input(&session, "print twice(total);");    // expect: 500254
+
+    freeSession(&session);
+    freeVM();
+    return failures > 0;
+}
@@ -0,0 +1,157 @@
+/*
+    A session saved to a snapshot and loaded into a fresh VM answers like
+    the one saved, and a damaged or truncated snapshot is refused, leaving
+    the session usable.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "snapshot.h"
+
+static const char *prelude =
+    "class Account\n"
+    "{\n"
+    "    init(owner, next) { this.owner = owner; this.next = next; this.balance = 0; }\n"
+    "    deposit(x) { this.balance = this.balance + x; return this.balance; }\n"
+    "}\n"
+    "fun counter() { var n = 0; fun next() { n = n + 1; return n; } return next; }\n"
+    "var tick = counter();\n"
+    "tick(); tick();\n"
+    "var accounts = nil;\n"
+    "for (var i = 0; i < 300; i = i + 1) accounts = Account(i, accounts);\n"
+    "accounts.deposit(100);\n"
+    "var rates = numbers(4);\n"
+    "for (var i = 0; i < 4; i = i + 1) rates[i] = i * 0.5;\n";
+
+static const char *request =
+    "print tick();\n"
+    "print accounts.deposit(5);\n"
+    "print accounts.next.next.owner;\n"
+    "print rates[3] + len(rates);\n";
+
+static char bytes[2][256];
+static OutputBuffer outputs[2] = {{bytes[0], sizeof(bytes[0]), 0}, {bytes[1], sizeof(bytes[1]), 0}};
+static int failures = 0;
+
+// stderr takes the reports of the refused snapshots
+static void fail(const char *what)
+{
+    printf("%s\n", what);
+    failures++;
+}
+
+static void input(Session *session, const char *source)
+{
+    if (interpretSession(session, source) != INTERPRET_OK)
+        fail("an input failed");
+}
+
+static long readFile(const char *path, uint8_t **content)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return -1;
+    fseek(file, 0L, SEEK_END);
+    long length = ftell(file);
+    rewind(file);
+    *content = (uint8_t*)malloc((size_t)length);
+    if (*content == NULL || fread(*content, 1, (size_t)length, file) != (size_t)length)
+        length = -1;
+    fclose(file);
+    return length;
+}
+
+static void writeFile(const char *path, const uint8_t *content, long length)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL || fwrite(content, 1, (size_t)length, file) != (size_t)length)
+        fail("a damaged snapshot can't be written");
+    if (file != NULL)
+        fclose(file);
+}
+
+// the snapshot must be refused, and the session left able to run
+static void refuse(const char *what, const char *path)
+{
+    Session session;
+    initSession(&session);
+    if (loadSnapshot(&session, path))
+        fail(what);
+    if (interpretSession(&session, "var fresh = 2; print fresh;") != INTERPRET_OK)
+        fail("the session doesn't run after a refused snapshot");
+    freeSession(&session);
+}
+
+int main(void)
+{
+    freopen("/dev/null", "w", stderr);
+    char dir[] = "/tmp/bee-snapshot-XXXXXX";
+    if (mkdtemp(dir) == NULL)
+        return 1;
+    char path[64], damaged[64];
+    snprintf(path, sizeof(path), "%s/prelude", dir);
+    snprintf(damaged, sizeof(damaged), "%s/damaged", dir);
+
+    // the prelude run and saved, then the request run on top of it
+    initVM();
+    setOutputSink(memorySink, &outputs[0]);
+    Session saved;
+    initSession(&saved);
+    input(&saved, prelude);
+    if (!saveSnapshot(&saved, path))
+        fail("the session wasn't saved");
+    input(&saved, request);
+    freeSession(&saved);
+    freeVM();
+
+    // the same request on the snapshot, in a VM that never ran the prelude
+    initVM();
+    setOutputSink(memorySink, &outputs[1]);
+    Session loaded;
+    initSession(&loaded);
+    if (!loadSnapshot(&loaded, path))
+        fail("the snapshot wasn't loaded");
+    input(&loaded, request);
+    freeSession(&loaded);
+
+    if (outputs[0].count != outputs[1].count || memcmp(bytes[0], bytes[1], outputs[0].count) != 0)
+        fail("the loaded session doesn't answer like the saved one");
+    fwrite(bytes[1], 1, outputs[1].count, stdout);
+    // expect: 3
+    // expect: 105
+    // expect: 297
+    // expect: 5.5
+    outputs[1].count = 0;
+
+    uint8_t *content;
+    long length = readFile(path, &content);
+    if (length <= 0)
+    {
+        fail("the snapshot can't be read");
+        return 1;
+    }
+
+    // cut anywhere, the header, the code, the objects or the checksum
+    const long cuts[] = {0, 4, 32, length / 2, length - 9, length - 1};
+    for (size_t i = 0; i < sizeof(cuts) / sizeof(cuts[0]); i++)
+    {
+        writeFile(damaged, content, cuts[i]);
+        refuse("a truncated snapshot was loaded", damaged);
+    }
+
+    content[length / 2] ^= 0x40;
+    writeFile(damaged, content, length);
+    refuse("a damaged snapshot was loaded", damaged);
+
+    const char *refused = "2\n2\n2\n2\n2\n2\n2\n";
+    if (outputs[1].count != strlen(refused) || memcmp(bytes[1], refused, outputs[1].count) != 0)
+        fail("the sessions didn't run after the refused snapshots");
+
+    free(content);
+    remove(damaged);
+    remove(path);
+    rmdir(dir);
+    freeVM();
+    return failures > 0;
+}
@@ -0,0 +1,99 @@
+/*
+    verifyBytecode() refuses a chunk breaking any one of its rules, and
+    accepts the well-formed one, which then runs.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "analysis.h"
+#include "vm.h"
+
+static int failures = 0;
+
+// builds the chunk, with 'constants' numbers and 'loops' loop counters
+static void initChunk(Bytecode *bytecode, const uint8_t *code, int length, int constants, int loops)
+{
+    initBytecode(bytecode);
+    for (int i = 0; i < length; i++)
+        appendBytecode(bytecode, code[i], 1);
+    for (int i = 0; i < constants; i++)
+        addConstant(bytecode, NUMBER_VAL(21 + i));
+    for (int i = 0; i < loops; i++)
+        addLoopCounter(bytecode);
+}
+
+// 'expected' is the message of the refusal, or NULL for a chunk to accept
+static void verify(const char *rule, const uint8_t *code, int length, int constants, int loops,
+                   const char *expected)
+{
+    Bytecode bytecode;
+    initChunk(&bytecode, code, length, constants, loops);
+    const char *error = verifyBytecode(&bytecode, 0);
+    if ((error == NULL) != (expected == NULL) || (error != NULL && strcmp(error, expected) != 0))
+    {
+        fprintf(stderr, "%s: \"%s\", expected \"%s\"\n", rule,
+                error != NULL ? error : "accepted", expected != NULL ? expected : "accepted");
+        failures++;
+    }
+    freeBytecode(&bytecode);
+}
+
+int main(void)
+{
+    initVM();
+    const char *misuse = "Malformed code or stack misuse.";
+
+    // var g = 21; print g + g;
+    const uint8_t wellFormed[] = {OP_CONSTANT, 0, OP_DEFINE_GLOBAL, 0, 0, OP_GET_GLOBAL, 0, 0,
+                                  OP_GET_GLOBAL, 0, 0, OP_ADD, OP_PRINT, OP_RETURN};
+    verify("well-formed", wellFormed, sizeof(wellFormed), 1, 0, NULL);
+
+    // the stack depth
+    const uint8_t underflow[] = {OP_NIL, OP_POP, OP_POP, OP_RETURN};
+    verify("stack underflow", underflow, sizeof(underflow), 0, 0, misuse);
+
+    uint8_t overflow[STACK_MAX + 2];
+    memset(overflow, OP_NIL, STACK_MAX + 1);
+    overflow[STACK_MAX + 1] = OP_RETURN;
+    verify("stack overflow", overflow, sizeof(overflow), 0, 0, misuse);
+
+    // the jump targets
+    const uint8_t pastEnd[] = {OP_JUMP, 0, 9, OP_RETURN};
+    verify("jump past the end", pastEnd, sizeof(pastEnd), 0, 0, misuse);
+
+    const uint8_t intoOperand[] = {OP_JUMP, 0, 1, OP_CONSTANT, 0, OP_POP, OP_RETURN};
+    verify("jump into an operand", intoOperand, sizeof(intoOperand), 1, 0, misuse);
+
+    // the indices
+    const uint8_t constant[] = {OP_CONSTANT, 1, OP_POP, OP_RETURN};
+    verify("constant index", constant, sizeof(constant), 1, 0, "Operand 1 out of range at offset 0.");
+
+    const uint8_t longConstant[] = {OP_CONSTANT_LONG, 1, 0, OP_POP, OP_RETURN};
+    verify("long constant index", longConstant, sizeof(longConstant), 1, 0,
+           "Operand 256 out of range at offset 0.");
+
+    const uint8_t local[] = {OP_NIL, OP_GET_LOCAL, 1, OP_POP, OP_POP, OP_RETURN};
+    verify("local index", local, sizeof(local), 0, 0, misuse);
+
+    const uint8_t global[] = {OP_GET_GLOBAL, 0xff, 0xff, OP_POP, OP_RETURN};
+    verify("global index", global, sizeof(global), 0, 0, "Operand 65535 out of range at offset 0.");
+
+    // a back-edge to the start, through the second counter of one
+    const uint8_t loop[] = {OP_NIL, OP_POP, OP_LOOP, 0, 7, 0, 1, OP_RETURN};
+    verify("loop counter index", loop, sizeof(loop), 0, 1, "Operand 1 out of range at offset 2.");
+
+    // falling off the end
+    const uint8_t noReturn[] = {OP_CONSTANT, 0, OP_PRINT};
+    verify("no return", noReturn, sizeof(noReturn), 1, 0, "Code runs past its end.");
+
+    Bytecode bytecode;
+    initChunk(&bytecode, wellFormed, sizeof(wellFormed), 1, 0);
+    if (interpretBytecode(&bytecode) != INTERPRET_OK)   // expect: 42
+    {
+        fprintf(stderr, "the well-formed chunk doesn't run\n");
+        failures++;
+    }
+    freeBytecode(&bytecode);
+
+    freeVM();
+    return failures > 0;
+}
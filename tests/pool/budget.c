@@ -0,0 +1,134 @@
+/*
+    The embedded profile (BEE_STATIC_POOL) keeps within its budget: the
+    VM takes nothing from the C heap, whose allocators the test wraps to
+    count the calls (-Wl,--wrap), and all it uses comes out of the pool.
+    Running out of the pool, while compiling or while running, gives the
+    pool back whole and leaves the VM fit for the next inputs.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "pool.h"
+#include "vm.h"
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void *pointer, size_t size);
+void __real_free(void *pointer);
+
+// the calls to the C heap from the VM, stdio's own not seen
+static int heapCalls = 0;
+
+void* __wrap_malloc(size_t size)
+{
+    heapCalls++;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size)
+{
+    heapCalls++;
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void *pointer, size_t size)
+{
+    heapCalls++;
+    return __real_realloc(pointer, size);
+}
+
+void __wrap_free(void *pointer)
+{
+    if (pointer != NULL)
+        heapCalls++;
+    __real_free(pointer);
+}
+
+// objects, closures and arrays, most of them garbage soon
+static const char *workload =
+    "class Node {\n"
+    "    init(value, next) { this.value = value; this.next = next; }\n"
+    "}\n"
+    "fun adder(k) { fun add(x) { return x + k; } return add; }\n"
+    "var total = 0;\n"
+    "for (var round = 0; round < 200; round = round + 1) {\n"
+    "    var list = nil;\n"
+    "    for (var i = 0; i < 20; i = i + 1) list = Node(i, list);\n"
+    "    var add = adder(round);\n"
+    "    var v = numbers(8);\n"
+    "    for (var i = 0; i < 8; i = i + 1) v[i] = add(i);\n"
+    "    while (list != nil) { total = total + list.value; list = list.next; }\n"
+    "    total = total + sum(v);\n"
+    "}\n"
+    "print total;\n";
+
+// a list that stays reachable until the pool runs out
+static const char *hoarder =
+    "class Node { init(next) { this.next = next; } }\n"
+    "var list = nil;\n"
+    "while (true) list = Node(list);\n";
+
+static char longSource[65536];
+static int failures = 0;
+
+static void check(const char *what, InterpretResult result, InterpretResult expected)
+{
+    if (result != expected)
+    {
+        printf("%s: result %d, %d expected\n", what, (int)result, (int)expected);
+        failures++;
+    }
+}
+
+// after running out, the pool holds no more than the VM right after initVM()
+static void checkRecovered(const char *what, size_t fresh)
+{
+    if (poolUsed() > fresh)
+    {
+        printf("%s: %lu bytes of the pool still in use, %lu after initVM()\n", what,
+               (unsigned long)poolUsed(), (unsigned long)fresh);
+        failures++;
+    }
+}
+
+int main(void)
+{
+    initVM();
+    size_t fresh = poolUsed();
+    // stderr takes the reports of the exhausted pool
+    freopen("/dev/null", "w", stderr);
+    heapCalls = 0;
+
+    check("the workload", interpret(workload), INTERPRET_OK);       // expect: 202800
+
+    // exhausted while running
+    check("the hoarder", interpret(hoarder), INTERPRET_OUT_OF_MEMORY);
+    checkRecovered("the hoarder", fresh);
+    check("the workload again", interpret(workload), INTERPRET_OK); // expect: 202800
+
+    // exhausted while compiling, the code and the lines of the script
+    // outgrowing the pool
+    for (int i = 0; i < 4000; i++)
+        strcat(longSource, "print 1;\n");
+    check("the long source", interpret(longSource), INTERPRET_OUT_OF_MEMORY);
+    checkRecovered("the long source", fresh);
+
+    // a session loses what it has declared, but takes the next inputs
+    Session session;
+    initSession(&session);
+    check("the declaration", interpretSession(&session, "var kept = 1; fun twice(x) { return 2 * x; }"), INTERPRET_OK);
+    check("the session's hoarder", interpretSession(&session, hoarder), INTERPRET_OUT_OF_MEMORY);
+    checkRecovered("the session's hoarder", fresh);
+    check("the input after", interpretSession(&session, "print kept;"), INTERPRET_COMPILE_ERROR);
+    check("the new declaration", interpretSession(&session, "fun twice(x) { return 2 * x; }"), INTERPRET_OK);
+    check("the call", interpretSession(&session, "print twice(21);"), INTERPRET_OK);       // expect: 42
+    freeSession(&session);
+
+    if (heapCalls > 0)
+    {
+        printf("%d calls to the C heap\n", heapCalls);
+        failures++;
+    }
+
+    freeVM();
+    return failures > 0;
+}
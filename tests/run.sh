@@ -0,0 +1,203 @@
+#!/bin/sh
+#
+# Test suite of BeeLang. Run it from anywhere:  sh tests/run.sh
+#
+# The tree is copied to a scratch directory, the debug switches of
+# common.h turned off, and built with $CC (cc by default). The scripts
+# state what they print with comments:
+#     // expect: <line>                   the next line of the output
+#     // expect runtime error: <message>  the error the run ends with,
+#                                         exit status 70
+#
+# Suites:
+#     tests/c/*.c         programs embedding the VM, built against the
+#                         tree but src/main.c and run
+#     tests/scripts/*.bee run by the interpreter
+#     tests/stream/*.bee  piped into an interpreter whose scanner window
+#                         is 32 bytes, so that the refills of the window
+#                         cut through the tokens
+#     tests/emitc/*.bee   translated with --emit-c, built against the
+#                         runtime and run
+#     tests/jit/*.bee     run by the interpreter, then with --jit, which
+#                         must print and exit the very same way
+#     all the scripts     run once more with -O2, which must print and
+#                         exit like the plain run
+#     tests/pool/*.c      programs like those of tests/c, built against
+#                         the embedded profile (BEE_STATIC_POOL) with the
+#                         allocators of the C heap wrapped. Linux only.
+#
+# Exits with 1 if a test has failed.
+#
+# sh tests/run.sh bench builds and runs the benchmarks of tests/bench
+# instead, each a C program linked like those of tests/c.
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+CC=${CC:-cc}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+passes=0
+failures=0
+
+fail()
+{
+    echo "FAIL $1: $2"
+    failures=$((failures + 1))
+}
+
+# check NAME SCRIPT STATUS STDOUT STDERR
+# Compares a run of the script with what its comments expect.
+check()
+{
+    sed -n 's|^.*// expect: ||p' "$2" > "$WORK/expected"
+    error=$(sed -n 's|^.*// expect runtime error: ||p' "$2")
+
+    if ! cmp -s "$WORK/expected" "$4"; then
+        fail "$1" "unexpected output"
+        diff "$WORK/expected" "$4" | head -n 10
+    elif [ -n "$error" ]; then
+        if [ "$3" -ne 70 ] || [ "$(head -n 1 "$5")" != "$error" ]; then
+            fail "$1" "expected \"$error\", got exit $3: $(head -n 1 "$5")"
+        else
+            passes=$((passes + 1))
+        fi
+    elif [ "$3" -ne 0 ] || [ -s "$5" ]; then
+        fail "$1" "exit $3: $(head -n 1 "$5")"
+    else
+        passes=$((passes + 1))
+    fi
+}
+
+# build the interpreter
+mkdir "$WORK/tree"
+cp -r "$ROOT/src" "$ROOT/include" "$WORK/tree/"
+sed 's|^#define DEBUG_|//#define DEBUG_|' "$ROOT/include/common.h" > "$WORK/tree/include/common.h"
+cd "$WORK/tree" || exit 1
+# compiled once, for the interpreter and the programs of tests/c
+for source in $(ls src/*.c | grep -v 'src/chunk.c'); do
+    if ! $CC -std=gnu11 -O2 -c -o "${source%.c}.o" "$source"; then
+        echo "FAIL build"
+        exit 1
+    fi
+done
+LIBRARY=$(ls src/*.o | grep -v 'src/main.o')
+if ! $CC -o "$WORK/bee" src/main.o $LIBRARY -lm; then
+    echo "FAIL build"
+    exit 1
+fi
+BEE="$WORK/bee"
+RUNTIME="src/value.c src/object.c src/shape.c src/array.c src/memory.c src/output.c src/number.c"
+
+if [ "$1" = bench ]; then
+    for program in "$ROOT"/tests/bench/*.c; do
+        echo "== bench/$(basename "$program")"
+        $CC -std=gnu11 -O2 -Iinclude -o "$WORK/program" "$program" $LIBRARY -lm && "$WORK/program"
+    done
+    exit
+fi
+
+# the embedding API, from C
+for program in "$ROOT"/tests/c/*.c; do
+    name="c/$(basename "$program")"
+    if ! $CC -std=gnu11 -O2 -Iinclude -o "$WORK/program" "$program" $LIBRARY -lm; then
+        fail "$name" "doesn't build"
+        continue
+    fi
+    "$WORK/program" > "$WORK/stdout" 2> "$WORK/stderr"
+    check "$name" "$program" $? "$WORK/stdout" "$WORK/stderr"
+done
+
+# the interpreter
+for script in "$ROOT"/tests/scripts/*.bee; do
+    name="scripts/$(basename "$script")"
+    "$BEE" "$script" > "$WORK/stdout" 2> "$WORK/stderr"
+    check "$name" "$script" $? "$WORK/stdout" "$WORK/stderr"
+done
+
+# the scanner refilling its window from a pipe, many times per script
+if $CC -std=gnu11 -O2 -DSCANNER_WINDOW=32 -c -o "$WORK/scanner.o" src/scanner.c &&
+   $CC -o "$WORK/bee-window" src/main.o $(echo $LIBRARY | sed 's|src/scanner.o||') "$WORK/scanner.o" -lm; then
+    for script in "$ROOT"/tests/stream/*.bee; do
+        name="stream/$(basename "$script")"
+        cat "$script" | "$WORK/bee-window" - > "$WORK/stdout" 2> "$WORK/stderr"
+        check "$name" "$script" $? "$WORK/stdout" "$WORK/stderr"
+    done
+else
+    fail "stream" "doesn't build"
+fi
+
+# --emit-c: the translated program must behave like the interpreter
+for script in "$ROOT"/tests/emitc/*.bee; do
+    name="emitc/$(basename "$script")"
+    if ! "$BEE" --emit-c "$script" > "$WORK/emitted.c" 2> "$WORK/stderr"; then
+        fail "$name" "not translated: $(head -n 1 "$WORK/stderr")"
+        continue
+    fi
+    if ! $CC -std=gnu11 -Iinclude -o "$WORK/emitted" "$WORK/emitted.c" $RUNTIME -lm; then
+        fail "$name" "the output doesn't build"
+        continue
+    fi
+    "$WORK/emitted" > "$WORK/stdout" 2> "$WORK/stderr"
+    check "$name" "$script" $? "$WORK/stdout" "$WORK/stderr"
+done
+
+# --jit: the native code must behave like the interpreter, bailouts included
+for script in "$ROOT"/tests/jit/*.bee; do
+    name="jit/$(basename "$script")"
+    "$BEE" "$script" > "$WORK/stdout" 2> "$WORK/stderr"
+    status=$?
+    check "$name" "$script" $status "$WORK/stdout" "$WORK/stderr"
+
+    "$BEE" --jit "$script" > "$WORK/jit-stdout" 2> "$WORK/jit-stderr"
+    jitStatus=$?
+    if [ $jitStatus -ne $status ] || ! cmp -s "$WORK/stdout" "$WORK/jit-stdout" ||
+       ! cmp -s "$WORK/stderr" "$WORK/jit-stderr"; then
+        fail "$name --jit" "differs from the interpreter, exit $jitStatus"
+        diff "$WORK/stdout" "$WORK/jit-stdout" | head -n 10
+        diff "$WORK/stderr" "$WORK/jit-stderr" | head -n 10
+    else
+        passes=$((passes + 1))
+    fi
+done
+
+# -O2: the optimized code must behave like the plain one
+for script in "$ROOT"/tests/scripts/*.bee "$ROOT"/tests/jit/*.bee "$ROOT"/tests/stream/*.bee; do
+    name="$(basename "$(dirname "$script")")/$(basename "$script") -O2"
+    "$BEE" "$script" > "$WORK/stdout" 2> "$WORK/stderr"
+    status=$?
+    "$BEE" -O2 "$script" > "$WORK/O2-stdout" 2> "$WORK/O2-stderr"
+    optimizedStatus=$?
+    if [ $optimizedStatus -ne $status ] || ! cmp -s "$WORK/stdout" "$WORK/O2-stdout" ||
+       ! cmp -s "$WORK/stderr" "$WORK/O2-stderr"; then
+        fail "$name" "differs from the plain run, exit $optimizedStatus"
+        diff "$WORK/stdout" "$WORK/O2-stdout" | head -n 10
+        diff "$WORK/stderr" "$WORK/O2-stderr" | head -n 10
+    else
+        passes=$((passes + 1))
+    fi
+done
+
+# the embedded profile, on hosts whose linker wraps symbols
+if [ "$(uname)" = Linux ]; then
+    mkdir "$WORK/pool"
+    for source in $(ls src/*.c | grep -v 'src/chunk.c' | grep -v 'src/main.c'); do
+        object="$WORK/pool/$(basename "${source%.c}").o"
+        if ! $CC -std=gnu11 -O2 -DBEE_STATIC_POOL -c -o "$object" "$source"; then
+            fail "pool" "doesn't build"
+            break
+        fi
+    done
+    WRAP="-Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free"
+    for program in "$ROOT"/tests/pool/*.c; do
+        name="pool/$(basename "$program")"
+        if ! $CC -std=gnu11 -O2 -DBEE_STATIC_POOL -Iinclude $WRAP -o "$WORK/program" "$program" "$WORK"/pool/*.o -lm; then
+            fail "$name" "doesn't build"
+            continue
+        fi
+        "$WORK/program" > "$WORK/stdout" 2> "$WORK/stderr"
+        check "$name" "$program" $? "$WORK/stdout" "$WORK/stderr"
+    done
+fi
+
+echo "$passes passed, $failures failed"
+[ "$failures" -eq 0 ]